@@ -2,21 +2,56 @@
 
 #include "Arks.h"
 #include "Common/PairHash.h"
+#include "Arks/Checkpoint.h"
 #include "Arks/DistanceEst.h"
+#include "Arks/EvidenceIndex.h"
+#include "Arks/IncrementalIndex.h"
+#include "Arks/KmerShard.h"
+#include "Arks/MemoryBudget.h"
+#include "Arks/PairCheckpoint.h"
+#include "Arks/PartialHits.h"
+#include "Arks/Misassembly.h"
+#include "Arks/PrefixKmerIndex.h"
+#include "Arks/ReadStore.h"
+#include "Arks/Significance.h"
+#include "Common/BoundedQueue.h"
+#include "Common/Logger.h"
 #include "Common/MapUtil.h"
+#include "Common/ReadAhead.h"
 #include "Common/StatUtil.h"
+#include "Common/StringUtil.h"
 #include <zlib.h>
 #include "kseq.h"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <cinttypes>
+#include <cstdarg>
+#include <exception>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <omp.h>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <unordered_set>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* sequence files are read ahead in large blocks, gunzipped if compressed;
+ * kseq has no error path, so a read error is thrown from here */
+static inline int readAheadRead(ReadAheadStream *in, void *buf, unsigned len) {
+	int n = in->read(buf, len);
+	if (n < 0)
+		throw std::runtime_error("reading `" + in->path() + "': " + strerror(errno));
+	return n;
+}
 
-KSEQ_INIT(gzFile, gzread)
+KSEQ_INIT(ReadAheadStream*, readAheadRead)
 
 #define PROGRAM "arks"
 
@@ -38,10 +73,32 @@ static const char USAGE_MESSAGE[] =
 		"			1) full    uses the full ARKS process (kmerize draft, kmerize and align chromium reads, scaffold).\n"
 		"			2) align   skips kmerizing of draft and starts with kmerizing and aligning chromium reads.\n"
 		"			3) graph   skips kmerizing draft and kmerizing/aligning chromium reads and only scaffolds.\n"
+		"			4) serve   kmerizes one shard of the draft (--shard_id of --index_partitions) and answers\n"
+		"			           k-mer lookups for `full' or `align' runs given --shards, until killed.\n"
+		"			5) store   converts the chromium read files into a binary read store (--read_store),\n"
+		"			           which later runs take in place of the FASTQ files.\n"
+		"			6) query   looks up the evidence linking pairs of contigs, given as arguments\n"
+		"			           (contigA contigB ...), in an --evidence_index written by an earlier run.\n"
+		"			7) cut     breaks misassembled contigs where few barcoded molecules span them, as\n"
+		"			           Tigmint does but without aligning the reads: writes <base>.cut.fa.\n"
+		"			8) pairs   skips pairing and builds the graph from a --pair_checkpoint written by\n"
+		"			           an earlier run, under new -l, -d and -B. Contig end orientations are those\n"
+		"			           called under the -r of that run; a new -r applies only to the edge test.\n"
+		"			9) batch   runs `full' for each job of a manifest, given as the only argument, in one\n"
+		"			           process. Each line is BASE DRAFT MULTFILE READS... (`#' starts a comment);\n"
+		"			           the job writes BASE_original.gv and the like, and -s, -S, --evidence_index,\n"
+		"			           --pair_checkpoint and --incremental files are named BASE_<file name>. Up to\n"
+		"			           -t jobs run at once, sharing the -t threads; with --max_memory, one at a time.\n"
+		"			           Each job reports its progress to BASE.log. A job that fails is listed in\n"
+		"			           the summary and the others run on; the exit status is 1 if any failed.\n"
 		"	=> INPUT OPTIONS: <=\n"
 		"	    A) Always required (specific type 'full'):\n"
 		"   		-f  Using kseq parser, these are the contig sequences to further scaffold and can be in either FASTA or FASTQ format. (required)\n"
 		"   		-a  tsv or csv file for barcode multiplicities. Can be acquired by running CalcBarcodeMultiplicity script included. (required)\n"
+		"   		--lib=MULTFILE[,READS,...]  Another linked-read library: its barcode multiplicity file\n"
+		"			and chromium read files (none for -p graph). Repeat for more libraries. Barcodes of\n"
+		"			the n-th --lib are namespaced as libn_BARCODE, so that libraries can share barcodes.\n"
+		"			The contig index is built once and all libraries are scaffolded together.\n"
 		"	    B) If you want to skip kmerizing contigs you will need (specified type 'align'):\n"
 		"   		-q  tsv file for ContigRecord (a record of all the contigs + h/t). \n"
 		"			--> Format of file should be: <contig record index number> <contig name> <H/T>\n"
@@ -74,15 +131,299 @@ static const char USAGE_MESSAGE[] =
 		"   -e  End length (bp) of sequences to consider (default: 30000)\n"
 		"   -r  Maximum p-value for H/T assignment and link orientation determination. Lower is more stringent (default: 0.05)\n"
 		"   -t 	Number of threads.(default: 1)\n"
+		"   --max_memory=N  Memory limit for the run, e.g. 16G. ARKS picks data structure representations\n"
+		"       that fit within the limit and exits early with an estimate if none do. Contig pairing is\n"
+		"       only checked against the limit: ARKS stops if the pair counts would not fit. (default: no limit)\n"
+		"   --index_partitions=N  Split the contig-end k-mer index into N partitions of k-mer space,\n"
+		"       building one at a time and reading the chromium reads once per partition. The k-mer hits\n"
+		"       of each pass are kept for the next in BASE_partial_hitsN.tmp. Gives the same result as a\n"
+		"       single index. (default: 1, or the fewest that fit --max_memory)\n"
+		"   --shards=ADDR,...  Look up read k-mers on `-p serve' workers listening at these addresses,\n"
+		"       listed in shard ID order, instead of building the k-mer index locally. (optional)\n"
+		"   --shard_id=N  With -p serve, the 0-based shard of --index_partitions to hold. (default: 0)\n"
+		"   --listen=ADDR  With -p serve, the address to listen on: unix:PATH or [HOST]:PORT. (required for serve)\n"
+		"   --read_store=FILE  With -p store, the binary read store to write. (required for store)\n"
+		"   --cut  With -p full, first break misassembled contigs as -p cut does, then scaffold the\n"
+		"       corrected draft <base>.cut.fa. (default: no)\n"
+		"   --cut_window=N  Window size (bp) for checking spanning molecules. (default: 1000)\n"
+		"   --cut_span=N  Cut where fewer than N molecules span a window. (default: 20)\n"
+		"   --cut_dist=N  Max distance (bp) between reads of the same molecule. (default: 50000)\n"
+		"   --cut_min_size=N  Minimum molecule size (bp). (default: 2000)\n"
+		"   --evidence_index=FILE  With -p full, align or graph, also write the IndexMap as barcode lists\n"
+		"       per contig end, for -p query; with -p query, the index to read. Queries report the shared\n"
+		"       barcodes, orientation votes, edge and distance estimate of a pair of contigs under the\n"
+		"       options of the run that wrote the index (before -d node removal). (required for query)\n"
+		"   --pair_checkpoint=FILE  With -p full, align or graph, also write the contig pair link\n"
+		"       counts (and barcode stats with -D) in binary; with -p pairs, the checkpoint to read.\n"
+		"       The counts depend on -c, -m, -e and the -r used for contig end orientations, which\n"
+		"       -p pairs takes from the checkpoint. (required for pairs)\n"
+		"   --kmer_index=hash|bucket  Contig-end k-mer index engine: a hash table, or sorted k-mers in\n"
+		"       buckets addressed by their first 8 bases (smaller and cache friendly; k <= 32). (default: hash)\n"
+		"   --classify=probe|merge|smem|sampled  Read classification: look up each read k-mer in the\n"
+		"       index, or radix sort the k-mers of a batch of reads and merge-join them against the\n"
+		"       index (needs --kmer_index=bucket), or match reads whole against an FM-index of the\n"
+		"       contig ends (smem; -p full only), or look up --sample_kmers evenly spaced k-mers first\n"
+		"       and the rest only if those leave the read ambiguous or near -j (sampled). (default: probe)\n"
+		"   --sample_kmers=N  k-mers looked up first by --classify=sampled. (default: 8)\n"
+		"   --log_limit=N  Print at most N messages of each kind (e.g. unpaired reads) every 10\n"
+		"       seconds, and a count of the rest; 0 for no limit. (default: 10)\n"
+		"   --io_block=N  Block size for reading input files, e.g. 16M; up to 4 blocks are read ahead\n"
+		"       of parsing. (default: 4M)\n"
+		"   --read_batch=N  Read pairs per batch handed to the classifying threads. (default: 1024)\n"
+		"   --autotune  With -p full or batch, first benchmark --kmer_index, --classify (probe or merge),\n"
+		"       --read_batch, whether to give the reader thread a core of -t, and --io_block on a sample\n"
+		"       of the draft and the first read file, and run with the fastest choice that fits\n"
+		"       --max_memory, overriding those options. (default: no)\n"
+		"   --incremental=FILE  With -p full or batch, keep the contig-end k-mers and the read pair\n"
+		"       classifications in FILE for the next run. If FILE is there from a run on the same\n"
+		"       reads, contig ends with the same name and sequence reuse their k-mers, and only read\n"
+		"       pairs with a k-mer of a changed, new or removed contig end are classified again; the\n"
+		"       result is that of a full run. FILE is then rewritten. Reused contig ends are not\n"
+		"       shredded again, but the hash index still inserts their k-mers one at a time (the\n"
+		"       bucket index takes them in bulk). Needs the k-mer index in one pass, and\n"
+		"       --classify=probe, merge or sampled.\n"
+		"   --deterministic  Write the checkpoints and intra-contig TSV in k-mer, barcode and contig ID\n"
+		"       order, so that all outputs are byte-identical for any -t. The k-mer checkpoint is sorted\n"
+		"       within each --index_partitions pass, so it is identical only for the same number of\n"
+		"       partitions. (default: hash table order)\n"
 		"   -v  Runs in verbose mode (optional, default: 0)\n";
 
 /* ARCS PREPARATION AKA GLOBAL VARIABLES: */
 
-ARCS::ArcsParams params;
+/*
+ * The options, program and statistics of one run of the pipeline.
+ * `-p batch' runs several jobs at once, on threads of their own; every
+ * other program runs one, s_mainJob.
+ */
+struct ArksJob {
+	ARCS::ArcsParams params;
+
+	/* the program (-p) */
+	bool full, alignc, graph, serve, store, query, pairs, cut;
+
+	/* the block size of input files (--io_block) */
+	size_t ioBlock;
+
+	/* Statistics counters are 64-bit: the k-mers and reads of a single
+	 * production library overflow 32 bits */
+	uint64_t s_numkmersmapped, s_numkmercollisions, s_numkmersremdup,
+		s_numbadkmers, s_uniquedraftkmers;
+
+	uint64_t s_totalnumckmers, s_ckmersasdups, s_numckmersfound,
+		s_numckmersrec, s_numbadckmers;
+
+	uint64_t s_numreadspassingjaccard, s_numreadsfailjaccard;
+
+	/* `--classify=sampled` tallies: reads, reads decided by stage one, k-mer
+	 * lookups, k-mer positions, and stage-one decisions checked and agreeing
+	 * with the exhaustive classifier */
+	uint64_t s_sampledreads, s_sampledstageone, s_sampledlookups,
+		s_sampledpositions, s_sampledchecked, s_sampledagreed;
+
+	/* guards the IndexMap while the reads are classified */
+	std::mutex imapMutex;
+
+	/* where std::cout of the job goes under `-p batch' (BASE.log) */
+	std::unique_ptr<std::ofstream> log;
+
+	ArksJob() : params(), full(false), alignc(false), graph(false),
+		serve(false), store(false), query(false), pairs(false), cut(false),
+		ioBlock(ReadAheadFile::DEFAULT_BLOCK_SIZE)
+	{
+		resetCounters();
+	}
+
+	/* Zero the k-mer and read tallies, which are reported per index */
+	void resetCounters()
+	{
+		s_numkmersmapped = s_numkmercollisions = s_numkmersremdup = 0;
+		s_numbadkmers = s_uniquedraftkmers = 0;
+		s_totalnumckmers = s_ckmersasdups = s_numckmersfound = 0;
+		s_numckmersrec = s_numbadckmers = 0;
+		s_numreadspassingjaccard = s_numreadsfailjaccard = 0;
+		s_sampledreads = s_sampledstageone = s_sampledlookups = 0;
+		s_sampledpositions = s_sampledchecked = s_sampledagreed = 0;
+	}
+};
+
+static ArksJob s_mainJob;
+
+/* The job of the calling thread: s_mainJob, set by main, or a batch
+ * job, set by its worker. Each OpenMP team copies it in from the
+ * thread that starts the team, and JobThread passes it on. */
+static ArksJob* s_job = NULL;
+#pragma omp threadprivate(s_job)
+
+static inline ArksJob& job() {
+	assert(s_job != NULL);
+	return *s_job;
+}
+
+/*
+ * A thread that runs part of the calling thread's job. What it throws
+ * is rethrown by join, so that it fails the job rather than the
+ * process; a thread not joined is joined, and its error dropped, when
+ * the job unwinds.
+ */
+class JobThread {
+public:
+	JobThread() {}
+
+	template <typename F>
+	explicit JobThread(F f) : m_error(new std::exception_ptr) {
+		ArksJob* current = s_job;
+		std::shared_ptr<std::exception_ptr> error = m_error;
+		m_thread = std::thread([current, f, error]() {
+			s_job = current;
+			try {
+				f();
+			} catch (...) {
+				*error = std::current_exception();
+			}
+		});
+	}
+
+	JobThread(JobThread&& o) : m_thread(std::move(o.m_thread)), m_error(o.m_error) {}
+
+	JobThread& operator=(JobThread&& o) {
+		if (m_thread.joinable())
+			m_thread.join();
+		m_thread = std::move(o.m_thread);
+		m_error = o.m_error;
+		return *this;
+	}
+
+	~JobThread() {
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+	bool joinable() const { return m_thread.joinable(); }
+
+	void join() {
+		m_thread.join();
+		if (*m_error)
+			std::rethrow_exception(*m_error);
+	}
+
+private:
+	JobThread(const JobThread&);
+	JobThread& operator=(const JobThread&);
+
+	std::thread m_thread;
+	std::shared_ptr<std::exception_ptr> m_error;
+};
+
+/* Start a thread that runs `f` as part of the calling thread's job */
+template <typename F>
+static JobThread jobThread(F f) {
+	return JobThread(f);
+}
+
+/*
+ * The first exception of the threads of an OpenMP team, which must not
+ * leave the parallel region; the thread that started the team rethrows
+ * it after. Threads stop taking work once one has failed.
+ */
+class TeamFailure {
+public:
+	TeamFailure() : m_failed(false) {}
+
+	/* Run `f`, keeping what it throws */
+	template <typename F>
+	void run(F f) {
+		try {
+			f();
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_error)
+				m_error = std::current_exception();
+			m_failed = true;
+		}
+	}
+
+	bool failed() const { return m_failed; }
+
+	void rethrow() {
+		if (m_error)
+			std::rethrow_exception(m_error);
+	}
+
+private:
+	std::mutex m_mutex;
+	std::exception_ptr m_error;
+	std::atomic<bool> m_failed;
+};
+
+/*
+ * The buffer of std::cout under `-p batch': what a thread writes goes to
+ * the log of its job, if it has one, so that the progress reports of
+ * jobs running at once are not interleaved.
+ */
+class JobOutput : public std::streambuf {
+public:
+	explicit JobOutput(std::streambuf* out) : m_out(out) {}
+
+	/* the buffer of the output of threads without a log */
+	std::streambuf* out() const { return m_out; }
+
+protected:
+	int overflow(int c) {
+		if (c == EOF)
+			return 0;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return target()->sputc(c);
+	}
+
+	std::streamsize xsputn(const char* s, std::streamsize n) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return target()->sputn(s, n);
+	}
+
+	int sync() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return target()->pubsync();
+	}
+
+private:
+	std::streambuf* target() const {
+		return s_job != NULL && s_job->log ? s_job->log->rdbuf() : m_out;
+	}
+
+	std::streambuf* m_out;
+	std::mutex m_mutex;
+};
+
+/* printf(3) to std::cout, which `-p batch' sends to the log of the job */
+static void coutPrintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static void coutPrintf(const char* format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	int n = vsnprintf(NULL, 0, format, ap);
+	va_end(ap);
+	if (n <= 0)
+		return;
+	std::vector<char> buf(n + 1);
+	va_start(ap, format);
+	vsnprintf(buf.data(), buf.size(), format, ap);
+	va_end(ap);
+	std::cout.write(buf.data(), n);
+}
+
+/* ctime(3) for concurrent jobs, which would share its static buffer */
+static std::string ctimeString(const std::time_t* t) {
+	char buf[26];
+	return ctime_r(t, buf);
+}
 
 static const char shortopts[] = "p:f:a:q:w:i:o:c:k:g:j:l:z:b:m:d:e:r:vt:Ds:S:B:";
 
-enum { OPT_HELP = 1, OPT_VERSION, OPT_NO_DIST_EST };
+enum { OPT_HELP = 1, OPT_VERSION, OPT_NO_DIST_EST, OPT_MAX_MEMORY, OPT_INDEX_PARTITIONS,
+	OPT_SHARDS, OPT_SHARD_ID, OPT_LISTEN, OPT_READ_STORE, OPT_KMER_INDEX,
+	OPT_CLASSIFY, OPT_DETERMINISTIC, OPT_IO_BLOCK, OPT_LIB, OPT_EVIDENCE_INDEX,
+	OPT_CUT, OPT_CUT_WINDOW, OPT_CUT_SPAN, OPT_CUT_DIST, OPT_CUT_MIN_SIZE,
+	OPT_SAMPLE_KMERS, OPT_LOG_LIMIT, OPT_PAIR_CHECKPOINT, OPT_READ_BATCH,
+	OPT_AUTOTUNE, OPT_INCREMENTAL };
 
 static const struct option longopts[] = {
     {"program", required_argument, NULL, 'p'},
@@ -107,54 +448,36 @@ static const struct option longopts[] = {
     {"no_dist_est", no_argument, NULL, OPT_NO_DIST_EST},
     {"run_verbose", no_argument, NULL, 'v'},
     {"threads", required_argument, NULL, 't'},
+    {"max_memory", required_argument, NULL, OPT_MAX_MEMORY},
+    {"index_partitions", required_argument, NULL, OPT_INDEX_PARTITIONS},
+    {"shards", required_argument, NULL, OPT_SHARDS},
+    {"shard_id", required_argument, NULL, OPT_SHARD_ID},
+    {"listen", required_argument, NULL, OPT_LISTEN},
+    {"read_store", required_argument, NULL, OPT_READ_STORE},
+    {"kmer_index", required_argument, NULL, OPT_KMER_INDEX},
+    {"classify", required_argument, NULL, OPT_CLASSIFY},
+    {"deterministic", no_argument, NULL, OPT_DETERMINISTIC},
+    {"io_block", required_argument, NULL, OPT_IO_BLOCK},
+    {"lib", required_argument, NULL, OPT_LIB},
+    {"evidence_index", required_argument, NULL, OPT_EVIDENCE_INDEX},
+    {"cut", no_argument, NULL, OPT_CUT},
+    {"cut_window", required_argument, NULL, OPT_CUT_WINDOW},
+    {"cut_span", required_argument, NULL, OPT_CUT_SPAN},
+    {"cut_dist", required_argument, NULL, OPT_CUT_DIST},
+    {"cut_min_size", required_argument, NULL, OPT_CUT_MIN_SIZE},
+    {"sample_kmers", required_argument, NULL, OPT_SAMPLE_KMERS},
+    {"log_limit", required_argument, NULL, OPT_LOG_LIMIT},
+    {"pair_checkpoint", required_argument, NULL, OPT_PAIR_CHECKPOINT},
+    {"read_batch", required_argument, NULL, OPT_READ_BATCH},
+    {"autotune", no_argument, NULL, OPT_AUTOTUNE},
+    {"incremental", required_argument, NULL, OPT_INCREMENTAL},
     {"version", no_argument, NULL, OPT_VERSION},
     {"help", no_argument, NULL, OPT_HELP},
     { NULL, 0, NULL, 0 }
 };
 
-unsigned int s_numkmersmapped = 0, s_numkmercollisions = 0, s_numkmersremdup = 0,
-		s_numbadkmers = 0, s_uniquedraftkmers = 0;
-
-unsigned int s_totalnumckmers = 0, s_ckmersasdups = 0, s_numckmersfound = 0,
-		s_numckmersrec = 0, s_numbadckmers = 0;
-
-unsigned int s_numreadspassingjaccard = 0, s_numreadsfailjaccard = 0;
-
-bool full = false;
-bool alignc = false;
-bool graph = false;
-
 /* HELPERS FOR CHECKING AND PRINTING: */
 
-std::string HeadOrTail(bool orientation) {
-	if (orientation) {
-		return "H";
-	} else {
-		return "T";
-	}
-}
-
-/* Precondition: input must either be "H" or "T" */
-bool HTtoBool(std::string ht) {
-	if (ht == "H") {
-		return true;
-	} else {
-		return false;
-	}
-}
-
-/* Returns true if the barcode only contains ATGC */
-static inline bool checkIndex(std::string seq) {
-	for (int i = 0; i < static_cast<int>(seq.length()); i++) {
-		char c = toupper(seq[i]);
-		if (c != 'A' && c != 'T' && c != 'G' && c != 'C')
-			return false;
-
-	}
-	//return (static_cast<int>(seq.length()) == params.indexLen);
-	return true;
-}
-
 /* Returns true if the contig sequence contains ATGC or IUPAC codes */
 static inline bool checkContigSequence(std::string seq) {
 	for (int i = 0; i < static_cast<int>(seq.length()); i++) {
@@ -212,14 +535,14 @@ vector<string> convertInputString(const string &inputString) {
 /* Write TSV checkpoint files */
 
 /* writes contigRecord table to TSV */
-void writeContigRecord(std::vector<ARCS::CI> &contigRecord) {
+void writeContigRecord(const std::vector<ARCS::CI> &contigRecord) {
 
-	std::string outputfilename = params.base_name + "_contigrec.tsv";
+	std::string outputfilename = job().params.base_name + "_contigrec.tsv";
 
 	FILE* fout = fopen(outputfilename.c_str(), "w");
 
 	size_t conreci = 0;
-	for (std::vector<ARCS::CI>::iterator it = contigRecord.begin(); it != contigRecord.end(); ++it) {
+	for (std::vector<ARCS::CI>::const_iterator it = contigRecord.begin(); it != contigRecord.end(); ++it) {
 		std::string contigname = it->first;
 		std::string ht = HeadOrTail(it->second);
 		fprintf(fout, "%zu\t%s\t%s\n", conreci, contigname.c_str(), ht.c_str());
@@ -228,14 +551,38 @@ void writeContigRecord(std::vector<ARCS::CI> &contigRecord) {
 	fclose(fout);
 }
 
-/* writes contigKMap to TSV */
-void writeContigKmerMap(ARCS::ContigKMap &kmap) {
+/* writes contigKMap to TSV (appends when writing later index partitions),
+ * in k-mer order with --deterministic. Each index partition is sorted on
+ * its own and appended, so the file is only identical between runs with
+ * the same number of partitions. */
+void writeContigKmerMap(const ARCS::ContigKMap &kmap, bool append = false) {
 
-	std::string outputfilename = params.base_name + "_kmercontigrec.tsv";
+	std::string outputfilename = job().params.base_name + "_kmercontigrec.tsv";
 
-	FILE* fout = fopen(outputfilename.c_str(), "w");
+	FILE* fout = fopen(outputfilename.c_str(), append ? "a" : "w");
 
-	for (auto it=kmap.begin(); it != kmap.end(); ++it) {
+	if (!job().params.deterministic) {
+		for (auto it = kmap.begin(); it != kmap.end(); ++it) {
+			std::string kmer = it->first;
+			size_t contigreci = it->second;
+			fprintf(fout, "%s\t%zu\n", kmer.c_str(), contigreci);
+		}
+		fclose(fout);
+		return;
+	}
+
+	std::vector<ARCS::ContigKMap::const_iterator> order;
+	order.reserve(kmap.size());
+	for (auto it = kmap.begin(); it != kmap.end(); ++it)
+		order.push_back(it);
+	std::sort(order.begin(), order.end(),
+		[](const ARCS::ContigKMap::const_iterator &a,
+				const ARCS::ContigKMap::const_iterator &b) {
+			return a->first < b->first;
+		});
+
+	for (auto oit = order.begin(); oit != order.end(); ++oit) {
+		auto it = *oit;
 		std::string kmer = it->first;
 		size_t contigreci = it->second;
 		fprintf(fout, "%s\t%zu\n", kmer.c_str(), contigreci);
@@ -243,104 +590,34 @@ void writeContigKmerMap(ARCS::ContigKMap &kmap) {
 	fclose(fout);
 }
 
-/* write IndexMap to TSV */
-void writeIndexMap(ARCS::IndexMap &imap) {
+/* writes the sorted contig-end k-mer index to TSV, in the ContigKMap format */
+void writeContigKmerMap(const PrefixKmerIndex &sorted, bool append = false) {
 
-	std::string barcode = "";
-	std::string contigname = "";
-	std::string orientation = "";
-	int count = 0;
+	std::string outputfilename = job().params.base_name + "_kmercontigrec.tsv";
 
-	std::string outputfilename = params.base_name + "_imap.tsv";
+	FILE* fout = fopen(outputfilename.c_str(), append ? "a" : "w");
 
-	FILE* fout = fopen(outputfilename.c_str(), "w");
-
-	for (auto it = imap.begin(); it != imap.end(); ++it) {
-		barcode = it->first;
-		ARCS::ScafMap smap = it->second;
-		for (auto j = smap.begin(); j != smap.end(); ++j) {
-			contigname = j->first.first;
-			orientation = HeadOrTail(j->first.second);
-			count = j->second;
-			fprintf(fout, "%s\t%s\t%s\t%d\n", barcode.c_str(), contigname.c_str(), orientation.c_str(), count);
-		}
+	for (size_t i = 0; i < sorted.size(); ++i) {
+		std::string kmer = sorted.kmer(i);
+		size_t contigreci = sorted.conreci(i);
+		fprintf(fout, "%s\t%zu\n", kmer.c_str(), contigreci);
 	}
 	fclose(fout);
 }
 
 /* Reading TSV (or CSV for barcode mult) checkpoint files */
 
-/* Create indexMultMap from Barcode Multiplicity File */
-void createIndexMultMap(std::string multfile, std::unordered_map<std::string, int> &indexMultMap) {
-
-	size_t numreadstotal=0;
-	size_t numreadskept=0;
-	size_t numbarcodes=0;
-
-	// Decide if it is a tsv or csv file
-	bool tsv = false;
-	std::size_t found = multfile.find(".tsv");
-	if (found!=std::string::npos)
-		tsv = true;
-
-	std::ifstream multfile_stream;
-	multfile_stream.open(multfile.c_str());
-	if (!multfile_stream) {
-		std::cerr << "Could not open " << multfile << ". --fatal.\n";
-		exit (EXIT_FAILURE);
-	}
-
-	std::string line;
-	while(getline(multfile_stream, line)) {
-
-		std::string barcode;
-		std::string multiplicity_string;
-		size_t multiplicity;
-
-		if (tsv) {
-			std::stringstream sst(line);
-			sst >> barcode >> multiplicity_string;
-			numbarcodes++;
-			multiplicity = std::stoi(multiplicity_string);
-		} else {
-			std::istringstream iss(line);
-			getline(iss, barcode, ',');
-			iss >> multiplicity_string;
-			numbarcodes++;
-			multiplicity = std::stoi(multiplicity_string);
-		}
-
-		numreadstotal += multiplicity;
-
-		if (!barcode.empty() && checkIndex(barcode)) {
-			numreadskept += multiplicity;
-			indexMultMap[barcode] = multiplicity;
-		} else {
-			std::cout << "Please check your multiplicity file." << std::endl;
-		}
-
-		assert(multfile_stream);
-	}
-	multfile_stream.close();
-
-	if (params.verbose) {
-		std::cout << "Saw " << numbarcodes << " barcodes and keeping " << numreadskept << " read pairs out of " << numreadstotal << std::endl;
-	}
-
-}
-
 /* Create contigRecord vector */
 void createContigRecord(std::string contigrectsv, std::vector<ARCS::CI> &contigRecord) {
 
-	std::ifstream contigrectsv_stream;
-	contigrectsv_stream.open(contigrectsv.c_str());
-	if (!contigrectsv_stream) {
+	ReadAheadStream contigrectsv_stream(contigrectsv, job().ioBlock);
+	if (!contigrectsv_stream.good()) {
 		std::cerr << "Could not open " << contigrectsv << ". --fatal.\n";
 		exit (EXIT_FAILURE);
 	}
 
 	std::string line;
-	while (getline(contigrectsv_stream, line)) {
+	while (contigrectsv_stream.getline(line)) {
 		std::stringstream sst(line);
 
 		int contigreci;
@@ -354,61 +631,39 @@ void createContigRecord(std::string contigrectsv, std::vector<ARCS::CI> &contigR
 
 		contigRecord[contigreci] = contigID;
 	}
-	contigrectsv_stream.close();
 }
 
-/* Create ContigKmerMap */
-void createContigKmerMap(std::string kmaptsv, ARCS::ContigKMap &kmap) {
+/* Create ContigKmerMap (only the k-mers in the given index partition),
+ * or queue the k-mers for the sorted index if `sorted` is given */
+void createContigKmerMap(std::string kmaptsv, ARCS::ContigKMap &kmap,
+		const ARCS::IndexPartition &partition, PrefixKmerIndex *sorted = NULL) {
 
-	std::ifstream kmaptsv_stream;
-	kmaptsv_stream.open(kmaptsv.c_str());
-	if (!kmaptsv_stream) {
+	ReadAheadStream kmaptsv_stream(kmaptsv, job().ioBlock);
+	if (!kmaptsv_stream.good()) {
 		std::cerr << "Could not open " << kmaptsv << ". --fatal.\n";
 		exit (EXIT_FAILURE);
 	}
 
 	std::string line;
-	while (getline(kmaptsv_stream, line)) {
+	while (kmaptsv_stream.getline(line)) {
 		std::stringstream sst(line);
 
 		std::string kmer, contigreci_string;
 		int contigreci;
 
 		sst >> kmer >> contigreci_string;
+		if (!partition.contains(kmer))
+			continue;
 		contigreci = std::stoi(contigreci_string);
 
-		kmap[kmer] = contigreci;
+		if (sorted != NULL)
+			sorted->add(kmer, contigreci);
+		else
+			kmap[kmer] = contigreci;
 	}
-	kmaptsv_stream.close();
-}
-
-/* Create IndexMap */
-void createIndexMap(std::string imaptsv, ARCS::IndexMap &imap) {
-
-	std::ifstream imaptsv_stream;
-	imaptsv_stream.open(imaptsv.c_str());
-	if (!imaptsv_stream) {
-		std::cerr << "Could not open " << imaptsv << ". --fatal.\n";
-		exit (EXIT_FAILURE);
-	}
-
-	std::string line;
-	while (getline(imaptsv_stream, line)) {
-		std::stringstream sst(line);
 
-		std::string barcode, contigname, ht_string, count_string;
-		bool ht;
-		int count;
-
-		sst >> barcode >> contigname >> ht_string >> count_string;
-		ht = HTtoBool(ht_string);
-		count = std::stoi(count_string);
-
-		ARCS::CI contigID(contigname, ht);
-
-		imap[barcode][contigID] = count;
-	}
-	imaptsv_stream.close();
+	if (sorted != NULL)
+		sorted->build();
 }
 
 /* Track memory usage */
@@ -429,55 +684,105 @@ int memory_usage() {
 	return mem;
 }
 
+/* Track peak memory usage (kB) */
+int peak_memory_usage() {
+	int mem = 0;
+	ifstream proc("/proc/self/status");
+	string s;
+	while (getline(proc, s), !proc.fail()) {
+		if (s.substr(0, 6) == "VmHWM:") {
+			stringstream convert(s.substr(6));
+			if (!(convert >> mem))
+				return 0;
+			return mem;
+		}
+	}
+	return mem;
+}
+
+/* Current resident set size in bytes */
+static inline size_t residentBytes() {
+	return (size_t) memory_usage() * 1024;
+}
+
 /* ARCS PROCESSES FUNCTIONS */
 
-/* Returns the size of the array for storing contigs */
-size_t initContigArray(std::string contigfile) {
+/* Returns the size of the array for storing contigs.
+ * 	numEndKmers				set to an upper bound on the number of contig-end k-mers
+ */
+size_t initContigArray(std::string contigfile, size_t& numEndKmers) {
 
 	size_t count = 0;
-
-	gzFile fp;
+	numEndKmers = 0;
 
 	int l;
-	const char* filename = contigfile.c_str();
-	fp = gzopen(filename, "r");
-	kseq_t * seq = kseq_init(fp);
+	ReadAheadStream in(contigfile, job().ioBlock);
+	kseq_t * seq = kseq_init(&in);
 
 	while ((l = kseq_read(seq)) >= 0) {
 		std::string sequence = seq->seq.s;
 		unsigned sequence_length = sequence.length();
-		if (checkContigSequence(sequence) && sequence_length >= params.min_size)
+		if (checkContigSequence(sequence) && sequence_length >= job().params.min_size) {
 			count++;
+			// same head/tail split as getContigKmers()
+			unsigned cutOff = job().params.end_length;
+			if (cutOff == 0 || sequence_length <= cutOff * 2)
+				cutOff = sequence_length / 2;
+			if (cutOff >= (unsigned) job().params.k_value)
+				numEndKmers += 2 * ((cutOff - job().params.k_value) / job().params.k_shift + 1);
+		}
 	}
 	kseq_destroy(seq);
-	gzclose(fp);
 
-	if (params.verbose) {
+	if (job().params.verbose) {
 		cerr << "Number of contigs:" << count << "\nSize of Contig Array:"
-				<< (count * 2) + 1 << endl;
+				<< (count * 2) + 1 << "\nContig-end k-mers (upper bound):"
+				<< numEndKmers << endl;
 	}
 
 	//Let the first index represent the a null contig
 	return (count * 2) + 1;
 }
 
+/* Stores one contig-end k-mer in the ContigKMap, marking k-mers of more than one
+ * contig end with the null contig, or queues it in the sorted index */
+static void storeKmer(const std::string &kmerseq, ARCS::ContigEndId conreci,
+		ARCS::ContigKMap &kmap, PrefixKmerIndex *sorted) {
+
+	// duplicates are collapsed when the sorted index is built
+	if (sorted != NULL) {
+		sorted->add(kmerseq, conreci);
+		return;
+	}
+
+	addContigKmer(kmap, kmerseq, conreci, job().s_numkmersmapped,
+		job().s_numkmercollisions, job().s_numkmersremdup, job().s_uniquedraftkmers);
+}
+
 /* Shreds end sequence into kmers and inputs them one by one into the ContigKMap
  * 	std::pair<std::string, bool> 				specifies contigID and head/tail
  * 	std::string						the end sequence of the contig
  *	int							k-value specified by user
  *	ARCS::ContigKMap					ContigKMap for storage of kmers
+ *	ARCS::IndexPartition					only k-mers in this partition are stored
+ *	PrefixKmerIndex						if given, kmers are queued here instead of the ContigKMap
+ *	std::string						if given, the packed k-mers are appended here (--incremental)
  */
 int mapKmers(std::string seqToKmerize, int k, int k_shift,
-		ARCS::ContigKMap &kmap, ReadsProcessor &proc, int conreci) {
+		ARCS::ContigKMap &kmap, ReadsProcessor &proc, ARCS::ContigEndId conreci,
+		const ARCS::IndexPartition &partition, PrefixKmerIndex *sorted,
+		std::string *kmers = NULL) {
 
 	int seqsize = seqToKmerize.length();
 
 	// Checks if length of the subsequence is smaller than the k size
 	// 	If the contig end is shorter than the k-value, then we ignore.
 	if (seqsize < k) {
-		std::string errmsg =
-				"Warning: ends of contig is shorter than k-value for contigID (no k-mers added): ";
-		std::cout << errmsg << conreci << std::endl;
+		if (partition.first()) {
+			std::string errmsg =
+					"Warning: ends of contig is shorter than k-value for contigID (no k-mers added): ";
+			logger().log(LOG_WARNING, "short contig end", errmsg + std::to_string(conreci));
+		}
 
 		return 0;
 	} else {
@@ -490,84 +795,341 @@ int mapKmers(std::string seqToKmerize, int k, int k_shift,
 			// Ignore a NULL kmer
 			if (temp != NULL) {
 				std::string kmerseq = proc.getStr(temp);
+				if (!partition.contains(kmerseq)) {
+					i += k_shift;
+					continue;
+				}
 
 				numKmers++;
-
-				//Critical section to prevent multiple thread from accessing datastructure
-				//only needed since we are writing to datastructure
-				//ideally would want CAS operation but without special a datastructure this is difficult
-				bool exists;
-				int alreadyconreci;
-
-//pragma omp critical(exists)
-				exists = kmap.find(kmerseq) != kmap.end();
-				alreadyconreci = kmap[kmerseq];
-
-				if (exists) {
-					if (alreadyconreci != conreci) {
-//#pragma omp atomic
-						s_numkmersremdup++;
-						if (alreadyconreci != 0) {
-							s_uniquedraftkmers--;
-//#pragma omp critical(duplicate)
-							kmap[kmerseq] = 0;
-						}
-					}
-//#pragma omp atomic
-					s_numkmercollisions++;
-				} else {
-//#pragma omp critical(insertkmerseq)
-					kmap[kmerseq] = conreci;
-					s_uniquedraftkmers++;
-					s_numkmersmapped++;
-				}
+				if (kmers != NULL)
+					kmers->append(kmerseq);
+				storeKmer(kmerseq, conreci, kmap, sorted);
 				i += k_shift;
 			} else {
 				i += k;
 //#pragma omp atomic
-				s_numbadkmers++;
+				if (partition.first())
+					job().s_numbadkmers++;
 			}
 		}
 		return numKmers;
 	}
 }
 
+/* The file of `path' with its size, mtime, inode and a hash of its first and
+ * last blocks, to tell whether it is the input of before */
+static IncrementalFile incrementalFile(const std::string &path) {
+	IncrementalFile file;
+	file.path = path;
+	int fd = open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd == -1)
+		return file;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return file;
+	}
+
+	std::vector<char> block(INCREMENTAL_FINGERPRINT_BLOCK);
+	uint64_t size = st.st_size;
+	size_t firstBytes = std::min<uint64_t>(size, block.size());
+	ssize_t n = pread(fd, block.data(), firstBytes, 0);
+	uint64_t hash = CityHash64(block.data(), n > 0 ? n : 0);
+	if (size > block.size()) {
+		n = pread(fd, block.data(), block.size(), size - block.size());
+		hash = CityHash64WithSeed(block.data(), n > 0 ? n : 0, hash);
+	}
+	close(fd);
+
+	file.size = size;
+	file.mtime = st.st_mtime;
+	file.inode = st.st_ino;
+	file.blocks = hash;
+	return file;
+}
+
+/*
+ * `--incremental': the contig-end k-mers and read pair classifications
+ * of the run before, if any, and those of this run, saved for the next.
+ * A contig end with the same name and sequence as before takes its
+ * k-mers from the saved state instead of being shredded again. A read
+ * pair keeps its saved classification unless a contig end it hit before
+ * has changed or gone, it hit a k-mer on several ends (which may now be
+ * on one) and has a k-mer of a changed or removed end, or it has a k-mer
+ * of a changed or new end. The first is tested on its saved hits; only
+ * the others scan the reads, and only for k-mers that changed.
+ */
+class IncrementalUpdate {
+public:
+	/* `numEnds' is the size of the ContigRecord */
+	IncrementalUpdate(const std::string &path, size_t numEnds) : m_path(path),
+			m_kmerBytes(ARCS::packedKmerBytes(job().params.k_value)),
+			m_added(job().params.k_value, job().params.k_shift), m_removed(job().params.k_value, job().params.k_shift),
+			m_reuseIndex(false), m_reuseReads(false), m_reusedEnds(0), m_checkedPairs(0),
+			m_reusedPairs(0), m_hitChangedPairs(0), m_kmerChangedPairs(0) {
+		m_next.kValue = job().params.k_value;
+		m_next.kShift = job().params.k_shift;
+		m_next.minMult = job().params.min_mult;
+		m_next.maxMult = job().params.max_mult;
+		m_next.classify = job().params.classify == "merge" ? 1 : job().params.classify == "sampled" ? 2 : 0;
+		m_next.jIndex = job().params.j_index;
+		for (size_t i = 0; i < job().params.libraries.size(); ++i) {
+			const ARCS::ReadLibrary &lib = job().params.libraries[i];
+			m_next.inputs.push_back(incrementalFile(lib.multfile));
+			for (size_t j = 0; j < lib.files.size(); ++j)
+				m_next.inputs.push_back(incrementalFile(lib.files[j]));
+		}
+		m_next.ends.resize(numEnds);
+		m_next.ends[0] = ARCS::CI("null contig", false);
+		m_next.fingerprints.resize(numEnds);
+		m_next.kmers.resize(numEnds);
+
+		if (!readIncrementalState(path, m_old)) {
+			std::cout << "Incremental: no state in " << path << " yet; indexing and classifying in full" << std::endl;
+			return;
+		}
+		m_reuseIndex = m_old.kValue == m_next.kValue && m_old.kShift == m_next.kShift;
+		bool sameOptions = m_old.minMult == m_next.minMult
+			&& m_old.maxMult == m_next.maxMult && m_old.classify == m_next.classify
+			&& m_old.jIndex == m_next.jIndex;
+		bool sameInputs = m_old.inputs == m_next.inputs;
+		m_reuseReads = m_reuseIndex && sameOptions && sameInputs;
+		if (!m_reuseIndex)
+			std::cout << "Incremental: " << path << " is of another -k or -g; indexing in full" << std::endl;
+		else if (!sameOptions)
+			std::cout << "Incremental: " << path << " is of other -m, -j or --classify;"
+				" classifying in full" << std::endl;
+		else if (!sameInputs)
+			std::cout << "Incremental: the reads or -a of " << path << " are not these files,"
+				" or have changed since (size, mtime, inode or content); classifying in full" << std::endl;
+		for (size_t i = 1; i < m_old.ends.size(); ++i)
+			m_oldEnds[m_old.ends[i]] = i;
+		m_oldToNew.assign(m_old.ends.size(), 0);
+	}
+
+	/* Index contig end `end' as getContigKmers does; returns its number of k-mers */
+	int indexEnd(const ARCS::CI &end, const std::string &seq, ARCS::ContigEndId conreci,
+			ARCS::ContigKMap &kmap, ReadsProcessor &proc,
+			const ARCS::IndexPartition &partition, PrefixKmerIndex *sorted) {
+		uint64_t fingerprint = CityHash64(seq.data(), seq.size());
+		m_next.ends[conreci] = end;
+		m_next.fingerprints[conreci] = fingerprint;
+		std::string &kmers = m_next.kmers[conreci];
+
+		std::map<ARCS::CI, size_t>::const_iterator it = m_oldEnds.find(end);
+		if (m_reuseIndex && it != m_oldEnds.end()
+				&& m_old.fingerprints[it->second] == fingerprint
+				&& m_oldToNew[it->second] == 0) {
+			kmers.swap(m_old.kmers[it->second]);
+			m_oldToNew[it->second] = conreci;
+			m_reusedEnds++;
+			if (sorted != NULL) {
+				sorted->addAll(kmers, conreci);
+			} else {
+				std::string kmer;
+				for (size_t i = 0; i < kmers.size(); i += m_kmerBytes) {
+					kmer.assign(kmers, i, m_kmerBytes);
+					storeKmer(kmer, conreci, kmap, NULL);
+				}
+			}
+			return kmers.size() / m_kmerBytes;
+		}
+
+		int num = mapKmers(seq, job().params.k_value, job().params.k_shift, kmap, proc, conreci,
+			partition, sorted, &kmers);
+		if (!m_old.ends.empty())
+			m_added.add(kmers);
+		return num;
+	}
+
+	/* After the draft is indexed: the k-mers of the ends of before that are gone */
+	void finishIndex() {
+		size_t goneEnds = 0;
+		for (size_t i = 1; i < m_old.ends.size(); ++i) {
+			if (m_oldToNew[i] == 0) {
+				m_removed.add(m_old.kmers[i]);
+				goneEnds++;
+			}
+		}
+		std::vector<std::string>().swap(m_old.kmers);
+		m_added.build();
+		m_removed.build();
+		m_oldHits.assign(m_old.hitCounts.size() + 1, 0);
+		for (size_t i = 0; i < m_old.hitCounts.size(); ++i)
+			m_oldHits[i + 1] = m_oldHits[i] + (m_old.hitCounts[i] & ~INCREMENTAL_COLLISION);
+		if (m_old.ends.empty())
+			return;
+		std::cout << "Incremental: " << m_reusedEnds << " contig ends unchanged, "
+			<< m_next.ends.size() - 1 - m_reusedEnds << " changed or new, "
+			<< goneEnds << " of before changed or removed; " << m_added.size()
+			<< " k-mers of changed or new contig ends, " << m_removed.size()
+			<< " of changed or removed ones" << std::endl;
+	}
+
+	/*
+	 * Set the contig ends of read pair `id' from its saved classification,
+	 * and `hits' from its saved hits, if it still holds; chromiumRead
+	 * classifies the pair otherwise
+	 */
+	bool reuse(size_t id, const std::string &seq1, const std::string &seq2,
+			ReadsProcessor &proc, int &corrConReci1, int &corrConReci2,
+			IncrementalHits &hits) {
+#pragma omp atomic
+		m_checkedPairs++;
+		if (!m_reuseReads || id >= m_old.outcomes.size())
+			return false;
+		uint32_t outcome = m_old.outcomes[id];
+		if (outcome == INCREMENTAL_UNCLASSIFIED
+				|| (outcome != 0 && (outcome >= m_oldToNew.size() || m_oldToNew[outcome] == 0)))
+			return false;
+
+		// a contig end it hit before has changed or gone
+		const uint32_t *oldHits = m_old.hits.data() + m_oldHits[id];
+		size_t numHits = m_oldHits[id + 1] - m_oldHits[id];
+		for (size_t i = 0; i < numHits; ++i) {
+			if (oldHits[i] >= m_oldToNew.size() || m_oldToNew[oldHits[i]] == 0) {
+#pragma omp atomic
+				m_hitChangedPairs++;
+				return false;
+			}
+		}
+
+		// it has a k-mer the index did not have, or one that was on several
+		// contig ends and may not be now
+		bool collision = (m_old.hitCounts[id] & INCREMENTAL_COLLISION) != 0;
+		if (m_added.contains(seq1, proc) || m_added.contains(seq2, proc)
+				|| (collision && (m_removed.contains(seq1, proc)
+					|| m_removed.contains(seq2, proc)))) {
+#pragma omp atomic
+			m_kmerChangedPairs++;
+			return false;
+		}
+
+		hits.clear();
+		hits.collision = collision;
+		for (size_t i = 0; i < numHits; ++i)
+			hits.ends.push_back(m_oldToNew[oldHits[i]]);
+		corrConReci1 = corrConReci2 = outcome == 0 ? 0 : m_oldToNew[outcome];
+#pragma omp atomic
+		m_reusedPairs++;
+		return true;
+	}
+
+	/* The read pairs whose classification was reused, so far; their k-mers
+	 * are not looked up, nor counted in the k-mer statistics of the job */
+	uint64_t reusedPairs() const { return m_reusedPairs; }
+
+	/* Save the classifications and hits of a batch of read pairs, the first
+	 * being pair `first' */
+	void record(size_t first, const std::vector<uint32_t> &outcomes,
+			std::vector<IncrementalHits> &hits) {
+		HitBatch batch;
+		batch.counts.reserve(hits.size());
+		for (size_t i = 0; i < hits.size(); ++i) {
+			hits[i].finish();
+			batch.counts.push_back(hits[i].ends.size()
+				| (hits[i].collision ? INCREMENTAL_COLLISION : 0));
+			batch.ends.insert(batch.ends.end(), hits[i].ends.begin(), hits[i].ends.end());
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_next.outcomes.size() < first + outcomes.size())
+				m_next.outcomes.resize(first + outcomes.size(), INCREMENTAL_UNCLASSIFIED);
+			std::copy(outcomes.begin(), outcomes.end(), m_next.outcomes.begin() + first);
+			m_hitBatches[first].swap(batch);
+		}
+	}
+
+	/* Write the state of this run, for the next */
+	void save() {
+		std::cout << "Incremental: reused the classification of " << m_reusedPairs
+			<< " of " << m_checkedPairs << " read pairs; classified again " << m_hitChangedPairs
+			<< " that hit a changed contig end and " << m_kmerChangedPairs
+			<< " with a changed k-mer" << std::endl;
+		for (std::map<size_t, HitBatch>::iterator it = m_hitBatches.begin();
+				it != m_hitBatches.end(); ++it) {
+			m_next.hitCounts.resize(it->first, 0);
+			m_next.hitCounts.insert(m_next.hitCounts.end(),
+				it->second.counts.begin(), it->second.counts.end());
+			m_next.hits.insert(m_next.hits.end(),
+				it->second.ends.begin(), it->second.ends.end());
+			HitBatch().swap(it->second);
+		}
+		m_next.hitCounts.resize(m_next.outcomes.size(), 0);
+		writeIncrementalState(m_path, m_next);
+	}
+
+private:
+	IncrementalUpdate(const IncrementalUpdate&);
+	IncrementalUpdate& operator=(const IncrementalUpdate&);
+
+	/* the hit counts and hits of a batch of read pairs, for save */
+	struct HitBatch {
+		std::vector<uint32_t> counts, ends;
+		void swap(HitBatch &o) { counts.swap(o.counts); ends.swap(o.ends); }
+	};
+
+	std::string m_path;
+	unsigned m_kmerBytes;
+	IncrementalState m_old, m_next;
+	/* contig end => its index in m_old */
+	std::map<ARCS::CI, size_t> m_oldEnds;
+	/* the ContigRecord index of each unchanged end of before, or 0 */
+	std::vector<ARCS::ContigEndId> m_oldToNew;
+	/* the offset of the saved hits of each read pair in m_old.hits */
+	std::vector<uint64_t> m_oldHits;
+	/* the k-mers of changed and new contig ends; of changed and removed ones */
+	IncrementalKmerSet m_added, m_removed;
+	/* by the first read pair of each batch */
+	std::map<size_t, HitBatch> m_hitBatches;
+	/* guards m_next.outcomes and m_hitBatches */
+	std::mutex m_mutex;
+	bool m_reuseIndex, m_reuseReads;
+	uint64_t m_reusedEnds, m_checkedPairs, m_reusedPairs, m_hitChangedPairs,
+		m_kmerChangedPairs;
+};
+
 /* Get the k-mers from the paired ends of the contigs and store them in map.
  * 	std::string file					FASTA (or later FASTQ) file
  *	std::sparse_hash_map<k-mer, pair<contidID, bool>> 	ContigKMap
  *	int k							k-value (specified by user)
+ *	ARCS::IndexPartition					only k-mers in this partition are stored
+ *	PrefixKmerIndex						if given, the k-mers go into this sorted index instead
+ *	ContigEndFMIndex					if given, the contig ends are indexed here whole instead
+ *	size_t maxContigs					stop after this many contigs are stored (--autotune)
+ *	IncrementalUpdate					if given, unchanged contig ends reuse their saved k-mers
  */
 void getContigKmers(std::string contigfile, ARCS::ContigKMap &kmap,
-	std::vector<ARCS::CI> &contigRecord, ARCS::ContigToLength& contigToLength)
+	std::vector<ARCS::CI> &contigRecord, ARCS::ContigToLength& contigToLength,
+	const ARCS::IndexPartition &partition, PrefixKmerIndex *sorted = NULL,
+	ContigEndFMIndex *fm = NULL, size_t maxContigs = SIZE_MAX,
+	IncrementalUpdate *incremental = NULL)
 {
-	int totalNumContigs = 0;
-	int skippedContigs = 0;
-	int validContigs = 0;
-	int totalKmers = 0;
+	uint64_t totalNumContigs = 0;
+	uint64_t skippedContigs = 0;
+	uint64_t validContigs = 0;
+	uint64_t totalKmers = 0;
 
 	ARCS::CI collisionmarker("null contig", false);
 	size_t conreci = 0; // 0 is the null contig so we will later increment before adding
 	contigRecord[conreci] = collisionmarker;
 
-	gzFile fp;
-
 	int l;
-	const char* filename = contigfile.c_str();
-	fp = gzopen(filename, "r");
-	kseq_t * seq = kseq_init(fp);
+	ReadAheadStream in(contigfile, job().ioBlock);
+	kseq_t * seq = kseq_init(&in);
 
 	//each thread gets a proc;
-	//vector<ReadsProcessor*> procs(params.threads);
+	//vector<ReadsProcessor*> procs(job().params.threads);
 
-	int16_t k_proc = params.k_value;
+	int16_t k_proc = job().params.k_value;
 	ReadsProcessor proc(k_proc);
 
-//	for (unsigned i = 0; i < params.threads; ++i) {
-//		procs[i] = new ReadsProcessor(params.k_value);
+//	for (unsigned i = 0; i < job().params.threads; ++i) {
+//		procs[i] = new ReadsProcessor(job().params.k_value);
 //	}
 
 //#pragma omp parallel
-	while ((l = kseq_read(seq)) >= 0) {
+	while (validContigs < maxContigs && (l = kseq_read(seq)) >= 0) {
 		totalNumContigs++;
 		bool good = false;
 		std::string contigID = "", sequence = "";
@@ -579,7 +1141,11 @@ void getContigKmers(std::string contigfile, ARCS::ContigKMap &kmap,
 			//if (l >= 0) {
 				contigID = seq->name.s;
 				sequence = seq->seq.s;
-				if (sequence.length() >= params.min_size) {
+				if (sequence.length() >= job().params.min_size) {
+					if (conreci + 2 > (size_t)ARCS::MAX_CONTIG_END_ID)
+						throw std::runtime_error("more than "
+							+ std::to_string(ARCS::MAX_CONTIG_END_ID / 2)
+							+ " contigs in the draft");
 					tempConreci1 = ++conreci;
 					tempConreci2 = ++conreci;
 					good = true;
@@ -592,7 +1158,7 @@ void getContigKmers(std::string contigfile, ARCS::ContigKMap &kmap,
 //			if (!checkContigSequence(sequence)) {
 //				std::string errormsg =
 //						"Error: Contig contains non-base characters. Please check your draft genome input file.";
-//				if (params.verbose) {
+//				if (job().params.verbose) {
 //					std::cerr << contigID << ": " << errormsg << std::endl;
 //				}
 //#pragma omp atomic
@@ -607,7 +1173,7 @@ void getContigKmers(std::string contigfile, ARCS::ContigKMap &kmap,
 
 				// If contig length is less than 2 x end_length, then we split the sequence
 				// in half to decide head/tail (aka we changed the end_length)
-				int cutOff = params.end_length;
+				int cutOff = job().params.end_length;
 				if (cutOff == 0 || sequence_length <= cutOff * 2)
 					cutOff = sequence_length / 2;
 
@@ -619,16 +1185,29 @@ void getContigKmers(std::string contigfile, ARCS::ContigKMap &kmap,
 				contigRecord[tempConreci1] = headside;
 				std::string seqend;
 				seqend = sequence.substr(0, cutOff);
-				int num = mapKmers(seqend, params.k_value, params.k_shift,
-						kmap, proc, tempConreci1);
+				int num = 0;
+				if (fm != NULL)
+					fm->add(seqend, tempConreci1);
+				else if (incremental != NULL)
+					num = incremental->indexEnd(headside, seqend, tempConreci1,
+						kmap, proc, partition, sorted);
+				else if (!partition.empty())
+					num = mapKmers(seqend, job().params.k_value, job().params.k_shift,
+						kmap, proc, tempConreci1, partition, sorted);
 //#pragma omp atomic
 				totalKmers += num;
 
 				contigRecord[tempConreci2] = tailside;
 				seqend = sequence.substr(sequence_length - cutOff,
 						sequence_length);
-				num = mapKmers(seqend, params.k_value, params.k_shift, kmap,
-						proc, tempConreci2);
+				if (fm != NULL)
+					fm->add(seqend, tempConreci2);
+				else if (incremental != NULL)
+					num = incremental->indexEnd(tailside, seqend, tempConreci2,
+						kmap, proc, partition, sorted);
+				else if (!partition.empty())
+					num = mapKmers(seqend, job().params.k_value, job().params.k_shift, kmap,
+						proc, tempConreci2, partition, sorted);
 
 //#pragma omp atomic
 				totalKmers += num;
@@ -641,11 +1220,12 @@ void getContigKmers(std::string contigfile, ARCS::ContigKMap &kmap,
 //			}
 //		}
 		// printprogress
-		if (params.verbose) {
+		if (job().params.verbose) {
 //#pragma omp critical(stdout)
 			if (totalNumContigs % 1000 == 0) {
 
-				printf("Finished %d Contigs...\n", totalNumContigs);
+				logger().log(LOG_INFO, "contig progress",
+					"Finished " + std::to_string(totalNumContigs) + " Contigs...");
 				// for memory tracking + debugging usage:
 					//std::cout << "Cumulative memory usage: " << memory_usage() << std::endl;
 					//std::cout << "Kmers so far: " << s_numkmersmapped << std::endl;
@@ -653,122 +1233,358 @@ void getContigKmers(std::string contigfile, ARCS::ContigKMap &kmap,
 		}
 	}
 	kseq_destroy(seq);
-	gzclose(fp);
+	logger().flush();
+	if (incremental != NULL)
+		incremental->finishIndex();
 
 	// clean up
 //	delete proc;
-//	for (unsigned i = 0; i < params.threads; ++i) {
+//	for (unsigned i = 0; i < job().params.threads; ++i) {
 //		delete procs[i];
 //	}
 
-	if (params.verbose) {
-		printf(
-				"%s %u\n%s %u\n%s %u\n%s %u\n%s %u\n%s %u\n%s %u\n%s %u\n%s %u\n",
+	if (sorted != NULL) {
+		PrefixKmerIndex::BuildStats stats = sorted->build();
+		job().s_numkmersmapped += stats.mapped;
+		job().s_numkmercollisions += stats.collisions;
+		job().s_numkmersremdup += stats.removedDuplicates;
+		job().s_uniquedraftkmers += stats.unique;
+	}
+	if (fm != NULL) {
+		if (fm->tooLarge())
+			throw std::runtime_error("the contig ends exceed the "
+				+ std::to_string(size_t(FMIndex::MAX_TEXT)) + " bases of the FM-index;"
+				" use --classify=probe or a smaller -e");
+		fm->build();
+		if (job().params.verbose)
+			coutPrintf("FM-index of %zu contig ends: %zu bases (both strands)\n",
+					fm->numEnds(), fm->size());
+	}
+
+	if (job().params.verbose) {
+		coutPrintf(
+				"%s %" PRIu64 "\n%s %" PRIu64 "\n%s %" PRIu64 "\n%s %" PRIu64 "\n%s %" PRIu64
+				"\n%s %" PRIu64 "\n%s %" PRIu64 "\n%s %" PRIu64 "\n%s %" PRIu64 "\n",
 				"Total number of contigs in draft genome: ", totalNumContigs,
 				"Total valid contigs: ", validContigs,
 				"Total skipped contigs: ", skippedContigs,
 				"Total number of Kmers: ", totalKmers, "Number Null Kmers: ",
-				s_numbadkmers, "Number Kmers Recorded: ", s_numkmersmapped,
-				"Number Kmer Collisions: ", s_numkmercollisions,
+				job().s_numbadkmers, "Number Kmers Recorded: ", job().s_numkmersmapped,
+				"Number Kmer Collisions: ", job().s_numkmercollisions,
 				"Number Times Kmers Removed (since duplicate in different contig): ",
-				s_numkmersremdup, "Number of unique kmers (only one contig): ",
-				s_uniquedraftkmers);
+				job().s_numkmersremdup, "Number of unique kmers (only one contig): ",
+				job().s_uniquedraftkmers);
 	}
 }
 
 
-/* Calculate the jaccard index */
-static inline double calcJacIndex(int smallCount, int overallCount) {
-	return (double) smallCount / (double) overallCount;
+/* Records one read k-mer found in the k-mer index, unless it is the collision marker
+ *	int corrConReci				contig record index stored for the k-mer
+ *	std::map<int, int> ktrack		contig record index => # k-mers found there
+ *	bool *collision				if given, set when it is the collision marker
+ */
+static inline void recordKmerHit(ARCS::ContigEndId corrConReci, std::map<int, int> &ktrack,
+		bool *collision = NULL) {
+	if (corrConReci != 0) {
+		ktrack[corrConReci]++;
+#pragma omp atomic
+		job().s_numckmersrec++;
+	} else {
+		if (collision != NULL)
+			*collision = true;
+#pragma omp atomic
+		job().s_ckmersasdups++;
+	}
+#pragma omp atomic
+	job().s_numckmersfound++;
 }
 
-/* Returns best corresponding contig from read through kmers
- * 	ARCS::ContigKMap			tells me what kmers correspond to which contig
+/* Looks up the k-mers of a read in the k-mer index and counts the hits per contig end.
+ * Returns the number of k-mer positions in the read.
+ * 	KmerIndex				tells me what kmers correspond to which contig
  *	std::string				read sequence
  *	int					size of k-mer
  *	int 					k_shift
- *      double j_index				Jaccard Index (default 0.5)
  *	ReadsProcessor				kmerizer
+ *	std::map<int, int> ktrack		contig record index => # k-mers found there
+ *	bool countTotals			update the totals that do not depend on the
+ *						index partition (only once per read)
+ *	bool *collision				if given, set when a k-mer is the collision marker
  */
-int bestContig (ARCS::ContigKMap &kmap, std::string readseq, int k, int k_shift,
-		double j_index, ReadsProcessor &proc) {
-
-	// to keep track of what contig+H/T that the k-mer from barcode matches to
-	// 	int					Index that corresponds to the contig in the contigRecord
-	// 	count					# kmers found here
-	std::map<int, int> ktrack;
+int countContigKmers(const KmerIndex &index, const std::string &readseq,
+		int k, int k_shift, ReadsProcessor &proc, std::map<int, int> &ktrack,
+		bool countTotals, bool *collision = NULL) {
 
-	// k-merize readsequence
-	int corrbestConReci = 0;
 	int seqlen = readseq.length();
-
 	int totalnumkmers = 0;
-	int kmerdups = 0;
-	int kmerfound = 0;
-	int kmerstore = 0;
-
 
 	int i = 0;
 
 	while (i <= seqlen - k) {
 		const unsigned char* temp = proc.prepSeq(readseq, i);
-#pragma omp atomic
 		totalnumkmers++;
 		if (temp != NULL) {
-			const std::string ckmerseq = proc.getStr(temp);
-#pragma omp atomic
-			s_totalnumckmers++;
-
-			// search for kmer in ContigKmerMap and only record if it is not the collisionmaker
-			if (kmap.find(ckmerseq) != kmap.end()) {
-
-				int corrConReci = kmap[ckmerseq];
-				if (corrConReci != 0) {
-					ktrack[corrConReci]++;
-#pragma omp atomic
-					kmerstore++;
-#pragma omp atomic
-					s_numckmersrec++;
-				} else {
-#pragma omp atomic
-					s_ckmersasdups++;
+			if (countTotals) {
 #pragma omp atomic
-					kmerdups++;
-				}
-#pragma omp atomic
-				kmerfound++;
-#pragma omp atomic
-				s_numckmersfound++;
-
+				job().s_totalnumckmers++;
 			}
-		} else {
+
+			// search for kmer in the index and only record if it is not the collisionmaker
+			// (read-only lookup, so that checkpoint writers may iterate it concurrently)
+			int corrConReci;
+			if (index.find(temp, corrConReci))
+				recordKmerHit(corrConReci, ktrack, collision);
+		} else if (countTotals) {
 #pragma omp atomic
-			s_numbadckmers++;
+			job().s_numbadckmers++;
 		}
 		i += k_shift;
 	}
 
-	double maxjaccardindex = 0;
-	// for the read, find the contig that it is most compatible with based on the jaccard index
-	for (auto it = ktrack.begin(); it != ktrack.end(); ++it) {
-		double currjaccardindex = calcJacIndex(it->second, totalnumkmers);
-		if (maxjaccardindex < currjaccardindex) {
-			maxjaccardindex = currjaccardindex;
-			corrbestConReci = it->first;
-		}
-	}
+	return totalnumkmers;
+}
 
-	// default jaccard threshold is 0.5
-	if (maxjaccardindex > j_index) {
-		s_numreadspassingjaccard++;
-		return corrbestConReci;
-	} else {
+/* Appends the k-mers of a read to kmers, for lookup on remote index shards.
+ * Returns the number of k-mer positions in the read.
+ */
+int collectReadKmers(const std::string &readseq, int k, int k_shift,
+		ReadsProcessor &proc, std::vector<std::string> &kmers) {
 
-		s_numreadsfailjaccard++;
-		return 0;
+	int seqlen = readseq.length();
+	int totalnumkmers = 0;
+
+	for (int i = 0; i <= seqlen - k; i += k_shift) {
+		const unsigned char* temp = proc.prepSeq(readseq, i);
+		totalnumkmers++;
+		if (temp != NULL)
+			kmers.push_back(proc.getStr(temp));
+	}
+
+	return totalnumkmers;
+}
+
+ARCS::ContigEndId bestContig(const std::map<int, int> &ktrack, int totalnumkmers, double j_index) {
+
+	int corrbestConReci = bestJaccardContig(ktrack, totalnumkmers, j_index);
+	if (corrbestConReci != 0) {
+#pragma omp atomic
+		job().s_numreadspassingjaccard++;
+	} else {
+#pragma omp atomic
+		job().s_numreadsfailjaccard++;
+	}
+	return corrbestConReci;
+}
+
+/* Returns best corresponding contig from read through kmers
+ * 	KmerIndex				tells me what kmers correspond to which contig
+ *	std::string				read sequence
+ *	int					size of k-mer
+ *	int 					k_shift
+ *      double j_index				Jaccard Index (default 0.5)
+ *	ReadsProcessor				kmerizer
+ *	IncrementalHits				if given, the contig ends hit are added (--incremental)
+ */
+ARCS::ContigEndId bestContig (const KmerIndex &index, std::string readseq, int k, int k_shift,
+		double j_index, ReadsProcessor &proc, IncrementalHits *hits = NULL) {
+
+	// to keep track of what contig+H/T that the k-mer from barcode matches to
+	// 	int					Index that corresponds to the contig in the contigRecord
+	// 	count					# kmers found here
+	std::map<int, int> ktrack;
+
+	int totalnumkmers = countContigKmers(index, readseq, k, k_shift, proc, ktrack, true,
+		hits != NULL ? &hits->collision : NULL);
+	if (hits != NULL)
+		hits->add(ktrack);
+	return bestContig(ktrack, totalnumkmers, j_index);
+}
+
+/* a stage-one decision needs the sampled hit fraction this many
+ * standard errors away from the Jaccard threshold */
+static const double SAMPLED_MARGIN = 2.0;
+/* one in this many stage-one decisions is checked against the exhaustive classifier */
+static const size_t SAMPLED_CHECK_INTERVAL = 64;
+
+/* Looks up the k-mer at position i of a read, as countContigKmers */
+static inline void lookupReadKmer(const KmerIndex &index, const std::string &readseq,
+		int i, ReadsProcessor &proc, std::map<int, int> &ktrack, bool *collision = NULL) {
+	const unsigned char* temp = proc.prepSeq(readseq, i);
+	if (temp != NULL) {
+#pragma omp atomic
+		job().s_totalnumckmers++;
+		int corrConReci;
+		if (index.find(temp, corrConReci))
+			recordKmerHit(corrConReci, ktrack, collision);
+	} else {
+#pragma omp atomic
+		job().s_numbadckmers++;
 	}
 }
 
+/* Returns best corresponding contig for a read, as bestContig, looking up
+ * as few of its k-mers as it can (`--classify=sampled`).
+ *
+ * Stage one looks up job().params.sample_kmers k-mers, evenly spaced along the
+ * read. If they all hit one contig end (or none) and their hit fraction
+ * is well above (or below) the Jaccard threshold, that decides the read.
+ * Otherwise stage two looks up the remaining k-mers, which gives exactly
+ * the exhaustive result. With `hits', the contig ends of the k-mers looked
+ * up are added to it (--incremental).
+ */
+ARCS::ContigEndId sampledBestContig(const KmerIndex &index, const std::string &readseq, int k,
+		int k_shift, double j_index, ReadsProcessor &proc, IncrementalHits *hits = NULL) {
+
+	int seqlen = readseq.length();
+	int numPositions = seqlen < k ? 0 : (seqlen - k) / k_shift + 1;
+	int numSamples = std::min<int>(job().params.sample_kmers, numPositions);
+	std::map<int, int> ktrack;
+	bool *collision = hits != NULL ? &hits->collision : NULL;
+
+	// the middle position of each of numSamples equal strata
+	std::vector<bool> sampled(numPositions, false);
+	for (int s = 0; s < numSamples; ++s) {
+		int p = (int)((2 * s + 1) * (int64_t)numPositions / (2 * numSamples));
+		sampled[p] = true;
+		lookupReadKmer(index, readseq, p * k_shift, proc, ktrack, collision);
+	}
+
+	int decided = -1;
+	if (numSamples > 0 && ktrack.size() <= 1) {
+		double fraction = ktrack.empty() ? 0
+			: (double)ktrack.begin()->second / numSamples;
+		double margin = SAMPLED_MARGIN * sqrt(j_index * (1 - j_index) / numSamples);
+		if (fraction > j_index + margin)
+			decided = ktrack.begin()->first;
+		else if (fraction < j_index - margin)
+			decided = 0;
+	}
+
+	uint64_t reads, lookups = numSamples;
+#pragma omp atomic capture
+	reads = ++job().s_sampledreads;
+#pragma omp atomic
+	job().s_sampledpositions += numPositions;
+
+	if (decided >= 0) {
+#pragma omp atomic
+		job().s_sampledstageone++;
+#pragma omp atomic
+		job().s_sampledlookups += lookups;
+		if (decided != 0) {
+#pragma omp atomic
+			job().s_numreadspassingjaccard++;
+		} else {
+#pragma omp atomic
+			job().s_numreadsfailjaccard++;
+		}
+
+		// check some of the stage-one decisions against all k-mers
+		if (reads % SAMPLED_CHECK_INTERVAL == 0) {
+			std::map<int, int> all;
+			for (int p = 0; p < numPositions; ++p) {
+				const unsigned char* temp = proc.prepSeq(readseq, p * k_shift);
+				int corrConReci;
+				if (temp != NULL && index.find(temp, corrConReci) && corrConReci != 0)
+					all[corrConReci]++;
+			}
+			bool agreed = bestJaccardContig(all, numPositions, j_index) == decided;
+#pragma omp atomic
+			job().s_sampledchecked++;
+			if (agreed) {
+#pragma omp atomic
+				job().s_sampledagreed++;
+			}
+		}
+		if (hits != NULL)
+			hits->add(ktrack);
+		return decided;
+	}
+
+	for (int p = 0; p < numPositions; ++p) {
+		if (!sampled[p])
+			lookupReadKmer(index, readseq, p * k_shift, proc, ktrack, collision);
+	}
+#pragma omp atomic
+	job().s_sampledlookups += numPositions;
+	if (hits != NULL)
+		hits->add(ktrack);
+	return bestContig(ktrack, numPositions, j_index);
+}
+
+/* Add the k-mer hits in ktrack to saved hits */
+/* Combines the k-mer hits of a read pair against the current index partition with
+ * those saved from earlier partitions in `saved'. Adds them there until the last
+ * partition, where it sets corrConReci1/2 and returns true.
+ */
+bool resolvePartitionHits(std::map<int, int> &ktrack1, std::map<int, int> &ktrack2,
+		int totalnumkmers1, int totalnumkmers2, ARCS::ReadPairHits &saved,
+		const ARCS::IndexPartition &partition,
+		int &corrConReci1, int &corrConReci2) {
+
+	if (!partition.last()) {
+		saveHits(ktrack1, saved.read1);
+		saveHits(ktrack2, saved.read2);
+		return false;
+	}
+
+	restoreHits(saved.read1, ktrack1);
+	restoreHits(saved.read2, ktrack2);
+	ARCS::KmerHits().swap(saved.read1);
+	ARCS::KmerHits().swap(saved.read2);
+
+	corrConReci1 = bestContig(ktrack1, totalnumkmers1, job().params.j_index);
+	corrConReci2 = bestContig(ktrack2, totalnumkmers2, job().params.j_index);
+	return true;
+}
+
+/* Best corresponding contigs for a read pair when the index is split into partitions.
+ * Hits against the current partition are saved in `saved' until the last partition,
+ * where they are merged with the hits from all earlier partitions to make the same
+ * decision as a single-index run. Returns true on the last partition, when
+ * corrConReci1/2 are set.
+ */
+bool partitionedBestContigs(const KmerIndex &index, const std::string &cread1,
+		const std::string &cread2, ARCS::ReadPairHits &saved,
+		const ARCS::IndexPartition &partition, ReadsProcessor &proc,
+		int &corrConReci1, int &corrConReci2) {
+
+	std::map<int, int> ktrack1, ktrack2;
+	int totalnumkmers1 = countContigKmers(index, cread1, job().params.k_value, job().params.k_shift,
+			proc, ktrack1, partition.first());
+	int totalnumkmers2 = countContigKmers(index, cread2, job().params.k_value, job().params.k_shift,
+			proc, ktrack2, partition.first());
+
+	return resolvePartitionHits(ktrack1, ktrack2, totalnumkmers1, totalnumkmers2,
+			saved, partition, corrConReci1, corrConReci2);
+}
+
+/* Best corresponding contigs for a read pair from its maximal exact matches on the
+ * contig ends (`--classify=smem`), with the same Jaccard decision as bestContig.
+ */
+void smemBestContigs(const ContigEndFMIndex &fm, const std::string &cread1,
+		const std::string &cread2, int &corrConReci1, int &corrConReci2) {
+
+	std::map<int, int> ktrack1, ktrack2;
+	ContigEndFMIndex::ReadStats stats;
+	int totalnumkmers1 = fm.readHits(cread1, job().params.k_value, job().params.k_shift, ktrack1, stats);
+	int totalnumkmers2 = fm.readHits(cread2, job().params.k_value, job().params.k_shift, ktrack2, stats);
+
+#pragma omp atomic
+	job().s_totalnumckmers += stats.valid;
+#pragma omp atomic
+	job().s_numbadckmers += stats.bad;
+#pragma omp atomic
+	job().s_numckmersfound += stats.found;
+#pragma omp atomic
+	job().s_numckmersrec += stats.recorded;
+#pragma omp atomic
+	job().s_ckmersasdups += stats.found - stats.recorded;
+
+	corrConReci1 = bestContig(ktrack1, totalnumkmers1, job().params.j_index);
+	corrConReci2 = bestContig(ktrack2, totalnumkmers2, job().params.j_index);
+}
+
 /* Strip the trailing "/1" or "/2" from a FASTA ID, if such exists */
 static inline void stripReadNum(std::string& readName)
 {
@@ -782,183 +1598,1006 @@ static inline void stripReadNum(std::string& readName)
 	readName.resize(pos);
 }
 
-/* Read through longranger basic chromium output fastq file */
-void chromiumRead(std::string chromiumfile, ARCS::ContigKMap& kmap, ARCS::IndexMap& imap,
-			const std::unordered_map<std::string, int> &indexMultMap,
-			const std::vector<ARCS::CI> &contigRecord) {
+/* Extract the barcode from a chromium FASTQ comment ("BX:Z:<barcode>-1") */
+static inline std::string parseBarcode(const std::string &comment) {
+	std::string barcode;
+	for (std::string::const_iterator i = comment.begin(); i != comment.end();
+			i++) {
+		if (*i != 'B' && *i != 'X' && *i != ':' && *i != 'Z'
+				&& *i != '-' && *i != '1' && *i != '\n') {
+			barcode += *i;
+		}
+	}
+	return barcode;
+}
 
-	int stored_readpairs = 0;
-	int skipped_unpaired = 0;
-	int skipped_invalidreadpair = 0;
-	int skipped_nogoodcontig = 0;
-	int invalidbarcode = 0;
+/* One read pair (two consecutive FASTQ records) of a chromium file */
+struct ChromiumReadPair {
+	std::string name1, barcode1, seq1;
+	std::string name2, barcode2, seq2;
+};
 
-	size_t count = 0;
-	bool stop = false;
+/* Consecutive read pairs of a file, the first being pair number `first` */
+struct ChromiumReadBatch {
+	size_t first;
+	std::vector<ChromiumReadPair> pairs;
+};
 
-	//each thread gets a proc;
-	vector<ReadsProcessor*> procs(params.threads);
+typedef std::shared_ptr<ChromiumReadBatch> ChromiumReadBatchPtr;
+typedef BoundedQueue<ChromiumReadBatchPtr> ChromiumReadQueue;
+
+/* batches parsed ahead of alignment, per file */
+static const size_t READ_BUFFER_BATCHES = 16;
 
-	for (unsigned i = 0; i < params.threads; ++i) {
-		procs[i] = new ReadsProcessor(params.k_value);
+/* Read pairs buffered while the reads are aligned, for --max_memory: the read buffers
+ * of the file being aligned and of the next, which the reader is on, the batch being
+ * parsed and those being classified; with index partitions, the batches of saved k-mer
+ * hits being classified, read ahead and waiting to be written.
+ */
+static AlignmentBuffers alignmentBuffers() {
+	size_t files = 0;
+	for (size_t i = 0; i < job().params.libraries.size(); ++i)
+		files += job().params.libraries[i].files.size();
+	size_t threads = job().params.threads;
+	AlignmentBuffers buffers;
+	buffers.readPairs = (std::min<size_t>(files, 2) * READ_BUFFER_BATCHES + 1 + threads)
+		* job().params.read_batch;
+	buffers.hitPairs = (PARTIAL_HITS_PENDING + 2) * threads * job().params.read_batch;
+	return buffers;
+}
+
+/*
+ * Decompresses and parses the chromium files on a background thread,
+ * into one bounded buffer per file. Started before the k-mer index is
+ * built, so that the first reads are waiting when alignment begins.
+ * If a file cannot be read, the buffers of it and the files after are
+ * closed early, and rethrow throws the error. The reader stops when it
+ * is destroyed before the reads are used up, as when its job fails.
+ */
+class ChromiumReader {
+public:
+	ChromiumReader(const vector<string> &files) : m_files(files),
+			m_libraries(files.size(), 0), m_prefixes(1), m_cancelled(false) {
+		for (unsigned i = 0; i < files.size(); ++i)
+			m_queues.push_back(new ChromiumReadQueue(READ_BUFFER_BATCHES));
 	}
 
-	gzFile fp2;
-	const char* filename = chromiumfile.c_str();
-	fp2 = gzopen(filename, "r");
-	if (fp2 == Z_NULL) {
-		cerr << "File " << filename << " cannot be opened." << endl;
-		exit(1);
-	} else {
-		cerr << "File " << filename << " opened." << endl;
-	}
-	kseq_t * seq2 = kseq_init(fp2);
-
-#pragma omp parallel
-	while (!stop) {
-		int l;
-		std::string read1_name = "";
-		std::string read2_name = "";
-		std::string barcode1;
-		std::string barcode2;
-		std::string cread1 = "";
-		std::string cread2 = "";
-		std::string comment1 = "";
-		std::string comment2 = "";
-		bool paired = false;
-		int corrConReci1 = 0;
-		int corrConReci2 = 0;
-#pragma omp critical(checkread1or2)
-		{
-			l = kseq_read(seq2);
-			if (l >= 0) {
-				read1_name = seq2->name.s;
-				if (seq2->comment.l) {
-					comment1 = seq2->comment.s;
-				}
-				cread1 = seq2->seq.s;
-				l = kseq_read(seq2);
-				if (l >= 0) {
-					read2_name = seq2->name.s;
-					if (seq2->comment.l) {
-						comment2 = seq2->comment.s;
-					}
-					cread2 = seq2->seq.s;
-				} else {
-					stop = true;
-				}
-			} else {
-				stop = true;
+	/* The files of each library in turn, their barcodes namespaced */
+	ChromiumReader(const std::vector<ARCS::ReadLibrary> &libraries) : m_cancelled(false) {
+		for (unsigned lib = 0; lib < libraries.size(); ++lib) {
+			m_prefixes.push_back(libraries[lib].barcodePrefix());
+			for (unsigned i = 0; i < libraries[lib].files.size(); ++i) {
+				m_files.push_back(libraries[lib].files[i]);
+				m_libraries.push_back(lib);
+				m_queues.push_back(new ChromiumReadQueue(READ_BUFFER_BATCHES));
 			}
-			stripReadNum(read1_name);
-			stripReadNum(read2_name);
-			if (read1_name == read2_name) {
-				paired = true;
-			} else {
-				std::cout << "File contains unpaired reads: " << read1_name << " " << read2_name << std::endl;
-				skipped_unpaired++;
+		}
+	}
+
+	~ChromiumReader() {
+		if (m_thread.joinable()) {
+			m_cancelled = true;
+			for (unsigned i = 0; i < m_queues.size(); ++i)
+				for (ChromiumReadBatchPtr batch; m_queues[i]->pop(batch);)
+					;
+			m_thread.join();
+		}
+		for (unsigned i = 0; i < m_queues.size(); ++i)
+			delete m_queues[i];
+	}
+
+	void start() {
+		m_thread = jobThread([this]() { run(); });
+	}
+
+	/*
+	 * Parse the first `n` read pairs of a FASTQ file into `pairs`, for
+	 * --autotune; returns the bytes of the file read for them.
+	 */
+	static uint64_t sample(const std::string &chromiumfile, const std::string &prefix,
+			size_t n, std::vector<ChromiumReadPair> &pairs) {
+		ReadAheadStream in(chromiumfile, job().ioBlock);
+		if (!in.good())
+			throw std::runtime_error("File " + chromiumfile + " cannot be opened.");
+		kseq_t * seq = kseq_init(&in);
+		while (pairs.size() < n) {
+			ChromiumReadPair pair;
+			if (kseq_read(seq) < 0)
+				break;
+			readRecord(seq, prefix, pair.name1, pair.barcode1, pair.seq1);
+			if (kseq_read(seq) < 0)
+				break;
+			readRecord(seq, prefix, pair.name2, pair.barcode2, pair.seq2);
+			pairs.push_back(pair);
+		}
+		uint64_t bytes = in.offset();
+		kseq_destroy(seq);
+		return bytes;
+	}
+
+	size_t size() const { return m_files.size(); }
+	const std::string& file(size_t i) const { return m_files[i]; }
+	/* the index of the library of file i */
+	size_t library(size_t i) const { return m_libraries[i]; }
+	ChromiumReadQueue& queue(size_t i) { return *m_queues[i]; }
+
+	/* Throw the error of the reader thread, if any, once the buffers are drained */
+	void rethrow() {
+		if (m_error)
+			std::rethrow_exception(m_error);
+	}
+
+private:
+	ChromiumReader(const ChromiumReader&);
+	ChromiumReader& operator=(const ChromiumReader&);
+
+	void run() {
+		unsigned i = 0;
+		try {
+			for (; i < m_files.size() && !m_cancelled; ++i) {
+				const std::string &prefix = m_prefixes[m_libraries[i]];
+				if (isReadStore(m_files[i]))
+					readStoreFile(m_files[i], prefix, *m_queues[i]);
+				else
+					readFile(m_files[i], prefix, *m_queues[i]);
 			}
-			count += 2;
-			if (params.verbose) {
-				if (count % 10000000 == 0) {
-					std::cout << "Processed " << count << " read pairs." << std::endl;
-				}
+		} catch (...) {
+			m_error = std::current_exception();
+		}
+		for (; i < m_queues.size(); ++i)
+			m_queues[i]->close();
+	}
+
+	static void readRecord(const kseq_t *seq, const std::string &prefix,
+			std::string &name, std::string &barcode, std::string &sequence) {
+		name = seq->name.s;
+		if (seq->comment.l)
+			barcode = parseBarcode(seq->comment.s);
+		if (!barcode.empty() && !prefix.empty())
+			barcode.insert(0, prefix);
+		sequence = seq->seq.s;
+	}
+
+	/* A read store (-p store) holds only pairs with matching names */
+	void readStoreFile(const std::string &storefile, const std::string &prefix,
+			ChromiumReadQueue &queue) {
+		ReadStoreReader store(storefile);
+		cerr << "Read store " << storefile << " opened ("
+			<< store.numPairs() << " read pairs)." << endl;
+
+		size_t count = 0;
+		std::string payload;
+		uint32_t numPairs;
+		while (!m_cancelled && store.readBlock(payload, numPairs)) {
+			ChromiumReadBatchPtr batch(new ChromiumReadBatch);
+			batch->first = count;
+			batch->pairs.resize(numPairs);
+			const char* p = payload.data();
+			for (uint32_t i = 0; i < numPairs; ++i) {
+				ChromiumReadPair &pair = batch->pairs[i];
+				uint32_t barcodeId;
+				p = ReadStoreReader::decode(p, barcodeId, pair.seq1, pair.seq2);
+				pair.barcode1 = pair.barcode2 = prefix + store.barcode(barcodeId);
 			}
+			count += numPairs;
+			queue.push(batch);
 		}
+		queue.close();
+	}
 
-		if (!stop) {
-			barcode1.clear();
-			for (std::string::iterator i = comment1.begin(); i != comment1.end();
-					i++) {
-				if (*i != 'B' && *i != 'X' && *i != ':' && *i != 'Z'
-						&& *i != '-' && *i != '1' && *i != '\n') {
-					barcode1 += *i;
-				}
+	/* A trailing record without a mate is dropped */
+	void readFile(const std::string &chromiumfile, const std::string &prefix,
+			ChromiumReadQueue &queue) {
+		const char* filename = chromiumfile.c_str();
+		ReadAheadStream in(chromiumfile, job().ioBlock);
+		if (!in.good()) {
+			throw std::runtime_error("File " + chromiumfile + " cannot be opened.");
+		} else {
+			cerr << "File " << filename << " opened." << endl;
+		}
+		kseq_t * seq = kseq_init(&in);
+		std::unique_ptr<kseq_t, void (*)(kseq_t*)> seqGuard(seq, kseq_destroy);
+
+		size_t count = 0;
+		ChromiumReadBatchPtr batch;
+		while (!m_cancelled) {
+			if (!batch) {
+				batch.reset(new ChromiumReadBatch);
+				batch->first = count;
+				batch->pairs.reserve(job().params.read_batch);
 			}
-			barcode2.clear();
-			for (std::string::iterator i = comment2.begin(); i != comment2.end();
-					i++) {
-				if (*i != 'B' && *i != 'X' && *i != ':' && *i != 'Z'
-						&& *i != '-' && *i != '1' && *i != '\n') {
-					barcode2 += *i;
-				}
+			ChromiumReadPair pair;
+			if (kseq_read(seq) < 0)
+				break;
+			readRecord(seq, prefix, pair.name1, pair.barcode1, pair.seq1);
+			if (kseq_read(seq) < 0)
+				break;
+			readRecord(seq, prefix, pair.name2, pair.barcode2, pair.seq2);
+			batch->pairs.push_back(pair);
+
+			count++;
+			if (job().params.verbose && count % 10000000 == 0)
+				logger().log(LOG_INFO, "read progress",
+					"Processed " + std::to_string(count) + " read pairs.");
+			if (batch->pairs.size() == job().params.read_batch) {
+				queue.push(batch);
+				batch.reset();
 			}
+		}
+		if (batch && !batch->pairs.empty())
+			queue.push(batch);
+		queue.close();
+	}
+
+	std::vector<std::string> m_files;
+	std::vector<size_t> m_libraries;
+	std::vector<std::string> m_prefixes;
+	std::vector<ChromiumReadQueue*> m_queues;
+	JobThread m_thread;
+	std::atomic<bool> m_cancelled;
+	std::exception_ptr m_error;
+};
 
-			bool validbarcode = indexMultMap.find(barcode1) != indexMultMap.end();
+/* Sort-merge classification state of one thread (`--classify=merge`) */
+struct MergeScratch {
+	std::vector<TaggedKmer> kmers, tmp;
+	std::vector<int32_t> conrecis;
+	std::vector<int> totals;
+	std::vector<std::map<int, int> > ktracks;
+};
+
+/* Best corresponding contigs for a batch of read pairs by sort-merge (`--classify=merge`).
+ * The k-mers of all the reads are tagged with their read, radix sorted and merge-joined
+ * against the sorted contig-end index, so that it is streamed rather than probed at
+ * random; the hits are then tallied per read. Sets corrConRecis[2j] and [2j+1] for pair j
+ * of `pairIndices` and returns true, except on earlier index partitions, where the hits
+ * are saved in `saved' as by partitionedBestContigs. With `hits', sets the contig ends
+ * hit by pair j in (*hits)[j] (--incremental).
+ */
+bool mergeBestContigs(const PrefixKmerIndex &sorted, const ChromiumReadBatch &batch,
+		const std::vector<size_t> &pairIndices, PartialHitFile::Batch &saved,
+		const ARCS::IndexPartition &partition, ReadsProcessor &proc,
+		MergeScratch &scratch, std::vector<int> &corrConRecis,
+		std::vector<IncrementalHits> *hits = NULL) {
+
+	const int k = job().params.k_value;
+	size_t numReads = 2 * pairIndices.size();
+	scratch.kmers.clear();
+	scratch.totals.assign(numReads, 0);
+	unsigned valid = 0, bad = 0;
+
+	for (size_t r = 0; r < numReads; ++r) {
+		const ChromiumReadPair &pair = batch.pairs[pairIndices[r / 2]];
+		const std::string &readseq = r % 2 == 0 ? pair.seq1 : pair.seq2;
+		int seqlen = readseq.length();
+		for (int i = 0; i <= seqlen - k; i += job().params.k_shift) {
+			const unsigned char* temp = proc.prepSeq(readseq, i);
+			scratch.totals[r]++;
+			if (temp != NULL) {
+				TaggedKmer kmer = { sorted.key(temp), (uint32_t)r };
+				scratch.kmers.push_back(kmer);
+				valid++;
+			} else {
+				bad++;
+			}
+		}
+	}
+	if (partition.first()) {
+#pragma omp atomic
+		job().s_totalnumckmers += valid;
+#pragma omp atomic
+		job().s_numbadckmers += bad;
+	}
 
-			if (!validbarcode) {
+	radixSortKmers(scratch.kmers, scratch.tmp);
+	sorted.joinSorted(scratch.kmers, scratch.conrecis);
+
+	scratch.ktracks.resize(numReads);
+	for (size_t r = 0; r < numReads; ++r)
+		scratch.ktracks[r].clear();
+	if (hits != NULL)
+		hits->assign(pairIndices.size(), IncrementalHits());
+	unsigned found = 0, recorded = 0;
+	for (size_t i = 0; i < scratch.kmers.size(); ++i) {
+		int corrConReci = scratch.conrecis[i];
+		if (corrConReci < 0)
+			continue;
+		found++;
+		if (corrConReci != 0) {
+			scratch.ktracks[scratch.kmers[i].tag][corrConReci]++;
+			recorded++;
+		} else if (hits != NULL) {
+			(*hits)[scratch.kmers[i].tag / 2].collision = true;
+		}
+	}
+#pragma omp atomic
+	job().s_numckmersfound += found;
 #pragma omp atomic
-				invalidbarcode++;
+	job().s_numckmersrec += recorded;
+#pragma omp atomic
+	job().s_ckmersasdups += found - recorded;
+
+	corrConRecis.assign(numReads, 0);
+	bool decided = true;
+	for (size_t j = 0; j < pairIndices.size(); ++j) {
+		std::map<int, int> &ktrack1 = scratch.ktracks[2 * j];
+		std::map<int, int> &ktrack2 = scratch.ktracks[2 * j + 1];
+		if (partition.count == 1) {
+			corrConRecis[2 * j] = bestContig(ktrack1, scratch.totals[2 * j], job().params.j_index);
+			corrConRecis[2 * j + 1] = bestContig(ktrack2, scratch.totals[2 * j + 1], job().params.j_index);
+			if (hits != NULL) {
+				(*hits)[j].add(ktrack1);
+				(*hits)[j].add(ktrack2);
 			}
+		} else {
+			decided = resolvePartitionHits(ktrack1, ktrack2,
+					scratch.totals[2 * j], scratch.totals[2 * j + 1],
+					saved[pairIndices[j]], partition,
+					corrConRecis[2 * j], corrConRecis[2 * j + 1]);
+		}
+	}
+	return decided;
+}
 
-			if (paired && validbarcode && !barcode1.empty() && !barcode2.empty() && (barcode1==barcode2)) {
-				const int indexMult = indexMultMap.at(barcode1);
-				bool goodmult = indexMult > params.min_mult || indexMult < params.max_mult;
-				if (goodmult && checkReadSequence(cread1) && checkReadSequence(cread2)) {
-					corrConReci1 = bestContig(kmap, cread1, params.k_value, params.k_shift, params.j_index, *procs[omp_get_thread_num()]);
-					corrConReci2 = bestContig(kmap, cread2, params.k_value, params.k_shift, params.j_index, *procs[omp_get_thread_num()]);
-				} else {
+/* Best corresponding contigs for a batch of read pairs, looking their k-mers up on the
+ * remote index shards (`--shards`). The k-mers of all the reads go out together, in one
+ * request per shard. Sets corrConRecis[2j] and [2j+1] for pair j of `pairIndices`.
+ */
+void shardedBestContigs(KmerShardClient &client, const ChromiumReadBatch &batch,
+		const std::vector<size_t> &pairIndices, ReadsProcessor &proc,
+		std::vector<int> &corrConRecis) {
+
+	size_t numReads = 2 * pairIndices.size();
+	std::vector<std::string> kmers;
+	// k-mer positions of each read, and the end of its k-mers in kmers
+	std::vector<int> totals(numReads);
+	std::vector<size_t> ends(numReads);
+	uint64_t positions = 0;
+	for (size_t r = 0; r < numReads; ++r) {
+		const ChromiumReadPair &pair = batch.pairs[pairIndices[r / 2]];
+		totals[r] = collectReadKmers(r % 2 == 0 ? pair.seq1 : pair.seq2,
+				job().params.k_value, job().params.k_shift, proc, kmers);
+		ends[r] = kmers.size();
+		positions += totals[r];
+	}
 #pragma omp atomic
-					skipped_invalidreadpair++;
+	job().s_totalnumckmers += kmers.size();
+#pragma omp atomic
+	job().s_numbadckmers += positions - kmers.size();
+
+	std::vector<int> conrecis;
+	client.lookup(kmers, conrecis);
+
+	corrConRecis.assign(numReads, 0);
+	unsigned found = 0, recorded = 0;
+	std::map<int, int> ktrack;
+	for (size_t r = 0, i = 0; r < numReads; ++r) {
+		ktrack.clear();
+		for (; i < ends[r]; ++i) {
+			int corrConReci = conrecis[i];
+			if (corrConReci == SHARD_KMER_ABSENT)
+				continue;
+			found++;
+			if (corrConReci != 0) {
+				ktrack[corrConReci]++;
+				recorded++;
+			}
+		}
+		corrConRecis[r] = bestContig(ktrack, totals[r], job().params.j_index);
+	}
+#pragma omp atomic
+	job().s_numckmersfound += found;
+#pragma omp atomic
+	job().s_numckmersrec += recorded;
+#pragma omp atomic
+	job().s_ckmersasdups += found - recorded;
+}
+
+/* Tallies of one linked-read library, for the per-library report */
+struct LibraryStats {
+	/* barcodes kept from the multiplicity file */
+	uint64_t barcodes;
+	uint64_t readPairs;
+	/* read pairs stored in the IndexMap */
+	uint64_t storedPairs;
+	/* read pairs with a barcode missing from the multiplicity file */
+	uint64_t invalidBarcodePairs;
+	/* barcodes in the IndexMap */
+	uint64_t indexMapBarcodes;
+
+	LibraryStats() : barcodes(0), readPairs(0), storedPairs(0),
+		invalidBarcodePairs(0), indexMapBarcodes(0) {}
+};
+
+/* Read through longranger basic chromium output fastq file, as parsed
+ * into `reads` by a ChromiumReader, adding its tallies to `stats'.
+ * Read pairs are numbered from pairBase on (to match up partial hits across
+ * index partitions); returns the number of read pairs in the file.
+ */
+size_t chromiumRead(ChromiumReadQueue &reads, const KmerIndex& index, ARCS::IndexMap& imap,
+			const std::unordered_map<std::string, int> &indexMultMap,
+			const std::vector<ARCS::CI> &contigRecord,
+			const ARCS::IndexPartition &partition, size_t pairBase,
+			LibraryStats &stats, IncrementalUpdate *incremental = NULL) {
+
+	uint64_t stored_readpairs = 0;
+	uint64_t skipped_unpaired = 0;
+	uint64_t skipped_invalidreadpair = 0;
+	uint64_t skipped_nogoodcontig = 0;
+	uint64_t invalidbarcode = 0;
+
+	uint64_t count = 0;
+
+	//each thread gets a proc;
+	vector<ReadsProcessor*> procs(job().params.threads);
+
+	for (unsigned i = 0; i < job().params.threads; ++i) {
+		procs[i] = new ReadsProcessor(job().params.k_value);
+	}
+
+	//each thread gets its own connections to the k-mer index shards
+	vector<KmerShardClient*> shardClients;
+	for (unsigned i = 0; !job().params.shards.empty() && i < job().params.threads; ++i) {
+		shardClients.push_back(new KmerShardClient(job().params.shards, job().params.k_value));
+	}
+
+	//each thread gets its own sort-merge buffers
+	const PrefixKmerIndex *mergeIndex = job().params.classify == "merge" && shardClients.empty()
+		? index.sorted() : NULL;
+	vector<MergeScratch> mergeScratch(mergeIndex != NULL ? job().params.threads : 0);
+
+	// we only store barcode info in index map if read pairs have same contig + orientation
+	// and if the corrContigId is not NULL (because it is above accuracy threshold)
+	auto storeReadPair = [&](const std::string &barcode, int corrConReci1, int corrConReci2) {
+		if (corrConReci1 != 0 && corrConReci1 == corrConReci2) {
+			const ARCS::CI corrContigId = contigRecord[corrConReci1];
+			{
+				std::lock_guard<std::mutex> lock(job().imapMutex);
+				imap[barcode][corrContigId]++;
+			}
+
+#pragma omp atomic
+			stored_readpairs++;
+
+		} else {
+#pragma omp atomic
+			skipped_nogoodcontig++;
+		}
+	};
+
+	TeamFailure failure;
+#pragma omp parallel copyin(s_job)
+	for (ChromiumReadBatchPtr batch; !failure.failed() && reads.pop(batch);) {
+		failure.run([&]() {
+#pragma omp atomic
+			count += batch->pairs.size();
+
+			// read pairs left for classification of the whole batch, by sort-merge or on the shards
+			std::vector<size_t> deferred;
+			// classifications of the batch and the contig ends they hit, for --incremental
+			std::vector<uint32_t> outcomes(incremental != NULL ? batch->pairs.size() : 0,
+				INCREMENTAL_UNCLASSIFIED);
+			std::vector<IncrementalHits> pairHits(outcomes.size());
+			// hits of the batch saved over the index partitions
+			PartialHitFile::Batch saved;
+			if (partition.count > 1)
+				partition.partialHits->take(pairBase + batch->first, batch->pairs.size(), saved);
+
+			for (size_t pairIndex = 0; pairIndex < batch->pairs.size(); ++pairIndex) {
+				ChromiumReadPair &pair = batch->pairs[pairIndex];
+				std::string &read1_name = pair.name1;
+				std::string &read2_name = pair.name2;
+				const std::string &barcode1 = pair.barcode1;
+				const std::string &barcode2 = pair.barcode2;
+				const std::string &cread1 = pair.seq1;
+				const std::string &cread2 = pair.seq2;
+				bool paired = false;
+				int corrConReci1 = 0;
+				int corrConReci2 = 0;
+				size_t readPairId = pairBase + batch->first + pairIndex;
+
+				stripReadNum(read1_name);
+				stripReadNum(read2_name);
+				if (read1_name == read2_name) {
+					paired = true;
+				} else if (partition.last()) {
+					logger().log(LOG_WARNING, "unpaired reads",
+						"File contains unpaired reads: " + read1_name + " " + read2_name);
+#pragma omp atomic
+					skipped_unpaired++;
 				}
-				// we only store barcode info in index map if read pairs have same contig + orientation
-				// and if the corrContigId is not NULL (because it is above accuracy threshold)
-				if (corrConReci1 != 0 && corrConReci1 == corrConReci2) {
-					const ARCS::CI corrContigId = contigRecord[corrConReci1];
-#pragma omp critical(imap)
-					{
-						imap[barcode1][corrContigId]++;
-					}
 
+				bool validbarcode = indexMultMap.find(barcode1) != indexMultMap.end();
+
+				if (!validbarcode && partition.last()) {
 #pragma omp atomic
-					stored_readpairs++;
+					invalidbarcode++;
+				}
 
-				} else {
+				if (paired && validbarcode && !barcode1.empty() && !barcode2.empty() && (barcode1==barcode2)) {
+					const int indexMult = indexMultMap.at(barcode1);
+					bool goodmult = indexMult > job().params.min_mult || indexMult < job().params.max_mult;
+					if (goodmult && checkReadSequence(cread1) && checkReadSequence(cread2)) {
+						ReadsProcessor &proc = *procs[omp_get_thread_num()];
+						IncrementalHits *hits = incremental != NULL ? &pairHits[pairIndex] : NULL;
+						if (incremental != NULL && incremental->reuse(readPairId,
+								cread1, cread2, proc, corrConReci1, corrConReci2, *hits)) {
+							// the saved classification holds
+						} else if (index.fm() != NULL) {
+							smemBestContigs(*index.fm(), cread1, cread2,
+									corrConReci1, corrConReci2);
+						} else if (mergeIndex != NULL || !shardClients.empty()) {
+							deferred.push_back(pairIndex);
+							continue;
+						} else if (partition.count == 1 && job().params.classify == "sampled") {
+							corrConReci1 = sampledBestContig(index, cread1, job().params.k_value, job().params.k_shift, job().params.j_index, proc, hits);
+							corrConReci2 = sampledBestContig(index, cread2, job().params.k_value, job().params.k_shift, job().params.j_index, proc, hits);
+						} else if (partition.count == 1) {
+							corrConReci1 = bestContig(index, cread1, job().params.k_value, job().params.k_shift, job().params.j_index, proc, hits);
+							corrConReci2 = bestContig(index, cread2, job().params.k_value, job().params.k_shift, job().params.j_index, proc, hits);
+						} else if (!partitionedBestContigs(index, cread1, cread2, saved[pairIndex],
+								partition, proc, corrConReci1, corrConReci2)) {
+							// hits saved for a later index partition
+							continue;
+						}
+						if (incremental != NULL)
+							outcomes[pairIndex] = corrConReci1 == corrConReci2 ? corrConReci1 : 0;
+					} else {
+						if (!partition.last())
+							continue;
 #pragma omp atomic
-					skipped_nogoodcontig++;
+						skipped_invalidreadpair++;
+					}
+					storeReadPair(barcode1, corrConReci1, corrConReci2);
 				}
 			}
-		}
+
+			if (!deferred.empty()) {
+				int thread = omp_get_thread_num();
+				std::vector<int> corrConRecis;
+				std::vector<IncrementalHits> mergeHits;
+				bool decided = true;
+				if (mergeIndex != NULL)
+					decided = mergeBestContigs(*mergeIndex, *batch, deferred, saved,
+						partition, *procs[thread], mergeScratch[thread], corrConRecis,
+						incremental != NULL ? &mergeHits : NULL);
+				else
+					shardedBestContigs(*shardClients[thread], *batch, deferred,
+						*procs[thread], corrConRecis);
+				if (decided) {
+					for (size_t j = 0; j < deferred.size(); ++j) {
+						storeReadPair(batch->pairs[deferred[j]].barcode1,
+								corrConRecis[2 * j], corrConRecis[2 * j + 1]);
+						if (incremental != NULL) {
+							outcomes[deferred[j]] = corrConRecis[2 * j] == corrConRecis[2 * j + 1]
+								? corrConRecis[2 * j] : 0;
+							std::swap(pairHits[deferred[j]], mergeHits[j]);
+						}
+					}
+				}
+			}
+
+			if (incremental != NULL)
+				incremental->record(pairBase + batch->first, outcomes, pairHits);
+			if (partition.count > 1)
+				partition.partialHits->put(pairBase + batch->first, saved);
+		});
+		/* threads saving their hits may be waiting on the batch that failed */
+		if (failure.failed() && partition.count > 1)
+			partition.partialHits->abandon();
 	}
-	kseq_destroy(seq2);
-	gzclose(fp2);
 
 	// clean up
-	for (unsigned i = 0; i < params.threads; ++i) {
+	for (unsigned i = 0; i < job().params.threads; ++i) {
 		delete procs[i];
 	}
+	for (unsigned i = 0; i < shardClients.size(); ++i) {
+		delete shardClients[i];
+	}
+	failure.rethrow();
 
-	if (params.verbose) {
-		printf(
-				"Stored read pairs: %u\nSkipped invalid read pairs: %u\nSkipped unpaired reads: %u\nSkipped reads pairs without a good contig: %u\n",
+	logger().flush();
+	if (job().params.verbose && partition.last()) {
+		coutPrintf(
+				"Stored read pairs: %" PRIu64 "\nSkipped invalid read pairs: %" PRIu64
+				"\nSkipped unpaired reads: %" PRIu64 "\nSkipped reads pairs without a good contig: %" PRIu64 "\n",
 				stored_readpairs, skipped_invalidreadpair, skipped_unpaired,
 				skipped_nogoodcontig);
-		printf(
-				"Total valid kmers: %u\nNumber invalid kmers: %u\nNumber of kmers found in ContigKmap: %u\nNumber of kmers recorded in Ktrack: %u\nNumber of kmers found in ContigKmap but duplicate: %u\nNumber of reads passing jaccard threshold: %u\nNumber of reads failing jaccard threshold: %u\n",
-				s_totalnumckmers, s_numbadckmers, s_numckmersfound, s_numckmersrec,
-				s_ckmersasdups, s_numreadspassingjaccard, s_numreadsfailjaccard);
+		coutPrintf(
+				"Total valid kmers: %" PRIu64 "\nNumber invalid kmers: %" PRIu64
+				"\nNumber of kmers found in ContigKmap: %" PRIu64 "\nNumber of kmers recorded in Ktrack: %" PRIu64
+				"\nNumber of kmers found in ContigKmap but duplicate: %" PRIu64
+				"\nNumber of reads passing jaccard threshold: %" PRIu64
+				"\nNumber of reads failing jaccard threshold: %" PRIu64 "\n",
+				job().s_totalnumckmers, job().s_numbadckmers, job().s_numckmersfound, job().s_numckmersrec,
+				job().s_ckmersasdups, job().s_numreadspassingjaccard, job().s_numreadsfailjaccard);
+		if (incremental != NULL)
+			coutPrintf("Read pairs with a reused classification (not in the k-mer and jaccard counts): %" PRIu64 "\n",
+					incremental->reusedPairs());
 		if (invalidbarcode > 0)
-			printf("WARNING:: Your chromium read file has %d read pairs that have barcodes not in the barcode multiplicity file.", invalidbarcode);
+			coutPrintf("WARNING:: Your chromium read file has %" PRIu64 " read pairs that have barcodes not in the barcode multiplicity file.", invalidbarcode);
+
+	}
 
+	if (partition.last()) {
+		stats.readPairs += count;
+		stats.storedPairs += stored_readpairs;
+		stats.invalidBarcodePairs += invalidbarcode;
 	}
+
+	return count;
 }
 
 
-void readChroms(vector<string> inputFiles, ARCS::ContigKMap &kmap,
+void readChroms(ChromiumReader &reader, const KmerIndex &index,
 		ARCS::IndexMap &imap,
 		const std::unordered_map<std::string, int> &indexMultMap,
-		const std::vector<ARCS::CI> &contigRecord) {
+		const std::vector<ARCS::CI> &contigRecord,
+		const ARCS::IndexPartition &partition,
+		std::vector<LibraryStats> &libraryStats,
+		IncrementalUpdate *incremental = NULL) {
+
+	size_t pairBase = 0;
+
+	for (size_t i = 0; i < reader.size(); ++i) {
+		if (job().params.verbose)
+			std::cout << "Reading chrom " << reader.file(i) << std::endl;
+		pairBase += chromiumRead(reader.queue(i), index, imap, indexMultMap, contigRecord,
+				partition, pairBase, libraryStats[reader.library(i)], incremental);
+		reader.rethrow();
+	}
+
+	if (job().params.classify == "sampled" && job().s_sampledreads > 0) {
+		coutPrintf("Sampled classification: %" PRIu64 " reads, %" PRIu64 " (%.1f%%) decided by %u sampled k-mers;\n"
+				"  %.1f k-mer lookups per read (exhaustive: %.1f);\n"
+				"  %" PRIu64 " stage-one decisions checked against the exhaustive classifier, %" PRIu64 " (%.2f%%) agree\n",
+				job().s_sampledreads, job().s_sampledstageone,
+				100.0 * job().s_sampledstageone / job().s_sampledreads, job().params.sample_kmers,
+				(double)job().s_sampledlookups / job().s_sampledreads,
+				(double)job().s_sampledpositions / job().s_sampledreads,
+				job().s_sampledchecked, job().s_sampledagreed,
+				job().s_sampledchecked > 0 ? 100.0 * job().s_sampledagreed / job().s_sampledchecked : 100.0);
+		std::cout.flush();
+	}
+}
+
+/* --autotune: read pairs of the first read file to calibrate on */
+static const size_t AUTOTUNE_READ_PAIRS = 20000;
+/* --autotune: contig-end k-mers of the draft (at most) to calibrate on */
+static const size_t AUTOTUNE_KMERS = 4 << 20;
+/* --autotune: bytes of the first read file read per --io_block candidate */
+static const uint64_t AUTOTUNE_IO_BYTES = 64 << 20;
+/* --autotune: the --read_batch and --io_block given are kept unless another is this much faster */
+static const double AUTOTUNE_MARGIN = 0.05;
+/* --autotune: --read_batch and --io_block candidates */
+static const size_t AUTOTUNE_BATCHES[] = { 256, 1024, 4096 };
+static const size_t AUTOTUNE_BLOCKS[] = { 1 << 20, 4 << 20, 16 << 20 };
+
+/* The index of the first contigs of the draft, for --autotune */
+struct SampleIndex {
+	ARCS::ContigKMap kmap;
+	std::unique_ptr<PrefixKmerIndex> sorted;
+	std::unique_ptr<ContigEndFMIndex> fm;
+	std::vector<ARCS::CI> contigRecord;
+	/* the time taken to build it */
+	double seconds;
+
+	/* `engine' is hash, bucket or fm */
+	SampleIndex(const std::string &engine, size_t numContigs) :
+			contigRecord(2 * numContigs + 1), seconds(0) {
+		kmap.set_deleted_key("");
+		if (engine == "bucket")
+			sorted.reset(new PrefixKmerIndex(job().params.k_value));
+		else if (engine == "fm")
+			fm.reset(new ContigEndFMIndex);
+		ARCS::ContigToLength contigToLength;
+		double start = omp_get_wtime();
+		getContigKmers(job().params.file, kmap, contigRecord, contigToLength,
+			ARCS::IndexPartition(0, 1, NULL), sorted.get(), fm.get(), numContigs);
+		seconds = omp_get_wtime() - start;
+	}
 
-	std::string chromFile;
+	KmerIndex index() const {
+		return fm ? KmerIndex(*fm) : sorted ? KmerIndex(*sorted)
+			: KmerIndex(kmap, job().params.k_value);
+	}
+};
 
-	for (auto p = inputFiles.begin(); p != inputFiles.end(); ++p) {
-		chromFile = *p;
-		if (params.verbose)
-			std::cout << "Reading chrom " << chromFile << std::endl;
-		chromiumRead(chromFile, kmap, imap, indexMultMap, contigRecord);
+/* Classify `pairs` as chromiumRead does, in batches of `batchSize`; returns the seconds taken */
+static double timeClassify(const std::vector<ChromiumReadPair> &pairs, size_t batchSize,
+		const SampleIndex &sample,
+		const std::unordered_map<std::string, int> &indexMultMap) {
+	ChromiumReadQueue queue((pairs.size() + batchSize - 1) / batchSize + 1);
+	for (size_t i = 0; i < pairs.size(); i += batchSize) {
+		ChromiumReadBatchPtr batch(new ChromiumReadBatch);
+		batch->first = i;
+		batch->pairs.assign(pairs.begin() + i,
+			pairs.begin() + std::min(i + batchSize, pairs.size()));
+		queue.push(batch);
 	}
+	queue.close();
+
+	ARCS::IndexMap imap;
+	LibraryStats stats;
+	double start = omp_get_wtime();
+	chromiumRead(queue, sample.index(), imap, indexMultMap, sample.contigRecord,
+		ARCS::IndexPartition(0, 1, NULL), 0, stats);
+	return omp_get_wtime() - start;
 }
 
+/* Read up to AUTOTUNE_IO_BYTES of `path` in blocks of `blockSize`, from
+ * storage rather than the page cache if the kernel lets us; returns bytes
+ * per second. Only the sampled prefix is dropped from the cache, so the
+ * rest of the input stays cached for the run. */
+static double timeReadAhead(const std::string &path, size_t blockSize) {
+#if HAVE_POSIX_FADVISE
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd != -1) {
+		posix_fadvise(fd, 0, AUTOTUNE_IO_BYTES, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+#endif
+	uint64_t bytes = 0;
+	double start = omp_get_wtime();
+	{
+		ReadAheadFile in(path, blockSize);
+		const char* data;
+		size_t size;
+		while (bytes < AUTOTUNE_IO_BYTES && in.next(data, size))
+			bytes += size;
+	}
+	double seconds = omp_get_wtime() - start;
+	return bytes / std::max(seconds, 1e-6);
+}
+
+/*
+ * --autotune: benchmark the index engines and classifiers, --read_batch,
+ * the thread split and --io_block on the first contigs of the draft (up
+ * to AUTOTUNE_KMERS end k-mers) and the first read pairs of the first
+ * FASTQ file, and set the fastest in `params`. Index build and
+ * classification times are projected to the whole draft and all of the
+ * reads (from the file sizes). `numContigs` and `numEndKmers` are those
+ * of initContigArray.
+ */
+static void autotune(size_t numContigs, size_t numEndKmers,
+		const std::unordered_map<std::string, int> &indexMultMap,
+		const MemoryBudget &budget) {
+	std::string readFile, prefix;
+	uint64_t readBytes = 0;
+	for (size_t i = 0; i < job().params.libraries.size(); ++i) {
+		const ARCS::ReadLibrary &lib = job().params.libraries[i];
+		for (size_t j = 0; j < lib.files.size(); ++j) {
+			struct stat st;
+			if (isReadStore(lib.files[j]))
+				continue;
+			if (readFile.empty()) {
+				readFile = lib.files[j];
+				prefix = lib.barcodePrefix();
+			}
+			if (stat(lib.files[j].c_str(), &st) == 0)
+				readBytes += st.st_size;
+		}
+	}
+	if (readFile.empty() || numContigs == 0) {
+		std::cout << "Autotune: no draft contigs or FASTQ read file to sample; keeping the options given" << std::endl;
+		return;
+	}
+
+	/* a stream of its own for the number format, which concurrent batch
+	 * jobs would otherwise change under each other */
+	std::ostream out(std::cout.rdbuf());
+	const int verbose = job().params.verbose;
+	job().params.verbose = 0;
+
+	std::vector<ChromiumReadPair> pairs;
+	double start = omp_get_wtime();
+	uint64_t sampleBytes = ChromiumReader::sample(readFile, prefix, AUTOTUNE_READ_PAIRS, pairs);
+	double parseSeconds = omp_get_wtime() - start;
+	double readScale = sampleBytes > 0 ? std::max(1.0, (double)readBytes / sampleBytes) : 1.0;
+	size_t sampleContigs = numEndKmers <= AUTOTUNE_KMERS ? numContigs
+		: std::max<size_t>(1, (uint64_t)numContigs * AUTOTUNE_KMERS / numEndKmers);
+	double draftScale = (double)numContigs / sampleContigs;
+	out << std::fixed << std::setprecision(3)
+		<< "Autotune: sample of " << pairs.size() << " read pairs of " << readFile
+		<< " (1/" << std::setprecision(1) << readScale << " of the reads) and "
+		<< sampleContigs << " of " << numContigs << " contigs" << std::endl;
+
+	/* the passes over the reads each engine's index needs in --max_memory,
+	 * as planKmerMap will choose them */
+	size_t resident = residentBytes();
+	auto indexPasses = [&](const std::string &engine) -> unsigned {
+		if (engine == "fm")
+			return 1u;
+		if (job().params.index_partitions > 1)
+			return job().params.index_partitions;
+		size_t bytesPerKmer = engine == "bucket" ? SORTED_KMAP_BYTES_PER_KMER
+			: KMAP_BYTES_PER_KMER;
+		return fitIndexPartitions(budget, resident, numEndKmers, bytesPerKmer,
+			alignmentBuffers());
+	};
+
+	/* engines and the classifiers each can run; smem and sampled are kept,
+	 * but sampled needs the index in one pass and falls back to probe */
+	std::vector<std::pair<std::string, std::vector<std::string> > > engines;
+	if (job().params.classify == "smem") {
+		engines.push_back(std::make_pair("fm", std::vector<std::string>(1, "smem")));
+	} else {
+		bool sortedOk = PrefixKmerIndex::supports(job().params.k_value);
+		bool sampled = job().params.classify == "sampled";
+		/* the hash table, unless it needs more passes than the smaller sorted index */
+		if (!sortedOk || indexPasses("hash") <= indexPasses("bucket")) {
+			bool hashSampled = sampled && indexPasses("hash") == 1;
+			engines.push_back(std::make_pair("hash",
+				std::vector<std::string>(1, hashSampled ? "sampled" : "probe")));
+		}
+		if (sortedOk) {
+			bool bucketSampled = sampled && indexPasses("bucket") == 1;
+			std::vector<std::string> classifiers(1, bucketSampled ? "sampled" : "probe");
+			if (!bucketSampled)
+				classifiers.push_back("merge");
+			engines.push_back(std::make_pair("bucket", classifiers));
+		}
+	}
+
+	std::string bestEngine, bestClassify;
+	double bestProjected = 0, bestClassifySeconds = 0;
+	for (size_t e = 0; e < engines.size(); ++e) {
+		const std::string &engine = engines[e].first;
+		unsigned passes = indexPasses(engine);
+		SampleIndex sample(engine, sampleContigs);
+		for (size_t c = 0; c < engines[e].second.size(); ++c) {
+			job().params.classify = engines[e].second[c];
+			double seconds = timeClassify(pairs, job().params.read_batch, sample, indexMultMap);
+			double projected = sample.seconds * draftScale
+				+ seconds * readScale * passes;
+			out << std::setprecision(3) << "Autotune: --kmer_index=" << engine
+				<< " --classify=" << job().params.classify << ": index " << sample.seconds
+				<< " s, classify " << seconds << " s";
+			if (passes > 1)
+				out << " x " << passes << " passes";
+			out << " => projected " << std::setprecision(1) << projected
+				<< " s" << std::endl;
+			if (bestEngine.empty() || projected < bestProjected) {
+				bestEngine = engine;
+				bestClassify = job().params.classify;
+				bestProjected = projected;
+				bestClassifySeconds = seconds;
+			}
+		}
+	}
+	if (bestEngine != "fm")
+		job().params.kmer_index = bestEngine;
+	job().params.classify = bestClassify;
+
+	{
+		SampleIndex sample(bestEngine, sampleContigs);
+		const size_t batchGiven = job().params.read_batch;
+		double givenSeconds = bestClassifySeconds;
+		for (size_t i = 0; i < sizeof AUTOTUNE_BATCHES / sizeof *AUTOTUNE_BATCHES; ++i) {
+			size_t batchSize = AUTOTUNE_BATCHES[i];
+			if (batchSize == batchGiven)
+				continue;
+			double seconds = timeClassify(pairs, batchSize, sample, indexMultMap);
+			out << std::setprecision(3) << "Autotune: --read_batch=" << batchSize
+				<< ": classify " << seconds << " s" << std::endl;
+			if (seconds < bestClassifySeconds
+					&& seconds < givenSeconds * (1 - AUTOTUNE_MARGIN)) {
+				job().params.read_batch = batchSize;
+				bestClassifySeconds = seconds;
+			}
+		}
+	}
+
+	/* the reader thread parses for all of the classifying threads: where
+	 * it is the slower and -t uses every core, it is better off with one */
+	double readerRate = pairs.size() / std::max(parseSeconds, 1e-6);
+	double classifyRate = pairs.size() / std::max(bestClassifySeconds, 1e-6);
+	out << std::setprecision(0) << "Autotune: reader " << readerRate
+		<< " read pairs/s, classifiers (-t " << job().params.threads << ") " << classifyRate
+		<< " read pairs/s" << std::endl;
+	if (job().params.threads > 1 && job().params.threads >= (unsigned)omp_get_num_procs()
+			&& readerRate < classifyRate * (job().params.threads - 1) / job().params.threads) {
+		job().params.threads--;
+		omp_set_num_threads(job().params.threads);
+	}
+
+	const size_t blockGiven = job().ioBlock;
+	size_t bestBlock = blockGiven;
+	if (readFile != "-") {
+		double bestRate = 0, givenRate = 0;
+		for (size_t i = 0; i < sizeof AUTOTUNE_BLOCKS / sizeof *AUTOTUNE_BLOCKS; ++i) {
+			double rate = timeReadAhead(readFile, AUTOTUNE_BLOCKS[i]);
+			out << "Autotune: --io_block=" << (AUTOTUNE_BLOCKS[i] >> 20) << "M: "
+				<< toSI(rate) << "B/s" << std::endl;
+			if (AUTOTUNE_BLOCKS[i] == blockGiven)
+				givenRate = rate;
+			if (rate > bestRate) {
+				bestBlock = AUTOTUNE_BLOCKS[i];
+				bestRate = rate;
+			}
+		}
+		if (bestRate < givenRate * (1 + AUTOTUNE_MARGIN))
+			bestBlock = blockGiven;
+		job().ioBlock = bestBlock;
+	}
+
+	out << "Autotune: chose --kmer_index=" << job().params.kmer_index
+		<< " --classify=" << job().params.classify << " --read_batch=" << job().params.read_batch
+		<< " -t " << job().params.threads << " --io_block=" << bestBlock << std::endl;
+
+	job().params.verbose = verbose;
+	job().resetCounters();
+}
+
+/* The library of a (namespaced) IndexMap barcode */
+static inline size_t barcodeLibrary(const std::string &barcode,
+		const std::vector<ARCS::ReadLibrary> &libraries) {
+	size_t end = barcode.find('_');
+	if (end != std::string::npos) {
+		for (size_t i = 0; i < libraries.size(); ++i)
+			if (libraries[i].name.compare(0, std::string::npos, barcode, 0, end) == 0)
+				return i;
+	}
+	return 0;
+}
+
+/* Print the tallies of each linked-read library */
+void reportLibraries(const std::vector<ARCS::ReadLibrary> &libraries,
+		std::vector<LibraryStats> &stats, const ARCS::IndexMap &imap) {
+	for (ARCS::IndexMap::const_iterator it = imap.begin(); it != imap.end(); ++it)
+		stats[barcodeLibrary(it->first, libraries)].indexMapBarcodes++;
+
+	std::cout << "Library\tMultiplicity file\tRead files\tBarcodes\tRead pairs"
+		"\tStored read pairs\tRead pairs with unknown barcodes\tIndexMap barcodes\n";
+	for (size_t i = 0; i < libraries.size(); ++i) {
+		const ARCS::ReadLibrary &lib = libraries[i];
+		std::cout << (lib.name.empty() ? "-" : lib.name)
+			<< '\t' << lib.multfile
+			<< '\t' << lib.files.size()
+			<< '\t' << stats[i].barcodes
+			<< '\t' << stats[i].readPairs
+			<< '\t' << stats[i].storedPairs
+			<< '\t' << stats[i].invalidBarcodePairs
+			<< '\t' << stats[i].indexMapBarcodes << '\n';
+	}
+	std::cout.flush();
+}
+
+
+/* Convert the chromium files into a binary read store (-p store).
+ * Only read pairs that alignment can use are kept: matching read names,
+ * matching non-empty barcodes and sequences passing checkReadSequence.
+ */
+void writeReadStore(const vector<string> &inputFiles, const std::string &storefile) {
+	ReadStoreWriter writer(storefile);
+	ChromiumReader reader(inputFiles);
+	reader.start();
+
+	size_t skipped = 0;
+	for (size_t i = 0; i < reader.size(); ++i) {
+		for (ChromiumReadBatchPtr batch; reader.queue(i).pop(batch);) {
+			for (size_t j = 0; j < batch->pairs.size(); ++j) {
+				ChromiumReadPair &pair = batch->pairs[j];
+				stripReadNum(pair.name1);
+				stripReadNum(pair.name2);
+				if (pair.name1 != pair.name2 || pair.barcode1.empty()
+						|| pair.barcode1 != pair.barcode2
+						|| !checkReadSequence(pair.seq1)
+						|| !checkReadSequence(pair.seq2)) {
+					skipped++;
+					continue;
+				}
+				writer.add(pair.barcode1, pair.seq1, pair.seq2);
+			}
+		}
+	}
+	reader.rethrow();
+
+	uint64_t stored = writer.finish();
+	std::cout << "Stored " << stored << " read pairs with " << writer.numBarcodes()
+		<< " barcodes in " << storefile << "; skipped " << skipped
+		<< " unusable read pairs." << std::endl;
+}
 
 /*
  * Check if SAM flag is one of the accepted ones.
@@ -974,40 +2613,115 @@ static inline bool checkChar(char c) {
 	return (c == 'M' || c == '=' || c == 'X' || c == 'I');
 }
 
-/* Normal approximation to the binomial distribution */
-static inline float normalEstimation(int x, float p, int n) {
-	float mean = n * p;
-	float sd = std::sqrt(n * p * (1 - p));
-	return 0.5 * (1 + std::erf((x - mean) / (sd * std::sqrt(2))));
+/*
+ * Return the number of read pairs in `smap` mapping to the
+ * given contig end, without inserting missing entries.
+ */
+static inline uint64_t readPairCount(const ARCS::ScafMap& smap,
+		const std::string& contig, bool head) {
+	ARCS::ScafMapConstIt it = smap.find(ARCS::CI(contig, head));
+	return it == smap.end() ? 0 : it->second;
 }
 
+/* (barcode, contig) entries of an IndexMap that can be dropped */
+typedef std::vector<std::pair<ARCS::IndexMap::iterator,
+	std::vector<std::string> > > IndexMapPruneList;
+
 /*
- * Based on number of read pairs that align to the
- * head or tail of scaffold, determine if is significantly
- * different from a uniform distribution (p=0.5)
+ * Find IndexMap entries that can not contribute to pairing or
+ * distance estimation under the current `-c`, `-m` and `-r` options:
+ *
+ * - barcodes outside of the multiplicity range
+ * - contigs whose head/tail read pair counts fail `headOrTail`
+ *   (unless distance estimation may still use one of their ends)
+ * - barcodes left with no contigs, or with a single contig
+ *   when distance estimation is off
+ *
+ * Only reads `imap`, so it may run while a checkpoint is being written.
+ * An empty contig list means the whole barcode is dropped.
  */
-static inline std::pair<bool, bool> headOrTail(int head, int tail) {
-	int max = std::max(head, tail);
-	int sum = head + tail;
-	if (sum < params.min_reads) {
-		return std::pair<bool, bool>(false, false);
-	}
-	float normalCdf = normalEstimation(max, 0.5, sum);
-	if (1 - normalCdf < params.error_percent) {
-		bool isHead = (max == head);
-		return std::pair<bool, bool>(true, isHead);
-	} else {
-		return std::pair<bool, bool>(false, false);
+void findPrunableEntries(ARCS::IndexMap& imap,
+		const std::unordered_map<std::string, int>& indexMultMap,
+		IndexMapPruneList& pruneList) {
+
+	for (auto it = imap.begin(); it != imap.end(); ++it) {
+
+		auto multIt = indexMultMap.find(it->first);
+		int indexMult = multIt == indexMultMap.end() ? 0 : multIt->second;
+		if (indexMult < job().params.min_mult || indexMult > job().params.max_mult) {
+			pruneList.push_back(std::make_pair(it, std::vector<std::string>()));
+			continue;
+		}
+
+		const ARCS::ScafMap& smap = it->second;
+		std::vector<std::string> dropped;
+		size_t keptContigs = 0;
+
+		/* head and tail of a contig are adjacent in the ScafMap */
+		for (auto o = smap.begin(); o != smap.end(); ) {
+			const std::string& contig = o->first.first;
+			uint64_t head = readPairCount(smap, contig, true);
+			uint64_t tail = readPairCount(smap, contig, false);
+			while (o != smap.end() && o->first.first == contig)
+				++o;
+
+			bool keep = headOrTail(head, tail, job().params).first;
+			if (!keep && job().params.distance_est)
+				keep = head >= job().params.min_reads || tail >= job().params.min_reads;
+
+			if (keep)
+				keptContigs++;
+			else
+				dropped.push_back(contig);
+		}
+
+		if (keptContigs == 0 || (keptContigs == 1 && !job().params.distance_est))
+			pruneList.push_back(std::make_pair(it, std::vector<std::string>()));
+		else if (!dropped.empty())
+			pruneList.push_back(std::make_pair(it, dropped));
 	}
 }
 
+/*
+ * Remove the entries found by `findPrunableEntries` from `imap`
+ * and shrink it to fit.
+ */
+void pruneIndexMap(ARCS::IndexMap& imap, IndexMapPruneList& pruneList) {
+
+	size_t barcodesBefore = imap.size();
+	size_t entriesBefore = 0, entriesAfter = 0;
+	for (auto it = imap.begin(); it != imap.end(); ++it)
+		entriesBefore += it->second.size();
+
+	for (auto p = pruneList.begin(); p != pruneList.end(); ++p) {
+		if (p->second.empty()) {
+			imap.erase(p->first);
+			continue;
+		}
+		ARCS::ScafMap& smap = p->first->second;
+		for (auto c = p->second.begin(); c != p->second.end(); ++c) {
+			smap.erase(ARCS::CI(*c, true));
+			smap.erase(ARCS::CI(*c, false));
+		}
+	}
+	IndexMapPruneList().swap(pruneList);
+	imap.rehash(0);
+
+	for (auto it = imap.begin(); it != imap.end(); ++it)
+		entriesAfter += it->second.size();
+
+	std::cout << "Compacted IndexMap: kept " << imap.size() << " of "
+		<< barcodesBefore << " barcodes and " << entriesAfter << " of "
+		<< entriesBefore << " barcode/contig end entries" << std::endl;
+}
+
 /*
  * Iterate through IndexMap and for every pair of scaffolds
  * that align to the same index, store in PairMap. PairMap
  * is a map with a key of pairs of saffold names, and value
  * of number of links between the pair. (Each link is one index).
  */
-void pairContigs(ARCS::IndexMap& imap, ARCS::PairMap& pmap,
+void pairContigs(const ARCS::IndexMap& imap, ARCS::PairMap& pmap,
 		std::unordered_map<std::string, int>& indexMultMap) {
 
 	/* for each Chromium barcode */
@@ -1016,7 +2730,7 @@ void pairContigs(ARCS::IndexMap& imap, ARCS::PairMap& pmap,
 		/* skip barcodes outside of min/max multiplicity range (`-m` opt) */
 		std::string index = it->first;
 		int indexMult = indexMultMap[index];
-		if (indexMult < params.min_mult || indexMult > params.max_mult)
+		if (indexMult < job().params.min_mult || indexMult > job().params.max_mult)
 			continue;
 
 		/*
@@ -1062,11 +2776,11 @@ void pairContigs(ARCS::IndexMap& imap, ARCS::PairMap& pmap,
 				bool validA, validB, scafAhead, scafBhead;
 
 				std::tie(validA, scafAhead) = headOrTail(
-					it->second[std::pair<std::string, bool>(scafA, true)],
-					it->second[std::pair<std::string, bool>(scafA, false)]);
+					readPairCount(it->second, scafA, true),
+					readPairCount(it->second, scafA, false), job().params);
 				std::tie(validB, scafBhead) = headOrTail(
-					it->second[std::pair<std::string, bool>(scafB, true)],
-					it->second[std::pair<std::string, bool>(scafB, false)]);
+					readPairCount(it->second, scafB, true),
+					readPairCount(it->second, scafB, false), job().params);
 
 				/*
 				 * if orientation of one/both contigs can not be
@@ -1076,7 +2790,7 @@ void pairContigs(ARCS::IndexMap& imap, ARCS::PairMap& pmap,
 					continue;
 
 				if (pmap.count(pair) == 0) {
-					std::vector<int> init(4, 0);
+					std::vector<uint64_t> init(4, 0);
 					pmap[pair] = init;
 				}
 
@@ -1102,8 +2816,8 @@ void pairContigs(ARCS::IndexMap& imap, ARCS::PairMap& pmap,
  * Return the max value and its index position
  * in the vector
  */
-std::pair<int, int> getMaxValueAndIndex(const std::vector<int> array) {
-	int max = 0;
+std::pair<uint64_t, int> getMaxValueAndIndex(const std::vector<uint64_t>& array) {
+	uint64_t max = 0;
 	int index = 0;
 	for (int i = 0; i < int(array.size()); i++) {
 		if (array[i] > max) {
@@ -1112,22 +2826,10 @@ std::pair<int, int> getMaxValueAndIndex(const std::vector<int> array) {
 		}
 	}
 
-	std::pair<int, int> result(max, index);
+	std::pair<uint64_t, int> result(max, index);
 	return result;
 }
 
-/*
- * Return true if the link orientation with the max support
- * is dominant
- */
-static inline bool checkSignificance(int max, int second) {
-	if (max < params.min_links) {
-		return false;
-	}
-	float normalCdf = normalEstimation(max, 0.5, second);
-	return (1 - normalCdf < params.error_percent);
-}
-
 /*
  * Construct a boost graph from PairMap. Each pair represents an
  * edge in the graph. The weight of each edge is the number of links
@@ -1143,18 +2845,19 @@ void createGraph(const ARCS::PairMap& pmap, ARCS::Graph& g)
 		std::string scaf1, scaf2;
 		std::tie(scaf1, scaf2) = it->first;
 
-		int max, index;
-		std::vector<int> count = it->second;
+		uint64_t max;
+		int index;
+		const std::vector<uint64_t>& count = it->second;
 		std::tie(max, index) = getMaxValueAndIndex(count);
 
-		int second = 0;
+		uint64_t second = 0;
 		for (int i = 0; i < int(count.size()); i++) {
 			if (count[i] != max && count[i] > second)
 				second = count[i];
 		}
 
 		/* Only insert edge if orientation with max links is dominant */
-		if (checkSignificance(max, second)) {
+		if (checkSignificance(max, second, job().params)) {
 
 			/* If scaf1 is not a node in the graph, add it */
 			if (vmap.count(scaf1) == 0) {
@@ -1182,105 +2885,570 @@ void createGraph(const ARCS::PairMap& pmap, ARCS::Graph& g)
 			}
 		}
 	}
-}
-
-/*
- * Write out the boost graph in a .dot file.
- */
-void writeGraph(const std::string& graphFile_dot, ARCS::Graph& g)
-{
-	std::ofstream out(graphFile_dot.c_str());
-	assert(out);
+}
+
+/*
+ * Write out the boost graph in a .dot file.
+ */
+void writeGraph(const std::string& graphFile_dot, ARCS::Graph& g)
+{
+	std::ofstream out(graphFile_dot.c_str());
+	assert(out);
+
+	ARCS::VertexPropertyWriter<ARCS::Graph> vpWriter(g);
+	ARCS::EdgePropertyWriter<ARCS::Graph> epWriter(g);
+
+	boost::write_graphviz(out, g, vpWriter, epWriter);
+	assert(out);
+	out.close();
+}
+
+/*
+ * Remove all nodes from graph wich have a degree
+ * greater than max_degree
+ */
+void removeDegreeNodes(ARCS::Graph& g, int max_degree) {
+
+	boost::graph_traits<ARCS::Graph>::vertex_iterator vi, vi_end, next;
+	boost::tie(vi, vi_end) = boost::vertices(g);
+
+	std::vector<ARCS::VertexDes> dVertex;
+	for (next = vi; vi != vi_end; vi = next) {
+		++next;
+		if (static_cast<int>(boost::degree(*vi, g)) > max_degree) {
+			dVertex.push_back(*vi);
+		}
+	}
+
+	for (unsigned i = 0; i < dVertex.size(); i++) {
+		boost::clear_vertex(dVertex[i], g);
+		boost::remove_vertex(dVertex[i], g);
+	}
+	boost::renumber_indices(g);
+}
+
+/*
+ * Remove nodes that have a degree greater than max_degree
+ * Write graph
+ */
+void writePostRemovalGraph(ARCS::Graph& g, const std::string graphFile) {
+	if (job().params.max_degree != 0) {
+		std::cout << "      Deleting nodes with degree > " << job().params.max_degree
+				<< "... \n";
+		removeDegreeNodes(g, job().params.max_degree);
+	} else {
+		std::cout << "      Max Degree (-d) set to: " << job().params.max_degree
+				<< ". Will not delete any verticies from graph.\n";
+	}
+
+	std::cout << "      Writting graph file to " << graphFile << "...\n";
+	writeGraph(graphFile, g);
+}
+
+/*
+ * Measure the intra-contig distance samples and the barcode stats of
+ * the candidate contig pairs, for distance estimation (`-D`)
+ */
+static inline void calcBarcodeStats(
+	const ARCS::IndexMap& imap,
+	const std::unordered_map<std::string, int> &indexMultMap,
+	const ARCS::ContigToLength& contigToLength,
+	DistSampleMap& distSamples,
+	PairToBarcodeStats& pairToStats)
+{
+    std::time_t rawtime;
+
+	time(&rawtime);
+	std::cout << "\n\t=>Measuring intra-contig distances / shared barcodes... "
+		<< ctimeString(&rawtime);
+	calcDistSamples(imap, contigToLength, indexMultMap, job().params, distSamples);
+
+	time(&rawtime);
+	std::cout << "\n\t=>Calculating barcode stats for scaffold pairs... "
+		<< ctimeString(&rawtime);
+	buildPairToBarcodeStats(imap, indexMultMap, contigToLength, job().params, pairToStats);
+}
+
+/*
+ * Add distance estimates to the edges of `g`, and write the intra- and
+ * inter-contig TSVs
+ */
+static inline void calcDistanceEstimates(
+	const DistSampleMap& distSamples,
+	const PairToBarcodeStats& pairToStats,
+	ARCS::Graph& g)
+{
+    std::time_t rawtime;
+
+	time(&rawtime);
+	std::cout << "\n\t=>Writing intra-contig distance samples to TSV in the background... "
+		<< ctimeString(&rawtime);
+	JobThread distSamplesWriter;
+	if (!job().params.intra_contig_tsv.empty()) {
+		distSamplesWriter = jobThread([&distSamples]() {
+			writeDistSamplesTSV(job().params.intra_contig_tsv, distSamples,
+				job().params.deterministic);
+		});
+	}
+
+	time(&rawtime);
+	std::cout << "\n\t=>Building Jaccard => distance map... "
+		<< ctimeString(&rawtime);
+	JaccardToDist jaccardToDist;
+	buildJaccardToDist(distSamples, jaccardToDist);
+
+	time(&rawtime);
+	std::cout << "\n\t=>Adding edge distances... " << ctimeString(&rawtime);
+	addEdgeDistances(pairToStats, jaccardToDist, job().params, g);
+
+	time(&rawtime);
+	std::cout << "\n\t=>Writing distance/barcode data to TSV... "
+		<< ctimeString(&rawtime);
+	writeDistTSV(job().params.inter_contig_tsv, pairToStats, g);
+
+	if (distSamplesWriter.joinable())
+		distSamplesWriter.join();
+}
+
+/*
+ * Break misassembled contigs (`-p cut`, `--cut`). The k-mers of each
+ * `--cut_window` window along the whole contigs (of at least `-z` bp)
+ * are indexed, with the window in place of the contig end; read pairs
+ * are classified to windows with bestContig; and the contigs are cut
+ * where few molecules span (see Misassembly.h). Writes the corrected
+ * draft to <base>.cut.fa, naming the pieces of a cut contig <name>-1,
+ * <name>-2 ..., and the cuts to <base>_breakpoints.tsv. Returns the path
+ * of the corrected draft.
+ */
+std::string cutMisassemblies(const std::string &contigfile,
+		const std::unordered_map<std::string, int> &indexMultMap) {
+	std::time_t rawtime;
+	const unsigned window = job().params.cut_window;
+
+	time(&rawtime);
+	std::cout << "\n=>Storing Kmers of contig windows... " << ctimeString(&rawtime) << std::endl;
+
+	ARCS::ContigKMap kmap;
+	kmap.set_deleted_key("");
+	std::unique_ptr<PrefixKmerIndex> sorted;
+	if (job().params.kmer_index == "bucket")
+		sorted.reset(new PrefixKmerIndex(job().params.k_value));
+	ARCS::IndexPartition partition;
+	ReadsProcessor proc(job().params.k_value);
+
+	/* contigs that are checked, and the (contig, window) of each window ID */
+	std::vector<std::string> names;
+	std::vector<unsigned> lengths, numWindows;
+	std::vector<std::pair<uint32_t, uint32_t> > windows(1);
+
+	ReadAheadStream draft(contigfile, job().ioBlock);
+	kseq_t *seq = kseq_init(&draft);
+	while (kseq_read(seq) >= 0) {
+		std::string sequence = seq->seq.s;
+		if (sequence.length() < job().params.min_size)
+			continue;
+		uint32_t contig = names.size();
+		names.push_back(seq->name.s);
+		lengths.push_back(sequence.length());
+		numWindows.push_back((sequence.length() + window - 1) / window);
+		for (uint32_t w = 0; w < numWindows.back(); ++w) {
+			int id = windows.size();
+			windows.push_back(std::make_pair(contig, w));
+			std::string kmers = sequence.substr((size_t)w * window,
+				window + job().params.k_value - 1);
+			if (kmers.length() >= (unsigned)job().params.k_value)
+				mapKmers(kmers, job().params.k_value, job().params.k_shift, kmap, proc, id,
+					partition, sorted.get());
+		}
+	}
+	kseq_destroy(seq);
+	if (sorted)
+		sorted->build();
+	KmerIndex index = sorted ? KmerIndex(*sorted) : KmerIndex(kmap, job().params.k_value);
+	std::cout << "Contigs: " << names.size() << ", windows: " << windows.size() - 1
+		<< "\nMemory usage: " << memory_usage() << std::endl;
+
+	/* barcodes in the -m multiplicity range */
+	std::unordered_map<std::string, uint32_t> barcodeIds;
+	for (auto it = indexMultMap.begin(); it != indexMultMap.end(); ++it) {
+		if (it->second >= job().params.min_mult && it->second <= job().params.max_mult)
+			barcodeIds.insert(std::make_pair(it->first, (uint32_t)barcodeIds.size()));
+	}
+
+	time(&rawtime);
+	std::cout << "\n=>Classifying Chromium reads to contig windows... " << ctimeString(&rawtime) << std::endl;
+
+	vector<ReadsProcessor*> procs(job().params.threads);
+	for (unsigned i = 0; i < job().params.threads; ++i)
+		procs[i] = new ReadsProcessor(job().params.k_value);
+	std::vector<std::vector<WindowHit> > threadHits(job().params.threads);
+	size_t numPairs = 0, numClassified = 0;
+
+	ChromiumReader reader(job().params.libraries);
+	reader.start();
+	TeamFailure failure;
+	for (size_t i = 0; i < reader.size() && !failure.failed(); ++i) {
+#pragma omp parallel copyin(s_job)
+		for (ChromiumReadBatchPtr batch; !failure.failed() && reader.queue(i).pop(batch);) {
+			failure.run([&]() {
+				int thread = omp_get_thread_num();
+				size_t classified = 0;
+				for (size_t j = 0; j < batch->pairs.size(); ++j) {
+					ChromiumReadPair &pair = batch->pairs[j];
+					stripReadNum(pair.name1);
+					stripReadNum(pair.name2);
+					if (pair.name1 != pair.name2 || pair.barcode1 != pair.barcode2)
+						continue;
+					auto barcodeIt = barcodeIds.find(pair.barcode1);
+					if (barcodeIt == barcodeIds.end()
+							|| !checkReadSequence(pair.seq1) || !checkReadSequence(pair.seq2))
+						continue;
+
+					int w1 = bestContig(index, pair.seq1, job().params.k_value, job().params.k_shift,
+							job().params.j_index, *procs[thread]);
+					int w2 = bestContig(index, pair.seq2, job().params.k_value, job().params.k_shift,
+							job().params.j_index, *procs[thread]);
+					/* both reads on the same contig */
+					if (w1 == 0 || w2 == 0 || windows[w1].first != windows[w2].first)
+						continue;
+					WindowHit hit1 = { windows[w1].first, barcodeIt->second, windows[w1].second };
+					WindowHit hit2 = { windows[w2].first, barcodeIt->second, windows[w2].second };
+					threadHits[thread].push_back(hit1);
+					threadHits[thread].push_back(hit2);
+					classified++;
+				}
+#pragma omp atomic
+				numPairs += batch->pairs.size();
+#pragma omp atomic
+				numClassified += classified;
+			});
+		}
+	}
+	for (unsigned i = 0; i < job().params.threads; ++i)
+		delete procs[i];
+	failure.rethrow();
+	reader.rethrow();
+	sorted.reset();
+	ARCS::ContigKMap().swap(kmap);
+
+	std::vector<WindowHit> hits;
+	for (unsigned i = 0; i < threadHits.size(); ++i) {
+		hits.insert(hits.end(), threadHits[i].begin(), threadHits[i].end());
+		std::vector<WindowHit>().swap(threadHits[i]);
+	}
+	std::cout << "Read pairs: " << numPairs << ", classified to a contig: "
+		<< numClassified << std::endl;
+
+	time(&rawtime);
+	std::cout << "\n=>Finding poorly spanned windows... " << ctimeString(&rawtime) << std::endl;
+	std::vector<std::vector<unsigned> > spanning;
+	size_t numMolecules;
+	countSpanningMolecules(hits, numWindows, job().params, spanning, numMolecules);
+	std::vector<WindowHit>().swap(hits);
+	std::vector<Breakpoint> breakpoints;
+	findBreakpoints(spanning, lengths, job().params, breakpoints);
+	std::cout << "Molecules: " << numMolecules << ", cuts: " << breakpoints.size() << std::endl;
+
+	std::string breakpointFile = job().params.base_name + "_breakpoints.tsv";
+	std::ofstream tsv(breakpointFile.c_str());
+	tsv << "contig\tstart\tend\tcut\tmin_spanning\n";
+	for (size_t i = 0; i < breakpoints.size(); ++i) {
+		const Breakpoint &bp = breakpoints[i];
+		tsv << names[bp.contig] << '\t' << bp.start << '\t' << bp.end
+			<< '\t' << bp.cut << '\t' << bp.minSpanning << '\n';
+	}
+	tsv.close();
+	if (!tsv.good())
+		throw std::runtime_error("`" + breakpointFile + "': " + strerror(errno));
+
+	/* copy the draft, cutting at the breakpoints */
+	time(&rawtime);
+	std::string cutFile = job().params.base_name + ".cut.fa";
+	std::cout << "\n=>Writing corrected draft " << cutFile << "... " << ctimeString(&rawtime) << std::endl;
+	std::ofstream out(cutFile.c_str());
+	ReadAheadStream draft2(contigfile, job().ioBlock);
+	seq = kseq_init(&draft2);
+	size_t contig = 0, next = 0;
+	while (kseq_read(seq) >= 0) {
+		std::string sequence = seq->seq.s;
+		std::string name = seq->name.s;
+		if (sequence.length() < job().params.min_size
+				|| next == breakpoints.size() || breakpoints[next].contig != contig) {
+			if (sequence.length() >= job().params.min_size)
+				contig++;
+			out << '>' << name << '\n' << sequence << '\n';
+			continue;
+		}
+		unsigned start = 0, piece = 0;
+		for (; next < breakpoints.size() && breakpoints[next].contig == contig; ++next) {
+			unsigned end = breakpoints[next].cut;
+			out << '>' << name << '-' << ++piece << '\n'
+				<< sequence.substr(start, end - start) << '\n';
+			start = end;
+		}
+		out << '>' << name << '-' << ++piece << '\n' << sequence.substr(start) << '\n';
+		contig++;
+	}
+	kseq_destroy(seq);
+	out.close();
+	if (!out.good())
+		throw std::runtime_error("`" + cutFile + "': " + strerror(errno));
+
+	/* the k-mer tallies are reported for the scaffolding index and reads */
+	job().resetCounters();
+
+	return cutFile;
+}
+
+/* Read pairs of a barcode on the head and tail of a contig */
+struct EndCounts {
+	uint32_t barcode;
+	uint32_t head, tail;
+};
+
+/* Merge the head and tail postings of `contig' into `counts', in barcode order */
+static void contigEndCounts(const EvidenceIndex &evidence,
+		const EvidenceContig &contig, std::vector<EndCounts> &counts) {
+	uint32_t numHead, numTail;
+	const EvidencePosting *head = evidence.postings(contig, true, numHead);
+	const EvidencePosting *tail = evidence.postings(contig, false, numTail);
+	uint32_t i = 0, j = 0;
+	while (i < numHead || j < numTail) {
+		EndCounts c = { 0, 0, 0 };
+		if (j == numTail || (i < numHead && head[i].barcode < tail[j].barcode)) {
+			c.barcode = head[i].barcode;
+			c.head = head[i++].readPairs;
+		} else if (i == numHead || tail[j].barcode < head[i].barcode) {
+			c.barcode = tail[j].barcode;
+			c.tail = tail[j++].readPairs;
+		} else {
+			c.barcode = head[i].barcode;
+			c.head = head[i++].readPairs;
+			c.tail = tail[j++].readPairs;
+		}
+		counts.push_back(c);
+	}
+}
+
+/*
+ * Print the evidence linking contigs `a' and `b': the read pairs and
+ * barcodes on each end, the barcodes shared by the two contigs and the
+ * orientation each votes for (as pairContigs), the resulting graph edge
+ * (as createGraph) and the distance estimate of each orientation (as
+ * buildPairToBarcodeStats and estimateDistance).
+ */
+void queryContigPair(const EvidenceIndex &evidence, const JaccardToDist &jaccardToDist,
+		std::string a, std::string b, std::ostream &out) {
+	static const char *ORIENTATIONS[NUM_ORIENTATIONS] = { "HH", "HT", "TH", "TT" };
+
+	/* contig pairs are in name order, as in the PairMap */
+	if (a > b)
+		std::swap(a, b);
+	out << "pair\t" << a << '\t' << b << '\n';
+
+	if (a == b) {
+		out << "contig\t" << a << "\tpaired with itself\n\n";
+		return;
+	}
+
+	const EvidenceContig *contigs[2] = { evidence.findContig(a), evidence.findContig(b) };
+	const std::string names[2] = { a, b };
+	std::vector<EndCounts> counts[2];
+	for (unsigned i = 0; i < 2; ++i) {
+		if (contigs[i] == NULL) {
+			out << "contig\t" << names[i] << "\tno barcodes\n\n";
+			return;
+		}
+		contigEndCounts(evidence, *contigs[i], counts[i]);
+	}
+
+	/* barcodes and read pairs of each end, and the barcodes distance estimation uses */
+	unsigned endBarcodes[2][2] = { { 0, 0 }, { 0, 0 } };
+	out << "contig\tlength\tend\tbarcodes\tread_pairs\tdistance_barcodes\n";
+	for (unsigned i = 0; i < 2; ++i) {
+		for (unsigned end = 0; end < 2; ++end) {
+			unsigned barcodes = 0;
+			size_t readPairs = 0;
+			for (size_t j = 0; j < counts[i].size(); ++j) {
+				uint32_t pairs = end == 0 ? counts[i][j].head : counts[i][j].tail;
+				if (pairs == 0)
+					continue;
+				barcodes++;
+				readPairs += pairs;
+				int mult = evidence.multiplicity(counts[i][j].barcode);
+				if (mult >= job().params.min_mult && mult <= job().params.max_mult
+						&& validBarcodeMapping(contigs[i]->length, pairs, job().params))
+					endBarcodes[i][end]++;
+			}
+			out << names[i] << '\t' << contigs[i]->length << '\t' << (end == 0 ? 'H' : 'T')
+				<< '\t' << barcodes << '\t' << readPairs
+				<< '\t' << endBarcodes[i][end] << '\n';
+		}
+	}
+
+	/* shared barcodes, in barcode order */
+	std::vector<uint64_t> votes(NUM_ORIENTATIONS, 0);
+	unsigned shared[NUM_ORIENTATIONS] = { 0, 0, 0, 0 };
+	out << "barcode\tmultiplicity\t" << a << ":H\t" << a << ":T\t"
+		<< b << ":H\t" << b << ":T\tvote\n";
+	for (size_t i = 0, j = 0; i < counts[0].size() && j < counts[1].size();) {
+		if (counts[0][i].barcode < counts[1][j].barcode) {
+			i++;
+			continue;
+		}
+		if (counts[1][j].barcode < counts[0][i].barcode) {
+			j++;
+			continue;
+		}
+		const EndCounts &ca = counts[0][i++];
+		const EndCounts &cb = counts[1][j++];
+		int mult = evidence.multiplicity(ca.barcode);
+
+		std::string vote;
+		if (mult < job().params.min_mult || mult > job().params.max_mult) {
+			vote = "-multiplicity";
+		} else {
+			bool validA, validB, aHead, bHead;
+			std::tie(validA, aHead) = headOrTail(ca.head, ca.tail, job().params);
+			std::tie(validB, bHead) = headOrTail(cb.head, cb.tail, job().params);
+			if (!validA || !validB) {
+				vote = !validA ? "-" + a + ":H/T" : "-" + b + ":H/T";
+			} else {
+				int o = aHead ? (bHead ? HH : HT) : (bHead ? TH : TT);
+				votes[o]++;
+				vote = ORIENTATIONS[o];
+			}
+
+			/* barcode intersection of each orientation, for distance estimation */
+			for (int o = HH; o < NUM_ORIENTATIONS; ++o) {
+				uint32_t pairsA = o == HH || o == HT ? ca.head : ca.tail;
+				uint32_t pairsB = o == HH || o == TH ? cb.head : cb.tail;
+				if (validBarcodeMapping(contigs[0]->length, pairsA, job().params)
+						&& validBarcodeMapping(contigs[1]->length, pairsB, job().params))
+					shared[o]++;
+			}
+		}
+		out << evidence.barcodeName(ca.barcode) << '\t' << mult
+			<< '\t' << ca.head << '\t' << ca.tail
+			<< '\t' << cb.head << '\t' << cb.tail << '\t' << vote << '\n';
+	}
 
-	ARCS::VertexPropertyWriter<ARCS::Graph> vpWriter(g);
-	ARCS::EdgePropertyWriter<ARCS::Graph> epWriter(g);
+	out << "orientation\tvotes\tbarcodes1\tbarcodes2\tshared\tunion\tjaccard"
+		"\tmin_dist\tdist\tmax_dist\n";
+	for (int o = HH; o < NUM_ORIENTATIONS; ++o) {
+		BarcodeStats stats;
+		stats.barcodes1 = endBarcodes[0][o == HH || o == HT ? 0 : 1];
+		stats.barcodes2 = endBarcodes[1][o == HH || o == TH ? 0 : 1];
+		stats.barcodesIntersect = shared[o];
+		if (stats.barcodes1 > 0 && stats.barcodes2 > 0)
+			stats.barcodesUnion = stats.barcodes1 + stats.barcodes2 - shared[o];
+		out << ORIENTATIONS[o] << '\t' << votes[o] << '\t' << stats.barcodes1
+			<< '\t' << stats.barcodes2 << '\t' << stats.barcodesIntersect
+			<< '\t' << stats.barcodesUnion;
+		DistanceEstimate est;
+		bool success;
+		std::tie(est, success) = estimateDistance(stats, jaccardToDist, job().params);
+		if (success)
+			out << '\t' << est.jaccard << '\t' << est.minDist << '\t' << est.dist
+				<< '\t' << est.maxDist << '\n';
+		else
+			out << "\t-\t-\t-\t-\n";
+	}
 
-	boost::write_graphviz(out, g, vpWriter, epWriter);
-	assert(out);
-	out.close();
+	uint64_t max;
+	int index;
+	std::tie(max, index) = getMaxValueAndIndex(votes);
+	uint64_t second = 0;
+	for (int o = HH; o < NUM_ORIENTATIONS; ++o) {
+		if (votes[o] != max && votes[o] > second)
+			second = votes[o];
+	}
+	if (max > 0 && checkSignificance(max, second, job().params))
+		out << "edge\t" << ORIENTATIONS[index] << "\tweight=" << max << "\n\n";
+	else
+		out << "edge\tnone\n\n";
 }
 
-/*
- * Remove all nodes from graph wich have a degree
- * greater than max_degree
- */
-void removeDegreeNodes(ARCS::Graph& g, int max_degree) {
-
-	boost::graph_traits<ARCS::Graph>::vertex_iterator vi, vi_end, next;
-	boost::tie(vi, vi_end) = boost::vertices(g);
+/* Answer `-p query' for each pair of `contigs' */
+void queryEvidenceIndex(const std::string &path, const std::vector<std::string> &contigs) {
+	EvidenceIndex evidence(path);
+
+	/* answer for the options of the run that wrote the index */
+	const EvidenceHeader &header = evidence.header();
+	job().params.min_reads = header.minReads;
+	job().params.min_mult = header.minMult;
+	job().params.max_mult = header.maxMult;
+	job().params.min_links = header.minLinks;
+	job().params.end_length = header.endLength;
+	job().params.error_percent = header.errorPercent;
+	job().params.dist_bin_size = header.distBinSize;
+	std::cout << "Evidence index " << path << ": " << header.numContigs << " contigs, "
+		<< header.numBarcodes << " barcodes, " << header.numPostings
+		<< " barcode-contig end entries; -c " << job().params.min_reads
+		<< " -m " << job().params.min_mult << '-' << job().params.max_mult
+		<< " -l " << job().params.min_links << " -e " << job().params.end_length
+		<< " -r " << job().params.error_percent << " -B " << job().params.dist_bin_size
+		<< "\n\n";
 
-	std::vector<ARCS::VertexDes> dVertex;
-	for (next = vi; vi != vi_end; vi = next) {
-		++next;
-		if (static_cast<int>(boost::degree(*vi, g)) > max_degree) {
-			dVertex.push_back(*vi);
-		}
-	}
+	JaccardToDist jaccardToDist;
+	evidence.jaccardToDist(jaccardToDist);
 
-	for (unsigned i = 0; i < dVertex.size(); i++) {
-		boost::clear_vertex(dVertex[i], g);
-		boost::remove_vertex(dVertex[i], g);
-	}
-	boost::renumber_indices(g);
+	for (size_t i = 0; i + 1 < contigs.size(); i += 2)
+		queryContigPair(evidence, jaccardToDist, contigs[i], contigs[i + 1], std::cout);
+	std::cout.flush();
 }
 
 /*
- * Remove nodes that have a degree greater than max_degree
- * Write graph
+ * `-p pairs': build the graph from a pair checkpoint, under the
+ * current -l, -d and -B, and write it to `graphFile'. The contig end
+ * orientations were called under the -r of the run that wrote the
+ * checkpoint; the current -r applies only to the significance test of
+ * edge orientations.
  */
-void writePostRemovalGraph(ARCS::Graph& g, const std::string graphFile) {
-	if (params.max_degree != 0) {
-		std::cout << "      Deleting nodes with degree > " << params.max_degree
-				<< "... \n";
-		removeDegreeNodes(g, params.max_degree);
-	} else {
-		std::cout << "      Max Degree (-d) set to: " << params.max_degree
-				<< ". Will not delete any verticies from graph.\n";
-	}
-
-	std::cout << "      Writting graph file to " << graphFile << "...\n";
-	writeGraph(graphFile, g);
-}
+void runPairCheckpoint(const std::string& graphFile) {
 
-static inline void calcDistanceEstimates(
-	const ARCS::IndexMap& imap,
-	const std::unordered_map<std::string, int> &indexMultMap,
-	const ARCS::ContigToLength& contigToLength,
-	ARCS::Graph& g)
-{
     std::time_t rawtime;
+    std::cout << "\n----Pair Checkpoint ARKS----\n" << std::endl;
 
-	time(&rawtime);
-	std::cout << "\n\t=>Measuring intra-contig distances / shared barcodes... "
-		<< ctime(&rawtime);
+    time(&rawtime);
+    std::cout << "\n=>Reading pair checkpoint " << job().params.pair_checkpoint << "... " << ctimeString(&rawtime);
+    ARCS::PairMap pmap;
+    PairToBarcodeStats pairToStats;
     DistSampleMap distSamples;
-	calcDistSamples(imap, contigToLength, indexMultMap, params, distSamples);
-
-	time(&rawtime);
-	std::cout << "\n\t=>Writing intra-contig distance samples to TSV... "
-		<< ctime(&rawtime);
-	writeDistSamplesTSV(params.intra_contig_tsv, distSamples);
+    PairCheckpointHeader header = readPairCheckpoint(job().params.pair_checkpoint,
+	pmap, pairToStats, distSamples);
+
+    /* the options the pair counts were made with */
+    job().params.min_reads = header.minReads;
+    job().params.min_mult = header.minMult;
+    job().params.max_mult = header.maxMult;
+    job().params.end_length = header.endLength;
+    std::cout << pmap.size() << " contig pairs, counted with -c " << job().params.min_reads
+	<< " -m " << job().params.min_mult << "-" << job().params.max_mult
+	<< " -e " << job().params.end_length << "; contig end orientations called with -r "
+	<< header.errorPercent << std::endl;
+
+    bool distances = (header.flags & PAIR_CHECKPOINT_DISTANCES) != 0;
+    if (job().params.distance_est && !distances)
+	throw std::runtime_error("-D needs a pair checkpoint written with -D");
 
-	time(&rawtime);
-	std::cout << "\n\t=>Building Jaccard => distance map... "
-		<< ctime(&rawtime);
-	JaccardToDist jaccardToDist;
-	buildJaccardToDist(distSamples, jaccardToDist);
+    time(&rawtime);
+    std::cout << "\n=>Starting to create graph... " << ctimeString(&rawtime);
+    ARCS::Graph g;
+    createGraph(pmap, g);
+    ARCS::PairMap().swap(pmap);
 
-	time(&rawtime);
-	std::cout << "\n\t=>Calculating barcode stats for scaffold pairs... "
-		<< ctime(&rawtime);
-	PairToBarcodeStats pairToStats;
-	buildPairToBarcodeStats(imap, indexMultMap, contigToLength, params, pairToStats);
+    if (job().params.distance_est) {
+	std::cout << "\n=>Calculating distance estimates... " << ctimeString(&rawtime);
+	calcDistanceEstimates(distSamples, pairToStats, g);
+    }
 
-	time(&rawtime);
-	std::cout << "\n\t=>Adding edge distances... " << ctime(&rawtime);
-	addEdgeDistances(pairToStats, jaccardToDist, params, g);
+    time(&rawtime);
+    std::cout << "\n=>Starting to write graph file... " << ctimeString(&rawtime) << std::endl;
+    writePostRemovalGraph(g, graphFile);
 
-	time(&rawtime);
-	std::cout << "\n\t=>Writing distance/barcode data to TSV... "
-		<< ctime(&rawtime);
-	writeDistTSV(params.inter_contig_tsv, pairToStats, g);
+    time(&rawtime);
+    std::cout << "\n=>Done. " << ctimeString(&rawtime) << std::endl;
 }
 
 void runArcs(vector<string> inputFiles) {
@@ -1288,29 +3456,73 @@ void runArcs(vector<string> inputFiles) {
 
     std::cout << "Running: " << PROGRAM << " " << PACKAGE_VERSION
         << "\n pid " << ::getpid()
-	<< "\n -p " << params.program
-        << "\n -f " << params.file
-	<< "\n -a " << params.multfile
-	<< "\n -q " << params.conrecfile
-	<< "\n -w " << params.kmapfile
-	<< "\n -i " << params.imapfile
-	<< "\n -o " << params.checkpoint_outs
-        << "\n -c " << params.min_reads
-	<< "\n -k " << params.k_value
-	<< "\n -g " << params.k_shift
-	<< "\n -j " << params.j_index
-        << "\n -l " << params.min_links
-        << "\n -z " << params.min_size
-        << "\n -b " << params.base_name
-        << "\n Min index multiplicity: " << params.min_mult
-        << "\n Max index multiplicity: " << params.max_mult
-        << "\n -d " << params.max_degree
-        << "\n -e " << params.end_length
-        << "\n -r " << params.error_percent
-	<< "\n -t " << params.threads
-        << "\n -v " << params.verbose << "\n";
-
-    std::string graphFile = params.base_name + "_original.gv";
+	<< "\n -p " << job().params.program
+        << "\n -f " << job().params.file
+	<< "\n -a " << job().params.multfile
+	<< "\n -q " << job().params.conrecfile
+	<< "\n -w " << job().params.kmapfile
+	<< "\n -i " << job().params.imapfile
+	<< "\n -o " << job().params.checkpoint_outs
+        << "\n -c " << job().params.min_reads
+	<< "\n -k " << job().params.k_value
+	<< "\n -g " << job().params.k_shift
+	<< "\n -j " << job().params.j_index
+        << "\n -l " << job().params.min_links
+        << "\n -z " << job().params.min_size
+        << "\n -b " << job().params.base_name
+        << "\n Min index multiplicity: " << job().params.min_mult
+        << "\n Max index multiplicity: " << job().params.max_mult
+        << "\n -d " << job().params.max_degree
+        << "\n -e " << job().params.end_length
+        << "\n -r " << job().params.error_percent
+	<< "\n -t " << job().params.threads
+	<< "\n --max_memory " << job().params.max_memory
+	<< "\n --index_partitions " << job().params.index_partitions
+	<< "\n --shards " << job().params.shards.size()
+	<< "\n --shard_id " << job().params.shard_id
+	<< "\n --listen " << job().params.listen
+	<< "\n --read_store " << job().params.read_store
+	<< "\n --evidence_index " << job().params.evidence_index
+	<< "\n --pair_checkpoint " << job().params.pair_checkpoint
+	<< "\n --cut " << job().params.cut
+	<< "\n --cut_window " << job().params.cut_window
+	<< "\n --cut_span " << job().params.cut_span
+	<< "\n --cut_dist " << job().params.cut_dist
+	<< "\n --cut_min_size " << job().params.cut_min_size
+	<< "\n --kmer_index " << job().params.kmer_index
+	<< "\n --classify " << job().params.classify
+	<< "\n --sample_kmers " << job().params.sample_kmers
+	<< "\n --log_limit " << job().params.log_limit
+	<< "\n --deterministic " << job().params.deterministic
+	<< "\n --io_block " << job().ioBlock
+	<< "\n --read_batch " << job().params.read_batch
+	<< "\n --autotune " << job().params.autotune
+	<< "\n --incremental " << job().params.incremental
+        << "\n -v " << job().params.verbose << "\n";
+    for (size_t i = 0; i < job().params.libraries.size(); ++i) {
+	const ARCS::ReadLibrary &lib = job().params.libraries[i];
+	if (lib.name.empty())
+		continue;
+	std::cout << " --lib " << lib.name << ": " << lib.multfile;
+	for (size_t j = 0; j < lib.files.size(); ++j)
+		std::cout << ',' << lib.files[j];
+	std::cout << "\n";
+    }
+
+    if (job().store) {
+	std::time_t rawtime;
+	time(&rawtime);
+	std::cout << "\n=>Writing read store " << job().params.read_store << "... " << ctimeString(&rawtime) << std::endl;
+	writeReadStore(inputFiles, job().params.read_store);
+	return;
+    }
+
+    if (job().query) {
+	queryEvidenceIndex(job().params.evidence_index, inputFiles);
+	return;
+    }
+
+    std::string graphFile = job().params.base_name + "_original.gv";
 
     ARCS::ContigKMap kmap;
     kmap.set_deleted_key("");
@@ -1319,105 +3531,531 @@ void runArcs(vector<string> inputFiles) {
     ARCS::PairMap pmap;
     ARCS::Graph g;
     std::unordered_map<std::string, int> indexMultMap;
+    std::vector<LibraryStats> libraryStats(job().params.libraries.size());
 
     ARCS::ContigToLength contigToLength;
 
+    if (job().pairs) {
+	runPairCheckpoint(graphFile);
+	return;
+    }
+
+    MemoryBudget budget(job().params.max_memory);
+    MemoryPlan plan;
+
+    /* `-o` checkpoints: 1 = draft (ContigRecord + ContigKmerMap), 2 = IndexMap, 3 = both */
+    bool writeDraftCheckpoints = job().params.checkpoint_outs == 1 || job().params.checkpoint_outs == 3;
+    bool writeIndexMapCheckpoint = job().params.checkpoint_outs == 2 || job().params.checkpoint_outs == 3;
+
+    /* k-mers are looked up on `-p serve' workers instead of a local index */
+    bool sharded = !job().params.shards.empty();
+
     std::time_t rawtime;
 
     std::cout << "\n---We are using KMER method.---\n" << std::endl;
 
-    time(&rawtime);
-    std::cout << "\n=>Preprocessing: Gathering barcode multiplicity information..." << ctime(&rawtime);
-    createIndexMultMap(params.multfile, indexMultMap);
+    /* the barcode table is not needed until the reads are aligned */
+    JobThread indexMultLoader;
+    if (!job().serve) {
+	time(&rawtime);
+	std::cout << "\n=>Preprocessing: Gathering barcode multiplicity information in the background..." << ctimeString(&rawtime);
+	indexMultLoader = jobThread([&indexMultMap, &libraryStats]() {
+		for (size_t i = 0; i < job().params.libraries.size(); ++i) {
+			const ARCS::ReadLibrary &lib = job().params.libraries[i];
+			libraryStats[i].barcodes = createIndexMultMap(lib.multfile,
+				lib.barcodePrefix(), indexMultMap, job().params, job().ioBlock);
+		}
+	});
+    }
+
+    /* break misassembled contigs, and scaffold the corrected draft */
+    if (job().cut || job().params.cut) {
+	std::cout << "\n----Misassembly Cutting ARKS----\n" << std::endl;
+	if (indexMultLoader.joinable())
+		indexMultLoader.join();
+	job().params.file = cutMisassemblies(job().params.file, indexMultMap);
+	if (job().cut) {
+		std::cout << "Peak memory usage: " << peak_memory_usage() << std::endl;
+		time(&rawtime);
+		std::cout << "\n=>Done. " << ctimeString(&rawtime) << std::endl;
+		return;
+	}
+    }
 
     time(&rawtime);
-    std::cout << "\n=>Preprocessing: Gathering draft information..." << ctime(&rawtime) << "\n";
-    size_t size = initContigArray(params.file);
+    std::cout << "\n=>Preprocessing: Gathering draft information..." << ctimeString(&rawtime) << "\n";
+    size_t numEndKmers = 0;
+    size_t size = initContigArray(job().params.file, numEndKmers);
     std::vector<ARCS::CI> contigRecord(size);
 
-    if (full) {
+    if (job().serve) {
+	std::cout << "\n----K-mer Index Shard ARKS----\n" << std::endl;
+
+	ARCS::IndexPartition partition(job().params.shard_id, job().params.index_partitions, NULL);
+	size_t shardKmers = numEndKmers / job().params.index_partitions;
+	if (!budget.unlimited())
+		planKmerMap(budget, residentBytes(), shardKmers, 1, false, AlignmentBuffers(), plan);
+	if (plan.presizeKmerMap)
+		kmap.resize(shardKmers);
+
+	time(&rawtime);
+	std::cout << "\n=>Storing Kmers from Contig ends... " << ctimeString(&rawtime) << std::endl;
+	getContigKmers(job().params.file, kmap, contigRecord, contigToLength, partition);
+	std::vector<ARCS::CI>().swap(contigRecord);
+	std::cout << "Memory usage: " << memory_usage() << std::endl;
+
+	serveKmerShard(kmap, partition, job().params.k_value, job().params.listen);
+	return;
+    }
+
+    if (job().params.autotune && job().full && !sharded) {
+	if (indexMultLoader.joinable())
+		indexMultLoader.join();
+	time(&rawtime);
+	std::cout << "\n=>Calibrating on a sample of the draft and reads... " << ctimeString(&rawtime) << std::endl;
+	autotune((size - 1) / 2, numEndKmers, indexMultMap, budget);
+    }
 
+    /* `--kmer_index=bucket`: sorted prefix-bucketed index instead of the ContigKMap */
+    bool sortedIndex = job().params.kmer_index == "bucket" && !sharded;
+
+    /* `--classify=smem`: FM-index of the contig ends instead of a k-mer index */
+    bool fmIndex = job().params.classify == "smem";
+
+    if ((job().full || job().alignc) && !sharded && !fmIndex)
+	planKmerMap(budget, residentBytes(), numEndKmers, job().params.index_partitions,
+		sortedIndex, alignmentBuffers(), plan);
+
+    if (job().full) {
 	std::cout << "\n----Full ARKS----\n" << std::endl;
+    } else if (job().alignc) {
+	std::cout << "\n----Kmer Align ARKS----\n" << std::endl;
+
+	time(&rawtime);
+	std::cout << "\n=>Detected ContigRecord file, making ContigRecord from checkpoint...\n" << ctimeString(&rawtime) << std::endl;
+	createContigRecord(job().params.conrecfile, contigRecord);
+    }
 
-    	time(&rawtime);
-    	std::cout << "\n=>Storing Kmers from Contig ends... " << ctime(&rawtime) << std::endl;
-    	getContigKmers(params.file, kmap, contigRecord, contigToLength);
+    /*
+     * Build and query the k-mer index one partition of k-mer space
+     * at a time. Hits from earlier partitions are streamed from pass
+     * to pass through a file, ordered by read pair, and merged on the
+     * last pass.
+     */
+    unsigned numPartitions = plan.indexPartitions;
+    auto partialHitsPath = [](unsigned p) {
+	return job().params.base_name + "_partial_hits" + std::to_string(p) + ".tmp";
+    };
+
+    /* `--classify=sampled' looks up a read's k-mers in one index */
+    if ((job().full || job().alignc) && job().params.classify == "sampled" && numPartitions > 1)
+	throw std::runtime_error("--classify=sampled needs the k-mer index in one pass,"
+		" but --max_memory needs " + std::to_string(numPartitions) + " partitions;"
+		" try a larger --max_memory or --classify=probe");
+
+    /* `--incremental': reuse what is unchanged since the run before */
+    std::unique_ptr<IncrementalUpdate> incremental;
+    if (job().full && !job().params.incremental.empty()) {
+	if (numPartitions > 1)
+		throw std::runtime_error("--incremental needs the k-mer index in one pass;"
+			" try a larger --max_memory");
+	incremental.reset(new IncrementalUpdate(job().params.incremental, size));
     }
 
-    if (full || alignc) {
+    for (unsigned p = 0; p < numPartitions; ++p) {
+	std::string hitsIn = p > 0 ? partialHitsPath(p - 1) : std::string();
+	std::string hitsOut = p + 1 < numPartitions ? partialHitsPath(p) : std::string();
+	PartialHitFile partialHits(hitsIn, hitsOut, PARTIAL_HITS_PENDING * job().params.threads);
+	ARCS::IndexPartition partition(p, numPartitions, &partialHits);
 
-	  if (!full && alignc) {
-		std::cout << "\n----Kmer Align ARKS----\n" << std::endl;
+	if (numPartitions > 1) {
+		time(&rawtime);
+		std::cout << "\n=>K-mer index partition " << p + 1 << " of "
+			<< numPartitions << "... " << ctimeString(&rawtime) << std::endl;
+	}
 
+	/* parse reads into a bounded buffer while the index is built */
+	ChromiumReader reader(job().params.libraries);
+	if (job().full || job().alignc)
+		reader.start();
+
+	std::unique_ptr<PrefixKmerIndex> sorted;
+	std::unique_ptr<ContigEndFMIndex> fm;
+	if (job().full && fmIndex)
+		fm.reset(new ContigEndFMIndex);
+	else if ((job().full || job().alignc) && sortedIndex)
+		sorted.reset(new PrefixKmerIndex(job().params.k_value));
+	else if ((job().full || job().alignc) && plan.presizeKmerMap && !sharded)
+		kmap.resize(numEndKmers / numPartitions);
+
+	if (job().full && sharded) {
+		time(&rawtime);
+		std::cout << "\n=>Gathering contig ends (k-mer index is on " << job().params.shards.size()
+			<< " shards)... " << ctimeString(&rawtime) << std::endl;
+		getContigKmers(job().params.file, kmap, contigRecord, contigToLength,
+			ARCS::IndexPartition::none());
+	} else if (job().full && fm) {
+		time(&rawtime);
+		std::cout << "\n=>Building FM-index of Contig ends... " << ctimeString(&rawtime) << std::endl;
+		getContigKmers(job().params.file, kmap, contigRecord, contigToLength, partition,
+			NULL, fm.get());
+	} else if (job().full) {
+		time(&rawtime);
+		std::cout << "\n=>Storing Kmers from Contig ends... " << ctimeString(&rawtime) << std::endl;
+		getContigKmers(job().params.file, kmap, contigRecord, contigToLength, partition,
+			sorted.get(), NULL, SIZE_MAX, incremental.get());
+	} else if (job().alignc && !sharded) {
+		time(&rawtime);
+		std::cout << "\n=>Detected ContigKmerMap file, making ContigKmerMap from checkpoint...\n" << ctimeString(&rawtime) << std::endl;
+		createContigKmerMap(job().params.kmapfile, kmap, partition, sorted.get());
+	}
+	KmerIndex index = fm ? KmerIndex(*fm)
+		: sorted ? KmerIndex(*sorted) : KmerIndex(kmap, job().params.k_value);
+
+	/*
+	 * ContigRecord and ContigKmerMap are final at this point and only
+	 * read from here on, so write their checkpoints in the background
+	 * while the reads are aligned.
+	 */
+	JobThread draftCheckpointWriter;
+	if (writeDraftCheckpoints && (sharded || fm)) {
+		if (job().full)
+			writeContigRecord(contigRecord);
+	} else if (writeDraftCheckpoints) {
 		time(&rawtime);
-		std::cout << "\n=>Detected ContigRecord file, making ContigRecord from checkpoint...\n" << ctime(&rawtime) << std::endl;
-		createContigRecord(params.conrecfile, contigRecord);
+		std::cout << "\n=>Writing ContigRecord and ContigKmerMap checkpoint files in the background... " << ctimeString(&rawtime) << std::endl;
+		const PrefixKmerIndex* sortedp = sorted.get();
+		draftCheckpointWriter = jobThread([&contigRecord, &kmap, sortedp, partition]() {
+			if (partition.first())
+				writeContigRecord(contigRecord);
+			if (sortedp != NULL)
+				writeContigKmerMap(*sortedp, !partition.first());
+			else
+				writeContigKmerMap(kmap, !partition.first());
+		});
+	}
 
+	if (indexMultLoader.joinable())
+		indexMultLoader.join();
+
+	if (job().full || job().alignc) {
 		time(&rawtime);
-		std::cout << "\n=>Detected ContigKmerMap file, making ContigKmerMap from checkpoint...\n" << ctime(&rawtime) << std::endl;
-		createContigKmerMap(params.kmapfile, kmap);
-	  }
+		std::cout << "\n=>Reading Chromium FASTQ file(s)... " << ctimeString(&rawtime) << std::endl;
+		readChroms(reader, index, imap, indexMultMap, contigRecord, partition,
+			libraryStats, incremental.get());
+		if (incremental) {
+			time(&rawtime);
+			std::cout << "\n=>Writing incremental state " << job().params.incremental << "... " << ctimeString(&rawtime);
+			incremental->save();
+		}
+		partialHits.close();
+		if (!hitsOut.empty())
+			std::cout << "Saved " << partialHits.bytes() << " bytes of k-mer hits for the next pass to "
+				<< hitsOut << std::endl;
 
-  	  time(&rawtime);
-  	  std::cout << "\n=>Reading Chromium FASTQ file(s)... " << ctime(&rawtime) << std::endl;
-  	  readChroms(inputFiles, kmap, imap, indexMultMap, contigRecord);
+		std::cout << "Cumulative memory usage: " << memory_usage() << std::endl;
+	}
 
-  	  std::cout << "Cumulative memory usage: " << memory_usage() << std::endl;
+	/* no later pass or stage needs this k-mer index */
+	if (draftCheckpointWriter.joinable())
+		draftCheckpointWriter.join();
+	sorted.reset();
+	fm.reset();
+	ARCS::ContigKMap().swap(kmap);
+	kmap.set_deleted_key("");
     }
+    std::vector<ARCS::CI>().swap(contigRecord);
+    std::cout << "Memory usage after releasing k-mer index: " << memory_usage() << std::endl;
 
-    if (graph) {
+    if (job().graph) {
 
 	std::cout << "\n----Graph ARKS----\n" << std::endl;
 
 	time(&rawtime);
-	std::cout << "\n=>Detected IndexMap file, making IndexMap from checkpoint...\n" << ctime(&rawtime) << std::endl;
-	createIndexMap(params.imapfile, imap);
+	std::cout << "\n=>Detected IndexMap file, making IndexMap from checkpoint...\n" << ctimeString(&rawtime) << std::endl;
+	createIndexMap(job().params.imapfile, imap, job().ioBlock);
+    }
+
+    time(&rawtime);
+    std::cout << "\n=>Linked-read libraries... " << ctimeString(&rawtime);
+    reportLibraries(job().params.libraries, libraryStats, imap);
+
+    /* IndexMap is final and only read until it is compacted */
+    JobThread imapCheckpointWriter;
+    if (writeIndexMapCheckpoint) {
+	time(&rawtime);
+	std::cout << "\n=>Writing IndexMap checkpoint file in the background... " << ctimeString(&rawtime) << std::endl;
+	imapCheckpointWriter = jobThread([&imap]() {
+		writeIndexMap(imap, job().params);
+	});
+    }
+
+    /* the evidence index is of the whole IndexMap, before it is compacted */
+    JobThread evidenceIndexWriter;
+    if (!job().params.evidence_index.empty()) {
+	time(&rawtime);
+	std::cout << "\n=>Writing evidence index in the background... " << ctimeString(&rawtime) << std::endl;
+	evidenceIndexWriter = jobThread([&imap, &indexMultMap, &contigToLength]() {
+		JaccardToDist jaccardToDist;
+		if (job().params.distance_est && !contigToLength.empty()) {
+			DistSampleMap distSamples;
+			calcDistSamples(imap, contigToLength, indexMultMap, job().params, distSamples);
+			buildJaccardToDist(distSamples, jaccardToDist);
+		}
+		writeEvidenceIndex(job().params.evidence_index, imap, indexMultMap,
+			contigToLength, jaccardToDist, job().params);
+	});
+    }
+
+    /*
+     * Drop IndexMap entries that can not contribute to the graph.
+     * The search only reads the IndexMap, so it overlaps with the
+     * checkpoint writer; the removal has to wait for it.
+     */
+    time(&rawtime);
+    std::cout << "\n=>Compacting IndexMap... " << ctimeString(&rawtime);
+    IndexMapPruneList pruneList;
+    findPrunableEntries(imap, indexMultMap, pruneList);
+    if (imapCheckpointWriter.joinable())
+	imapCheckpointWriter.join();
+    if (evidenceIndexWriter.joinable())
+	evidenceIndexWriter.join();
+    pruneIndexMap(imap, pruneList);
+    std::cout << "Memory usage after compacting IndexMap: " << memory_usage() << std::endl;
+
+    if (!budget.unlimited()) {
+	size_t resident = residentBytes();
+	size_t entries = countIndexMapEntries(imap);
+	budget.log("IndexMap", resident, entries * IMAP_BYTES_PER_ENTRY,
+		"materialized (" + std::to_string(entries) + " entries)");
+	planPairing(budget, resident,
+		estimateCandidatePairs(imap, indexMultMap, job().params),
+		job().params.distance_est);
     }
 
 	time(&rawtime);
-    std::cout << "\n=>Starting pairing of scaffolds... " << ctime(&rawtime);
+    std::cout << "\n=>Starting pairing of scaffolds... " << ctimeString(&rawtime);
     pairContigs(imap, pmap, indexMultMap);
 
     time(&rawtime);
-    std::cout << "\n=>Starting to create graph... " << ctime(&rawtime);
+    std::cout << "\n=>Starting to create graph... " << ctimeString(&rawtime);
     createGraph(pmap, g);
+    if (job().params.pair_checkpoint.empty())
+	ARCS::PairMap().swap(pmap);
+
+    DistSampleMap distSamples;
+    PairToBarcodeStats pairToStats;
+    if (job().params.distance_est) {
+        std::cout << "\n=>Calculating distance estimates... " << ctimeString(&rawtime);
+        calcBarcodeStats(imap, indexMultMap, contigToLength, distSamples, pairToStats);
+    }
 
-    if (params.distance_est) {
-        std::cout << "\n=>Calculating distance estimates... " << ctime(&rawtime);
-        calcDistanceEstimates(imap, indexMultMap, contigToLength, g);
+    /* no later stage needs the IndexMap */
+    ARCS::IndexMap().swap(imap);
+
+    if (!job().params.pair_checkpoint.empty()) {
+	time(&rawtime);
+	std::cout << "\n=>Writing pair checkpoint " << job().params.pair_checkpoint << "... " << ctimeString(&rawtime);
+	writePairCheckpoint(job().params.pair_checkpoint, pmap, job().params.distance_est,
+		pairToStats, distSamples, job().params);
+	ARCS::PairMap().swap(pmap);
     }
 
+    if (job().params.distance_est)
+	calcDistanceEstimates(distSamples, pairToStats, g);
+
     time(&rawtime);
-    std::cout << "\n=>Starting to write graph file... " << ctime(&rawtime) << std::endl;
+    std::cout << "\n=>Starting to write graph file... " << ctimeString(&rawtime) << std::endl;
     writePostRemovalGraph(g, graphFile);
 
-    time(&rawtime);
-    std::cout << "\n=>Outputting desired checkpoint files... " << ctime(&rawtime) << std::endl;
-    int o = params.checkpoint_outs;
-    switch (o) {
-	case 3:
-		writeContigRecord(contigRecord);
-		writeContigKmerMap(kmap);
-		writeIndexMap(imap);
-		break;
-	case 2:
-		writeIndexMap(imap);
-		break;
-	case 1:
-		writeContigRecord(contigRecord);
-		writeContigKmerMap(kmap);
-		break;
-	case 0:
-	default:
-		break;
-    }
+    std::cout << "Peak memory usage: " << peak_memory_usage() << std::endl;
 
     time(&rawtime);
-    std::cout << "\n=>Done. " << ctime(&rawtime) << std::endl;
+    std::cout << "\n=>Done. " << ctimeString(&rawtime) << std::endl;
+}
+
+/* One line of a `-p batch' manifest */
+struct BatchJob {
+	std::string base;
+	std::string draft;
+	std::string multfile;
+	std::vector<std::string> files;
+};
+
+/*
+ * Read a `-p batch' manifest: one job per line, as
+ *   BASE DRAFT MULTFILE READS...
+ * separated by whitespace; blank lines and lines starting with `#' are
+ * skipped. Every job is checked before any is run.
+ */
+static bool readBatchManifest(const std::string& path, std::vector<BatchJob>& jobs) {
+	std::ifstream in(path.c_str());
+	if (!in) {
+		std::cerr << PROGRAM ": cannot read manifest `" << path << "'\n";
+		return false;
+	}
+	bool ok = true;
+	std::unordered_set<std::string> bases;
+	unsigned lineNum = 0;
+	for (std::string line; std::getline(in, line);) {
+		lineNum++;
+		std::istringstream ss(line);
+		BatchJob job;
+		if (!(ss >> job.base) || job.base[0] == '#')
+			continue;
+		ss >> job.draft >> job.multfile;
+		for (std::string file; ss >> file;)
+			job.files.push_back(file);
+		if (job.files.empty()) {
+			std::cerr << path << ":" << lineNum
+				<< ": expected BASE DRAFT MULTFILE READS...\n";
+			ok = false;
+			continue;
+		}
+		if (!bases.insert(job.base).second) {
+			std::cerr << path << ":" << lineNum << ": duplicate base name `"
+				<< job.base << "'\n";
+			ok = false;
+		}
+		std::vector<std::string> inputs(job.files);
+		inputs.push_back(job.draft);
+		inputs.push_back(job.multfile);
+		for (size_t i = 0; i < inputs.size(); ++i) {
+			if (!std::ifstream(inputs[i].c_str()).good()) {
+				std::cerr << path << ":" << lineNum << ": cannot read `"
+					<< inputs[i] << "'\n";
+				ok = false;
+			}
+		}
+		jobs.push_back(job);
+	}
+	if (ok && jobs.empty()) {
+		std::cerr << PROGRAM ": no jobs in manifest `" << path << "'\n";
+		ok = false;
+	}
+	return ok;
+}
+
+/* An output file of the batch job `base': the file name of `path', after the job's base name */
+static std::string batchOutput(const std::string& base, const std::string& path) {
+	if (path.empty())
+		return path;
+	size_t slash = path.rfind('/');
+	return base + "_" + (slash == std::string::npos ? path : path.substr(slash + 1));
+}
+
+/*
+ * `-p batch': run the full pipeline for each job of the manifest in this
+ * process. Up to -t jobs run at once, each on a worker thread with its
+ * share of -t, or one at a time with --max_memory. A worker takes the next job when it finishes one, so that
+ * its OpenMP team and heap arenas serve all of its jobs, as the logger
+ * serves all of the workers. Each job writes under its own base name,
+ * and its progress report to BASE.log. A job that fails is reported in
+ * the summary, and the others run on; returns the number that failed.
+ */
+size_t runBatch(const std::vector<BatchJob>& jobs) {
+	const ArksJob& batch = job();
+	/* a job plans its index against the memory the process has left,
+	 * which jobs planning at the same time would both count on */
+	const unsigned numWorkers = batch.params.max_memory > 0 ? 1
+		: std::min<size_t>(jobs.size(), std::max(batch.params.threads, 1u));
+
+	std::vector<double> seconds(jobs.size());
+	std::vector<std::string> errors(jobs.size());
+	std::atomic<size_t> next(0);
+	JobOutput output(std::cout.rdbuf());
+	std::cout.rdbuf(&output);
+	auto work = [&](unsigned worker) {
+		ArksJob* caller = s_job;
+		/* the threads left over from an even share go to the first workers */
+		const unsigned threads = std::max(batch.params.threads / numWorkers
+			+ (worker < batch.params.threads % numWorkers ? 1 : 0), 1u);
+		for (size_t i; (i = next++) < jobs.size();) {
+			const BatchJob& batchJob = jobs[i];
+			std::time_t rawtime;
+			time(&rawtime);
+			std::cout << "\n----Batch job " << i + 1 << " of " << jobs.size()
+				<< ": " << batchJob.base << " (-t " << threads << "), writing "
+				<< batchJob.base << ".log----\n" << ctimeString(&rawtime) << std::endl;
+
+			ArksJob current;
+			current.full = true;
+			current.ioBlock = batch.ioBlock;
+			ARCS::ArcsParams &params = current.params;
+			params = batch.params;
+			params.program = "full";
+			params.threads = threads;
+			params.file = batchJob.draft;
+			params.multfile = batchJob.multfile;
+			params.base_name = batchJob.base;
+			params.libraries.assign(1, ARCS::ReadLibrary());
+			params.libraries[0].multfile = batchJob.multfile;
+			params.libraries[0].files = batchJob.files;
+			params.intra_contig_tsv = batchOutput(batchJob.base, batch.params.intra_contig_tsv);
+			params.inter_contig_tsv = batchOutput(batchJob.base, batch.params.inter_contig_tsv);
+			params.evidence_index = batchOutput(batchJob.base, batch.params.evidence_index);
+			params.pair_checkpoint = batchOutput(batchJob.base, batch.params.pair_checkpoint);
+			params.incremental = batchOutput(batchJob.base, batch.params.incremental);
+			std::string logFile = batchJob.base + ".log";
+			current.log.reset(new std::ofstream(logFile.c_str()));
+			if (!*current.log) {
+				std::cerr << PROGRAM ": warning: cannot write `" << logFile
+					<< "'; the progress of " << batchJob.base << " goes to stdout\n";
+				current.log.reset();
+			}
+			s_job = &current;
+			/* as the job before may have been tuned */
+			omp_set_num_threads(threads);
+
+			double start = omp_get_wtime();
+			try {
+				runArcs(batchJob.files);
+			} catch (const std::exception& e) {
+				errors[i] = e.what();
+				std::cout << PROGRAM ": error: " << e.what() << std::endl;
+			}
+			logger().flush();
+			seconds[i] = omp_get_wtime() - start;
+			s_job = caller;
+			if (!errors[i].empty())
+				std::cerr << PROGRAM ": error: batch job " << batchJob.base << ": "
+					<< errors[i] << "\n";
+		}
+	};
+
+	if (numWorkers == 1) {
+		work(0);
+	} else {
+		std::vector<std::thread> workers;
+		for (unsigned w = 0; w < numWorkers; ++w)
+			workers.push_back(std::thread(work, w));
+		for (unsigned w = 0; w < numWorkers; ++w)
+			workers[w].join();
+	}
+	omp_set_num_threads(batch.params.threads);
+	std::cout.rdbuf(output.out());
+
+	size_t failed = 0;
+	std::cout << "\n----Batch summary: " << jobs.size() << " jobs, "
+		<< numWorkers << " at a time----\n";
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		std::cout << jobs[i].base << "\t" << std::fixed << std::setprecision(2)
+			<< seconds[i] << " s";
+		if (!errors[i].empty()) {
+			std::cout << "\tfailed: " << errors[i];
+			failed++;
+		}
+		std::cout << "\n";
+	}
+	if (failed > 0)
+		std::cout << failed << " of " << jobs.size() << " jobs failed\n";
+	std::cout << std::endl;
+	return failed;
 }
 
 int main(int argc, char** argv) {
 
+	s_job = &s_mainJob;
 	printf("Reading user inputs...\n");
 
 	std::string rawInputFiles = "";
@@ -1428,49 +4066,49 @@ int main(int argc, char** argv) {
 		std::istringstream arg(optarg != NULL ? optarg : "");
 		switch (c) {
 		case 'p':
-			arg >> params.program;
+			arg >> job().params.program;
 			break;
 		case '?':
 			die = true;
 			break;
 		case 'f':
-			arg >> params.file;
+			arg >> job().params.file;
 			break;
 		case 'a':
-			arg >> params.multfile;
+			arg >> job().params.multfile;
 			break;
 		case 'q':
-			arg >> params.conrecfile;
+			arg >> job().params.conrecfile;
 			break;
 		case 'w':
-			arg >> params.kmapfile;
+			arg >> job().params.kmapfile;
 			break;
 		case 'i':
-			arg >> params.imapfile;
+			arg >> job().params.imapfile;
 			break;
 		case 'o':
-			arg >> params.checkpoint_outs;
+			arg >> job().params.checkpoint_outs;
 			break;
 		case 'c':
-			arg >> params.min_reads;
+			arg >> job().params.min_reads;
 			break;
 		case 'k':
-			arg >> params.k_value;
+			arg >> job().params.k_value;
 			break;
 		case 'g':
-			arg >> params.k_shift;
+			arg >> job().params.k_shift;
 			break;
 		case 'j':
-			arg >> params.j_index;
+			arg >> job().params.j_index;
 			break;
 		case 'l':
-			arg >> params.min_links;
+			arg >> job().params.min_links;
 			break;
 		case 'z':
-			arg >> params.min_size;
+			arg >> job().params.min_size;
 			break;
 		case 'b':
-			arg >> params.base_name;
+			arg >> job().params.base_name;
 			break;
 		case 'm': {
 			std::string firstStr, secondStr;
@@ -1478,38 +4116,172 @@ int main(int argc, char** argv) {
 			std::getline(arg, secondStr);
 			std::stringstream ss;
 			ss << firstStr << "\t" << secondStr;
-			ss >> params.min_mult >> params.max_mult;
+			ss >> job().params.min_mult >> job().params.max_mult;
 		}
 			break;
 		case 'd':
-			arg >> params.max_degree;
+			arg >> job().params.max_degree;
 			break;
 		case 'e':
-			arg >> params.end_length;
+			arg >> job().params.end_length;
 			break;
 		case 'r':
-			arg >> params.error_percent;
+			arg >> job().params.error_percent;
 			break;
 		case 'v':
-			++params.verbose;
+			++job().params.verbose;
 			break;
 		case 't':
-			arg >> params.threads;
+			arg >> job().params.threads;
 			break;
 		case 'D':
-			params.distance_est = true;
+			job().params.distance_est = true;
 			break;
 		case 's':
-			arg >> params.intra_contig_tsv;
+			arg >> job().params.intra_contig_tsv;
 			break;
 		case 'S':
-			arg >> params.inter_contig_tsv;
+			arg >> job().params.inter_contig_tsv;
 			break;
 		case 'B':
-			arg >> params.dist_bin_size;
+			arg >> job().params.dist_bin_size;
 			break;
 		case OPT_NO_DIST_EST:
-			params.distance_est = false;
+			job().params.distance_est = false;
+			break;
+		case OPT_MAX_MEMORY: {
+			std::string size;
+			arg >> size;
+			if (!parseMemorySize(size, job().params.max_memory)) {
+				std::cerr << PROGRAM ": invalid --max_memory size: `"
+					<< size << "'\n";
+				die = true;
+			}
+		}
+			break;
+		case OPT_INDEX_PARTITIONS:
+			arg >> job().params.index_partitions;
+			if (job().params.index_partitions < 1
+					|| job().params.index_partitions > MAX_INDEX_PARTITIONS) {
+				std::cerr << PROGRAM ": --index_partitions must be between 1 and "
+					<< MAX_INDEX_PARTITIONS << "\n";
+				die = true;
+			}
+			break;
+		case OPT_SHARDS: {
+			std::string addresses;
+			arg >> addresses;
+			std::istringstream ss(addresses);
+			for (std::string address; std::getline(ss, address, ',');)
+				if (!address.empty())
+					job().params.shards.push_back(address);
+		}
+			break;
+		case OPT_SHARD_ID:
+			arg >> job().params.shard_id;
+			break;
+		case OPT_LISTEN:
+			arg >> job().params.listen;
+			break;
+		case OPT_READ_STORE:
+			arg >> job().params.read_store;
+			break;
+		case OPT_EVIDENCE_INDEX:
+			arg >> job().params.evidence_index;
+			break;
+		case OPT_CUT:
+			job().params.cut = true;
+			break;
+		case OPT_CUT_WINDOW:
+			arg >> job().params.cut_window;
+			if (job().params.cut_window == 0) {
+				std::cerr << PROGRAM ": --cut_window must be positive\n";
+				die = true;
+			}
+			break;
+		case OPT_CUT_SPAN:
+			arg >> job().params.cut_span;
+			break;
+		case OPT_CUT_DIST:
+			arg >> job().params.cut_dist;
+			break;
+		case OPT_CUT_MIN_SIZE:
+			arg >> job().params.cut_min_size;
+			break;
+		case OPT_SAMPLE_KMERS:
+			arg >> job().params.sample_kmers;
+			if (job().params.sample_kmers == 0) {
+				std::cerr << PROGRAM ": --sample_kmers must be positive\n";
+				die = true;
+			}
+			break;
+		case OPT_LOG_LIMIT:
+			arg >> job().params.log_limit;
+			break;
+		case OPT_PAIR_CHECKPOINT:
+			arg >> job().params.pair_checkpoint;
+			break;
+		case OPT_READ_BATCH:
+			arg >> job().params.read_batch;
+			if (job().params.read_batch == 0) {
+				std::cerr << PROGRAM ": --read_batch must be positive\n";
+				die = true;
+			}
+			break;
+		case OPT_AUTOTUNE:
+			job().params.autotune = true;
+			break;
+		case OPT_INCREMENTAL:
+			arg >> job().params.incremental;
+			break;
+		case OPT_KMER_INDEX:
+			arg >> job().params.kmer_index;
+			if (job().params.kmer_index != "hash" && job().params.kmer_index != "bucket") {
+				std::cerr << PROGRAM ": --kmer_index must be `hash' or `bucket'\n";
+				die = true;
+			}
+			break;
+		case OPT_IO_BLOCK: {
+			std::string size;
+			size_t bytes = 0;
+			arg >> size;
+			if (!parseMemorySize(size, bytes) || bytes == 0) {
+				std::cerr << PROGRAM ": invalid --io_block size: `"
+					<< size << "'\n";
+				die = true;
+			} else {
+				job().ioBlock = bytes;
+			}
+		}
+			break;
+		case OPT_DETERMINISTIC:
+			job().params.deterministic = true;
+			break;
+		case OPT_LIB: {
+			std::string files;
+			arg >> files;
+			ARCS::ReadLibrary lib;
+			lib.name = "lib" + std::to_string(job().params.libraries.size() + 1);
+			std::istringstream ss(files);
+			std::getline(ss, lib.multfile, ',');
+			for (std::string file; std::getline(ss, file, ',');)
+				if (!file.empty())
+					lib.files.push_back(file);
+			if (lib.multfile.empty()) {
+				std::cerr << PROGRAM ": --lib needs a barcode multiplicity file: `"
+					<< files << "'\n";
+				die = true;
+			}
+			job().params.libraries.push_back(lib);
+		}
+			break;
+		case OPT_CLASSIFY:
+			arg >> job().params.classify;
+			if (job().params.classify != "probe" && job().params.classify != "merge"
+					&& job().params.classify != "smem" && job().params.classify != "sampled") {
+				std::cerr << PROGRAM ": --classify must be `probe', `merge', `smem' or `sampled'\n";
+				die = true;
+			}
 			break;
 		case OPT_HELP:
 			std::cout << USAGE_MESSAGE;
@@ -1524,7 +4296,41 @@ int main(int argc, char** argv) {
 			exit(EXIT_FAILURE);
 		}
 	}
-	omp_set_num_threads(params.threads);
+	omp_set_num_threads(job().params.threads);
+
+	if (job().params.kmer_index == "bucket" && !PrefixKmerIndex::supports(job().params.k_value)) {
+		std::cerr << PROGRAM ": --kmer_index=bucket supports k up to 32\n";
+		die = true;
+	}
+	if (job().params.classify == "merge" && job().params.kmer_index != "bucket") {
+		std::cerr << PROGRAM ": --classify=merge needs --kmer_index=bucket\n";
+		die = true;
+	}
+	if (job().params.classify == "sampled" && (!job().params.shards.empty() || job().params.index_partitions > 1)) {
+		std::cerr << PROGRAM ": --classify=sampled needs a single local index, without --shards or --index_partitions\n";
+		die = true;
+	}
+	if (job().params.autotune && ((job().params.program != "full" && job().params.program != "batch")
+			|| !job().params.shards.empty())) {
+		std::cerr << PROGRAM ": --autotune needs -p full or batch, without --shards\n";
+		die = true;
+	}
+	if (!job().params.incremental.empty() && ((job().params.program != "full" && job().params.program != "batch")
+			|| !job().params.shards.empty() || job().params.index_partitions > 1
+			|| job().params.classify == "smem")) {
+		std::cerr << PROGRAM ": --incremental needs -p full or batch, without --shards,"
+			" --index_partitions or --classify=smem\n";
+		die = true;
+	}
+	if (job().params.cut && job().params.program != "full" && job().params.program != "batch") {
+		std::cerr << PROGRAM ": --cut needs -p full or batch (or use -p cut)\n";
+		die = true;
+	}
+	if (job().params.classify == "smem" && ((job().params.program != "full" && job().params.program != "batch")
+			|| !job().params.shards.empty() || job().params.index_partitions > 1)) {
+		std::cerr << PROGRAM ": --classify=smem needs -p full or batch, without --shards or --index_partitions\n";
+		die = true;
+	}
 
 	//gather all the chromium files
 	vector<string> inputFiles = convertInputString(rawInputFiles);
@@ -1534,18 +4340,79 @@ int main(int argc, char** argv) {
 		optind++;
 	}
 
-	std::ifstream g(params.file.c_str());
-	if (!g.good()) {
-		std::cerr << "Cannot find -f " << params.file << ". Exiting... \n";
+	/* the library of -a and the read file arguments comes first, unnamed */
+	if (!job().params.multfile.empty() || !inputFiles.empty() || job().params.libraries.empty()) {
+		ARCS::ReadLibrary lib;
+		lib.multfile = job().params.multfile;
+		lib.files = inputFiles;
+		job().params.libraries.insert(job().params.libraries.begin(), lib);
+	}
+
+	std::ifstream g(job().params.file.c_str());
+	if (job().params.program != "store" && job().params.program != "query"
+			&& job().params.program != "pairs" && job().params.program != "batch" && !g.good()) {
+		std::cerr << "Cannot find -f " << job().params.file << ". Exiting... \n";
 		die = true;
 	}
 
-	if (params.program == "full") {
-		full = true;
-	} else if (params.program == "align") {
-		alignc = true;
-	} else if (params.program == "graph") {
-		graph = true;
+	if (job().params.program == "full") {
+		job().full = true;
+	} else if (job().params.program == "align") {
+		job().alignc = true;
+	} else if (job().params.program == "graph") {
+		job().graph = true;
+	} else if (job().params.program == "store") {
+		job().store = true;
+		if (job().params.read_store.empty()) {
+			std::cerr << "-p store needs a --read_store file to write. Exiting... \n";
+			die = true;
+		}
+		if (!job().params.libraries.back().name.empty()) {
+			std::cerr << "-p store takes the read files as arguments, not --lib. Exiting... \n";
+			die = true;
+		}
+	} else if (job().params.program == "cut") {
+		job().cut = true;
+	} else if (job().params.program == "query") {
+		job().query = true;
+		if (job().params.evidence_index.empty()) {
+			std::cerr << "-p query needs an --evidence_index to read. Exiting... \n";
+			die = true;
+		}
+		if (inputFiles.empty() || inputFiles.size() % 2 != 0) {
+			std::cerr << "-p query takes pairs of contig names. Exiting... \n";
+			die = true;
+		}
+	} else if (job().params.program == "pairs") {
+		job().pairs = true;
+		if (job().params.pair_checkpoint.empty()) {
+			std::cerr << "-p pairs needs a --pair_checkpoint to read. Exiting... \n";
+			die = true;
+		}
+	} else if (job().params.program == "batch") {
+		if (inputFiles.size() != 1) {
+			std::cerr << "-p batch takes one manifest file as argument. Exiting... \n";
+			die = true;
+		}
+		if (!job().params.file.empty() || !job().params.multfile.empty()
+				|| !job().params.libraries.back().name.empty()) {
+			std::cerr << "-p batch takes the draft, -a and read files of each job from the manifest. Exiting... \n";
+			die = true;
+		}
+		if (!job().params.shards.empty()) {
+			std::cerr << "-p batch indexes each draft locally, without --shards. Exiting... \n";
+			die = true;
+		}
+	} else if (job().params.program == "serve") {
+		job().serve = true;
+		if (job().params.listen.empty()) {
+			std::cerr << "-p serve needs an address to --listen on. Exiting... \n";
+			die = true;
+		}
+		if (job().params.shard_id >= job().params.index_partitions) {
+			std::cerr << "--shard_id must be less than --index_partitions. Exiting... \n";
+			die = true;
+		}
 	} else {
 		std::cerr << "You must specify where you want ARKS to start. Exiting... \n";
 		die = true;
@@ -1556,20 +4423,38 @@ int main(int argc, char** argv) {
 		exit(EXIT_FAILURE);
 	}
 
+	logger().setLevel(job().params.verbose > 1 ? LOG_DEBUG
+		: job().params.verbose ? LOG_INFO : LOG_WARNING);
+	logger().setLimit(job().params.log_limit);
+
 	/* Setting base name if not previously set */
-	if (params.base_name.empty()) {
+	if (job().params.base_name.empty()) {
 		std::ostringstream filename;
-		filename << params.file << ".scaff" << "k-method" << "_c"
-				<< params.min_reads << "_k" << params.k_value << "_g"
-				<< params.k_shift << "_j" << params.j_index << "_l"
-				<< params.min_links << "_d" << params.max_degree << "_e"
-				<< params.end_length << "_r" << params.error_percent;
-		params.base_name = filename.str();
+		filename << job().params.file << ".scaff" << "k-method" << "_c"
+				<< job().params.min_reads << "_k" << job().params.k_value << "_g"
+				<< job().params.k_shift << "_j" << job().params.j_index << "_l"
+				<< job().params.min_links << "_d" << job().params.max_degree << "_e"
+				<< job().params.end_length << "_r" << job().params.error_percent;
+		job().params.base_name = filename.str();
+	}
+
+	if (job().params.program == "batch") {
+		std::vector<BatchJob> jobs;
+		if (!readBatchManifest(inputFiles[0], jobs)) {
+			std::cerr << "Check the manifest. Exiting... \n";
+			exit(EXIT_FAILURE);
+		}
+		return runBatch(jobs) > 0 ? EXIT_FAILURE : 0;
 	}
 
 	printf("%s\n", "Finished reading user inputs...entering runArcs()...");
 
-	runArcs(inputFiles);
+	try {
+		runArcs(inputFiles);
+	} catch (const std::exception& e) {
+		std::cerr << PROGRAM ": error: " << e.what() << std::endl;
+		exit(EXIT_FAILURE);
+	}
 
 	return 0;
 }
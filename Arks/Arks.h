@@ -11,6 +11,7 @@
 #include <utility>
 #include <algorithm>
 #include <cmath>
+#include <stdint.h>
 #include <map>
 #include <unordered_map>
 #include <fstream>
@@ -30,8 +31,26 @@
 #include <google/sparse_hash_map>
 #include "city.h"
 
+class PartialHitFile;
+
 namespace ARCS {
 
+/**
+ * A linked-read library: chromium read files and the barcode
+ * multiplicity file of their barcodes. Barcodes of a named library are
+ * prefixed with `<name>_`, so that they can not collide with those of
+ * the other libraries of the run.
+ */
+struct ReadLibrary {
+	std::string name;
+	std::string multfile;
+	std::vector<std::string> files;
+
+	std::string barcodePrefix() const {
+		return name.empty() ? std::string() : name + "_";
+	}
+};
+
 /**
  * Parameters controlling ARCS run
  */
@@ -44,7 +63,7 @@ struct ArcsParams {
 	std::string kmapfile; 
 	std::string imapfile; 
 	int checkpoint_outs;
-	int min_reads;
+	unsigned min_reads;
 	int k_value;
 	int k_shift;
 	double j_index;
@@ -62,12 +81,44 @@ struct ArcsParams {
 	std::string intra_contig_tsv;
 	std::string inter_contig_tsv;
 	unsigned dist_bin_size;
+	size_t max_memory;
+	unsigned index_partitions;
+	std::vector<std::string> shards;
+	unsigned shard_id;
+	std::string listen;
+	std::string read_store;
+	std::string evidence_index;
+	/* pair-count checkpoint to write, or to read with `-p pairs` */
+	std::string pair_checkpoint;
+	std::string kmer_index;
+	std::string classify;
+	bool deterministic;
+	/* linked-read libraries: that of -a and the read file arguments
+	 * (unnamed) if given, then those of `--lib`, named lib1, lib2... */
+	std::vector<ReadLibrary> libraries;
+	/* misassembly cutting (-p cut, --cut) */
+	bool cut;
+	unsigned cut_window;
+	unsigned cut_span;
+	unsigned cut_dist;
+	unsigned cut_min_size;
+	/* k-mers looked up in stage one of `--classify=sampled` */
+	unsigned sample_kmers;
+	/* messages of each kind logged per rate limit window (0: no limit) */
+	unsigned log_limit;
+	/* read pairs per batch handed to the classifying threads */
+	size_t read_batch;
+	/* choose the index engine, classifier, batch size, thread split and
+	 * I/O block size by benchmarking them on a sample first */
+	bool autotune;
+	/* contig-end k-mers and read classifications kept from run to run */
+	std::string incremental;
 
 	ArcsParams() :
 			program(), file(), multfile(), conrecfile(), kmapfile(), imapfile(), checkpoint_outs(0), min_reads(5), k_value(
 					30), k_shift(1), j_index(0.55), min_links(0), min_size(500), base_name(
 					""), min_mult(50), max_mult(10000), max_degree(0), end_length(
-					30000), error_percent(0.05), verbose(0), threads(1), distance_est(false), dist_bin_size(20) {
+					30000), error_percent(0.05), verbose(0), threads(1), distance_est(false), dist_bin_size(20), max_memory(0), index_partitions(1), shard_id(0), kmer_index("hash"), classify("probe"), deterministic(false), cut(false), cut_window(1000), cut_span(20), cut_dist(50000), cut_min_size(2000), sample_kmers(8), log_limit(10), read_batch(1024), autotune(false) {
 	}
 
 };
@@ -107,10 +158,19 @@ struct eqstr {
 	}
 };
 
-typedef google::sparse_hash_map<std::string, int, CityHasher<std::string>, eqstr> ContigKMap;
+/**
+ * Contig record index: contig ends are numbered from 1, head then tail,
+ * and 0 is the null (collision) record. The k-mer indexes, the shard
+ * protocol and the partitioned hit lists store it in 32 bits, which
+ * allows drafts of up to 2^30 contigs; larger drafts are rejected.
+ */
+typedef int32_t ContigEndId;
+static const ContigEndId MAX_CONTIG_END_ID = INT32_MAX;
+
+typedef google::sparse_hash_map<std::string, ContigEndId, CityHasher<std::string>, eqstr> ContigKMap;
 
 /* ScafMap: <pair(scaffold id, bool), count>, cout =  # times index maps to scaffold (c), bool = true-head, false-tail*/
-typedef std::map<CI, int> ScafMap;
+typedef std::map<CI, uint64_t> ScafMap;
 typedef typename ScafMap::const_iterator ScafMapConstIt;
 
 /* IndexMap: key = index sequence, value = ScafMap */
@@ -119,10 +179,62 @@ typedef std::unordered_map<std::string, ScafMap> IndexMap;
 /** a pair of contig IDs */
 typedef std::pair<std::string, std::string> ContigPair;
 
-/* PairMap: key = pair of scaf sequence id, value = num links*/
-typedef std::map<std::pair<std::string, std::string>, std::vector<int>> PairMap;
+/* PairMap: key = pair of scaf sequence id, value = num links per orientation
+ * (64-bit, as a pair of large contigs can share more than 2^32 links) */
+typedef std::map<std::pair<std::string, std::string>, std::vector<uint64_t>> PairMap;
 typedef typename PairMap::iterator PairMapIt;
 
+/* PARTITIONED (MULTI-PASS) ALIGNMENT: */
+
+/** k-mer hits of a read: (contig record index, number of k-mers) */
+typedef std::vector<std::pair<ContigEndId, int> > KmerHits;
+
+/** k-mer hits of a read pair, accumulated over index partitions */
+struct ReadPairHits {
+	KmerHits read1;
+	KmerHits read2;
+};
+
+
+/** Return the size in bytes of a packed k-mer from ReadsProcessor */
+static inline unsigned packedKmerBytes(int k) {
+	return (k + 3) / 4;
+}
+
+/** Return the index partition (out of `numPartitions`) that owns a k-mer */
+static inline unsigned kmerPartition(const std::string& kmer,
+		unsigned numPartitions) {
+	// seeded, so that partitions do not share low bits of the ContigKMap hash
+	return CityHash64WithSeed(kmer.c_str(), kmer.size(), 0x9e3779b97f4a7c15ULL)
+		% numPartitions;
+}
+
+/**
+ * The slice of k-mer space held in the ContigKMap during one
+ * pass over the reads. With a single partition, the whole
+ * index is built and the reads are streamed once.
+ */
+struct IndexPartition {
+	unsigned id;
+	unsigned count;
+	/** hits of earlier partitions, saved and added to (PartialHits.h) */
+	PartialHitFile* partialHits;
+
+	IndexPartition() : id(0), count(1), partialHits(NULL) {}
+	IndexPartition(unsigned id, unsigned count, PartialHitFile* partialHits) :
+		id(id), count(count), partialHits(partialHits) {}
+
+	/** a partition holding no k-mers (the index lives elsewhere) */
+	static IndexPartition none() { return IndexPartition(1, 1, NULL); }
+
+	bool empty() const { return id >= count; }
+	bool first() const { return id == 0; }
+	bool last() const { return id + 1 == count; }
+	bool contains(const std::string& kmer) const {
+		return !empty() && (count == 1 || kmerPartition(kmer, count) == id);
+	}
+};
+
 /** maps contig FASTA ID to contig length (bp) */
 typedef std::unordered_map<std::string, int> ContigToLength;
 typedef typename ContigToLength::const_iterator ContigToLengthIt;
@@ -136,7 +248,8 @@ struct VertexProperties {
 /* Orientation: 0-HH, 1-HT, 2-TH, 3-TT */
 struct EdgeProperties {
 	int orientation;
-	int weight;
+	/** links supporting the orientation, from the PairMap */
+	uint64_t weight;
 	int minDist;
 	int dist;
 	int maxDist;
@@ -0,0 +1,191 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_ 1
+
+#include "Arks/Arks.h"
+#include "Common/Logger.h"
+#include "Common/ReadAhead.h"
+#include "Common/StringUtil.h"
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * The IndexMap TSV checkpoint (`-o`), one line per barcode and contig
+ * end: BARCODE CONTIG H|T COUNT, and the barcode multiplicity file.
+ */
+
+static inline std::string HeadOrTail(bool orientation) {
+	if (orientation) {
+		return "H";
+	} else {
+		return "T";
+	}
+}
+
+/* Precondition: input must either be "H" or "T" */
+static inline bool HTtoBool(std::string ht) {
+	if (ht == "H") {
+		return true;
+	} else {
+		return false;
+	}
+}
+
+/* Returns true if the barcode only contains ATGC */
+static inline bool checkIndex(std::string seq) {
+	for (int i = 0; i < static_cast<int>(seq.length()); i++) {
+		char c = toupper(seq[i]);
+		if (c != 'A' && c != 'T' && c != 'G' && c != 'C')
+			return false;
+
+	}
+	//return (static_cast<int>(seq.length()) == params.indexLen);
+	return true;
+}
+
+/* write IndexMap to BASE_imap.tsv (in barcode order with --deterministic) */
+static inline void writeIndexMap(const ARCS::IndexMap &imap,
+		const ARCS::ArcsParams &params) {
+
+	std::string barcode = "";
+	std::string contigname = "";
+	std::string orientation = "";
+	uint64_t count = 0;
+
+	std::string outputfilename = params.base_name + "_imap.tsv";
+
+	FILE* fout = fopen(outputfilename.c_str(), "w");
+
+	std::vector<ARCS::IndexMap::const_iterator> order;
+	for (auto it = imap.begin(); it != imap.end(); ++it)
+		order.push_back(it);
+	if (params.deterministic) {
+		std::sort(order.begin(), order.end(),
+			[](const ARCS::IndexMap::const_iterator &a,
+					const ARCS::IndexMap::const_iterator &b) {
+				return a->first < b->first;
+			});
+	}
+
+	for (auto oit = order.begin(); oit != order.end(); ++oit) {
+		auto it = *oit;
+		barcode = it->first;
+		const ARCS::ScafMap& smap = it->second;
+		for (auto j = smap.begin(); j != smap.end(); ++j) {
+			contigname = j->first.first;
+			orientation = HeadOrTail(j->first.second);
+			count = j->second;
+			fprintf(fout, "%s\t%s\t%s\t%" PRIu64 "\n", barcode.c_str(), contigname.c_str(), orientation.c_str(), count);
+		}
+	}
+	fclose(fout);
+}
+
+/* Create indexMultMap from Barcode Multiplicity File, with barcodes
+ * prefixed by `prefix', read in blocks of `blockSize'. Returns the
+ * number of barcodes kept. */
+static inline size_t createIndexMultMap(std::string multfile, const std::string &prefix,
+		std::unordered_map<std::string, int> &indexMultMap,
+		const ARCS::ArcsParams &params, size_t blockSize = 0) {
+
+	size_t numreadstotal=0;
+	size_t numreadskept=0;
+	size_t numbarcodes=0;
+	size_t numbarcodeskept=0;
+
+	// Decide if it is a tsv or csv file
+	bool tsv = false;
+	std::size_t found = multfile.find(".tsv");
+	if (found!=std::string::npos)
+		tsv = true;
+
+	ReadAheadStream multfile_stream(multfile, blockSize);
+	if (!multfile_stream.good()) {
+		std::cerr << "Could not open " << multfile << ". --fatal.\n";
+		exit (EXIT_FAILURE);
+	}
+
+	std::string line;
+	while(multfile_stream.getline(line)) {
+
+		std::string barcode;
+		std::string multiplicity_string;
+		uint64_t multiplicity;
+
+		if (tsv) {
+			std::stringstream sst(line);
+			sst >> barcode >> multiplicity_string;
+		} else {
+			std::istringstream iss(line);
+			getline(iss, barcode, ',');
+			iss >> multiplicity_string;
+		}
+		numbarcodes++;
+		if (!parseCount(multiplicity_string, multiplicity)) {
+			std::cerr << "Could not read the multiplicity of barcode `" << barcode
+				<< "' in " << multfile << ". --fatal.\n";
+			exit (EXIT_FAILURE);
+		}
+
+		numreadstotal += multiplicity;
+
+		if (!barcode.empty() && checkIndex(barcode)) {
+			numreadskept += multiplicity;
+			numbarcodeskept++;
+			// beyond any -m range, so saturating at INT_MAX loses nothing
+			indexMultMap[prefix + barcode] =
+				(int)std::min<uint64_t>(multiplicity, INT_MAX);
+		} else {
+			logger().log(LOG_WARNING, "multiplicity file", "Please check your multiplicity file.");
+		}
+
+	}
+
+	if (params.verbose) {
+		std::cout << "Saw " << numbarcodes << " barcodes and keeping " << numreadskept << " read pairs out of " << numreadstotal << std::endl;
+	}
+
+	return numbarcodeskept;
+}
+
+/* Create IndexMap from BASE_imap.tsv, read in blocks of `blockSize' */
+static inline void createIndexMap(std::string imaptsv, ARCS::IndexMap &imap,
+		size_t blockSize = 0) {
+
+	ReadAheadStream imaptsv_stream(imaptsv, blockSize);
+	if (!imaptsv_stream.good()) {
+		std::cerr << "Could not open " << imaptsv << ". --fatal.\n";
+		exit (EXIT_FAILURE);
+	}
+
+	std::string line;
+	while (imaptsv_stream.getline(line)) {
+		std::stringstream sst(line);
+
+		std::string barcode, contigname, ht_string, count_string;
+		bool ht;
+		uint64_t count;
+
+		sst >> barcode >> contigname >> ht_string >> count_string;
+		ht = HTtoBool(ht_string);
+		if (!parseCount(count_string, count)) {
+			std::cerr << "Could not read the read pair count of barcode `" << barcode
+				<< "' in " << imaptsv << ". --fatal.\n";
+			exit (EXIT_FAILURE);
+		}
+
+		ARCS::CI contigID(contigname, ht);
+
+		imap[barcode][contigID] = count;
+	}
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef _CONTIG_END_FM_INDEX_H_
+#define _CONTIG_END_FM_INDEX_H_ 1
+
+#include "Common/FMIndex.h"
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Contig-end index for `--classify=smem`: an FMIndex of the contig-end
+ * sequences and their reverse complements, so reads of either strand
+ * match. Reads are classified by their maximal exact matches, rather
+ * than by looking up each of their k-mers.
+ */
+class ContigEndFMIndex
+{
+  public:
+
+	/** Maximal exact matches with more occurrences are taken as repeats */
+	static const size_t MAX_OCCURRENCES = 16;
+
+	/** k-mer tallies of a read, as counted by countContigKmers */
+	struct ReadStats
+	{
+		/** k-mer positions without an N */
+		unsigned valid;
+		/** k-mer positions with an N */
+		unsigned bad;
+		/** k-mers found in the contig ends */
+		unsigned found;
+		/** k-mers found on only one contig end */
+		unsigned recorded;
+
+		ReadStats() : valid(0), bad(0), found(0), recorded(0) {}
+	};
+
+	/** Queue contig end `conreci` for build() */
+	void add(const std::string& seqend, int conreci)
+	{
+		m_fm.add(seqend);
+		m_fm.add(reverseComplement(seqend));
+		m_conrecis.push_back(conreci);
+	}
+
+	/** Build the index */
+	void build() { m_fm.build(); }
+
+	/** Return true if the queued contig ends are too large to build */
+	bool tooLarge() const { return m_fm.queued() >= FMIndex::MAX_TEXT; }
+
+	/** the number of indexed bases, separators included */
+	size_t size() const { return m_fm.size(); }
+
+	/** the number of contig ends */
+	size_t numEnds() const { return m_conrecis.size(); }
+
+	/**
+	 * Count the k-mers of `readseq` (at every k_shift-th position) on
+	 * each contig end into `ktrack`, skipping k-mers on several ends.
+	 * Returns the number of k-mer positions in the read.
+	 *
+	 * From each end position, working right to left, the match is
+	 * extended backward as far as it goes. Every k-mer inside a match
+	 * of length k or more occurs in the contig ends; it is credited to
+	 * the one contig end the match occurs on, if there is one. The
+	 * next search starts at the last k-mer end overlapping the base
+	 * that stopped the match, and k-mers already credited are not
+	 * counted again, so each read k-mer that occurs is counted once.
+	 * A k-mer inside a long match that is unique to one contig end is
+	 * taken to be unique too.
+	 */
+	int readHits(const std::string& readseq, int k, int k_shift,
+		std::map<int, int>& ktrack, ReadStats& stats) const
+	{
+		int seqlen = readseq.length();
+		if (seqlen < k)
+			return 0;
+		int totalnumkmers = (seqlen - k) / k_shift + 1;
+
+		/* k-mer positions containing a base other than ACGT */
+		std::vector<int> nonACGT(seqlen + 1, 0);
+		for (int i = 0; i < seqlen; ++i)
+			nonACGT[i + 1] = nonACGT[i] + !isBase(readseq[i]);
+		for (int i = 0; i <= seqlen - k; i += k_shift) {
+			if (nonACGT[i + k] == nonACGT[i])
+				stats.valid++;
+			else
+				stats.bad++;
+		}
+
+		/* k-mer start positions >= covered have been counted */
+		int covered = seqlen - k + 1;
+		for (int end = seqlen; end >= k;) {
+			FMIndex::Interval iv = m_fm.all();
+			int start = end;
+			while (start > 0 && m_fm.extend(iv, readseq[start - 1]))
+				start--;
+
+			if (end - start >= k) {
+				int last = std::min(end - k, covered - 1);
+				int numKmers = countShifted(start, last, k_shift);
+				if (numKmers > 0) {
+					int conreci = endOf(iv);
+					stats.found += numKmers;
+					if (conreci != 0) {
+						ktrack[conreci] += numKmers;
+						stats.recorded += numKmers;
+					}
+				}
+				covered = std::min(covered, start);
+			}
+			if (start == 0)
+				break;
+			end = std::min(end - 1, start - 1 + k);
+		}
+		return totalnumkmers;
+	}
+
+  private:
+
+	static bool isBase(char c)
+	{
+		switch (c) {
+		  case 'A': case 'C': case 'G': case 'T':
+		  case 'a': case 'c': case 'g': case 't':
+			return true;
+		  default:
+			return false;
+		}
+	}
+
+	static std::string reverseComplement(const std::string& seq)
+	{
+		std::string rc(seq.rbegin(), seq.rend());
+		for (size_t i = 0; i < rc.size(); ++i) {
+			switch (rc[i]) {
+			  case 'A': case 'a': rc[i] = 'T'; break;
+			  case 'C': case 'c': rc[i] = 'G'; break;
+			  case 'G': case 'g': rc[i] = 'C'; break;
+			  case 'T': case 't': rc[i] = 'A'; break;
+			  default: rc[i] = 'N'; break;
+			}
+		}
+		return rc;
+	}
+
+	/** the number of multiples of k_shift in [first, last] */
+	static int countShifted(int first, int last, int k_shift)
+	{
+		if (last < first)
+			return 0;
+		return last / k_shift - (first + k_shift - 1) / k_shift + 1;
+	}
+
+	/**
+	 * The contig end that all rows of `iv` lie on, or 0 if they lie
+	 * on more than one or are too many to check.
+	 */
+	int endOf(const FMIndex::Interval& iv) const
+	{
+		if (iv.size() > MAX_OCCURRENCES)
+			return 0;
+		int conreci = 0;
+		for (size_t row = iv.lo; row < iv.hi; ++row) {
+			size_t seq, offset;
+			m_fm.locate(row, seq, offset);
+			int c = m_conrecis[seq / 2];
+			if (conreci != 0 && c != conreci)
+				return 0;
+			conreci = c;
+		}
+		return conreci;
+	}
+
+	FMIndex m_fm;
+	std::vector<int> m_conrecis;
+};
+
+#endif
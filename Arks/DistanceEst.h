@@ -10,6 +10,7 @@
 #include <limits>
 #include <iostream>
 #include <utility>
+#include <vector>
 
 /** min/max distance estimate for a pair contigs */
 struct DistanceEstimate
@@ -103,7 +104,7 @@ void calcDistSamples(const ARCS::IndexMap& imap,
 			std::string contigID;
 			bool isHead;
 			std::tie(contigID, isHead) = contigIt->first;
-			int readPairs = contigIt->second;
+			uint64_t readPairs = contigIt->second;
 
 			/*
 			 * skip contigs with less than required number of
@@ -154,6 +155,19 @@ void calcDistSamples(const ARCS::IndexMap& imap,
 	}
 }
 
+/** Collect the distance samples in contig ID order */
+static inline void sortDistSamples(const DistSampleMap& distSamples,
+	std::vector<DistSampleConstIt>& sorted)
+{
+	for (DistSampleConstIt it = distSamples.begin();
+		it != distSamples.end(); ++it)
+		sorted.push_back(it);
+	std::sort(sorted.begin(), sorted.end(),
+		[](const DistSampleConstIt& a, const DistSampleConstIt& b) {
+			return a->first < b->first;
+		});
+}
+
 /**
  * Build a ordered map from barcode Jaccard index to
  * distance sample. Each distance sample comes from
@@ -165,10 +179,17 @@ static inline void buildJaccardToDist(
 	const DistSampleMap& distSamples,
 	JaccardToDist& jaccardToDist)
 {
-	for (DistSampleConstIt it = distSamples.begin();
-		it != distSamples.end(); ++it)
+	/*
+	 * Visit samples in contig ID order, so that the sample kept
+	 * for tied Jaccard scores does not depend on hash table order.
+	 */
+	std::vector<DistSampleConstIt> sorted;
+	sortDistSamples(distSamples, sorted);
+
+	for (auto sortedIt = sorted.begin(); sortedIt != sorted.end();
+		++sortedIt)
 	{
-		const DistSample& sample = it->second;
+		const DistSample& sample = (*sortedIt)->second;
 		double jaccard = double(sample.barcodesIntersect)
 			/ sample.barcodesUnion;
 		jaccardToDist.insert(
@@ -182,7 +203,7 @@ static inline void buildJaccardToDist(
  * mapping in our calculations.
  */
 static inline bool validBarcodeMapping(unsigned contigLength,
-	int pairs, const ARCS::ArcsParams& params)
+	uint64_t pairs, const ARCS::ArcsParams& params)
 {
 	/*
 	 * skip contigs with less than required number of
@@ -240,7 +261,7 @@ static inline void buildPairToBarcodeStats(
 
 			/* check requirements for calculating distance estimates */
 			unsigned length1 = contigToLength.at(id1);
-			int pairs1 = endIt1->second;
+			uint64_t pairs1 = endIt1->second;
 			if (!validBarcodeMapping(length1, pairs1, params))
 				continue;
 
@@ -257,7 +278,7 @@ static inline void buildPairToBarcodeStats(
 
 				/* check requirements for calculating distance estimates */
 				unsigned length2 = contigToLength.at(endIt2->first.first);
-				int pairs2 = endIt2->second;
+				uint64_t pairs2 = endIt2->second;
 				if (!validBarcodeMapping(length2, pairs2, params))
 					continue;
 
@@ -515,10 +536,11 @@ static inline void writeDistTSV(const std::string& path,
  * Write distance samples to an output stream.  The distance
  * samples record the distance between the head and tail regions
  * of the same contig with associated barcode stats (e.g.
- * barcode intersection size).
+ * barcode intersection size). If `sorted`, the samples are written
+ * in contig ID order rather than hash table order.
  */
 static inline std::ostream& writeDistSamplesTSV(std::ostream& out,
-	const DistSampleMap& distSamples)
+	const DistSampleMap& distSamples, bool sorted = false)
 {
 	out << "contig_id" << '\t'
 		<< "distance" << '\t'
@@ -527,11 +549,19 @@ static inline std::ostream& writeDistSamplesTSV(std::ostream& out,
 		<< "barcodes_union" << '\t'
 		<< "barcodes_intersect" << '\n';
 
-	for (DistSampleConstIt it = distSamples.begin();
-		it != distSamples.end(); ++it)
+	std::vector<DistSampleConstIt> order;
+	if (sorted) {
+		sortDistSamples(distSamples, order);
+	} else {
+		for (DistSampleConstIt it = distSamples.begin();
+			it != distSamples.end(); ++it)
+			order.push_back(it);
+	}
+
+	for (auto orderIt = order.begin(); orderIt != order.end(); ++orderIt)
 	{
-		const std::string& contigID = it->first;
-		const DistSample& sample = it->second;
+		const std::string& contigID = (*orderIt)->first;
+		const DistSample& sample = (*orderIt)->second;
 
 		out << contigID << '\t'
 			<< sample.distance << '\t'
@@ -549,7 +579,7 @@ static inline std::ostream& writeDistSamplesTSV(std::ostream& out,
  * TSV file.
  */
 static inline void writeDistSamplesTSV(const std::string& path,
-	const DistSampleMap& distSamples)
+	const DistSampleMap& distSamples, bool sorted = false)
 {
 	if (path.empty())
 		return;
@@ -557,7 +587,7 @@ static inline void writeDistSamplesTSV(const std::string& path,
 	ofstream samplesOut;
 	samplesOut.open(path.c_str());
 	assert(samplesOut);
-	writeDistSamplesTSV(samplesOut, distSamples);
+	writeDistSamplesTSV(samplesOut, distSamples, sorted);
 	assert(samplesOut);
 	samplesOut.close();
 }
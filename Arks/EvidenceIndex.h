@@ -0,0 +1,371 @@
+#ifndef _EVIDENCE_INDEX_H_
+#define _EVIDENCE_INDEX_H_ 1
+
+#include "Arks/Arks.h"
+#include "Arks/DistanceEst.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Evidence index: the IndexMap turned around into one list of barcodes
+ * (postings) per contig end, for answering questions about a pair of
+ * contigs (`-p query`) from a memory-mapped file, without reading the
+ * whole IndexMap.
+ *
+ * file:     header, contigs, postings, barcodes, Jaccard samples, names
+ * header:   EvidenceHeader, including the options of the run that
+ *           wrote the index, which queries answer for
+ * contigs:  EvidenceContig records, in name order
+ * postings: EvidencePosting records, each contig end's in barcode order
+ * barcodes: EvidenceBarcode records, in name order (the barcode ID)
+ * Jaccard:  EvidenceJaccard records, the intra-contig distance samples
+ *           of distance estimation (`-D`), in Jaccard order
+ * names:    contig and barcode names, not terminated
+ *
+ * Records are 8-byte aligned. Integers are in host byte order.
+ */
+
+static const char EVIDENCE_INDEX_MAGIC[8] = { 'A', 'R', 'K', 'S', 'E', 'V', 'I', '1' };
+static const uint32_t EVIDENCE_INDEX_VERSION = 1;
+
+struct EvidenceHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t numContigs;
+	uint32_t numBarcodes;
+	uint32_t distBinSize;
+	uint64_t numPostings;
+	uint64_t numJaccard;
+	uint64_t namesBytes;
+	int32_t minReads;
+	int32_t minMult;
+	int32_t maxMult;
+	int32_t minLinks;
+	int32_t endLength;
+	float errorPercent;
+};
+
+struct EvidenceContig
+{
+	uint64_t name;
+	uint32_t nameLength;
+	/** contig length, or 0 if the writing run did not read the draft */
+	uint32_t length;
+	/** first posting and number of postings of the head [0] and tail [1] */
+	uint64_t postings[2];
+	uint32_t numPostings[2];
+};
+
+struct EvidencePosting
+{
+	uint32_t barcode;
+	/** read pairs of the barcode on the contig end, saturated at 2^32-1 */
+	uint32_t readPairs;
+};
+
+struct EvidenceBarcode
+{
+	uint64_t name;
+	uint32_t nameLength;
+	int32_t multiplicity;
+};
+
+struct EvidenceJaccard
+{
+	double jaccard;
+	uint32_t distance;
+	uint32_t unused;
+};
+
+[[noreturn]] static inline void evidenceIndexError(const std::string& path, const std::string& what)
+{
+	std::string message = "evidence index `" + path + "': " + what;
+	if (errno != 0)
+		message += std::string(": ") + strerror(errno);
+	throw std::runtime_error(message);
+}
+
+/**
+ * Write the evidence index of `imap` to `path`. Barcodes missing from
+ * `indexMultMap` get multiplicity 0, and contigs missing from
+ * `contigToLength` length 0. The postings are counted per contig end
+ * first, then filled in at their offsets in the mapped file, so that
+ * no copy of the IndexMap is held in memory.
+ */
+static inline void writeEvidenceIndex(const std::string& path,
+	const ARCS::IndexMap& imap,
+	const std::unordered_map<std::string, int>& indexMultMap,
+	const ARCS::ContigToLength& contigToLength,
+	const JaccardToDist& jaccardToDist,
+	const ARCS::ArcsParams& params)
+{
+	/* barcode IDs in name order */
+	std::vector<ARCS::IndexMap::const_iterator> barcodes;
+	for (ARCS::IndexMap::const_iterator it = imap.begin(); it != imap.end(); ++it)
+		barcodes.push_back(it);
+	std::sort(barcodes.begin(), barcodes.end(),
+		[](const ARCS::IndexMap::const_iterator& a,
+				const ARCS::IndexMap::const_iterator& b) {
+			return a->first < b->first;
+		});
+
+	/* contig name => its record, first with the postings of its head and tail counted */
+	std::map<std::string, EvidenceContig> contigs;
+	for (uint32_t id = 0; id < barcodes.size(); ++id) {
+		const ARCS::ScafMap& ends = barcodes[id]->second;
+		for (ARCS::ScafMapConstIt it = ends.begin(); it != ends.end(); ++it)
+			contigs[it->first.first].numPostings[it->first.second ? 0 : 1]++;
+	}
+
+	std::string names;
+	uint64_t numPostings = 0;
+	for (auto it = contigs.begin(); it != contigs.end(); ++it) {
+		EvidenceContig& contig = it->second;
+		contig.name = names.size();
+		contig.nameLength = it->first.size();
+		names += it->first;
+		ARCS::ContigToLengthIt lengthIt = contigToLength.find(it->first);
+		contig.length = lengthIt == contigToLength.end() ? 0 : lengthIt->second;
+		contig.postings[0] = numPostings;
+		numPostings += contig.numPostings[0];
+		contig.postings[1] = numPostings;
+		numPostings += contig.numPostings[1];
+	}
+
+	std::vector<EvidenceBarcode> barcodeRecords(barcodes.size());
+	for (uint32_t id = 0; id < barcodes.size(); ++id) {
+		const std::string& barcode = barcodes[id]->first;
+		EvidenceBarcode& record = barcodeRecords[id];
+		record.name = names.size();
+		record.nameLength = barcode.size();
+		names += barcode;
+		std::unordered_map<std::string, int>::const_iterator multIt
+			= indexMultMap.find(barcode);
+		record.multiplicity = multIt == indexMultMap.end() ? 0 : multIt->second;
+	}
+
+	std::vector<EvidenceJaccard> jaccardRecords;
+	for (JaccardToDistConstIt it = jaccardToDist.begin(); it != jaccardToDist.end(); ++it) {
+		EvidenceJaccard record = { it->first, it->second.distance, 0 };
+		jaccardRecords.push_back(record);
+	}
+
+	EvidenceHeader header;
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, EVIDENCE_INDEX_MAGIC, sizeof header.magic);
+	header.version = EVIDENCE_INDEX_VERSION;
+	header.numContigs = contigs.size();
+	header.numBarcodes = barcodeRecords.size();
+	header.distBinSize = params.dist_bin_size;
+	header.numPostings = numPostings;
+	header.numJaccard = jaccardRecords.size();
+	header.namesBytes = names.size();
+	header.minReads = params.min_reads;
+	header.minMult = params.min_mult;
+	header.maxMult = params.max_mult;
+	header.minLinks = params.min_links;
+	header.endLength = params.end_length;
+	header.errorPercent = params.error_percent;
+
+	size_t size = sizeof header
+		+ contigs.size() * sizeof(EvidenceContig)
+		+ numPostings * sizeof(EvidencePosting)
+		+ barcodeRecords.size() * sizeof(EvidenceBarcode)
+		+ jaccardRecords.size() * sizeof(EvidenceJaccard) + names.size();
+
+	/* reserve the blocks up front, so that a full disk is an error rather than SIGBUS */
+	errno = 0;
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1)
+		evidenceIndexError(path, "cannot create");
+	errno = posix_fallocate(fd, 0, size);
+	if (errno != 0) {
+		close(fd);
+		evidenceIndexError(path, "write failed");
+	}
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		evidenceIndexError(path, "cannot map");
+	}
+	char* data = static_cast<char*>(p);
+
+	memcpy(data, &header, sizeof header);
+	EvidenceContig* contigRecords = reinterpret_cast<EvidenceContig*>(data + sizeof header);
+	EvidencePosting* postings = reinterpret_cast<EvidencePosting*>(contigRecords + contigs.size());
+	EvidenceBarcode* barcodeOut = reinterpret_cast<EvidenceBarcode*>(postings + numPostings);
+	EvidenceJaccard* jaccardOut = reinterpret_cast<EvidenceJaccard*>(barcodeOut + barcodeRecords.size());
+	char* namesOut = reinterpret_cast<char*>(jaccardOut + jaccardRecords.size());
+
+	EvidenceContig* record = contigRecords;
+	for (auto it = contigs.begin(); it != contigs.end(); ++it)
+		*record++ = it->second;
+
+	/* the postings of each contig end, in barcode order; the records in
+	 * `contigs` now serve as the cursors of their ends */
+	for (uint32_t id = 0; id < barcodes.size(); ++id) {
+		const ARCS::ScafMap& ends = barcodes[id]->second;
+		for (ARCS::ScafMapConstIt it = ends.begin(); it != ends.end(); ++it) {
+			EvidenceContig& contig = contigs.find(it->first.first)->second;
+			EvidencePosting posting = { id,
+				(uint32_t)std::min<uint64_t>(it->second, UINT32_MAX) };
+			postings[contig.postings[it->first.second ? 0 : 1]++] = posting;
+		}
+	}
+
+	if (!barcodeRecords.empty())
+		memcpy(barcodeOut, barcodeRecords.data(),
+			barcodeRecords.size() * sizeof(EvidenceBarcode));
+	if (!jaccardRecords.empty())
+		memcpy(jaccardOut, jaccardRecords.data(),
+			jaccardRecords.size() * sizeof(EvidenceJaccard));
+	memcpy(namesOut, names.data(), names.size());
+
+	errno = 0;
+	bool ok = munmap(p, size) == 0;
+	if (close(fd) != 0 || !ok)
+		evidenceIndexError(path, "write failed");
+}
+
+/**
+ * A memory-mapped evidence index. Looking up a contig is a binary
+ * search of the contig records; only the pages of the records and
+ * postings touched by a query are read from disk.
+ */
+class EvidenceIndex
+{
+  public:
+
+	EvidenceIndex(const std::string& path) : m_path(path), m_data(NULL), m_size(0)
+	{
+		errno = 0;
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd == -1)
+			evidenceIndexError(path, "cannot open");
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+			evidenceIndexError(path, "cannot stat");
+		m_size = st.st_size;
+		errno = 0;
+		if (m_size < sizeof(EvidenceHeader))
+			evidenceIndexError(path, "not an evidence index");
+		void* p = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+			evidenceIndexError(path, "cannot map");
+		close(fd);
+		m_data = static_cast<const char*>(p);
+
+		errno = 0;
+		const EvidenceHeader& h = header();
+		if (memcmp(h.magic, EVIDENCE_INDEX_MAGIC, sizeof h.magic) != 0)
+			evidenceIndexError(path, "not an evidence index");
+		if (h.version != EVIDENCE_INDEX_VERSION)
+			evidenceIndexError(path, "unsupported version");
+
+		uint64_t expected = sizeof h
+			+ (uint64_t)h.numContigs * sizeof(EvidenceContig)
+			+ h.numPostings * sizeof(EvidencePosting)
+			+ (uint64_t)h.numBarcodes * sizeof(EvidenceBarcode)
+			+ h.numJaccard * sizeof(EvidenceJaccard) + h.namesBytes;
+		if (expected != m_size)
+			evidenceIndexError(path, "truncated or corrupt");
+
+		m_contigs = reinterpret_cast<const EvidenceContig*>(m_data + sizeof h);
+		m_postings = reinterpret_cast<const EvidencePosting*>(m_contigs + h.numContigs);
+		m_barcodes = reinterpret_cast<const EvidenceBarcode*>(m_postings + h.numPostings);
+		m_jaccard = reinterpret_cast<const EvidenceJaccard*>(m_barcodes + h.numBarcodes);
+		m_names = reinterpret_cast<const char*>(m_jaccard + h.numJaccard);
+	}
+
+	~EvidenceIndex()
+	{
+		munmap(const_cast<char*>(m_data), m_size);
+	}
+
+	const EvidenceHeader& header() const
+	{
+		return *reinterpret_cast<const EvidenceHeader*>(m_data);
+	}
+
+	/** The record of contig `name`, or NULL if no barcode maps to it */
+	const EvidenceContig* findContig(const std::string& name) const
+	{
+		const EvidenceContig* end = m_contigs + header().numContigs;
+		const EvidenceContig* it = std::lower_bound(m_contigs, end, name,
+			[this](const EvidenceContig& c, const std::string& key) {
+				return compareName(c.name, c.nameLength, key) < 0;
+			});
+		if (it == end || compareName(it->name, it->nameLength, name) != 0)
+			return NULL;
+		return it;
+	}
+
+	/** The barcodes of the head (or tail) of `contig`, in ID order */
+	const EvidencePosting* postings(const EvidenceContig& contig, bool head,
+		uint32_t& count) const
+	{
+		unsigned end = head ? 0 : 1;
+		count = contig.numPostings[end];
+		return m_postings + contig.postings[end];
+	}
+
+	std::string barcodeName(uint32_t id) const
+	{
+		const EvidenceBarcode& b = m_barcodes[id];
+		return std::string(m_names + b.name, b.nameLength);
+	}
+
+	int multiplicity(uint32_t id) const
+	{
+		return m_barcodes[id].multiplicity;
+	}
+
+	/** Load the intra-contig distance samples of the writing run */
+	void jaccardToDist(JaccardToDist& out) const
+	{
+		for (uint64_t i = 0; i < header().numJaccard; ++i) {
+			DistSample sample;
+			sample.distance = m_jaccard[i].distance;
+			out.insert(JaccardToDist::value_type(m_jaccard[i].jaccard, sample));
+		}
+	}
+
+  private:
+
+	EvidenceIndex(const EvidenceIndex&);
+	EvidenceIndex& operator=(const EvidenceIndex&);
+
+	int compareName(uint64_t offset, uint32_t length, const std::string& key) const
+	{
+		int c = memcmp(m_names + offset, key.data(), std::min<size_t>(length, key.size()));
+		if (c != 0)
+			return c;
+		return length < key.size() ? -1 : length > key.size() ? 1 : 0;
+	}
+
+	std::string m_path;
+	const char* m_data;
+	size_t m_size;
+	const EvidenceContig* m_contigs;
+	const EvidencePosting* m_postings;
+	const EvidenceBarcode* m_barcodes;
+	const EvidenceJaccard* m_jaccard;
+	const char* m_names;
+};
+
+#endif
@@ -0,0 +1,479 @@
+#ifndef _INCREMENTAL_INDEX_H_
+#define _INCREMENTAL_INDEX_H_ 1
+
+#include "Arks/Arks.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/*
+ * Incremental index state (`--incremental`): the contig ends of a run
+ * with the fingerprint of their sequence and their k-mers, and the
+ * classification of each read pair, so that the next run on an edited
+ * draft and the same reads can reuse both for unchanged contig ends.
+ *
+ * file:     header, ends, inputs, outcomes, hit counts, hits, k-mers, names
+ * header:   IncrementalHeader, including the options the k-mers and
+ *           classifications depend on
+ * ends:     IncrementalEnd records, by contig record index (the first
+ *           is the null contig)
+ * inputs:   IncrementalInput records: the multiplicity and read files,
+ *           with the size, mtime, inode and a hash of the first and
+ *           last blocks of each
+ * outcomes: one uint32_t per read pair, in read order: the contig
+ *           record index the pair was stored under, 0 if none, or
+ *           INCREMENTAL_UNCLASSIFIED
+ * hit counts: one uint32_t per read pair, in read order: the number of
+ *           its hits, with INCREMENTAL_COLLISION set if a k-mer of the
+ *           pair was on more than one contig end
+ * hits:     the contig record indices the k-mers of each read pair were
+ *           found on, one uint32_t each, in read order
+ * k-mers:   the packed k-mers of each end, in end order
+ * names:    contig and file names, not terminated
+ *
+ * Records are 8-byte aligned. Integers are in host byte order.
+ */
+
+static const char INCREMENTAL_MAGIC[8] = { 'A', 'R', 'K', 'S', 'I', 'N', 'C', '1' };
+static const uint32_t INCREMENTAL_VERSION = 3;
+
+/** The outcome of a read pair that was not classified (filtered out) */
+static const uint32_t INCREMENTAL_UNCLASSIFIED = UINT32_MAX;
+
+/** Hit count flag: a k-mer of the read pair had the null contig record */
+static const uint32_t INCREMENTAL_COLLISION = 1u << 31;
+
+struct IncrementalHeader
+{
+	char magic[8];
+	uint32_t version;
+	int32_t kValue;
+	int32_t kShift;
+	int32_t minMult;
+	int32_t maxMult;
+	/** 0 probe, 1 merge, 2 sampled */
+	uint32_t classify;
+	double jIndex;
+	uint64_t numEnds;
+	uint64_t numInputs;
+	uint64_t numPairs;
+	uint64_t numHits;
+	uint64_t kmerBytes;
+	uint64_t namesBytes;
+};
+
+struct IncrementalEnd
+{
+	uint64_t name;
+	uint32_t nameLength;
+	/** 1 for the head of the contig */
+	uint32_t head;
+	/** CityHash64 of the end sequence */
+	uint64_t fingerprint;
+	/** the k-mers of the end, as a byte range of the k-mers section */
+	uint64_t kmers;
+	uint64_t kmersLength;
+};
+
+struct IncrementalInput
+{
+	uint64_t name;
+	uint32_t nameLength;
+	uint32_t reserved;
+	uint64_t size;
+	uint64_t mtime;
+	uint64_t inode;
+	/** CityHash64 of the first and last INCREMENTAL_FINGERPRINT_BLOCK bytes */
+	uint64_t blocks;
+};
+
+/** The bytes at each end of an input file that its fingerprint hashes */
+static const size_t INCREMENTAL_FINGERPRINT_BLOCK = 1 << 20;
+
+/**
+ * An input file of a run, with what tells whether the next run reads
+ * the same file; all zero for a file that is not a regular file (such
+ * as `-'), which matches no other
+ */
+struct IncrementalFile
+{
+	std::string path;
+	uint64_t size, mtime, inode, blocks;
+
+	IncrementalFile() : size(0), mtime(0), inode(0), blocks(0) {}
+
+	bool regular() const { return inode != 0; }
+
+	bool operator==(const IncrementalFile& o) const
+	{
+		return regular() && path == o.path && size == o.size
+			&& mtime == o.mtime && inode == o.inode && blocks == o.blocks;
+	}
+};
+
+/** The state of an `--incremental` run, in memory */
+struct IncrementalState
+{
+	int kValue, kShift, minMult, maxMult;
+	unsigned classify;
+	double jIndex;
+	/** by contig record index; ends[0] is the null contig */
+	std::vector<ARCS::CI> ends;
+	std::vector<uint64_t> fingerprints;
+	/** the packed k-mers of each end, concatenated */
+	std::vector<std::string> kmers;
+	std::vector<IncrementalFile> inputs;
+	std::vector<uint32_t> outcomes;
+	/** per read pair, as in the file */
+	std::vector<uint32_t> hitCounts;
+	std::vector<uint32_t> hits;
+
+	IncrementalState() : kValue(0), kShift(0), minMult(0), maxMult(0),
+		classify(0), jIndex(0) {}
+};
+
+[[noreturn]] static inline void incrementalError(const std::string& path, const char* what)
+{
+	std::string message = "incremental state `" + path + "': " + what;
+	if (errno != 0)
+		message += std::string(": ") + strerror(errno);
+	throw std::runtime_error(message);
+}
+
+static inline void writeIncrementalState(const std::string& path,
+	const IncrementalState& state)
+{
+	std::string names, kmers;
+	std::vector<IncrementalEnd> ends;
+	for (size_t i = 0; i < state.ends.size(); ++i) {
+		IncrementalEnd end = { names.size(), (uint32_t)state.ends[i].first.size(),
+			state.ends[i].second ? 1u : 0u, state.fingerprints[i],
+			kmers.size(), state.kmers[i].size() };
+		names += state.ends[i].first;
+		kmers += state.kmers[i];
+		ends.push_back(end);
+	}
+	std::vector<IncrementalInput> inputs;
+	for (size_t i = 0; i < state.inputs.size(); ++i) {
+		const IncrementalFile& file = state.inputs[i];
+		IncrementalInput input = { names.size(), (uint32_t)file.path.size(), 0,
+			file.size, file.mtime, file.inode, file.blocks };
+		names += file.path;
+		inputs.push_back(input);
+	}
+
+	IncrementalHeader header;
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, INCREMENTAL_MAGIC, sizeof header.magic);
+	header.version = INCREMENTAL_VERSION;
+	header.kValue = state.kValue;
+	header.kShift = state.kShift;
+	header.minMult = state.minMult;
+	header.maxMult = state.maxMult;
+	header.classify = state.classify;
+	header.jIndex = state.jIndex;
+	header.numEnds = ends.size();
+	header.numInputs = inputs.size();
+	header.numPairs = state.outcomes.size();
+	header.numHits = state.hits.size();
+	header.kmerBytes = kmers.size();
+	header.namesBytes = names.size();
+
+	/* written aside and renamed, as the state it replaces may be
+	 * the one being read from */
+	std::string tmp = path + ".tmp";
+	errno = 0;
+	FILE* out = fopen(tmp.c_str(), "wb");
+	if (out == NULL)
+		incrementalError(tmp, "cannot create");
+	std::vector<char> buffer(8 << 20);
+	setvbuf(out, buffer.data(), _IOFBF, buffer.size());
+
+	const std::vector<uint32_t>& outcomes = state.outcomes;
+	bool ok = fwrite(&header, sizeof header, 1, out) == 1;
+	if (ok && !ends.empty())
+		ok = fwrite(ends.data(), sizeof ends[0], ends.size(), out) == ends.size();
+	if (ok && !inputs.empty())
+		ok = fwrite(inputs.data(), sizeof inputs[0], inputs.size(), out) == inputs.size();
+	if (ok && !outcomes.empty())
+		ok = fwrite(outcomes.data(), sizeof outcomes[0], outcomes.size(), out) == outcomes.size();
+	const std::vector<uint32_t>& hitCounts = state.hitCounts;
+	if (ok && !hitCounts.empty())
+		ok = fwrite(hitCounts.data(), sizeof hitCounts[0], hitCounts.size(), out) == hitCounts.size();
+	const std::vector<uint32_t>& hits = state.hits;
+	if (ok && !hits.empty())
+		ok = fwrite(hits.data(), sizeof hits[0], hits.size(), out) == hits.size();
+	if (ok)
+		ok = fwrite(kmers.data(), 1, kmers.size(), out) == kmers.size();
+	if (ok)
+		ok = fwrite(names.data(), 1, names.size(), out) == names.size();
+	if (fclose(out) != 0 || !ok)
+		incrementalError(tmp, "write failed");
+	if (rename(tmp.c_str(), path.c_str()) != 0)
+		incrementalError(path, "cannot replace");
+}
+
+/* Read `n` records of `v` from `in`, for readIncrementalState */
+template <typename T>
+static inline bool readIncrementalRecords(FILE* in, std::vector<T>& v, uint64_t n)
+{
+	v.resize(n);
+	return n == 0 || fread(v.data(), sizeof(T), n, in) == n;
+}
+
+/**
+ * Load the incremental state at `path` into `state`. Returns false if
+ * there is no such file, as on the first run.
+ */
+static inline bool readIncrementalState(const std::string& path,
+	IncrementalState& state)
+{
+	errno = 0;
+	FILE* in = fopen(path.c_str(), "rb");
+	if (in == NULL && errno == ENOENT)
+		return false;
+	if (in == NULL)
+		incrementalError(path, "cannot open");
+	IncrementalHeader h;
+	errno = 0;
+	if (fread(&h, sizeof h, 1, in) != 1
+			|| memcmp(h.magic, INCREMENTAL_MAGIC, sizeof h.magic) != 0)
+		incrementalError(path, "not an incremental state file");
+	if (h.version != INCREMENTAL_VERSION)
+		incrementalError(path, "unsupported version");
+
+	if (fseeko(in, 0, SEEK_END) != 0)
+		incrementalError(path, "cannot seek");
+	uint64_t expected = sizeof h
+		+ h.numEnds * sizeof(IncrementalEnd)
+		+ h.numInputs * sizeof(IncrementalInput)
+		+ 2 * h.numPairs * sizeof(uint32_t) + h.numHits * sizeof(uint32_t)
+		+ h.kmerBytes + h.namesBytes;
+	if ((uint64_t)ftello(in) != expected)
+		incrementalError(path, "truncated or corrupt");
+	fseeko(in, sizeof h, SEEK_SET);
+
+	std::vector<IncrementalEnd> ends;
+	std::vector<IncrementalInput> inputs;
+	std::string kmers(h.kmerBytes, '\0'), names(h.namesBytes, '\0');
+	bool ok = readIncrementalRecords(in, ends, h.numEnds)
+		&& readIncrementalRecords(in, inputs, h.numInputs)
+		&& readIncrementalRecords(in, state.outcomes, h.numPairs)
+		&& readIncrementalRecords(in, state.hitCounts, h.numPairs)
+		&& readIncrementalRecords(in, state.hits, h.numHits)
+		&& (kmers.empty() || fread(&kmers[0], 1, kmers.size(), in) == kmers.size())
+		&& (names.empty() || fread(&names[0], 1, names.size(), in) == names.size());
+	fclose(in);
+	if (!ok)
+		incrementalError(path, "read failed");
+
+	state.kValue = h.kValue;
+	state.kShift = h.kShift;
+	state.minMult = h.minMult;
+	state.maxMult = h.maxMult;
+	state.classify = h.classify;
+	state.jIndex = h.jIndex;
+	state.ends.resize(ends.size());
+	state.fingerprints.resize(ends.size());
+	state.kmers.resize(ends.size());
+	for (size_t i = 0; i < ends.size(); ++i) {
+		const IncrementalEnd& e = ends[i];
+		if (e.name + e.nameLength > names.size()
+				|| e.kmers + e.kmersLength > kmers.size())
+			incrementalError(path, "truncated or corrupt");
+		state.ends[i] = ARCS::CI(names.substr(e.name, e.nameLength), e.head != 0);
+		state.fingerprints[i] = e.fingerprint;
+		state.kmers[i] = kmers.substr(e.kmers, e.kmersLength);
+	}
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		const IncrementalInput& input = inputs[i];
+		if (input.name + input.nameLength > names.size())
+			incrementalError(path, "truncated or corrupt");
+		IncrementalFile file;
+		file.path = names.substr(input.name, input.nameLength);
+		file.size = input.size;
+		file.mtime = input.mtime;
+		file.inode = input.inode;
+		file.blocks = input.blocks;
+		state.inputs.push_back(file);
+	}
+	uint64_t numHits = 0;
+	for (size_t i = 0; i < state.hitCounts.size(); ++i)
+		numHits += state.hitCounts[i] & ~INCREMENTAL_COLLISION;
+	if (numHits != state.hits.size())
+		incrementalError(path, "truncated or corrupt");
+	return true;
+}
+
+/**
+ * The contig ends the k-mers of a read pair were found on when it was
+ * classified, and whether any k-mer was on more than one. Unless one of
+ * those ends or k-mers changes, or the pair has a k-mer that is new to
+ * the index, the pair is classified as before.
+ */
+struct IncrementalHits
+{
+	std::vector<uint32_t> ends;
+	bool collision;
+
+	IncrementalHits() : collision(false) {}
+
+	void clear()
+	{
+		ends.clear();
+		collision = false;
+	}
+
+	/** Add the contig ends of a read's ktrack */
+	void add(const std::map<int, int>& ktrack)
+	{
+		for (std::map<int, int>::const_iterator it = ktrack.begin();
+				it != ktrack.end(); ++it)
+			ends.push_back(it->first);
+	}
+
+	/** Sort the ends and drop those found by both reads */
+	void finish()
+	{
+		std::sort(ends.begin(), ends.end());
+		ends.erase(std::unique(ends.begin(), ends.end()), ends.end());
+	}
+};
+
+/**
+ * A set of contig-end k-mers that finds whether a read has one of them
+ * at a k-mer position of the classifiers (every `k_shift` bases). For
+ * k <= 32, the read's canonical k-mers are rolled as 2-bit words and
+ * tested against a bit filter before the sorted words, so that a read
+ * is scanned without packing each k-mer or probing a hash table.
+ */
+class IncrementalKmerSet
+{
+  public:
+	IncrementalKmerSet(unsigned k, unsigned kShift) : m_k(k), m_kShift(kShift),
+		m_kmerBytes(ARCS::packedKmerBytes(k)), m_words(k <= 32),
+		m_filterMask(0) {}
+
+	/** Add the packed k-mers `kmers` (ReadsProcessor canonical form) */
+	void add(const std::string& kmers)
+	{
+		for (size_t i = 0; i + m_kmerBytes <= kmers.size(); i += m_kmerBytes) {
+			if (m_words)
+				m_keys.push_back(key(kmers.data() + i));
+			else
+				m_strings.insert(kmers.substr(i, m_kmerBytes));
+		}
+	}
+
+	/** Sort the k-mers and build the filter, after the last add */
+	void build()
+	{
+		std::sort(m_keys.begin(), m_keys.end());
+		m_keys.erase(std::unique(m_keys.begin(), m_keys.end()), m_keys.end());
+		size_t bits = 1 << 16;
+		while (bits < 16 * m_keys.size())
+			bits *= 2;
+		m_filter.assign(bits / 64, 0);
+		m_filterMask = bits - 1;
+		for (size_t i = 0; i < m_keys.size(); ++i) {
+			uint64_t bit = filterBit(m_keys[i]);
+			m_filter[bit / 64] |= uint64_t(1) << (bit % 64);
+		}
+	}
+
+	bool empty() const { return m_keys.empty() && m_strings.empty(); }
+	size_t size() const { return m_keys.size() + m_strings.size(); }
+
+	/** Whether read `seq` has one of the k-mers */
+	bool contains(const std::string& seq, ReadsProcessor& proc) const
+	{
+		if (empty())
+			return false;
+		if (!m_words)
+			return containsString(seq, proc);
+
+		const uint64_t mask = m_k == 32 ? ~uint64_t(0)
+			: (uint64_t(1) << (2 * m_k)) - 1;
+		const unsigned rcShift = 2 * (m_k - 1), align = 64 - 2 * m_k;
+		uint64_t fw = 0, rc = 0;
+		size_t valid = 0;
+		for (size_t i = 0; i < seq.size(); ++i) {
+			uint64_t base = baseCode(seq[i]);
+			if (base > 3) {
+				valid = 0;
+				continue;
+			}
+			fw = ((fw << 2) | base) & mask;
+			rc = (rc >> 2) | ((3 - base) << rcShift);
+			if (++valid < m_k || (i + 1 - m_k) % m_kShift != 0)
+				continue;
+			uint64_t word = std::min(fw, rc) << align;
+			uint64_t bit = filterBit(word);
+			if ((m_filter[bit / 64] >> (bit % 64) & 1) != 0
+					&& std::binary_search(m_keys.begin(), m_keys.end(), word))
+				return true;
+		}
+		return false;
+	}
+
+  private:
+	/** the packed k-mer as a big-endian word, left aligned, as PrefixKmerIndex */
+	uint64_t key(const char* kmer) const
+	{
+		uint64_t word = 0;
+		for (unsigned b = 0; b < m_kmerBytes; ++b)
+			word |= (uint64_t)(unsigned char)kmer[b] << (56 - 8 * b);
+		return word;
+	}
+
+	uint64_t filterBit(uint64_t word) const
+	{
+		word ^= word >> 33;
+		word *= 0xff51afd7ed558ccdULL;
+		word ^= word >> 33;
+		return word & m_filterMask;
+	}
+
+	/** the 2-bit code of a base, as ReadsProcessor packs it, or 4 */
+	static uint64_t baseCode(char c)
+	{
+		switch (c) {
+		case 'A': case 'a': return 0;
+		case 'C': case 'c': return 1;
+		case 'G': case 'g': return 2;
+		case 'T': case 't': return 3;
+		default: return 4;
+		}
+	}
+
+	/* k > 32: pack each k-mer and look it up */
+	bool containsString(const std::string& seq, ReadsProcessor& proc) const
+	{
+		int seqlen = seq.length();
+		for (int i = 0; i <= seqlen - (int)m_k; i += m_kShift) {
+			const unsigned char* kmer = proc.prepSeq(seq, i);
+			if (kmer != NULL && m_strings.count(std::string(
+					reinterpret_cast<const char*>(kmer), m_kmerBytes)) != 0)
+				return true;
+		}
+		return false;
+	}
+
+	unsigned m_k, m_kShift, m_kmerBytes;
+	bool m_words;
+	std::vector<uint64_t> m_keys;
+	std::unordered_set<std::string> m_strings;
+	std::vector<uint64_t> m_filter;
+	uint64_t m_filterMask;
+};
+
+#endif
+
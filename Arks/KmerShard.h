@@ -0,0 +1,233 @@
+#ifndef _KMER_SHARD_H_
+#define _KMER_SHARD_H_ 1
+
+#include "Arks/Arks.h"
+#include "Common/Socket.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Wire protocol between an aligning ARKS process (the coordinator)
+ * and `-p serve` workers that each hold one partition (shard) of the
+ * contig-end k-mer index. All integers are 32-bit, network byte order.
+ *
+ * request:      type, count, then `count` k-mers of ceil(k/4) bytes each;
+ *               at most SHARD_MAX_LOOKUP k-mers per request
+ * HELLO reply:  shard id, number of shards, k
+ * LOOKUP reply: `count` contig record indices, one per k-mer
+ *               (0 = k-mer shared by several contig ends,
+ *               SHARD_KMER_ABSENT = k-mer not in the index)
+ */
+enum ShardRequestType { SHARD_HELLO = 1, SHARD_LOOKUP = 2 };
+
+static const int32_t SHARD_KMER_ABSENT = -1;
+
+/** most k-mers in one LOOKUP request; larger lookups are split */
+static const uint32_t SHARD_MAX_LOOKUP = 1 << 20;
+
+/** Answer requests on one coordinator connection until it closes */
+static inline void serveShardConnection(int fd, const ARCS::ContigKMap& kmap,
+	ARCS::IndexPartition partition, int k)
+{
+	const unsigned kmerBytes = ARCS::packedKmerBytes(k);
+	std::vector<char> kmers;
+	std::vector<uint32_t> reply;
+
+	for (;;) {
+		uint32_t header[2];
+		if (!readFully(fd, header, sizeof header))
+			break;
+		uint32_t type = ntohl(header[0]);
+		uint32_t count = ntohl(header[1]);
+
+		if (type == SHARD_HELLO) {
+			uint32_t hello[3] = { htonl(partition.id),
+				htonl(partition.count), htonl(k) };
+			if (!writeFully(fd, hello, sizeof hello))
+				break;
+			continue;
+		}
+		if (type != SHARD_LOOKUP)
+			break;
+		if (count > SHARD_MAX_LOOKUP) {
+			std::cerr << "arks: warning: closing a connection that asked for "
+				<< count << " k-mers in one lookup (at most "
+				<< SHARD_MAX_LOOKUP << ")\n";
+			break;
+		}
+
+		kmers.resize((size_t)count * kmerBytes);
+		if (!readFully(fd, kmers.data(), kmers.size()))
+			break;
+
+		reply.resize(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			std::string kmer(&kmers[(size_t)i * kmerBytes], kmerBytes);
+			auto it = kmap.find(kmer);
+			int32_t conreci = it == kmap.end() ? SHARD_KMER_ABSENT : it->second;
+			reply[i] = htonl((uint32_t)conreci);
+		}
+		if (!writeFully(fd, reply.data(), reply.size() * sizeof reply[0]))
+			break;
+	}
+	close(fd);
+}
+
+/**
+ * Serve lookups against one shard of the contig-end k-mer index
+ * on `address`, one thread per coordinator connection. Runs until
+ * the process is killed.
+ */
+static inline void serveKmerShard(const ARCS::ContigKMap& kmap,
+	const ARCS::IndexPartition& partition, int k,
+	const std::string& address)
+{
+	int listenfd = listenOn(address);
+	if (listenfd == -1)
+		throw std::runtime_error("cannot listen on `" + address + "': "
+			+ strerror(errno));
+
+	std::cout << "Serving k-mer index shard " << partition.id + 1
+		<< " of " << partition.count << " (" << kmap.size()
+		<< " k-mers) on " << address << std::endl;
+
+	for (;;) {
+		int fd = acceptConnection(listenfd);
+		if (fd == -1) {
+			std::cerr << "arks: warning: accept failed on `" << address
+				<< "': " << strerror(errno) << "\n";
+			continue;
+		}
+		std::thread(serveShardConnection, fd, std::cref(kmap),
+			partition, k).detach();
+	}
+}
+
+/**
+ * Coordinator side of a sharded k-mer index: one connection to
+ * each shard worker. Not thread safe; use one client per thread.
+ */
+class KmerShardClient
+{
+  public:
+
+	/** Connect to the shard workers, given in shard ID order */
+	KmerShardClient(const std::vector<std::string>& addresses, int k) :
+		m_addresses(addresses), m_kmerBytes(ARCS::packedKmerBytes(k)),
+		m_positions(addresses.size()), m_requests(addresses.size())
+	{
+		for (unsigned i = 0; i < addresses.size(); ++i) {
+			int fd = connectTo(addresses[i]);
+			if (fd == -1)
+				throw std::runtime_error("cannot connect to k-mer index shard `"
+					+ addresses[i] + "': " + strerror(errno));
+			m_fds.push_back(fd);
+
+			uint32_t hello[2] = { htonl(SHARD_HELLO), 0 };
+			uint32_t reply[3];
+			if (!writeFully(fd, hello, sizeof hello)
+					|| !readFully(fd, reply, sizeof reply))
+				lost(i);
+			if (ntohl(reply[0]) != i || ntohl(reply[1]) != addresses.size()
+					|| (int)ntohl(reply[2]) != k) {
+				std::ostringstream ss;
+				ss << "`" << addresses[i] << "' serves shard "
+					<< ntohl(reply[0]) + 1 << " of " << ntohl(reply[1])
+					<< " with k=" << ntohl(reply[2]) << ", but expected shard "
+					<< i + 1 << " of " << addresses.size() << " with k=" << k
+					<< ". List --shards in shard ID order.";
+				throw std::runtime_error(ss.str());
+			}
+		}
+	}
+
+	~KmerShardClient()
+	{
+		for (unsigned i = 0; i < m_fds.size(); ++i)
+			close(m_fds[i]);
+	}
+
+	/**
+	 * Look up packed k-mers on their owning shards. Sets `conrecis[i]`
+	 * to the contig record index of `kmers[i]`, or SHARD_KMER_ABSENT.
+	 * Each shard gets one request per SHARD_MAX_LOOKUP k-mers.
+	 */
+	void lookup(const std::vector<std::string>& kmers,
+		std::vector<int>& conrecis)
+	{
+		conrecis.resize(kmers.size());
+		for (size_t first = 0; first < kmers.size(); first += SHARD_MAX_LOOKUP)
+			lookup(kmers, first, std::min(kmers.size(), first + SHARD_MAX_LOOKUP),
+				conrecis);
+	}
+
+  private:
+
+	/** Look up `kmers[first]` to `kmers[last - 1]` */
+	void lookup(const std::vector<std::string>& kmers, size_t first,
+		size_t last, std::vector<int>& conrecis)
+	{
+		unsigned numShards = m_fds.size();
+		for (unsigned s = 0; s < numShards; ++s) {
+			m_positions[s].clear();
+			m_requests[s].assign(2 * sizeof(uint32_t), '\0');
+		}
+
+		for (size_t i = first; i < last; ++i) {
+			assert(kmers[i].size() == m_kmerBytes);
+			unsigned s = ARCS::kmerPartition(kmers[i], numShards);
+			m_positions[s].push_back(i);
+			m_requests[s] += kmers[i];
+		}
+
+		/* send all requests before waiting on any reply */
+		for (unsigned s = 0; s < numShards; ++s) {
+			if (m_positions[s].empty())
+				continue;
+			uint32_t header[2] = { htonl(SHARD_LOOKUP),
+				htonl((uint32_t)m_positions[s].size()) };
+			memcpy(&m_requests[s][0], header, sizeof header);
+			if (!writeFully(m_fds[s], m_requests[s].data(), m_requests[s].size()))
+				lost(s);
+		}
+
+		for (unsigned s = 0; s < numShards; ++s) {
+			if (m_positions[s].empty())
+				continue;
+			m_reply.resize(m_positions[s].size());
+			if (!readFully(m_fds[s], m_reply.data(),
+					m_reply.size() * sizeof m_reply[0]))
+				lost(s);
+			for (size_t j = 0; j < m_reply.size(); ++j)
+				conrecis[m_positions[s][j]] = (int32_t)ntohl(m_reply[j]);
+		}
+	}
+
+	[[noreturn]] void lost(unsigned shard) const
+	{
+		throw std::runtime_error("lost connection to k-mer index shard `"
+			+ m_addresses[shard] + "'");
+	}
+
+	std::vector<std::string> m_addresses;
+	std::vector<int> m_fds;
+	unsigned m_kmerBytes;
+	std::vector<std::vector<size_t> > m_positions;
+	std::vector<std::string> m_requests;
+	std::vector<uint32_t> m_reply;
+};
+
+#endif
@@ -0,0 +1,400 @@
+#ifndef _MEMORY_BUDGET_H_
+#define _MEMORY_BUDGET_H_ 1
+
+#include "Arks/Arks.h"
+#include "Common/StringUtil.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Approximate heap footprint (bytes) of one entry in each of the
+ * major ARKS data structures. These are deliberately on the high
+ * side, so that a plan that "fits" really does fit.
+ */
+
+/** one k-mer => contig end entry in ContigKMap (key string + value + table overhead) */
+static const size_t KMAP_BYTES_PER_KMER = 48;
+/** extra cost per k-mer of reserving the whole ContigKMap table up front */
+static const size_t KMAP_PRESIZE_BYTES_PER_KMER = 8;
+/** one k-mer occurrence in PrefixKmerIndex while it is sorted (two copies) */
+static const size_t SORTED_KMAP_BYTES_PER_KMER = 32;
+/** one (contig end => read pair count) node of a ScafMap */
+static const size_t IMAP_BYTES_PER_ENTRY = 96;
+/** one contig pair => orientation counts entry of PairMap */
+static const size_t PMAP_BYTES_PER_PAIR = 176;
+/** one contig pair => barcode stats entry of PairToBarcodeStats */
+static const size_t BARCODE_STATS_BYTES_PER_PAIR = 144;
+/** one parsed read pair in a read buffer (two 150 bp reads, names and barcodes) */
+static const size_t READ_PAIR_BYTES = 768;
+/** the saved k-mer hits of one read pair, decoded and encoded, between index partitions */
+static const size_t PARTIAL_HIT_BYTES_PER_PAIR = 128;
+
+/**
+ * Parse a memory size such as "512M", "16G" or "16GB".
+ * A bare number is interpreted as bytes. Return false
+ * if the string is not a valid size.
+ */
+static inline bool parseMemorySize(const std::string& s, size_t& bytes)
+{
+	if (s.empty())
+		return false;
+
+	char* end = NULL;
+	double n = strtod(s.c_str(), &end);
+	if (end == s.c_str() || n < 0)
+		return false;
+
+	std::string suffix(end);
+	if (suffix.size() == 2 && toupper(suffix[1]) == 'B')
+		suffix.resize(1);
+
+	double scale = 1;
+	if (suffix.empty()) {
+		scale = 1;
+	} else if (suffix.size() == 1) {
+		switch (toupper(suffix[0])) {
+		case 'K': scale = 1024.0; break;
+		case 'M': scale = 1024.0 * 1024; break;
+		case 'G': scale = 1024.0 * 1024 * 1024; break;
+		case 'T': scale = 1024.0 * 1024 * 1024 * 1024; break;
+		default: return false;
+		}
+	} else {
+		return false;
+	}
+
+	bytes = (size_t)(n * scale);
+	return true;
+}
+
+/**
+ * Representation choices made by the memory budget
+ * controller before each stage.
+ */
+struct MemoryPlan
+{
+	/**
+	 * true: reserve the full ContigKMap table before inserting
+	 * k-mers (fewer rehashes, faster build);
+	 * false: grow the table on demand (smaller peak)
+	 */
+	bool presizeKmerMap;
+
+	/**
+	 * number of k-mer space partitions; the index for each
+	 * is built and queried in a separate pass over the reads
+	 */
+	unsigned indexPartitions;
+
+	MemoryPlan() : presizeKmerMap(true), indexPartitions(1) {}
+};
+
+/**
+ * Read pairs held in memory beside the k-mer index while the reads
+ * are aligned
+ */
+struct AlignmentBuffers
+{
+	/** read pairs parsed ahead in the read buffers or being classified */
+	size_t readPairs;
+	/** read pairs whose saved k-mer hits are in memory, with partitions */
+	size_t hitPairs;
+
+	AlignmentBuffers() : readPairs(0), hitPairs(0) {}
+
+	/** Return the bytes of the buffers of a run with `partitions` passes */
+	size_t bytes(unsigned partitions) const
+	{
+		return readPairs * READ_PAIR_BYTES
+			+ (partitions > 1 ? hitPairs * PARTIAL_HIT_BYTES_PER_PAIR : 0);
+	}
+};
+
+/**
+ * Tracks the `--max_memory` limit and checks stage
+ * estimates against it. A limit of 0 means unlimited.
+ */
+class MemoryBudget
+{
+  public:
+
+	MemoryBudget(size_t limit) : m_limit(limit) {}
+
+	bool unlimited() const { return m_limit == 0; }
+
+	size_t limit() const { return m_limit; }
+
+	/**
+	 * Return true if `estimate` more bytes fit in the budget,
+	 * given that `resident` bytes are already in use.
+	 */
+	bool fits(size_t resident, size_t estimate) const
+	{
+		return unlimited() || resident + estimate <= m_limit;
+	}
+
+	/** Log the estimate for a stage and the decision that was made */
+	void log(const std::string& stage, size_t resident,
+		size_t estimate, const std::string& decision) const
+	{
+		std::cout << "Memory budget: " << stage
+			<< ": estimated " << toSI(estimate) << "B"
+			<< ", resident " << toSI(resident) << "B"
+			<< ", limit " << (unlimited() ? std::string("none")
+				: toSI(m_limit) + "B")
+			<< " => " << decision << std::endl;
+	}
+
+	/**
+	 * Fail the run, by throwing std::runtime_error, because no
+	 * representation for `stage` fits within the budget.
+	 */
+	[[noreturn]] void fail(const std::string& stage, size_t resident,
+		size_t estimate, const std::string& hint) const
+	{
+		std::string message = stage + " needs an estimated "
+			+ toSI(estimate) + "B on top of " + toSI(resident)
+			+ "B already resident, which exceeds --max_memory="
+			+ toSI(m_limit) + "B.";
+		if (!hint.empty())
+			message += "\narks: " + hint;
+		throw std::runtime_error(message);
+	}
+
+  private:
+
+	size_t m_limit;
+};
+
+/** upper limit on the number of k-mer index partitions (passes over the reads) */
+static const unsigned MAX_INDEX_PARTITIONS = 256;
+
+/**
+ * Return the smallest number of k-mer partitions whose index, of
+ * `bytesPerKmer` for each of `numKmers` k-mers, fits in the budget
+ * along with the alignment `buffers`
+ */
+static inline unsigned fitIndexPartitions(const MemoryBudget& budget,
+	size_t resident, size_t numKmers, size_t bytesPerKmer,
+	const AlignmentBuffers& buffers)
+{
+	unsigned partitions = 1;
+	while (!budget.fits(resident, (numKmers + partitions - 1) / partitions
+			* bytesPerKmer + buffers.bytes(partitions))
+		&& partitions < MAX_INDEX_PARTITIONS)
+		partitions++;
+	return partitions;
+}
+
+/**
+ * Choose a ContigKMap representation for `numKmers` contig-end
+ * k-mers (an upper bound, before duplicate removal). When even the
+ * compact index does not fit, split k-mer space into the smallest
+ * number of partitions whose index does. `partitions` > 1 forces
+ * that number of partitions (`--index_partitions`). `sorted` selects
+ * the PrefixKmerIndex, which has no presized variant. The read
+ * `buffers` of the alignment are counted with the index.
+ */
+static inline void planKmerMap(const MemoryBudget& budget,
+	size_t resident, size_t numKmers, unsigned partitions,
+	bool sorted, const AlignmentBuffers& buffers, MemoryPlan& plan)
+{
+	size_t bytesPerKmer = sorted ? SORTED_KMAP_BYTES_PER_KMER
+		: KMAP_BYTES_PER_KMER;
+
+	if (partitions <= 1)
+		partitions = fitIndexPartitions(budget, resident, numKmers,
+			bytesPerKmer, buffers);
+
+	size_t perPartition = (numKmers + partitions - 1) / partitions;
+	size_t buffered = buffers.bytes(partitions);
+	size_t compact = perPartition * bytesPerKmer + buffered;
+	size_t fast = sorted ? compact
+		: compact + perPartition * KMAP_PRESIZE_BYTES_PER_KMER;
+
+	plan.indexPartitions = partitions;
+	std::string passes;
+	if (partitions > 1)
+		passes = ", " + std::to_string(partitions)
+			+ " k-mer partitions (one pass over the reads each)";
+	if (buffered > 0)
+		passes += ", with " + toSI(buffered) + "B of read and k-mer hit buffers";
+
+	if (sorted && budget.fits(resident, compact)) {
+		plan.presizeKmerMap = false;
+		budget.log("contig-end k-mer index", resident, compact,
+			"sorted prefix-bucketed index" + passes);
+	} else if (budget.fits(resident, fast)) {
+		plan.presizeKmerMap = true;
+		budget.log("contig-end k-mer index", resident, fast,
+			"fast (presized) index" + passes);
+	} else if (budget.fits(resident, compact)) {
+		plan.presizeKmerMap = false;
+		budget.log("contig-end k-mer index", resident, compact,
+			"compact (grow on demand) index" + passes);
+	} else {
+		budget.fail("the contig-end k-mer index (with "
+			+ toSI(buffered) + "B of read and k-mer hit buffers)",
+			resident, compact,
+			"Try a smaller end length (-e), a larger k-mer shift (-g),"
+			" more --index_partitions, a smaller --read_batch or fewer"
+			" threads (-t), or a larger --max_memory.");
+	}
+}
+
+/** Return the number of (barcode, contig end) entries in `imap` */
+static inline size_t countIndexMapEntries(const ARCS::IndexMap& imap)
+{
+	size_t entries = 0;
+	for (auto it = imap.begin(); it != imap.end(); ++it)
+		entries += it->second.size();
+	return entries;
+}
+
+/** 64-bit finalizer from MurmurHash3, used to mix pair hashes */
+static inline uint64_t mixHash64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/**
+ * Contig pairs (barcode, contig, contig) that estimateCandidatePairs
+ * enumerates, over a sample of the barcodes, to estimate how many are
+ * repeats of a pair seen under another barcode.
+ */
+static const uint64_t PAIR_ESTIMATE_SAMPLE = 1 << 22;
+
+/** Return the number of distinct contigs of a barcode's ScafMap */
+static inline uint64_t countScafMapContigs(const ARCS::ScafMap& scafMap)
+{
+	uint64_t n = 0;
+	const std::string* last = NULL;
+	for (auto o = scafMap.begin(); o != scafMap.end(); ++o) {
+		if (last == NULL || o->first.first != *last)
+			++n;
+		last = &o->first.first;
+	}
+	return n;
+}
+
+/**
+ * Estimate the number of distinct contig pairs that `pairContigs`
+ * will create from `imap`, counting only barcodes within the `-m`
+ * multiplicity range. The pairs of each barcode are counted directly
+ * as n(n-1)/2; the fraction of them that are distinct is measured with
+ * a k-minimum-values sketch over a sample of the barcodes holding about
+ * PAIR_ESTIMATE_SAMPLE pairs, so the work and memory are bounded. A
+ * sample sees fewer repeats than the whole, so the estimate errs high.
+ */
+static inline size_t estimateCandidatePairs(const ARCS::IndexMap& imap,
+	const std::unordered_map<std::string, int>& indexMultMap,
+	const ARCS::ArcsParams& params)
+{
+	std::vector<const ARCS::IndexMap::value_type*> barcodes;
+	std::vector<uint64_t> barcodePairs;
+	uint64_t totalPairs = 0;
+	for (auto it = imap.begin(); it != imap.end(); ++it) {
+		auto multIt = indexMultMap.find(it->first);
+		if (multIt == indexMultMap.end())
+			continue;
+		int indexMult = multIt->second;
+		if (indexMult < params.min_mult || indexMult > params.max_mult)
+			continue;
+		uint64_t n = countScafMapContigs(it->second);
+		if (n < 2)
+			continue;
+		barcodes.push_back(&*it);
+		barcodePairs.push_back(n * (n - 1) / 2);
+		totalPairs += barcodePairs.back();
+	}
+	if (totalPairs == 0)
+		return 0;
+
+	/* sample barcodes by hash, so that a rerun gives the same estimate */
+	double rate = std::min(1.0, double(PAIR_ESTIMATE_SAMPLE) / totalPairs);
+	uint64_t threshold = rate >= 1.0 ? std::numeric_limits<uint64_t>::max()
+		: uint64_t(rate * double(std::numeric_limits<uint64_t>::max()));
+
+	const size_t k = 1024;
+	std::set<uint64_t> sketch;
+	std::vector<uint64_t> contigHashes;
+	uint64_t sampledPairs = 0;
+	for (size_t b = 0; b < barcodes.size(); ++b) {
+		const std::string& barcode = barcodes[b]->first;
+		if (mixHash64(CityHash64(barcode.c_str(), barcode.size())) > threshold)
+			continue;
+		sampledPairs += barcodePairs[b];
+
+		contigHashes.clear();
+		const ARCS::ScafMap& scafMap = barcodes[b]->second;
+		for (auto o = scafMap.begin(); o != scafMap.end(); ++o) {
+			const std::string& id = o->first.first;
+			contigHashes.push_back(CityHash64(id.c_str(), id.size()));
+		}
+		std::sort(contigHashes.begin(), contigHashes.end());
+		contigHashes.erase(std::unique(contigHashes.begin(),
+			contigHashes.end()), contigHashes.end());
+
+		for (size_t i = 0; i < contigHashes.size(); ++i) {
+			for (size_t j = i + 1; j < contigHashes.size(); ++j) {
+				uint64_t h = mixHash64(contigHashes[i]
+					^ mixHash64(contigHashes[j]));
+				if (sketch.size() < k) {
+					sketch.insert(h);
+				} else if (h < *sketch.rbegin()
+					&& sketch.find(h) == sketch.end()) {
+					sketch.erase(--sketch.end());
+					sketch.insert(h);
+				}
+			}
+		}
+	}
+	if (sampledPairs == 0)
+		return totalPairs;
+
+	/* fewer than k distinct pairs: the sketch holds all of them */
+	double sampledDistinct = sketch.size();
+	if (sketch.size() >= k) {
+		double kthSmallest = double(*sketch.rbegin())
+			/ double(std::numeric_limits<uint64_t>::max());
+		sampledDistinct = (k - 1) / kthSmallest;
+	}
+	double distinctRate = std::min(1.0, sampledDistinct / sampledPairs);
+	return (size_t)(distinctRate * totalPairs);
+}
+
+/**
+ * Check that the pair counting (and optionally distance estimation)
+ * stages fit in the memory budget; abort if they do not. Pair counts
+ * are always held in memory: this stage is checked, never spilled.
+ */
+static inline void planPairing(const MemoryBudget& budget,
+	size_t resident, size_t numPairs, bool distanceEst)
+{
+	size_t estimate = numPairs * PMAP_BYTES_PER_PAIR;
+	if (distanceEst)
+		estimate += numPairs * BARCODE_STATS_BYTES_PER_PAIR;
+
+	if (budget.fits(resident, estimate)) {
+		budget.log("contig pairing", resident, estimate,
+			"in-memory pair counts");
+	} else {
+		budget.fail("pairing contigs", resident, estimate,
+			"Try a narrower multiplicity range (-m), a larger -c,"
+			" or a larger --max_memory.");
+	}
+}
+
+#endif
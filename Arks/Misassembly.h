@@ -0,0 +1,129 @@
+#ifndef _MISASSEMBLY_H_
+#define _MISASSEMBLY_H_ 1
+
+#include "Arks/Arks.h"
+#include <algorithm>
+#include <cassert>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Misassembly detection (`-p cut`, `--cut`), after Tigmint: reads are
+ * classified to fixed-size windows along the contigs, the reads of a
+ * barcode on a contig are grouped into molecules, and a contig is cut
+ * where too few molecules span its windows.
+ */
+
+/** A read of barcode `barcode` classified to a window of contig `contig` */
+struct WindowHit
+{
+	uint32_t contig;
+	uint32_t barcode;
+	uint32_t window;
+
+	bool operator<(const WindowHit& o) const
+	{
+		if (contig != o.contig)
+			return contig < o.contig;
+		if (barcode != o.barcode)
+			return barcode < o.barcode;
+		return window < o.window;
+	}
+};
+
+/** A run of poorly spanned windows, to be cut at `cut` (bp) */
+struct Breakpoint
+{
+	uint32_t contig;
+	/** the run, in bp: [start, end) */
+	unsigned start, end;
+	unsigned cut;
+	/** the fewest molecules spanning a window of the run */
+	unsigned minSpanning;
+};
+
+/**
+ * Count the molecules spanning each window of each contig. The hits
+ * of a barcode on a contig are split into molecules where consecutive
+ * hits are more than `cut_dist` apart; molecules shorter than
+ * `cut_min_size` are dropped. A molecule spans the windows strictly
+ * between its first and last. Sorts `hits`.
+ */
+static inline void countSpanningMolecules(std::vector<WindowHit>& hits,
+	const std::vector<unsigned>& numWindows, const ARCS::ArcsParams& params,
+	std::vector<std::vector<unsigned> >& spanning, size_t& numMolecules)
+{
+	std::sort(hits.begin(), hits.end());
+
+	/* difference arrays, summed below */
+	spanning.resize(numWindows.size());
+	for (size_t i = 0; i < numWindows.size(); ++i)
+		spanning[i].assign(numWindows[i] + 1, 0);
+
+	const uint64_t window = params.cut_window;
+	numMolecules = 0;
+	for (size_t i = 0; i < hits.size();) {
+		size_t j = i + 1;
+		while (j < hits.size() && hits[j].contig == hits[i].contig
+				&& hits[j].barcode == hits[i].barcode
+				&& (uint64_t)(hits[j].window - hits[j - 1].window) * window
+					<= (uint64_t)params.cut_dist)
+			j++;
+
+		uint32_t first = hits[i].window, last = hits[j - 1].window;
+		if ((last - first + 1) * window >= params.cut_min_size && last > first + 1) {
+			std::vector<unsigned>& counts = spanning[hits[i].contig];
+			counts[first + 1]++;
+			counts[last]--;
+			numMolecules++;
+		}
+		i = j;
+	}
+
+	for (size_t c = 0; c < spanning.size(); ++c) {
+		std::vector<unsigned>& counts = spanning[c];
+		for (size_t w = 1; w < counts.size(); ++w)
+			counts[w] += counts[w - 1];
+		counts.pop_back();
+	}
+}
+
+/**
+ * Find the runs of windows spanned by fewer than `cut_span` molecules
+ * that lie between well spanned windows; the ends of a contig, which
+ * molecules can not span, are never cut. Each run is cut at its middle.
+ */
+static inline void findBreakpoints(
+	const std::vector<std::vector<unsigned> >& spanning,
+	const std::vector<unsigned>& lengths, const ARCS::ArcsParams& params,
+	std::vector<Breakpoint>& breakpoints)
+{
+	const unsigned window = params.cut_window;
+	for (uint32_t c = 0; c < spanning.size(); ++c) {
+		const std::vector<unsigned>& counts = spanning[c];
+		bool spanned = false;
+		for (size_t w = 0; w < counts.size();) {
+			if (counts[w] >= params.cut_span) {
+				spanned = true;
+				w++;
+				continue;
+			}
+			size_t end = w;
+			unsigned minSpanning = counts[w];
+			while (end < counts.size() && counts[end] < params.cut_span)
+				minSpanning = std::min(minSpanning, counts[end++]);
+			if (spanned && end < counts.size()) {
+				Breakpoint bp;
+				bp.contig = c;
+				bp.start = w * window;
+				bp.end = std::min<unsigned>(end * window, lengths[c]);
+				bp.cut = (bp.start + bp.end) / 2;
+				bp.minSpanning = minSpanning;
+				breakpoints.push_back(bp);
+			}
+			w = end;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef _PAIR_CHECKPOINT_H_
+#define _PAIR_CHECKPOINT_H_ 1
+
+#include "Arks/Arks.h"
+#include "Arks/DistanceEst.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Pair-count checkpoint: the output of pairContigs (HH/HT/TH/TT barcode
+ * counts of each contig pair) and, with distance estimation (`-D`), the
+ * barcode stats of the pairs and the intra-contig distance samples, so
+ * that `-p pairs` can rebuild the graph under other `-l`, `-r` and `-d`
+ * without the IndexMap.
+ *
+ * file:     header, contigs, pairs, pair stats, distance samples, names
+ * header:   PairCheckpointHeader, including the options the counts
+ *           depend on
+ * contigs:  PairCheckpointContig records, in name order (the contig ID)
+ * pairs:    PairCheckpointPair records, in (contig1, contig2) order
+ * stats:    with `-D`, one PairCheckpointStats record per pair
+ * samples:  with `-D`, PairCheckpointSample records, in contig order
+ * names:    contig names, not terminated
+ *
+ * Records are 8-byte aligned. Integers are in host byte order.
+ */
+
+static const char PAIR_CHECKPOINT_MAGIC[8] = { 'A', 'R', 'K', 'S', 'P', 'C', 'P', '1' };
+static const uint32_t PAIR_CHECKPOINT_VERSION = 2;
+
+/** PairCheckpointHeader flags: the file has pair stats and distance samples */
+static const uint32_t PAIR_CHECKPOINT_DISTANCES = 1;
+
+struct PairCheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t numContigs;
+	uint64_t numPairs;
+	uint64_t numSamples;
+	uint64_t namesBytes;
+	int32_t minReads;
+	int32_t minMult;
+	int32_t maxMult;
+	int32_t endLength;
+	float errorPercent;
+	uint32_t reserved;
+};
+
+struct PairCheckpointContig
+{
+	uint64_t name;
+	uint32_t nameLength;
+	uint32_t reserved;
+};
+
+struct PairCheckpointPair
+{
+	uint32_t contig1;
+	uint32_t contig2;
+	/** links per orientation: HH, HT, TH, TT */
+	uint64_t counts[4];
+};
+
+struct PairCheckpointStats
+{
+	/** 0 if buildPairToBarcodeStats found no stats for the pair */
+	uint32_t present;
+	uint32_t reserved;
+	/** barcodes1, barcodes2, barcodesUnion and barcodesIntersect per orientation */
+	uint32_t stats[NUM_ORIENTATIONS][4];
+};
+
+struct PairCheckpointSample
+{
+	uint32_t contig;
+	uint32_t distance;
+	uint32_t barcodesHead;
+	uint32_t barcodesTail;
+	uint32_t barcodesUnion;
+	uint32_t barcodesIntersect;
+};
+
+[[noreturn]] static inline void pairCheckpointError(const std::string& path, const char* what)
+{
+	std::string message = "pair checkpoint `" + path + "': " + what;
+	if (errno != 0)
+		message += std::string(": ") + strerror(errno);
+	throw std::runtime_error(message);
+}
+
+/**
+ * Write `pmap` to `path`, with the barcode stats of its pairs and the
+ * distance samples if `distances` is set.
+ */
+static inline void writePairCheckpoint(const std::string& path,
+	const ARCS::PairMap& pmap, bool distances,
+	const PairToBarcodeStats& pairToStats, const DistSampleMap& distSamples,
+	const ARCS::ArcsParams& params)
+{
+	/* contig IDs in name order */
+	std::map<std::string, uint32_t> ids;
+	for (ARCS::PairMap::const_iterator it = pmap.begin(); it != pmap.end(); ++it) {
+		ids[it->first.first] = 0;
+		ids[it->first.second] = 0;
+	}
+	if (distances) {
+		for (DistSampleConstIt it = distSamples.begin(); it != distSamples.end(); ++it)
+			ids[it->first] = 0;
+	}
+
+	std::string names;
+	std::vector<PairCheckpointContig> contigs;
+	for (std::map<std::string, uint32_t>::iterator it = ids.begin(); it != ids.end(); ++it) {
+		it->second = contigs.size();
+		PairCheckpointContig contig = { names.size(), (uint32_t)it->first.size(), 0 };
+		names += it->first;
+		contigs.push_back(contig);
+	}
+
+	std::vector<PairCheckpointPair> pairs;
+	std::vector<PairCheckpointStats> stats;
+	for (ARCS::PairMap::const_iterator it = pmap.begin(); it != pmap.end(); ++it) {
+		PairCheckpointPair pair;
+		pair.contig1 = ids[it->first.first];
+		pair.contig2 = ids[it->first.second];
+		for (unsigned o = 0; o < 4; ++o)
+			pair.counts[o] = it->second[o];
+		pairs.push_back(pair);
+		if (!distances)
+			continue;
+
+		PairCheckpointStats record;
+		memset(&record, 0, sizeof record);
+		PairToBarcodeStats::const_iterator statsIt = pairToStats.find(it->first);
+		if (statsIt != pairToStats.end()) {
+			record.present = 1;
+			for (unsigned o = 0; o < NUM_ORIENTATIONS; ++o) {
+				const BarcodeStats& s = statsIt->second[o];
+				record.stats[o][0] = s.barcodes1;
+				record.stats[o][1] = s.barcodes2;
+				record.stats[o][2] = s.barcodesUnion;
+				record.stats[o][3] = s.barcodesIntersect;
+			}
+		}
+		stats.push_back(record);
+	}
+
+	std::vector<PairCheckpointSample> samples;
+	if (distances) {
+		for (DistSampleConstIt it = distSamples.begin(); it != distSamples.end(); ++it) {
+			const DistSample& s = it->second;
+			PairCheckpointSample sample = { ids[it->first], s.distance,
+				s.barcodesHead, s.barcodesTail, s.barcodesUnion, s.barcodesIntersect };
+			samples.push_back(sample);
+		}
+		std::sort(samples.begin(), samples.end(),
+			[](const PairCheckpointSample& a, const PairCheckpointSample& b) {
+				return a.contig < b.contig;
+			});
+	}
+
+	PairCheckpointHeader header;
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, PAIR_CHECKPOINT_MAGIC, sizeof header.magic);
+	header.version = PAIR_CHECKPOINT_VERSION;
+	header.flags = distances ? PAIR_CHECKPOINT_DISTANCES : 0;
+	header.numContigs = contigs.size();
+	header.numPairs = pairs.size();
+	header.numSamples = samples.size();
+	header.namesBytes = names.size();
+	header.minReads = params.min_reads;
+	header.minMult = params.min_mult;
+	header.maxMult = params.max_mult;
+	header.endLength = params.end_length;
+	header.errorPercent = params.error_percent;
+
+	errno = 0;
+	FILE* out = fopen(path.c_str(), "wb");
+	if (out == NULL)
+		pairCheckpointError(path, "cannot create");
+	std::vector<char> buffer(8 << 20);
+	setvbuf(out, buffer.data(), _IOFBF, buffer.size());
+
+	bool ok = fwrite(&header, sizeof header, 1, out) == 1;
+	if (ok && !contigs.empty())
+		ok = fwrite(contigs.data(), sizeof contigs[0], contigs.size(), out) == contigs.size();
+	if (ok && !pairs.empty())
+		ok = fwrite(pairs.data(), sizeof pairs[0], pairs.size(), out) == pairs.size();
+	if (ok && !stats.empty())
+		ok = fwrite(stats.data(), sizeof stats[0], stats.size(), out) == stats.size();
+	if (ok && !samples.empty())
+		ok = fwrite(samples.data(), sizeof samples[0], samples.size(), out) == samples.size();
+	if (ok)
+		ok = fwrite(names.data(), 1, names.size(), out) == names.size();
+	if (fclose(out) != 0 || !ok)
+		pairCheckpointError(path, "write failed");
+}
+
+/* Read `n` records of `v` from `in`, for readPairCheckpoint */
+template <typename T>
+static inline bool readRecords(FILE* in, std::vector<T>& v, uint64_t n)
+{
+	v.resize(n);
+	return n == 0 || fread(v.data(), sizeof(T), n, in) == n;
+}
+
+/**
+ * Load a pair checkpoint into `pmap` and, if it has them, the barcode
+ * stats and distance samples. Returns its header.
+ */
+static inline PairCheckpointHeader readPairCheckpoint(const std::string& path,
+	ARCS::PairMap& pmap, PairToBarcodeStats& pairToStats,
+	DistSampleMap& distSamples)
+{
+	errno = 0;
+	FILE* in = fopen(path.c_str(), "rb");
+	if (in == NULL)
+		pairCheckpointError(path, "cannot open");
+	PairCheckpointHeader h;
+	errno = 0;
+	if (fread(&h, sizeof h, 1, in) != 1
+			|| memcmp(h.magic, PAIR_CHECKPOINT_MAGIC, sizeof h.magic) != 0)
+		pairCheckpointError(path, "not a pair checkpoint");
+	if (h.version != PAIR_CHECKPOINT_VERSION)
+		pairCheckpointError(path, "unsupported version");
+
+	bool distances = (h.flags & PAIR_CHECKPOINT_DISTANCES) != 0;
+	if (fseeko(in, 0, SEEK_END) != 0)
+		pairCheckpointError(path, "cannot seek");
+	uint64_t expected = sizeof h
+		+ h.numContigs * sizeof(PairCheckpointContig)
+		+ h.numPairs * sizeof(PairCheckpointPair)
+		+ (distances ? h.numPairs * sizeof(PairCheckpointStats) : 0)
+		+ h.numSamples * sizeof(PairCheckpointSample) + h.namesBytes;
+	if ((uint64_t)ftello(in) != expected)
+		pairCheckpointError(path, "truncated or corrupt");
+	fseeko(in, sizeof h, SEEK_SET);
+
+	std::vector<PairCheckpointContig> contigs;
+	std::vector<PairCheckpointPair> pairs;
+	std::vector<PairCheckpointStats> stats;
+	std::vector<PairCheckpointSample> samples;
+	std::string names(h.namesBytes, '\0');
+	bool ok = readRecords(in, contigs, h.numContigs)
+		&& readRecords(in, pairs, h.numPairs)
+		&& readRecords(in, stats, distances ? h.numPairs : 0)
+		&& readRecords(in, samples, h.numSamples)
+		&& (names.empty() || fread(&names[0], 1, names.size(), in) == names.size());
+	fclose(in);
+	if (!ok)
+		pairCheckpointError(path, "read failed");
+
+	std::vector<std::string> ids(contigs.size());
+	for (size_t i = 0; i < contigs.size(); ++i) {
+		if (contigs[i].name + contigs[i].nameLength > names.size())
+			pairCheckpointError(path, "truncated or corrupt");
+		ids[i] = names.substr(contigs[i].name, contigs[i].nameLength);
+	}
+
+	/* the records are in PairMap order, so each insert goes at the end */
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		const PairCheckpointPair& p = pairs[i];
+		if (p.contig1 >= ids.size() || p.contig2 >= ids.size())
+			pairCheckpointError(path, "truncated or corrupt");
+		ARCS::ContigPair pair(ids[p.contig1], ids[p.contig2]);
+		pmap.insert(pmap.end(), ARCS::PairMap::value_type(pair,
+			std::vector<uint64_t>(p.counts, p.counts + 4)));
+		if (!distances || !stats[i].present)
+			continue;
+		BarcodeStatsArray& array = pairToStats.insert(pairToStats.end(),
+			PairToBarcodeStats::value_type(pair, BarcodeStatsArray()))->second;
+		for (unsigned o = 0; o < NUM_ORIENTATIONS; ++o) {
+			array[o].barcodes1 = stats[i].stats[o][0];
+			array[o].barcodes2 = stats[i].stats[o][1];
+			array[o].barcodesUnion = stats[i].stats[o][2];
+			array[o].barcodesIntersect = stats[i].stats[o][3];
+		}
+	}
+
+	for (size_t i = 0; i < samples.size(); ++i) {
+		const PairCheckpointSample& s = samples[i];
+		if (s.contig >= ids.size())
+			pairCheckpointError(path, "truncated or corrupt");
+		DistSample& sample = distSamples[ids[s.contig]];
+		sample.distance = s.distance;
+		sample.barcodesHead = s.barcodesHead;
+		sample.barcodesTail = s.barcodesTail;
+		sample.barcodesUnion = s.barcodesUnion;
+		sample.barcodesIntersect = s.barcodesIntersect;
+	}
+	return h;
+}
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef _PARTIAL_HITS_H_
+#define _PARTIAL_HITS_H_ 1
+
+#include "Arks.h"
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * k-mer hits of read pairs, kept on disk between the passes of a
+ * partitioned alignment (--max_memory). Each pass but the last writes
+ * the hits of the read pairs so far, ordered by read pair ID; the next
+ * streams them back in a batch at a time and adds its own.
+ *
+ * file:    batches of read pairs, in order of their first read pair;
+ *          batches without hits are left out
+ * batch:   u64 first read pair ID, u64 number of read pairs, u64
+ *          payload bytes, then the payload (pair records)
+ * record:  u32 index of the pair in the batch, u32 hits of read 1,
+ *          u32 hits of read 2, then per hit: u32 contig end, u32 k-mers
+ *
+ * Integers are in host byte order.
+ */
+
+/** stdio buffer for the sequential reads and writes of a hit file */
+static const size_t PARTIAL_HITS_IO_BUFFER = 4 << 20;
+/** batches that may wait to be written, per classifying thread */
+static const size_t PARTIAL_HITS_PENDING = 4;
+
+[[noreturn]] static inline void partialHitsError(const std::string& path, const std::string& what)
+{
+	std::string message = "partial hit file `" + path + "': " + what;
+	if (errno != 0)
+		message += std::string(": ") + strerror(errno);
+	throw std::runtime_error(message);
+}
+
+/** Return the ratio of k-mer hits of a contig end to the k-mers of a read */
+static inline double calcJacIndex(int smallCount, int overallCount) {
+	return (double) smallCount / (double) overallCount;
+}
+
+/* Returns best corresponding contig for a read from its k-mer hits, or 0 if
+ * no contig end passes the Jaccard threshold
+ *	std::map<int, int> ktrack		contig record index => # k-mers found there
+ *	int totalnumkmers			number of k-mer positions in the read
+ *      double j_index				Jaccard Index (default 0.5)
+ */
+static inline ARCS::ContigEndId bestJaccardContig(const std::map<int, int> &ktrack, int totalnumkmers,
+		double j_index) {
+
+	int corrbestConReci = 0;
+	double maxjaccardindex = 0;
+	// for the read, find the contig that it is most compatible with based on the jaccard index
+	for (auto it = ktrack.begin(); it != ktrack.end(); ++it) {
+		double currjaccardindex = calcJacIndex(it->second, totalnumkmers);
+		if (maxjaccardindex < currjaccardindex) {
+			maxjaccardindex = currjaccardindex;
+			corrbestConReci = it->first;
+		}
+	}
+
+	// default jaccard threshold is 0.5
+	return maxjaccardindex > j_index ? corrbestConReci : 0;
+}
+
+static inline void saveHits(const std::map<int, int> &ktrack, ARCS::KmerHits &hits) {
+	hits.insert(hits.end(), ktrack.begin(), ktrack.end());
+}
+
+/* Add saved k-mer hits back into ktrack */
+static inline void restoreHits(const ARCS::KmerHits &hits, std::map<int, int> &ktrack) {
+	for (auto it = hits.begin(); it != hits.end(); ++it)
+		ktrack[it->first] += it->second;
+}
+
+/**
+ * The hit file of the pass before, read, and of this pass, written.
+ * Classifying threads take the saved hits of a batch when they start
+ * it and put them back, with their own added, when they finish it.
+ * Batches are taken and put in about the order they were read, and
+ * put waits while more than `maxPending` batches are ahead of the
+ * next to be written, so that only the batches in flight are held
+ * in memory.
+ */
+class PartialHitFile
+{
+  public:
+
+	/** saved hits of the read pairs of a batch */
+	typedef std::vector<ARCS::ReadPairHits> Batch;
+
+	/**
+	 * Read the hits of `in` and write those of this pass to `out`;
+	 * either may be empty, on the first and the last pass. `in` is
+	 * removed when done with, and `out` too unless it is closed.
+	 */
+	PartialHitFile(const std::string& in, const std::string& out, size_t maxPending)
+		: m_inPath(in), m_outPath(out), m_in(NULL), m_out(NULL),
+		m_covered(0), m_next(0), m_maxPending(maxPending), m_bytes(0),
+		m_abandoned(false), m_closed(false)
+	{
+		assert(maxPending > 0);
+		if (!in.empty()) {
+			m_in = fopen(in.c_str(), "rb");
+			if (m_in == NULL)
+				partialHitsError(in, "cannot open");
+			setvbuf(m_in, NULL, _IOFBF, PARTIAL_HITS_IO_BUFFER);
+		}
+		if (!out.empty()) {
+			m_out = fopen(out.c_str(), "wb");
+			if (m_out == NULL)
+				partialHitsError(out, "cannot create");
+			setvbuf(m_out, NULL, _IOFBF, PARTIAL_HITS_IO_BUFFER);
+		}
+	}
+
+	~PartialHitFile()
+	{
+		if (m_in != NULL) {
+			fclose(m_in);
+			unlink(m_inPath.c_str());
+		}
+		if (m_out != NULL) {
+			fclose(m_out);
+			if (!m_closed)
+				unlink(m_outPath.c_str());
+		}
+	}
+
+	/** Set `batch` to the saved hits of the `count` pairs from `first` on */
+	void take(size_t first, size_t count, Batch& batch)
+	{
+		batch.assign(count, ARCS::ReadPairHits());
+		if (m_in == NULL)
+			return;
+		std::lock_guard<std::mutex> lock(m_inMutex);
+		for (;;) {
+			std::map<size_t, std::string>::iterator it = m_stash.find(first);
+			if (it != m_stash.end()) {
+				decode(it->second, batch);
+				m_stash.erase(it);
+				return;
+			}
+			if (first < m_covered || !readBatch())
+				return;
+		}
+	}
+
+	/** Save the hits of the batch from pair `first` on, for the next pass */
+	void put(size_t first, const Batch& batch)
+	{
+		if (m_out == NULL)
+			return;
+		std::string payload = encode(batch);
+		std::unique_lock<std::mutex> lock(m_outMutex);
+		m_room.wait(lock, [&] {
+			return m_abandoned || first == m_next || m_pending.size() < m_maxPending;
+		});
+		if (m_abandoned)
+			return;
+		m_pending[first] = std::make_pair(batch.size(), std::string());
+		m_pending[first].second.swap(payload);
+		while (!m_pending.empty() && m_pending.begin()->first == m_next) {
+			std::map<size_t, std::pair<size_t, std::string> >::iterator it = m_pending.begin();
+			write(it->first, it->second.first, it->second.second);
+			m_next += it->second.first;
+			m_pending.erase(it);
+		}
+		m_room.notify_all();
+	}
+
+	/**
+	 * Stop writing, as when a batch fails and will not be put, so that
+	 * the threads waiting to put theirs return
+	 */
+	void abandon()
+	{
+		std::lock_guard<std::mutex> lock(m_outMutex);
+		m_abandoned = true;
+		m_room.notify_all();
+	}
+
+	/** Flush the hits written; every batch must have been put */
+	void close()
+	{
+		assert(m_abandoned || m_pending.empty());
+		if (m_out != NULL && (fflush(m_out) != 0 || ferror(m_out)))
+			partialHitsError(m_outPath, "write failed");
+		m_closed = !m_abandoned;
+	}
+
+	/** Return the number of bytes written */
+	uint64_t bytes() const { return m_bytes; }
+
+  private:
+
+	PartialHitFile(const PartialHitFile&);
+	PartialHitFile& operator=(const PartialHitFile&);
+
+	static void append32(std::string& s, uint32_t x)
+	{
+		s.append(reinterpret_cast<const char*>(&x), sizeof x);
+	}
+
+	static uint32_t get32(const std::string& s, size_t& pos)
+	{
+		uint32_t x;
+		memcpy(&x, s.data() + pos, sizeof x);
+		pos += sizeof x;
+		return x;
+	}
+
+	static void appendHits(std::string& s, const ARCS::KmerHits& hits)
+	{
+		for (ARCS::KmerHits::const_iterator it = hits.begin(); it != hits.end(); ++it) {
+			append32(s, it->first);
+			append32(s, it->second);
+		}
+	}
+
+	static std::string encode(const Batch& batch)
+	{
+		std::string s;
+		for (size_t i = 0; i < batch.size(); ++i) {
+			const ARCS::ReadPairHits& hits = batch[i];
+			if (hits.read1.empty() && hits.read2.empty())
+				continue;
+			append32(s, i);
+			append32(s, hits.read1.size());
+			append32(s, hits.read2.size());
+			appendHits(s, hits.read1);
+			appendHits(s, hits.read2);
+		}
+		return s;
+	}
+
+	void decodeHits(const std::string& s, size_t& pos, uint32_t n, ARCS::KmerHits& hits)
+	{
+		if (s.size() - pos < 8 * (uint64_t)n)
+			partialHitsError(m_inPath, "corrupt batch");
+		hits.reserve(n);
+		for (uint32_t i = 0; i < n; ++i) {
+			ARCS::ContigEndId end = get32(s, pos);
+			int kmers = get32(s, pos);
+			hits.push_back(std::make_pair(end, kmers));
+		}
+	}
+
+	void decode(const std::string& s, Batch& batch)
+	{
+		for (size_t pos = 0; pos < s.size();) {
+			if (s.size() - pos < 12)
+				partialHitsError(m_inPath, "corrupt batch");
+			uint32_t i = get32(s, pos);
+			uint32_t n1 = get32(s, pos);
+			uint32_t n2 = get32(s, pos);
+			if (i >= batch.size())
+				partialHitsError(m_inPath, "corrupt batch");
+			decodeHits(s, pos, n1, batch[i].read1);
+			decodeHits(s, pos, n2, batch[i].read2);
+		}
+	}
+
+	void write(uint64_t first, uint64_t count, const std::string& payload)
+	{
+		if (payload.empty())
+			return;
+		uint64_t header[3] = { first, count, payload.size() };
+		if (fwrite(header, 1, sizeof header, m_out) != sizeof header
+				|| fwrite(payload.data(), 1, payload.size(), m_out) != payload.size())
+			partialHitsError(m_outPath, "write failed");
+		m_bytes += sizeof header + payload.size();
+	}
+
+	/** Stash the next batch of the file; return false at its end */
+	bool readBatch()
+	{
+		uint64_t header[3];
+		size_t n = fread(header, 1, sizeof header, m_in);
+		if (n == 0 && feof(m_in))
+			return false;
+		if (n != sizeof header || header[0] < m_covered)
+			partialHitsError(m_inPath, "corrupt batch header");
+		std::string& payload = m_stash[header[0]];
+		payload.resize(header[2]);
+		if (fread(&payload[0], 1, payload.size(), m_in) != payload.size())
+			partialHitsError(m_inPath, "truncated batch");
+		m_covered = header[0] + header[1];
+		return true;
+	}
+
+	std::string m_inPath, m_outPath;
+	FILE* m_in;
+	FILE* m_out;
+
+	std::mutex m_inMutex;
+	/** batches read ahead of the one taken, by first read pair */
+	std::map<size_t, std::string> m_stash;
+	/** the read pairs before this are all read from the file */
+	size_t m_covered;
+
+	std::mutex m_outMutex;
+	std::condition_variable m_room;
+	/** batches finished ahead of the next to write: first => (pairs, payload) */
+	std::map<size_t, std::pair<size_t, std::string> > m_pending;
+	/** the first read pair of the next batch to write */
+	size_t m_next;
+	size_t m_maxPending;
+	uint64_t m_bytes;
+	bool m_abandoned, m_closed;
+};
+
+#endif
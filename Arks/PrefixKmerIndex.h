@@ -0,0 +1,358 @@
+#ifndef _PREFIX_KMER_INDEX_H_
+#define _PREFIX_KMER_INDEX_H_ 1
+
+#include "Arks/Arks.h"
+#include "Arks/ContigEndFMIndex.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** A read k-mer, as a PrefixKmerIndex::key(), tagged with its read */
+struct TaggedKmer
+{
+	uint64_t key;
+	uint32_t tag;
+};
+
+/**
+ * Sort `kmers` by key with a least significant digit radix sort,
+ * one byte per pass; passes where all keys share the byte are
+ * skipped. `tmp` is scratch space.
+ */
+static inline void radixSortKmers(std::vector<TaggedKmer>& kmers,
+	std::vector<TaggedKmer>& tmp)
+{
+	tmp.resize(kmers.size());
+	size_t counts[256];
+	for (unsigned shift = 0; shift < 64; shift += 8) {
+		memset(counts, 0, sizeof counts);
+		for (size_t i = 0; i < kmers.size(); ++i)
+			counts[(kmers[i].key >> shift) & 0xff]++;
+		if (kmers.empty() || counts[(kmers[0].key >> shift) & 0xff] == kmers.size())
+			continue;
+		size_t sum = 0;
+		for (unsigned b = 0; b < 256; ++b) {
+			size_t c = counts[b];
+			counts[b] = sum;
+			sum += c;
+		}
+		for (size_t i = 0; i < kmers.size(); ++i)
+			tmp[counts[(kmers[i].key >> shift) & 0xff]++] = kmers[i];
+		kmers.swap(tmp);
+	}
+}
+
+/**
+ * Contig-end k-mer index stored as a sorted array (`--kmer_index=bucket`).
+ *
+ * Each packed k-mer (ReadsProcessor byte order, k <= 32) is read as a
+ * big-endian 64-bit word, so that integer order is byte order. The
+ * words are sorted, with a parallel array of contig record indices.
+ * A direct-address table on the first PREFIX_BYTES bytes (4 bases per
+ * byte) gives the small slice of the array to search for a k-mer.
+ *
+ * A k-mer on more than one contig end has contig record index 0, as in
+ * ContigKMap.
+ */
+class PrefixKmerIndex
+{
+  public:
+
+	/** the number of bases covered by the direct-address table */
+	static const unsigned PREFIX_BYTES = 2;
+
+	/** Duplicate k-mer tallies, as counted by mapKmers */
+	struct BuildStats
+	{
+		/** distinct k-mers */
+		size_t mapped;
+		/** repeated occurrences of a k-mer */
+		size_t collisions;
+		/** repeated occurrences on a different contig end */
+		size_t removedDuplicates;
+		/** distinct k-mers on only one contig end */
+		size_t unique;
+
+		BuildStats() : mapped(0), collisions(0),
+			removedDuplicates(0), unique(0) {}
+	};
+
+	/** Return true if k-mers of size k fit the 64-bit words */
+	static bool supports(unsigned k)
+	{
+		return ARCS::packedKmerBytes(k) <= sizeof(uint64_t);
+	}
+
+	PrefixKmerIndex(unsigned k) : m_kmerBytes(ARCS::packedKmerBytes(k))
+	{
+		assert(supports(k));
+	}
+
+	unsigned kmerBytes() const { return m_kmerBytes; }
+
+	/** the number of distinct k-mers */
+	size_t size() const { return m_keys.size(); }
+
+	/** Queue a k-mer occurrence on contig end `conreci` for build() */
+	void add(const std::string& kmer, int conreci)
+	{
+		assert(kmer.size() == m_kmerBytes);
+		Entry e = { key(reinterpret_cast<const unsigned char*>(kmer.data())),
+			conreci };
+		m_entries.push_back(e);
+	}
+
+	/** Queue all of the packed k-mers `kmers`, end to end, on contig end `conreci` */
+	void addAll(const std::string& kmers, int conreci)
+	{
+		assert(kmers.size() % m_kmerBytes == 0);
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(kmers.data());
+		for (size_t i = 0; i < kmers.size(); i += m_kmerBytes) {
+			Entry e = { key(p + i), conreci };
+			m_entries.push_back(e);
+		}
+	}
+
+	/**
+	 * Sort the queued k-mers and collapse each run of equal k-mers to
+	 * one entry. The sort is radix partitioning on the first byte
+	 * followed by a stable sort of each of the 256 parts in parallel,
+	 * which keeps occurrences in the order added, so the duplicate
+	 * tallies match those of mapKmers exactly.
+	 */
+	BuildStats build()
+	{
+		std::vector<Entry> sorted;
+		radixPartition(sorted);
+
+		BuildStats stats;
+		m_keys.clear();
+		m_ids.clear();
+		for (size_t i = 0; i < sorted.size();) {
+			size_t j = i + 1;
+			int conreci = sorted[i].conreci;
+			for (; j < sorted.size() && sorted[j].key == sorted[i].key; ++j) {
+				stats.collisions++;
+				if (sorted[j].conreci != conreci) {
+					stats.removedDuplicates++;
+					conreci = 0;
+				}
+			}
+			stats.mapped++;
+			if (conreci != 0)
+				stats.unique++;
+			m_keys.push_back(sorted[i].key);
+			m_ids.push_back(conreci);
+			i = j;
+		}
+		std::vector<Entry>().swap(sorted);
+		std::vector<uint64_t>(m_keys).swap(m_keys);
+		std::vector<int32_t>(m_ids).swap(m_ids);
+
+		m_offsets.assign((1 << (8 * PREFIX_BYTES)) + 1, 0);
+		for (size_t i = 0; i < m_keys.size(); ++i)
+			m_offsets[prefix(m_keys[i]) + 1]++;
+		for (size_t i = 1; i < m_offsets.size(); ++i)
+			m_offsets[i] += m_offsets[i - 1];
+		return stats;
+	}
+
+	/**
+	 * Look up a packed k-mer. Return true and set `conreci` if it is in
+	 * the index. The search inside a bucket is branch-free.
+	 */
+	bool find(const unsigned char* kmer, int& conreci) const
+	{
+		uint64_t word = key(kmer);
+		size_t p = prefix(word);
+		size_t lo = m_offsets[p];
+		size_t n = m_offsets[p + 1] - lo;
+		if (n == 0)
+			return false;
+		const uint64_t* base = &m_keys[lo];
+		while (n > 1) {
+			size_t half = n / 2;
+			base = base[half] <= word ? base + half : base;
+			n -= half;
+		}
+		if (*base != word)
+			return false;
+		conreci = m_ids[base - &m_keys[0]];
+		return true;
+	}
+
+	/**
+	 * Merge-join `kmers`, sorted by key, against the index: set
+	 * `conrecis[i]` to the contig record index of `kmers[i]`, or -1 if
+	 * it is absent. The index is read front to back, skipping ahead
+	 * with the prefix table and a galloping search.
+	 */
+	void joinSorted(const std::vector<TaggedKmer>& kmers,
+		std::vector<int32_t>& conrecis) const
+	{
+		conrecis.resize(kmers.size());
+		size_t pos = 0;
+		for (size_t i = 0; i < kmers.size(); ++i) {
+			uint64_t word = kmers[i].key;
+			size_t p = prefix(word);
+			size_t end = m_offsets[p + 1];
+			size_t lo = std::max(pos, m_offsets[p]);
+			if (lo < end && m_keys[lo] < word) {
+				size_t step = 1;
+				while (lo + step < end && m_keys[lo + step] < word) {
+					lo += step;
+					step *= 2;
+				}
+				size_t hi = std::min(lo + step, end);
+				lo = std::lower_bound(m_keys.begin() + lo + 1,
+					m_keys.begin() + hi, word) - m_keys.begin();
+			}
+			pos = lo;
+			conrecis[i] = lo < end && m_keys[lo] == word ? m_ids[lo] : -1;
+		}
+	}
+
+	/** the packed k-mer as a big-endian word, left aligned */
+	uint64_t key(const unsigned char* kmer) const
+	{
+		uint64_t word = 0;
+		for (unsigned b = 0; b < m_kmerBytes; ++b)
+			word |= (uint64_t)kmer[b] << (56 - 8 * b);
+		return word;
+	}
+
+	/** the packed k-mer of entry `i`, in sorted order */
+	std::string kmer(size_t i) const
+	{
+		std::string s(m_kmerBytes, '\0');
+		for (unsigned b = 0; b < m_kmerBytes; ++b)
+			s[b] = (char)(m_keys[i] >> (56 - 8 * b));
+		return s;
+	}
+
+	/** the contig record index of entry `i` */
+	int conreci(size_t i) const { return m_ids[i]; }
+
+  private:
+
+	struct Entry
+	{
+		uint64_t key;
+		int32_t conreci;
+	};
+
+	static size_t prefix(uint64_t key)
+	{
+		return key >> (64 - 8 * PREFIX_BYTES);
+	}
+
+	/** Move the queued entries into `sorted`, in k-mer order */
+	void radixPartition(std::vector<Entry>& sorted)
+	{
+		std::vector<size_t> start(257, 0);
+		for (size_t i = 0; i < m_entries.size(); ++i)
+			start[(m_entries[i].key >> 56) + 1]++;
+		for (unsigned b = 1; b < start.size(); ++b)
+			start[b] += start[b - 1];
+
+		sorted.resize(m_entries.size());
+		std::vector<size_t> next(start.begin(), start.end() - 1);
+		for (size_t i = 0; i < m_entries.size(); ++i)
+			sorted[next[m_entries[i].key >> 56]++] = m_entries[i];
+		std::vector<Entry>().swap(m_entries);
+
+#pragma omp parallel for schedule(dynamic)
+		for (int b = 0; b < 256; ++b) {
+			std::stable_sort(sorted.begin() + start[b],
+				sorted.begin() + start[b + 1],
+				[](const Entry& x, const Entry& y) { return x.key < y.key; });
+		}
+	}
+
+	unsigned m_kmerBytes;
+	std::vector<Entry> m_entries;
+	std::vector<uint64_t> m_keys;
+	std::vector<int32_t> m_ids;
+	std::vector<size_t> m_offsets;
+};
+
+/**
+ * Add an occurrence of `kmer` on contig end `conreci` to the hash table
+ * index, as mapKmers does, and tally it as PrefixKmerIndex::build()
+ * tallies its duplicates: a k-mer on more than one contig end gets
+ * contig record index 0.
+ */
+static inline void addContigKmer(ARCS::ContigKMap& kmap, const std::string& kmer,
+	ARCS::ContigEndId conreci, uint64_t& mapped, uint64_t& collisions,
+	uint64_t& removedDuplicates, uint64_t& unique)
+{
+	std::pair<ARCS::ContigKMap::iterator, bool> inserted =
+		kmap.insert(std::make_pair(kmer, conreci));
+	if (inserted.second) {
+		unique++;
+		mapped++;
+		return;
+	}
+	ARCS::ContigEndId& already = inserted.first->second;
+	if (already != conreci) {
+		removedDuplicates++;
+		if (already != 0) {
+			unique--;
+			already = 0;
+		}
+	}
+	collisions++;
+}
+
+/**
+ * The contig-end k-mer index that reads are classified against:
+ * the ContigKMap hash table, a PrefixKmerIndex, or a ContigEndFMIndex,
+ * which is searched for whole matches rather than k-mers.
+ */
+class KmerIndex
+{
+  public:
+
+	KmerIndex(const ARCS::ContigKMap& kmap, unsigned k) :
+		m_kmap(&kmap), m_sorted(NULL), m_fm(NULL),
+		m_kmerBytes(ARCS::packedKmerBytes(k)) {}
+
+	KmerIndex(const PrefixKmerIndex& sorted) :
+		m_kmap(NULL), m_sorted(&sorted), m_fm(NULL),
+		m_kmerBytes(sorted.kmerBytes()) {}
+
+	KmerIndex(const ContigEndFMIndex& fm) :
+		m_kmap(NULL), m_sorted(NULL), m_fm(&fm), m_kmerBytes(0) {}
+
+	/** the sorted index, or NULL */
+	const PrefixKmerIndex* sorted() const { return m_sorted; }
+
+	/** the FM-index, or NULL */
+	const ContigEndFMIndex* fm() const { return m_fm; }
+
+	/** Look up a packed k-mer from ReadsProcessor::prepSeq */
+	bool find(const unsigned char* kmer, int& conreci) const
+	{
+		assert(m_fm == NULL);
+		if (m_sorted != NULL)
+			return m_sorted->find(kmer, conreci);
+		auto it = m_kmap->find(std::string(
+			reinterpret_cast<const char*>(kmer), m_kmerBytes));
+		if (it == m_kmap->end())
+			return false;
+		conreci = it->second;
+		return true;
+	}
+
+  private:
+
+	const ARCS::ContigKMap* m_kmap;
+	const PrefixKmerIndex* m_sorted;
+	const ContigEndFMIndex* m_fm;
+	unsigned m_kmerBytes;
+};
+
+#endif
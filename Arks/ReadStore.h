@@ -0,0 +1,471 @@
+#ifndef _READ_STORE_H_
+#define _READ_STORE_H_ 1
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <zlib.h>
+
+/*
+ * Binary read store: linked read pairs converted once from FASTQ so
+ * that repeat runs skip decompression and text parsing.
+ *
+ * file:    header, blocks, barcode table
+ * header:  magic "ARKSRDS1", u32 version, u32 unused,
+ *          u64 number of read pairs, u64 offset of the barcode table
+ * block:   u32 number of pairs, u32 payload bytes, u32 CRC-32 of the
+ *          payload, u32 unused, then the payload (pair records)
+ * record:  u32 barcode ID, u32 read 1 length, u32 read 2 length,
+ *          u8 flags (bit 0/1: read 1/2 has an N mask), then per read:
+ *          2 bits per base (A=0 C=1 G=2 T=3), 4 bases per byte, first
+ *          base in the low bits; and if flagged, a bit mask of the N
+ *          positions, 8 per byte
+ * table:   u32 number of barcodes, u32 CRC-32 of the rest, then
+ *          u32 length and the bytes of each barcode, in ID order
+ *
+ * Pairs are grouped by barcode. Integers are in host byte order.
+ */
+
+static const char READ_STORE_MAGIC[8] = { 'A', 'R', 'K', 'S', 'R', 'D', 'S', '1' };
+static const uint32_t READ_STORE_VERSION = 1;
+static const size_t READ_STORE_HEADER_BYTES = 32;
+static const size_t READ_STORE_BLOCK_HEADER_BYTES = 16;
+static const size_t READ_STORE_RECORD_HEADER_BYTES = 13;
+
+/** target payload size of a block */
+static const size_t READ_STORE_BLOCK_BYTES = 1 << 20;
+/** number of temporary files barcodes are spread over while converting */
+static const unsigned READ_STORE_BUCKETS = 64;
+/** stdio buffer for sequential reads and writes of a store */
+static const size_t READ_STORE_IO_BUFFER = 8 << 20;
+
+/** Return true if `path` starts with the read store magic number */
+static inline bool isReadStore(const std::string& path)
+{
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == NULL)
+		return false;
+	char magic[sizeof READ_STORE_MAGIC];
+	bool match = fread(magic, 1, sizeof magic, f) == sizeof magic
+		&& memcmp(magic, READ_STORE_MAGIC, sizeof magic) == 0;
+	fclose(f);
+	return match;
+}
+
+template <typename T>
+static inline void appendValue(std::string& out, T x)
+{
+	out.append(reinterpret_cast<const char*>(&x), sizeof x);
+}
+
+template <typename T>
+static inline T loadValue(const char* p)
+{
+	T x;
+	memcpy(&x, p, sizeof x);
+	return x;
+}
+
+/**
+ * Pack `seq` into 2-bit `bases` and an N `mask`. The sequence must
+ * consist of ACGTN only (either case). Return true if it has an N.
+ */
+static inline bool packBases(const std::string& seq, std::string& bases,
+	std::string& mask)
+{
+	bases.assign((seq.size() + 3) / 4, '\0');
+	mask.assign((seq.size() + 7) / 8, '\0');
+	bool hasN = false;
+	for (size_t i = 0; i < seq.size(); ++i) {
+		unsigned code;
+		switch (toupper(seq[i])) {
+		case 'A': code = 0; break;
+		case 'C': code = 1; break;
+		case 'G': code = 2; break;
+		case 'T': code = 3; break;
+		default:
+			code = 0;
+			mask[i / 8] |= 1 << (i % 8);
+			hasN = true;
+		}
+		bases[i / 4] |= code << (2 * (i % 4));
+	}
+	return hasN;
+}
+
+/** Decode `length` bases (and N mask, if any) at `p`; return the end */
+static inline const char* unpackBases(const char* p, uint32_t length,
+	bool hasN, std::string& seq)
+{
+	static const char ACGT[4] = { 'A', 'C', 'G', 'T' };
+	seq.resize(length);
+	const unsigned char* bases = reinterpret_cast<const unsigned char*>(p);
+	for (uint32_t i = 0; i < length; ++i)
+		seq[i] = ACGT[(bases[i / 4] >> (2 * (i % 4))) & 3];
+	p += (length + 3) / 4;
+	if (hasN) {
+		const unsigned char* mask = reinterpret_cast<const unsigned char*>(p);
+		for (uint32_t i = 0; i < length; ++i)
+			if (mask[i / 8] & (1 << (i % 8)))
+				seq[i] = 'N';
+		p += (length + 7) / 8;
+	}
+	return p;
+}
+
+/** Size in bytes of the record starting at `p` */
+static inline size_t readStoreRecordBytes(const char* p)
+{
+	uint32_t len1 = loadValue<uint32_t>(p + 4);
+	uint32_t len2 = loadValue<uint32_t>(p + 8);
+	uint8_t flags = p[12];
+	size_t bytes = READ_STORE_RECORD_HEADER_BYTES
+		+ (len1 + 3) / 4 + (len2 + 3) / 4;
+	if (flags & 1)
+		bytes += (len1 + 7) / 8;
+	if (flags & 2)
+		bytes += (len2 + 7) / 8;
+	return bytes;
+}
+
+[[noreturn]] static inline void readStoreError(const std::string& path, const std::string& what)
+{
+	std::string message = "read store `" + path + "': " + what;
+	if (errno != 0)
+		message += std::string(": ") + strerror(errno);
+	throw std::runtime_error(message);
+}
+
+/**
+ * Writes a read store. Pairs are first spread over temporary bucket
+ * files by barcode ID, then each bucket is sorted by barcode and
+ * written out in checksummed blocks, so that memory use is bounded
+ * by the largest bucket rather than the whole library.
+ */
+class ReadStoreWriter
+{
+  public:
+
+	ReadStoreWriter(const std::string& path) : m_path(path), m_numPairs(0)
+	{
+		for (unsigned i = 0; i < READ_STORE_BUCKETS; ++i) {
+			std::string bucketPath = bucketName(i);
+			errno = 0;
+			FILE* f = fopen(bucketPath.c_str(), "w+b");
+			if (f == NULL)
+				readStoreError(bucketPath, "cannot create temporary file");
+			m_buckets.push_back(f);
+		}
+	}
+
+	~ReadStoreWriter()
+	{
+		for (unsigned i = 0; i < m_buckets.size(); ++i) {
+			fclose(m_buckets[i]);
+			remove(bucketName(i).c_str());
+		}
+	}
+
+	/** Add a read pair; the reads must consist of ACGTN only */
+	void add(const std::string& barcode, const std::string& seq1,
+		const std::string& seq2)
+	{
+		auto inserted = m_barcodeIds.insert(std::make_pair(barcode,
+			(uint32_t)m_barcodes.size()));
+		if (inserted.second)
+			m_barcodes.push_back(barcode);
+		uint32_t id = inserted.first->second;
+
+		m_record.clear();
+		appendValue(m_record, id);
+		appendValue(m_record, (uint32_t)seq1.size());
+		appendValue(m_record, (uint32_t)seq2.size());
+		bool n1 = packBases(seq1, m_bases1, m_mask1);
+		bool n2 = packBases(seq2, m_bases2, m_mask2);
+		appendValue(m_record, (uint8_t)((n1 ? 1 : 0) | (n2 ? 2 : 0)));
+		m_record += m_bases1;
+		if (n1)
+			m_record += m_mask1;
+		m_record += m_bases2;
+		if (n2)
+			m_record += m_mask2;
+
+		FILE* bucket = m_buckets[id % READ_STORE_BUCKETS];
+		if (fwrite(m_record.data(), 1, m_record.size(), bucket) != m_record.size())
+			readStoreError(bucketName(id % READ_STORE_BUCKETS), "write failed");
+		m_numPairs++;
+	}
+
+	/** Write the store file; return the number of read pairs */
+	uint64_t finish()
+	{
+		errno = 0;
+		FILE* out = fopen(m_path.c_str(), "wb");
+		if (out == NULL)
+			readStoreError(m_path, "cannot create");
+		std::vector<char> buffer(READ_STORE_IO_BUFFER);
+		setvbuf(out, buffer.data(), _IOFBF, buffer.size());
+
+		std::string header(READ_STORE_HEADER_BYTES, '\0');
+		write(out, header);
+
+		std::string bucket, block;
+		std::vector<size_t> offsets;
+		for (unsigned i = 0; i < m_buckets.size(); ++i) {
+			loadBucket(i, bucket);
+
+			offsets.clear();
+			for (size_t off = 0; off < bucket.size(); off += readStoreRecordBytes(&bucket[off]))
+				offsets.push_back(off);
+			const std::string& records = bucket;
+			std::stable_sort(offsets.begin(), offsets.end(),
+				[&records](size_t a, size_t b) {
+					return loadValue<uint32_t>(&records[a])
+						< loadValue<uint32_t>(&records[b]);
+				});
+
+			uint32_t numPairs = 0;
+			block.clear();
+			for (size_t j = 0; j < offsets.size(); ++j) {
+				const char* record = &bucket[offsets[j]];
+				block.append(record, readStoreRecordBytes(record));
+				numPairs++;
+				if (block.size() >= READ_STORE_BLOCK_BYTES) {
+					writeBlock(out, numPairs, block);
+					numPairs = 0;
+					block.clear();
+				}
+			}
+			if (numPairs > 0)
+				writeBlock(out, numPairs, block);
+		}
+
+		uint64_t tableOffset = ftell(out);
+		std::string table;
+		for (size_t i = 0; i < m_barcodes.size(); ++i) {
+			appendValue(table, (uint32_t)m_barcodes[i].size());
+			table += m_barcodes[i];
+		}
+		std::string tableHeader;
+		appendValue(tableHeader, (uint32_t)m_barcodes.size());
+		appendValue(tableHeader, (uint32_t)crc32(0,
+			reinterpret_cast<const Bytef*>(table.data()), table.size()));
+		write(out, tableHeader);
+		write(out, table);
+
+		header.clear();
+		header.append(READ_STORE_MAGIC, sizeof READ_STORE_MAGIC);
+		appendValue(header, READ_STORE_VERSION);
+		appendValue(header, (uint32_t)0);
+		appendValue(header, m_numPairs);
+		appendValue(header, tableOffset);
+		assert(header.size() == READ_STORE_HEADER_BYTES);
+		fseek(out, 0, SEEK_SET);
+		write(out, header);
+
+		if (fclose(out) != 0)
+			readStoreError(m_path, "write failed");
+		return m_numPairs;
+	}
+
+	size_t numBarcodes() const { return m_barcodes.size(); }
+
+  private:
+
+	ReadStoreWriter(const ReadStoreWriter&);
+	ReadStoreWriter& operator=(const ReadStoreWriter&);
+
+	std::string bucketName(unsigned i) const
+	{
+		return m_path + ".tmp" + std::to_string(i);
+	}
+
+	void write(FILE* out, const std::string& bytes) const
+	{
+		if (fwrite(bytes.data(), 1, bytes.size(), out) != bytes.size())
+			readStoreError(m_path, "write failed");
+	}
+
+	void writeBlock(FILE* out, uint32_t numPairs, const std::string& payload) const
+	{
+		std::string header;
+		appendValue(header, numPairs);
+		appendValue(header, (uint32_t)payload.size());
+		appendValue(header, (uint32_t)crc32(0,
+			reinterpret_cast<const Bytef*>(payload.data()), payload.size()));
+		appendValue(header, (uint32_t)0);
+		write(out, header);
+		write(out, payload);
+	}
+
+	void loadBucket(unsigned i, std::string& bucket) const
+	{
+		FILE* f = m_buckets[i];
+		fflush(f);
+		fseek(f, 0, SEEK_END);
+		bucket.resize(ftell(f));
+		fseek(f, 0, SEEK_SET);
+		if (!bucket.empty() && fread(&bucket[0], 1, bucket.size(), f) != bucket.size())
+			readStoreError(bucketName(i), "read failed");
+	}
+
+	std::string m_path;
+	std::vector<FILE*> m_buckets;
+	std::unordered_map<std::string, uint32_t> m_barcodeIds;
+	std::vector<std::string> m_barcodes;
+	uint64_t m_numPairs;
+	std::string m_record, m_bases1, m_mask1, m_bases2, m_mask2;
+};
+
+/**
+ * Reads a read store block by block with large sequential reads,
+ * verifying each block's checksum, and that its records and the
+ * barcode table stay within their bytes.
+ */
+class ReadStoreReader
+{
+  public:
+
+	ReadStoreReader(const std::string& path) : m_path(path), m_buffer(READ_STORE_IO_BUFFER)
+	{
+		errno = 0;
+		m_in = fopen(path.c_str(), "rb");
+		if (m_in == NULL)
+			readStoreError(path, "cannot open");
+		setvbuf(m_in, m_buffer.data(), _IOFBF, m_buffer.size());
+#if HAVE_POSIX_FADVISE
+		posix_fadvise(fileno(m_in), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+		std::string header = read(READ_STORE_HEADER_BYTES, "truncated header");
+		errno = 0;
+		if (memcmp(header.data(), READ_STORE_MAGIC, sizeof READ_STORE_MAGIC) != 0)
+			readStoreError(path, "not a read store");
+		if (loadValue<uint32_t>(&header[8]) != READ_STORE_VERSION)
+			readStoreError(path, "unsupported version");
+		m_numPairs = loadValue<uint64_t>(&header[16]);
+		uint64_t tableOffset = loadValue<uint64_t>(&header[24]);
+
+		/* load the barcode table, then come back for the blocks */
+		fseek(m_in, 0, SEEK_END);
+		uint64_t fileBytes = ftell(m_in);
+		errno = 0;
+		if (tableOffset < READ_STORE_HEADER_BYTES || tableOffset > fileBytes
+				|| fileBytes - tableOffset < 8)
+			readStoreError(path, "corrupt barcode table offset");
+		fseek(m_in, tableOffset, SEEK_SET);
+		std::string tableHeader = read(8, "truncated barcode table");
+		uint32_t numBarcodes = loadValue<uint32_t>(&tableHeader[0]);
+		uint32_t crc = loadValue<uint32_t>(&tableHeader[4]);
+		std::string table;
+		table.resize(fileBytes - tableOffset - 8);
+		fseek(m_in, tableOffset + 8, SEEK_SET);
+		if (!table.empty() && fread(&table[0], 1, table.size(), m_in) != table.size())
+			readStoreError(path, "truncated barcode table");
+		errno = 0;
+		if (crc32(0, reinterpret_cast<const Bytef*>(table.data()), table.size()) != crc)
+			readStoreError(path, "barcode table checksum mismatch");
+		for (size_t off = 0; m_barcodes.size() < numBarcodes;) {
+			if (table.size() - off < 4)
+				readStoreError(path, "corrupt barcode table");
+			uint32_t len = loadValue<uint32_t>(&table[off]);
+			if (table.size() - off - 4 < len)
+				readStoreError(path, "corrupt barcode table");
+			m_barcodes.push_back(table.substr(off + 4, len));
+			off += 4 + len;
+		}
+
+		fseek(m_in, READ_STORE_HEADER_BYTES, SEEK_SET);
+		m_blocksEnd = tableOffset;
+	}
+
+	~ReadStoreReader()
+	{
+		fclose(m_in);
+	}
+
+	uint64_t numPairs() const { return m_numPairs; }
+
+	const std::string& barcode(uint32_t id) const { return m_barcodes[id]; }
+
+	/**
+	 * Read the next block into `payload`, setting `numPairs`.
+	 * Return false at the end of the blocks.
+	 */
+	bool readBlock(std::string& payload, uint32_t& numPairs)
+	{
+		if ((uint64_t)ftell(m_in) >= m_blocksEnd)
+			return false;
+		std::string header = read(READ_STORE_BLOCK_HEADER_BYTES, "truncated block");
+		numPairs = loadValue<uint32_t>(&header[0]);
+		uint32_t bytes = loadValue<uint32_t>(&header[4]);
+		uint32_t crc = loadValue<uint32_t>(&header[8]);
+		payload.resize(bytes);
+		if (bytes > 0 && fread(&payload[0], 1, bytes, m_in) != bytes)
+			readStoreError(m_path, "truncated block");
+		errno = 0;
+		if (crc32(0, reinterpret_cast<const Bytef*>(payload.data()), bytes) != crc)
+			readStoreError(m_path, "block checksum mismatch at offset "
+				+ std::to_string(ftell(m_in) - bytes - READ_STORE_BLOCK_HEADER_BYTES));
+
+		/* the block header is outside the checksum: check that the
+		 * records fit the payload and name known barcodes */
+		size_t off = 0;
+		for (uint32_t i = 0; i < numPairs; ++i) {
+			if (bytes - off < READ_STORE_RECORD_HEADER_BYTES
+					|| loadValue<uint32_t>(&payload[off]) >= m_barcodes.size()
+					|| bytes - off < readStoreRecordBytes(&payload[off]))
+				readStoreError(m_path, "corrupt block at offset "
+					+ std::to_string(ftell(m_in) - bytes - READ_STORE_BLOCK_HEADER_BYTES));
+			off += readStoreRecordBytes(&payload[off]);
+		}
+		return true;
+	}
+
+	/** Decode the record at `p`; return the start of the next one */
+	static const char* decode(const char* p, uint32_t& barcodeId,
+		std::string& seq1, std::string& seq2)
+	{
+		barcodeId = loadValue<uint32_t>(p);
+		uint32_t len1 = loadValue<uint32_t>(p + 4);
+		uint32_t len2 = loadValue<uint32_t>(p + 8);
+		uint8_t flags = p[12];
+		p += READ_STORE_RECORD_HEADER_BYTES;
+		p = unpackBases(p, len1, flags & 1, seq1);
+		return unpackBases(p, len2, flags & 2, seq2);
+	}
+
+  private:
+
+	ReadStoreReader(const ReadStoreReader&);
+	ReadStoreReader& operator=(const ReadStoreReader&);
+
+	std::string read(size_t bytes, const char* what)
+	{
+		std::string s(bytes, '\0');
+		errno = 0;
+		if (fread(&s[0], 1, bytes, m_in) != bytes)
+			readStoreError(m_path, what);
+		return s;
+	}
+
+	std::string m_path;
+	std::vector<char> m_buffer;
+	FILE* m_in;
+	uint64_t m_numPairs;
+	uint64_t m_blocksEnd;
+	std::vector<std::string> m_barcodes;
+};
+
+#endif
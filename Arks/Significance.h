@@ -0,0 +1,58 @@
+#ifndef _SIGNIFICANCE_H_
+#define _SIGNIFICANCE_H_ 1
+
+#include "Arks/Arks.h"
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <utility>
+
+/*
+ * Tests of read pair and link counts: which end of a contig the
+ * barcode's read pairs align to, and which orientation of a contig
+ * pair its links support. The counts are 64-bit, as in IndexMap and
+ * PairMap.
+ */
+
+/* Normal approximation to the binomial distribution */
+static inline float normalEstimation(uint64_t x, float p, uint64_t n) {
+	float mean = n * p;
+	float sd = std::sqrt(n * p * (1 - p));
+	return 0.5 * (1 + std::erf((x - mean) / (sd * std::sqrt(2))));
+}
+
+/*
+ * Based on number of read pairs that align to the
+ * head or tail of scaffold, determine if is significantly
+ * different from a uniform distribution (p=0.5)
+ */
+static inline std::pair<bool, bool> headOrTail(uint64_t head, uint64_t tail,
+		const ARCS::ArcsParams &params) {
+	uint64_t max = std::max(head, tail);
+	uint64_t sum = head + tail;
+	if (sum < params.min_reads) {
+		return std::pair<bool, bool>(false, false);
+	}
+	float normalCdf = normalEstimation(max, 0.5, sum);
+	if (1 - normalCdf < params.error_percent) {
+		bool isHead = (max == head);
+		return std::pair<bool, bool>(true, isHead);
+	} else {
+		return std::pair<bool, bool>(false, false);
+	}
+}
+
+/*
+ * Return true if the link orientation with the max support
+ * is dominant
+ */
+static inline bool checkSignificance(uint64_t max, uint64_t second,
+		const ARCS::ArcsParams &params) {
+	if (params.min_links > 0 && max < (uint64_t)params.min_links) {
+		return false;
+	}
+	float normalCdf = normalEstimation(max, 0.5, second);
+	return (1 - normalCdf < params.error_percent);
+}
+
+#endif
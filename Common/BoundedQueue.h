@@ -0,0 +1,74 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H 1
+
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/**
+ * A first-in first-out queue of bounded capacity, for handing work
+ * from producer threads to consumer threads. `push` blocks while the
+ * queue is full, and `pop` blocks while it is empty and open.
+ */
+template <typename T>
+class BoundedQueue
+{
+  public:
+
+	BoundedQueue(size_t capacity) : m_capacity(capacity), m_closed(false)
+	{
+		assert(capacity > 0);
+	}
+
+	/** Add an item, waiting for room if the queue is full */
+	void push(const T& item)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notFull.wait(lock, [this] { return m_queue.size() < m_capacity; });
+		assert(!m_closed);
+		m_queue.push_back(item);
+		m_notEmpty.notify_one();
+	}
+
+	/**
+	 * Remove the oldest item into `item`, waiting for one if the queue
+	 * is empty. Return false once the queue is closed and drained.
+	 */
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notEmpty.wait(lock, [this] { return !m_queue.empty() || m_closed; });
+		if (m_queue.empty())
+			return false;
+		item = m_queue.front();
+		m_queue.pop_front();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	/** Signal that no more items will be pushed */
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+		m_notEmpty.notify_all();
+	}
+
+	size_t capacity() const { return m_capacity; }
+
+  private:
+
+	BoundedQueue(const BoundedQueue&);
+	BoundedQueue& operator=(const BoundedQueue&);
+
+	size_t m_capacity;
+	bool m_closed;
+	std::deque<T> m_queue;
+	std::mutex m_mutex;
+	std::condition_variable m_notFull;
+	std::condition_variable m_notEmpty;
+};
+
+#endif
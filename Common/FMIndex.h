@@ -0,0 +1,288 @@
+#ifndef _FM_INDEX_H_
+#define _FM_INDEX_H_ 1
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * FM-index (Burrows-Wheeler transform with occurrence counts and a
+ * sampled suffix array) of a collection of DNA sequences.
+ *
+ * The sequences are concatenated with a separator after each one and
+ * a terminator at the end. Anything other than A, C, G or T is stored
+ * as a separator, so no match spans two sequences or an N.
+ *
+ * The BWT is packed 2 bits per base in blocks of 64 rows, each block
+ * holding the base counts before it, so a rank is one table read and
+ * a popcount. One text position in SA_SAMPLE is kept for locate().
+ * With the block headers that is about 8 bits per indexed base.
+ */
+class FMIndex
+{
+  public:
+
+	/** a range [lo, hi) of BWT rows, all prefixed by the same string */
+	struct Interval
+	{
+		size_t lo, hi;
+
+		size_t size() const { return hi - lo; }
+		bool empty() const { return hi <= lo; }
+	};
+
+	/** one text position in SA_SAMPLE is kept for locate() */
+	static const unsigned SA_SAMPLE = 32;
+
+	/** the largest text, separators and terminator included: suffix
+	 * array entries are 32-bit */
+	static const size_t MAX_TEXT = UINT32_MAX - 1;
+
+	FMIndex() : m_n(0) {}
+
+	/** Queue a sequence for build(); returns its sequence index */
+	size_t add(const std::string& seq)
+	{
+		assert(m_n == 0);
+		m_starts.push_back(m_text.size());
+		for (size_t i = 0; i < seq.size(); ++i)
+			m_text.push_back(code(seq[i]));
+		m_text.push_back(SEPARATOR);
+		return m_starts.size() - 1;
+	}
+
+	/** the text queued for build(), separators included */
+	size_t queued() const { return m_text.size(); }
+
+	/** Build the index of the queued sequences and free the text */
+	void build()
+	{
+		m_text.push_back(TERMINATOR);
+		assert(m_text.size() <= MAX_TEXT);
+		m_n = m_text.size();
+
+		std::vector<uint32_t> sa;
+		suffixArray(m_text, sa);
+
+		m_blocks.assign(m_n / 64 + 1, Block());
+		m_samples.clear();
+		size_t counts[4] = { 0, 0, 0, 0 };
+		size_t sampled = 0;
+		for (size_t row = 0; row < m_n; ++row) {
+			Block& b = m_blocks[row / 64];
+			unsigned r = row % 64;
+			if (r == 0) {
+				for (unsigned c = 0; c < 4; ++c)
+					b.occ[c] = counts[c];
+				b.sampledRank = sampled;
+			}
+			uint8_t c = sa[row] == 0 ? (uint8_t)TERMINATOR : m_text[sa[row] - 1];
+			if (c >= BASE) {
+				counts[c - BASE]++;
+				b.bases[r / 32] |= (uint64_t)(c - BASE) << (2 * (r % 32));
+			} else {
+				b.other |= (uint64_t)1 << r;
+			}
+			/* rows preceded by a separator are sampled, so locate()
+			 * never steps back across one */
+			if (sa[row] % SA_SAMPLE == 0 || c < BASE) {
+				b.sampled |= (uint64_t)1 << r;
+				m_samples.push_back(sa[row]);
+				sampled++;
+			}
+		}
+
+		/* C array: the number of text characters smaller than each base */
+		m_first[0] = m_n - counts[0] - counts[1] - counts[2] - counts[3];
+		for (unsigned c = 1; c < 4; ++c)
+			m_first[c] = m_first[c - 1] + counts[c - 1];
+
+		std::vector<uint8_t>().swap(m_text);
+	}
+
+	/** the length of the indexed text, separators included */
+	size_t size() const { return m_n; }
+
+	size_t numSequences() const { return m_starts.size(); }
+
+	/** the interval of the empty string: every row */
+	Interval all() const
+	{
+		Interval iv = { 0, m_n };
+		return iv;
+	}
+
+	/**
+	 * Backward search step: narrow `iv` to the rows prefixed by `base`
+	 * followed by its current string. Returns false, leaving `iv`
+	 * untouched, if that string does not occur.
+	 */
+	bool extend(Interval& iv, char base) const
+	{
+		uint8_t c = code(base);
+		if (c < BASE)
+			return false;
+		c -= BASE;
+		size_t lo = m_first[c] + rank(c, iv.lo);
+		size_t hi = m_first[c] + rank(c, iv.hi);
+		if (hi <= lo)
+			return false;
+		iv.lo = lo;
+		iv.hi = hi;
+		return true;
+	}
+
+	/** Find the sequence index and offset in it of the suffix at `row` */
+	void locate(size_t row, size_t& seq, size_t& offset) const
+	{
+		size_t steps = 0;
+		for (;;) {
+			const Block& b = m_blocks[row / 64];
+			unsigned r = row % 64;
+			if (b.sampled >> r & 1) {
+				size_t i = b.sampledRank + popcount(b.sampled & lowMask(r));
+				size_t pos = m_samples[i] + steps;
+				seq = std::upper_bound(m_starts.begin(), m_starts.end(), pos)
+					- m_starts.begin() - 1;
+				offset = pos - m_starts[seq];
+				return;
+			}
+			unsigned c = b.bases[r / 32] >> (2 * (r % 32)) & 3;
+			row = m_first[c] + rank(c, row);
+			steps++;
+		}
+	}
+
+  private:
+
+	enum { TERMINATOR = 0, SEPARATOR = 1, BASE = 2 };
+
+	struct Block
+	{
+		/** counts of A, C, G and T in the rows before this block */
+		uint32_t occ[4];
+		/** samples in the rows before this block */
+		uint32_t sampledRank;
+		/** 2-bit bases of the 64 rows; others are stored as A */
+		uint64_t bases[2];
+		/** rows whose BWT character is a separator or the terminator */
+		uint64_t other;
+		/** rows whose suffix array entry is sampled */
+		uint64_t sampled;
+
+		Block() : sampledRank(0), other(0), sampled(0)
+		{
+			occ[0] = occ[1] = occ[2] = occ[3] = 0;
+			bases[0] = bases[1] = 0;
+		}
+	};
+
+	static uint8_t code(char c)
+	{
+		switch (toupper(c)) {
+		  case 'A': return BASE;
+		  case 'C': return BASE + 1;
+		  case 'G': return BASE + 2;
+		  case 'T': return BASE + 3;
+		  default: return SEPARATOR;
+		}
+	}
+
+	static unsigned popcount(uint64_t x) { return __builtin_popcountll(x); }
+
+	/** bits [0, r) */
+	static uint64_t lowMask(unsigned r)
+	{
+		return r == 0 ? 0 : ~(uint64_t)0 >> (64 - r);
+	}
+
+	/** 32 2-bit bases => one bit at each even position where base is c */
+	static uint64_t matches(uint64_t word, unsigned c)
+	{
+		uint64_t x = word ^ (0x5555555555555555ULL * c);
+		return ~(x | x >> 1) & 0x5555555555555555ULL;
+	}
+
+	/** the number of rows before `row` whose BWT character is base c */
+	size_t rank(unsigned c, size_t row) const
+	{
+		const Block& b = m_blocks[row / 64];
+		unsigned r = row % 64;
+		size_t n = b.occ[c];
+		if (r <= 32) {
+			n += popcount(matches(b.bases[0], c) & lowMask(2 * r));
+		} else {
+			n += popcount(matches(b.bases[0], c))
+				+ popcount(matches(b.bases[1], c) & lowMask(2 * (r - 32)));
+		}
+		if (c == 0)
+			n -= popcount(b.other & lowMask(r));
+		return n;
+	}
+
+	/**
+	 * Suffix array by prefix doubling: each round sorts the suffixes
+	 * by their first 2h characters with two counting sorts, using the
+	 * ranks of the first h from the previous round. O(n log n).
+	 */
+	static void suffixArray(const std::vector<uint8_t>& text,
+		std::vector<uint32_t>& sa)
+	{
+		size_t n = text.size();
+		sa.resize(n);
+		std::vector<uint32_t> rank(n), tmp(n);
+		std::vector<size_t> counts(std::max<size_t>(n, 256) + 1);
+
+		for (size_t i = 0; i < n; ++i)
+			counts[text[i] + 1]++;
+		for (size_t c = 1; c <= 256; ++c)
+			counts[c] += counts[c - 1];
+		for (size_t i = 0; i < n; ++i)
+			sa[counts[text[i]]++] = i;
+		rank[sa[0]] = 0;
+		for (size_t j = 1; j < n; ++j)
+			rank[sa[j]] = rank[sa[j - 1]] + (text[sa[j]] != text[sa[j - 1]]);
+
+		for (size_t h = 1; rank[sa[n - 1]] < n - 1; h *= 2) {
+			/* by second key: suffixes shorter than h first */
+			size_t p = 0;
+			for (size_t i = n - h; i < n; ++i)
+				tmp[p++] = i;
+			for (size_t j = 0; j < n; ++j)
+				if (sa[j] >= h)
+					tmp[p++] = sa[j] - h;
+
+			/* stable by first key */
+			size_t numRanks = rank[sa[n - 1]] + 1;
+			std::fill(counts.begin(), counts.begin() + numRanks + 1, 0);
+			for (size_t i = 0; i < n; ++i)
+				counts[rank[i] + 1]++;
+			for (size_t r = 1; r <= numRanks; ++r)
+				counts[r] += counts[r - 1];
+			for (size_t j = 0; j < n; ++j)
+				sa[counts[rank[tmp[j]]]++] = tmp[j];
+
+			tmp[sa[0]] = 0;
+			for (size_t j = 1; j < n; ++j) {
+				size_t a = sa[j - 1], b = sa[j];
+				bool differ = rank[a] != rank[b]
+					|| (a + h < n ? (int64_t)rank[a + h] : -1)
+						!= (b + h < n ? (int64_t)rank[b + h] : -1);
+				tmp[b] = tmp[a] + differ;
+			}
+			rank.swap(tmp);
+		}
+	}
+
+	size_t m_n;
+	std::vector<uint8_t> m_text;
+	std::vector<size_t> m_starts;
+	std::vector<Block> m_blocks;
+	std::vector<uint32_t> m_samples;
+	size_t m_first[4];
+};
+
+#endif
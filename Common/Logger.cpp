@@ -0,0 +1,126 @@
+#include "Logger.h"
+#include <sstream>
+
+Logger::Logger(FILE* out) :
+	m_out(out), m_level(LOG_INFO), m_limit(DEFAULT_LIMIT), m_dropped(0),
+	m_writing(false), m_stop(false)
+{
+	m_thread = std::thread(&Logger::writeLines, this);
+}
+
+Logger::~Logger()
+{
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+		m_haveLines.notify_all();
+	}
+	m_thread.join();
+}
+
+void Logger::setLevel(LogLevel level)
+{
+	m_level = level;
+}
+
+void Logger::setLimit(unsigned limit)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_limit = limit;
+}
+
+/* Queue the summary of the messages of `key` suppressed in its window */
+void Logger::summarise(const std::string& key, KeyState& state)
+{
+	if (state.suppressed == 0)
+		return;
+	std::ostringstream s;
+	s << state.suppressed << " more `" << key << "' messages suppressed";
+	state.suppressed = 0;
+	if (m_lines.size() < CAPACITY)
+		m_lines.push_back(s.str());
+	else
+		m_dropped++;
+}
+
+void Logger::log(LogLevel level, const std::string& key, const std::string& message)
+{
+	if (!enabled(level))
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_limit > 0) {
+		Clock::time_point now = Clock::now();
+		std::map<std::string, KeyState>::iterator it = m_keys.find(key);
+		if (it == m_keys.end()) {
+			KeyState state = { now, 0, 0 };
+			it = m_keys.insert(std::make_pair(key, state)).first;
+		}
+		KeyState& state = it->second;
+		if (now - state.windowStart >= std::chrono::seconds(WINDOW_SECONDS)) {
+			summarise(key, state);
+			state.windowStart = now;
+			state.logged = 0;
+		}
+		if (state.logged >= m_limit) {
+			state.suppressed++;
+			return;
+		}
+		state.logged++;
+	}
+
+	if (m_lines.size() < CAPACITY)
+		m_lines.push_back(message);
+	else
+		m_dropped++;
+	m_haveLines.notify_one();
+}
+
+void Logger::flush()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (std::map<std::string, KeyState>::iterator it = m_keys.begin();
+			it != m_keys.end(); ++it)
+		summarise(it->first, it->second);
+	m_haveLines.notify_one();
+	m_written.wait(lock, [this] {
+		return m_lines.empty() && m_dropped == 0 && !m_writing; });
+}
+
+/* Write queued lines in batches, with one flush of the stream per batch */
+void Logger::writeLines()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_haveLines.wait(lock, [this] {
+			return !m_lines.empty() || m_dropped > 0 || m_stop; });
+		if (m_lines.empty() && m_dropped == 0)
+			break;
+
+		std::deque<std::string> lines;
+		lines.swap(m_lines);
+		size_t dropped = m_dropped;
+		m_dropped = 0;
+		m_writing = true;
+		lock.unlock();
+
+		for (size_t i = 0; i < lines.size(); ++i) {
+			fputs(lines[i].c_str(), m_out);
+			fputc('\n', m_out);
+		}
+		if (dropped > 0)
+			fprintf(m_out, "%zu log messages dropped\n", dropped);
+		fflush(m_out);
+
+		lock.lock();
+		m_writing = false;
+		m_written.notify_all();
+	}
+}
+
+Logger& logger()
+{
+	static Logger log(stdout);
+	return log;
+}
@@ -0,0 +1,91 @@
+#ifndef LOGGER_H
+#define LOGGER_H 1
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+enum LogLevel { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR };
+
+/**
+ * Diagnostic log for messages raised by worker threads. A message is
+ * queued under a short lock and written by a background thread, so no
+ * worker waits on output. Each kind of message (its `key`) is rate
+ * limited: past `limit` messages in one window, the rest are counted
+ * and summarised as "N more ... suppressed" once the window is over,
+ * or at the next flush().
+ */
+class Logger
+{
+  public:
+
+	/** messages waiting for the writer; further ones are dropped and counted */
+	static const size_t CAPACITY = 4096;
+
+	/** the rate limit window */
+	static const unsigned WINDOW_SECONDS = 10;
+
+	static const unsigned DEFAULT_LIMIT = 10;
+
+	explicit Logger(FILE* out);
+	~Logger();
+
+	/** Discard messages below `level`; call before logging starts */
+	void setLevel(LogLevel level);
+
+	/** Let `limit` messages of each key through per window; 0 for no limit */
+	void setLimit(unsigned limit);
+
+	bool enabled(LogLevel level) const { return level >= m_level; }
+
+	/** Queue `message`, a line without its newline, of kind `key` */
+	void log(LogLevel level, const std::string& key, const std::string& message);
+
+	/** Summarise the suppressed messages and wait until all is written */
+	void flush();
+
+  private:
+
+	Logger(const Logger&);
+	Logger& operator=(const Logger&);
+
+	typedef std::chrono::steady_clock Clock;
+
+	/** the rate limit state of one key */
+	struct KeyState
+	{
+		Clock::time_point windowStart;
+		unsigned logged;
+		size_t suppressed;
+	};
+
+	void summarise(const std::string& key, KeyState& state);
+	void writeLines();
+
+	FILE* m_out;
+	LogLevel m_level;
+	unsigned m_limit;
+	std::map<std::string, KeyState> m_keys;
+
+	/** lines queued for the writer, and lines dropped while it was full */
+	std::deque<std::string> m_lines;
+	size_t m_dropped;
+	/** lines taken by the writer and not yet written */
+	bool m_writing;
+	bool m_stop;
+
+	std::mutex m_mutex;
+	std::condition_variable m_haveLines;
+	std::condition_variable m_written;
+	std::thread m_thread;
+};
+
+/** The log of this process, writing to stdout */
+Logger& logger();
+
+#endif
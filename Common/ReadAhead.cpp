@@ -0,0 +1,232 @@
+#include "config.h"
+#include "ReadAhead.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static size_t s_blockSize = ReadAheadFile::DEFAULT_BLOCK_SIZE;
+
+void ReadAheadFile::setBlockSize(size_t bytes)
+{
+	assert(bytes > 0);
+	s_blockSize = bytes;
+}
+
+size_t ReadAheadFile::blockSize()
+{
+	return s_blockSize;
+}
+
+ReadAheadFile::ReadAheadFile(const std::string& path, size_t blockSize) :
+	m_fd(-1), m_blockSize(blockSize > 0 ? blockSize : s_blockSize), m_full(DEPTH), m_free(DEPTH),
+	m_stop(false), m_haveCur(false), m_pos(0), m_error(0)
+{
+	m_fd = path == "-" ? dup(STDIN_FILENO) : open(path.c_str(), O_RDONLY);
+	if (m_fd == -1)
+		return;
+#if HAVE_POSIX_FADVISE
+	posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	for (unsigned i = 0; i < DEPTH; ++i) {
+		void* p;
+		if (posix_memalign(&p, ALIGNMENT, m_blockSize) != 0)
+			abort();
+		m_buffers.push_back(static_cast<char*>(p));
+		m_free.push(m_buffers.back());
+	}
+	m_thread = std::thread(&ReadAheadFile::readBlocks, this);
+}
+
+ReadAheadFile::~ReadAheadFile()
+{
+	if (m_thread.joinable()) {
+		/* unblock the reader thread if it is waiting on either queue */
+		m_stop = true;
+		m_free.close();
+		for (Block b; m_full.pop(b);)
+			;
+		m_thread.join();
+	}
+	for (unsigned i = 0; i < m_buffers.size(); ++i)
+		free(m_buffers[i]);
+	if (m_fd != -1)
+		close(m_fd);
+}
+
+/* Fill free buffers with consecutive blocks of the file, until end of file */
+void ReadAheadFile::readBlocks()
+{
+	off_t offset = 0;
+	for (char* data; !m_stop && m_free.pop(data);) {
+#if HAVE_POSIX_FADVISE
+		/* have the kernel start on the blocks after this one */
+		posix_fadvise(m_fd, offset + m_blockSize, DEPTH * m_blockSize,
+			POSIX_FADV_WILLNEED);
+#endif
+		Block b = { data, 0, 0 };
+		while (b.size < m_blockSize) {
+			ssize_t n = ::read(m_fd, data + b.size, m_blockSize - b.size);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n == -1)
+				b.error = errno;
+			if (n <= 0)
+				break;
+			b.size += n;
+		}
+		offset += b.size;
+		m_full.push(b);
+		if (b.size < m_blockSize)
+			break;
+	}
+	m_full.close();
+}
+
+bool ReadAheadFile::next(const char*& data, size_t& size)
+{
+	if (m_haveCur) {
+		m_free.push(m_cur.data);
+		m_haveCur = false;
+	}
+	if (!good() || m_error != 0 || !m_full.pop(m_cur))
+		return false;
+	m_haveCur = true;
+	m_pos = 0;
+	if (m_cur.error != 0) {
+		m_error = m_cur.error;
+		errno = m_error;
+	}
+	data = m_cur.data;
+	size = m_cur.size;
+	return size > 0;
+}
+
+long ReadAheadFile::read(void* buf, size_t len)
+{
+	size_t n = 0;
+	while (n < len) {
+		if (!m_haveCur || m_pos == m_cur.size) {
+			const char* data;
+			size_t size;
+			if (!next(data, size))
+				break;
+		}
+		size_t chunk = std::min(len - n, m_cur.size - m_pos);
+		memcpy(static_cast<char*>(buf) + n, m_cur.data + m_pos, chunk);
+		m_pos += chunk;
+		n += chunk;
+	}
+	if (n == 0 && m_error != 0)
+		return -1;
+	return n;
+}
+
+ReadAheadStream::ReadAheadStream(const std::string& path, size_t blockSize) :
+	m_path(path), m_file(path, blockSize), m_started(false), m_gz(false), m_eof(false),
+	m_inMember(false), m_in(NULL), m_inSize(0), m_offset(0),
+	m_line(1 << 16), m_linePos(0), m_lineEnd(0)
+{
+	memset(&m_zs, 0, sizeof m_zs);
+}
+
+ReadAheadStream::~ReadAheadStream()
+{
+	if (m_gz)
+		inflateEnd(&m_zs);
+}
+
+/* Move on to the next block of input; returns false at end of file */
+bool ReadAheadStream::nextInput()
+{
+	const char* data;
+	size_t size;
+	if (!m_file.next(data, size))
+		return false;
+	if (!m_started) {
+		m_started = true;
+		m_gz = size >= 2 && (unsigned char)data[0] == 0x1f
+			&& (unsigned char)data[1] == 0x8b;
+		/* 15 + 32: gzip or zlib, detected from the header */
+		if (m_gz && inflateInit2(&m_zs, 15 + 32) != Z_OK)
+			abort();
+	}
+	m_in = data;
+	m_inSize = size;
+	m_offset += size;
+	m_zs.next_in = (Bytef*)data;
+	m_zs.avail_in = size;
+	return true;
+}
+
+int ReadAheadStream::read(void* buf, unsigned len)
+{
+	if (!good())
+		return -1;
+	unsigned n = 0;
+	while (n < len && !m_eof) {
+		if (!m_started || (m_gz ? m_zs.avail_in == 0 : m_inSize == 0)) {
+			if (!nextInput()) {
+				m_eof = true;
+				break;
+			}
+		}
+
+		if (!m_gz) {
+			size_t chunk = std::min<size_t>(len - n, m_inSize);
+			memcpy(static_cast<char*>(buf) + n, m_in, chunk);
+			m_in += chunk;
+			m_inSize -= chunk;
+			n += chunk;
+			continue;
+		}
+
+		m_zs.next_out = static_cast<Bytef*>(buf) + n;
+		m_zs.avail_out = len - n;
+		int status = inflate(&m_zs, Z_NO_FLUSH);
+		n = len - m_zs.avail_out;
+		m_inMember = status != Z_STREAM_END;
+		if (status == Z_STREAM_END) {
+			/* concatenated gzip members, as written by bgzip */
+			inflateReset(&m_zs);
+		} else if (status != Z_OK && status != Z_BUF_ERROR) {
+			errno = EIO;
+			return -1;
+		}
+	}
+	if (n == 0 && m_eof && m_inMember) {
+		errno = EIO;
+		return -1;
+	}
+	if (n == 0 && m_file.error() != 0)
+		return -1;
+	return n;
+}
+
+bool ReadAheadStream::getline(std::string& line)
+{
+	line.clear();
+	for (;;) {
+		if (m_linePos == m_lineEnd) {
+			int n = read(m_line.data(), m_line.size());
+			if (n <= 0)
+				return !line.empty();
+			m_linePos = 0;
+			m_lineEnd = n;
+		}
+		const char* start = m_line.data() + m_linePos;
+		const char* nl = static_cast<const char*>(
+			memchr(start, '\n', m_lineEnd - m_linePos));
+		if (nl != NULL) {
+			line.append(start, nl);
+			m_linePos = nl - m_line.data() + 1;
+			return true;
+		}
+		line.append(start, m_lineEnd - m_linePos);
+		m_linePos = m_lineEnd;
+	}
+}
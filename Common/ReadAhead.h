@@ -0,0 +1,140 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H 1
+
+#include "Common/BoundedQueue.h"
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+/**
+ * Sequential reader of a file (or `-` for stdin) that keeps several
+ * large blocks in flight: a background thread reads block after block
+ * into aligned buffers, up to DEPTH blocks ahead of the consumer, and
+ * advises the kernel of the sequential access pattern.
+ */
+class ReadAheadFile
+{
+  public:
+
+	/** the number of blocks read ahead of the consumer */
+	static const unsigned DEPTH = 4;
+
+	/** buffer alignment, for direct I/O friendly transfers */
+	static const size_t ALIGNMENT = 4096;
+
+	static const size_t DEFAULT_BLOCK_SIZE = 4 << 20;
+
+	/** Set the default block size of files opened after this call */
+	static void setBlockSize(size_t bytes);
+	static size_t blockSize();
+
+	/** Open `path`, read in blocks of `blockSize`, or 0 for the default */
+	explicit ReadAheadFile(const std::string& path, size_t blockSize = 0);
+	~ReadAheadFile();
+
+	/** Return false if the file could not be opened (errno is set) */
+	bool good() const { return m_fd != -1; }
+
+	/**
+	 * Get the next block, valid until the next call. Returns false at
+	 * end of file, or on a read error, when error() is set.
+	 */
+	bool next(const char*& data, size_t& size);
+
+	/** Copy up to `len` bytes into `buf`; returns 0 at end of file, -1 on error */
+	long read(void* buf, size_t len);
+
+	/** the errno of a failed read, or 0 */
+	int error() const { return m_error; }
+
+  private:
+
+	ReadAheadFile(const ReadAheadFile&);
+	ReadAheadFile& operator=(const ReadAheadFile&);
+
+	struct Block
+	{
+		char* data;
+		size_t size;
+		int error;
+	};
+
+	void readBlocks();
+
+	int m_fd;
+	size_t m_blockSize;
+	std::vector<char*> m_buffers;
+	BoundedQueue<Block> m_full;
+	BoundedQueue<char*> m_free;
+	std::thread m_thread;
+	std::atomic<bool> m_stop;
+
+	/** the block being consumed */
+	Block m_cur;
+	bool m_haveCur;
+	size_t m_pos;
+	int m_error;
+};
+
+/**
+ * A ReadAheadFile that is gunzipped on the fly if it is gzip (or
+ * zlib) compressed, for sequence and TSV input. Use either read() or
+ * getline() on one stream, not both.
+ */
+class ReadAheadStream
+{
+  public:
+
+	/** Open `path`, read in blocks of `blockSize`, or 0 for the default */
+	explicit ReadAheadStream(const std::string& path, size_t blockSize = 0);
+	~ReadAheadStream();
+
+	/** Return false if the file could not be opened (errno is set) */
+	bool good() const { return m_file.good(); }
+
+	const std::string& path() const { return m_path; }
+
+	/** the bytes of the file consumed so far (compressed, if it is) */
+	uint64_t offset() const
+	{
+		return m_offset - (m_gz ? m_zs.avail_in : m_inSize);
+	}
+
+	/** Read up to `len` bytes, as gzread: returns 0 at end of file, -1 on error */
+	int read(void* buf, unsigned len);
+
+	/** Read a line without its newline; returns false at end of file */
+	bool getline(std::string& line);
+
+  private:
+
+	ReadAheadStream(const ReadAheadStream&);
+	ReadAheadStream& operator=(const ReadAheadStream&);
+
+	bool nextInput();
+
+	std::string m_path;
+	ReadAheadFile m_file;
+	bool m_started;
+	bool m_gz;
+	bool m_eof;
+	z_stream m_zs;
+	/** inside a gzip member, so end of file means it is truncated */
+	bool m_inMember;
+
+	/** the block being consumed, when not compressed */
+	const char* m_in;
+	size_t m_inSize;
+	/** the bytes of the blocks taken from m_file */
+	uint64_t m_offset;
+
+	/** getline buffer */
+	std::vector<char> m_line;
+	size_t m_linePos, m_lineEnd;
+};
+
+#endif
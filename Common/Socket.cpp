@@ -0,0 +1,225 @@
+#include "Socket.h"
+#include "Fcontrol.h"
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const char UNIX_PREFIX[] = "unix:";
+
+/* Return true and set `path` if `address` names a UNIX domain socket. */
+static bool unixPath(const std::string& address, std::string& path)
+{
+	size_t n = sizeof UNIX_PREFIX - 1;
+	if (address.compare(0, n, UNIX_PREFIX) != 0)
+		return false;
+	path = address.substr(n);
+	return true;
+}
+
+/* Split a "HOST:PORT" address. Return false if there is no port. */
+static bool splitHostPort(const std::string& address,
+		std::string& host, std::string& port)
+{
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos || colon + 1 == address.size())
+		return false;
+	host = address.substr(0, colon);
+	port = address.substr(colon + 1);
+	return true;
+}
+
+/* Fill in a UNIX domain socket address. Return false if the path is too long. */
+static bool unixAddress(const std::string& path, struct sockaddr_un& addr)
+{
+	if (path.empty() || path.size() >= sizeof addr.sun_path)
+		return false;
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	return true;
+}
+
+/* Disable Nagle's algorithm; requests and replies are small and latency bound. */
+static void setNoDelay(int fd)
+{
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+}
+
+/*
+ * Create a socket listening on the specified address.
+ * Return the socket, or -1 and set errno on failure.
+ */
+int listenOn(const std::string& address)
+{
+	std::string path;
+	if (unixPath(address, path)) {
+		struct sockaddr_un addr;
+		if (!unixAddress(path, addr)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd == -1)
+			return -1;
+		unlink(path.c_str());
+		if (bind(fd, (struct sockaddr*)&addr, sizeof addr) == -1
+				|| listen(fd, SOMAXCONN) == -1) {
+			int saved = errno;
+			close(fd);
+			errno = saved;
+			return -1;
+		}
+		setCloexec(fd);
+		return fd;
+	}
+
+	std::string host, port;
+	if (!splitHostPort(address, host, port)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(),
+				&hints, &res) != 0) {
+		errno = EADDRNOTAVAIL;
+		return -1;
+	}
+
+	int fd = -1;
+	for (struct addrinfo* p = res; p != NULL; p = p->ai_next) {
+		fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (fd == -1)
+			continue;
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+		if (bind(fd, p->ai_addr, p->ai_addrlen) == 0
+				&& listen(fd, SOMAXCONN) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd != -1)
+		setCloexec(fd);
+	return fd;
+}
+
+/*
+ * Accept a connection on a listening socket, retrying if interrupted.
+ * Return the connected socket, or -1 and set errno on failure.
+ */
+int acceptConnection(int listenfd)
+{
+	int fd;
+	do {
+		fd = accept(listenfd, NULL, NULL);
+	} while (fd == -1 && errno == EINTR);
+	if (fd != -1) {
+		setCloexec(fd);
+		setNoDelay(fd);
+	}
+	return fd;
+}
+
+/*
+ * Connect to the specified address.
+ * Return the connected socket, or -1 and set errno on failure.
+ */
+int connectTo(const std::string& address)
+{
+	std::string path;
+	if (unixPath(address, path)) {
+		struct sockaddr_un addr;
+		if (!unixAddress(path, addr)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd == -1)
+			return -1;
+		if (connect(fd, (struct sockaddr*)&addr, sizeof addr) == -1) {
+			int saved = errno;
+			close(fd);
+			errno = saved;
+			return -1;
+		}
+		setCloexec(fd);
+		return fd;
+	}
+
+	std::string host, port;
+	if (!splitHostPort(address, host, port) || host.empty()) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+		errno = EHOSTUNREACH;
+		return -1;
+	}
+
+	int fd = -1;
+	for (struct addrinfo* p = res; p != NULL; p = p->ai_next) {
+		fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (fd == -1)
+			continue;
+		if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd != -1) {
+		setCloexec(fd);
+		setNoDelay(fd);
+	}
+	return fd;
+}
+
+/* Read exactly n bytes. Return false on error or end-of-file. */
+bool readFully(int fd, void* buf, size_t n)
+{
+	char* p = static_cast<char*>(buf);
+	while (n > 0) {
+		ssize_t r = read(fd, p, n);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+		p += r;
+		n -= r;
+	}
+	return true;
+}
+
+/* Write exactly n bytes. Return false on error. */
+bool writeFully(int fd, const void* buf, size_t n)
+{
+	const char* p = static_cast<const char*>(buf);
+	while (n > 0) {
+		ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+		p += r;
+		n -= r;
+	}
+	return true;
+}
@@ -0,0 +1,19 @@
+#ifndef SOCKET_H
+#define SOCKET_H 1
+
+#include <cstddef>
+#include <string>
+
+/*
+ * Socket addresses are either "unix:PATH" for a UNIX domain socket
+ * or "HOST:PORT" for TCP. A listening TCP address may omit the host
+ * (":PORT") to listen on all interfaces.
+ */
+
+int listenOn(const std::string& address);
+int acceptConnection(int listenfd);
+int connectTo(const std::string& address);
+bool readFully(int fd, void* buf, size_t n);
+bool writeFully(int fd, const void* buf, size_t n);
+
+#endif
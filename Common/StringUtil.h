@@ -4,6 +4,7 @@
 #include <cassert>
 #include <iomanip>
 #include <sstream>
+#include <stdint.h>
 #include <string>
 
 /** Return the last character of s and remove it. */
@@ -87,4 +88,24 @@ bool endsWith(const std::string& s, const std::string& suffix)
 			suffix.begin());
 }
 
+/**
+ * Parse the decimal count s, of up to 64 bits. Return false if s is
+ * not all digits, or does not fit.
+ */
+static inline bool parseCount(const std::string& s, uint64_t& n)
+{
+	if (s.empty())
+		return false;
+	n = 0;
+	for (size_t i = 0; i < s.size(); ++i) {
+		if (s[i] < '0' || s[i] > '9')
+			return false;
+		unsigned digit = s[i] - '0';
+		if (n > (UINT64_MAX - digit) / 10)
+			return false;
+		n = 10 * n + digit;
+	}
+	return true;
+}
+
 #endif
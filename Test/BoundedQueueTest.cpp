@@ -0,0 +1,72 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/BoundedQueue.h"
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+TEST_CASE("items come out in order", "[BoundedQueue]")
+{
+	BoundedQueue<int> queue(4);
+	queue.push(1);
+	queue.push(2);
+	queue.close();
+
+	int item;
+	REQUIRE(queue.pop(item));
+	REQUIRE(item == 1);
+	REQUIRE(queue.pop(item));
+	REQUIRE(item == 2);
+
+	// closed and drained => pop fails
+
+	REQUIRE(!queue.pop(item));
+}
+
+TEST_CASE("producer blocks on a full queue", "[BoundedQueue]")
+{
+	const int n = 10000;
+	BoundedQueue<int> queue(3);
+
+	thread producer([&queue, n]() {
+		for (int i = 0; i < n; ++i)
+			queue.push(i);
+		queue.close();
+	});
+
+	vector<int> items;
+	for (int item; queue.pop(item);)
+		items.push_back(item);
+	producer.join();
+
+	REQUIRE(items.size() == (size_t)n);
+	for (int i = 0; i < n; ++i)
+		REQUIRE(items[i] == i);
+}
+
+TEST_CASE("several consumers drain the queue", "[BoundedQueue]")
+{
+	const int n = 10000;
+	BoundedQueue<int> queue(8);
+	vector<long> sums(4, 0);
+
+	vector<thread> consumers;
+	for (unsigned t = 0; t < sums.size(); ++t) {
+		consumers.push_back(thread([&queue, &sums, t]() {
+			for (int item; queue.pop(item);)
+				sums[t] += item;
+		}));
+	}
+	for (int i = 1; i <= n; ++i)
+		queue.push(i);
+	queue.close();
+	for (unsigned t = 0; t < consumers.size(); ++t)
+		consumers[t].join();
+
+	long total = 0;
+	for (unsigned t = 0; t < sums.size(); ++t)
+		total += sums[t];
+	REQUIRE(total == (long)n * (n + 1) / 2);
+}
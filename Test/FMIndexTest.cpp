@@ -0,0 +1,89 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/FMIndex.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/* Find every occurrence of `query` in `index`, by backward search */
+static vector<pair<size_t, size_t> >
+find(const FMIndex& index, const string& query)
+{
+	vector<pair<size_t, size_t> > hits;
+	FMIndex::Interval iv = index.all();
+	for (size_t i = query.size(); i > 0; --i)
+		if (!index.extend(iv, query[i - 1]))
+			return hits;
+	for (size_t row = iv.lo; row < iv.hi; ++row) {
+		size_t seq, offset;
+		index.locate(row, seq, offset);
+		hits.push_back(make_pair(seq, offset));
+	}
+	sort(hits.begin(), hits.end());
+	return hits;
+}
+
+/* Find every occurrence of `query` in `seqs`, by brute force */
+static vector<pair<size_t, size_t> >
+scan(const vector<string>& seqs, const string& query)
+{
+	vector<pair<size_t, size_t> > hits;
+	for (size_t s = 0; s < seqs.size(); ++s)
+		for (size_t i = 0; i + query.size() <= seqs[s].size(); ++i)
+			if (seqs[s].compare(i, query.size(), query) == 0)
+				hits.push_back(make_pair(s, i));
+	return hits;
+}
+
+TEST_CASE("small collection", "[FMIndex]")
+{
+	vector<string> seqs = { "ACGTACGT", "TTACG", "GANTAC" };
+	FMIndex index;
+	for (size_t s = 0; s < seqs.size(); ++s)
+		REQUIRE(index.add(seqs[s]) == s);
+	index.build();
+
+	REQUIRE(index.numSequences() == 3);
+	REQUIRE(index.size() == 8 + 5 + 6 + 3 + 1);
+
+	REQUIRE(find(index, "ACG") == scan(seqs, "ACG"));
+	REQUIRE(find(index, "TAC") == scan(seqs, "TAC"));
+	REQUIRE(find(index, "T").size() == 5);
+
+	// no match spans two sequences or an N
+
+	REQUIRE(find(index, "CGTTA").empty());
+	REQUIRE(find(index, "GAN").empty());
+	REQUIRE(find(index, "AT").empty());
+}
+
+TEST_CASE("random sequences match brute force", "[FMIndex]")
+{
+	const char* bases = "ACGT";
+	srand(1);
+	vector<string> seqs;
+	FMIndex index;
+	for (unsigned s = 0; s < 20; ++s) {
+		string seq;
+		for (unsigned i = 0, n = 50 + rand() % 500; i < n; ++i)
+			seq += bases[rand() % 4];
+		seqs.push_back(seq);
+		index.add(seq);
+	}
+	index.build();
+
+	for (unsigned q = 0; q < 500; ++q) {
+		const string& seq = seqs[rand() % seqs.size()];
+		size_t len = 1 + rand() % 12;
+		size_t pos = rand() % (seq.size() - len);
+		string query = seq.substr(pos, len);
+		if (q % 2)
+			query[rand() % len] = bases[rand() % 4];
+		REQUIRE(find(index, query) == scan(seqs, query));
+	}
+}
@@ -0,0 +1,105 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Arks/IncrementalIndex.h"
+#include "Common/ReadsProcessor.h"
+#include <cstdlib>
+#include <set>
+#include <string>
+
+using namespace std;
+
+/* A random sequence of `n` bases, with some lower case and N */
+static string randomSeq(size_t n)
+{
+	static const char bases[] = "ACGTACGTACGTacgtN";
+	string s(n, 'A');
+	for (size_t i = 0; i < n; ++i)
+		s[i] = bases[rand() % (sizeof bases - 1)];
+	return s;
+}
+
+/* The packed k-mers of `seq` at every position, as mapKmers stores them */
+static string packedKmers(const string& seq, unsigned k, ReadsProcessor& proc)
+{
+	string kmers;
+	for (size_t i = 0; i + k <= seq.size(); ++i) {
+		const unsigned char* kmer = proc.prepSeq(seq, i);
+		if (kmer != NULL)
+			kmers.append(reinterpret_cast<const char*>(kmer),
+				ARCS::packedKmerBytes(k));
+	}
+	return kmers;
+}
+
+/* Whether `read` has a k-mer of `set` at a multiple of `kShift`, by packing each */
+static bool containsPacked(const set<string>& kmers, const string& read,
+	unsigned k, unsigned kShift, ReadsProcessor& proc)
+{
+	for (size_t i = 0; i + k <= read.size(); i += kShift) {
+		const unsigned char* kmer = proc.prepSeq(read, i);
+		if (kmer != NULL && kmers.count(string(reinterpret_cast<const char*>(kmer),
+				ARCS::packedKmerBytes(k))) != 0)
+			return true;
+	}
+	return false;
+}
+
+TEST_CASE("IncrementalKmerSet finds the k-mers ReadsProcessor packs", "[IncrementalIndex]")
+{
+	srand(1);
+	const unsigned ks[] = { 5, 13, 30, 32, 33 };
+	for (unsigned ki = 0; ki < sizeof ks / sizeof *ks; ++ki) {
+		unsigned k = ks[ki];
+		ReadsProcessor proc(k);
+		unsigned bytes = ARCS::packedKmerBytes(k);
+		for (unsigned kShift = 1; kShift <= 3; kShift += 2) {
+			string contig = randomSeq(200);
+			string kmers = packedKmers(contig, k, proc);
+			IncrementalKmerSet incremental(k, kShift);
+			incremental.add(kmers);
+			incremental.build();
+			set<string> expected;
+			for (size_t i = 0; i < kmers.size(); i += bytes)
+				expected.insert(kmers.substr(i, bytes));
+
+			unsigned found = 0;
+			for (unsigned r = 0; r < 400; ++r) {
+				// reads from the contig, either strand, with some random bases
+				size_t start = rand() % (contig.size() - 60);
+				string read = contig.substr(start, 60);
+				if (r % 2 == 1) {
+					string rc(read.rbegin(), read.rend());
+					for (size_t i = 0; i < rc.size(); ++i) {
+						switch (rc[i]) {
+						case 'A': rc[i] = 'T'; break;
+						case 'C': rc[i] = 'G'; break;
+						case 'G': rc[i] = 'C'; break;
+						case 'T': rc[i] = 'A'; break;
+						case 'a': rc[i] = 't'; break;
+						case 'c': rc[i] = 'g'; break;
+						case 'g': rc[i] = 'c'; break;
+						case 't': rc[i] = 'a'; break;
+						}
+					}
+					read = rc;
+				}
+				if (r % 3 == 0)
+					read = randomSeq(60);
+				bool want = containsPacked(expected, read, k, kShift, proc);
+				REQUIRE(incremental.contains(read, proc) == want);
+				found += want;
+			}
+			REQUIRE(found > 0);
+		}
+	}
+}
+
+TEST_CASE("IncrementalKmerSet is empty until k-mers are added", "[IncrementalIndex]")
+{
+	ReadsProcessor proc(30);
+	IncrementalKmerSet incremental(30, 1);
+	incremental.build();
+	REQUIRE(incremental.empty());
+	REQUIRE(!incremental.contains(string(100, 'A'), proc));
+}
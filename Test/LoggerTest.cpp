@@ -0,0 +1,83 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/Logger.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/* The lines written to `f` so far */
+static vector<string> readLines(FILE* f)
+{
+	fflush(f);
+	rewind(f);
+	vector<string> lines;
+	char buf[256];
+	while (fgets(buf, sizeof buf, f) != NULL) {
+		string line(buf);
+		if (!line.empty() && line[line.size() - 1] == '\n')
+			line.erase(line.size() - 1);
+		lines.push_back(line);
+	}
+	return lines;
+}
+
+TEST_CASE("levels and rate limit", "[Logger]")
+{
+	FILE* f = tmpfile();
+	REQUIRE(f != NULL);
+	{
+		Logger log(f);
+		log.setLevel(LOG_WARNING);
+		log.setLimit(5);
+		log.log(LOG_INFO, "progress", "not shown");
+		for (int i = 0; i < 25; ++i)
+			log.log(LOG_WARNING, "unpaired", "unpaired " + to_string(i));
+		log.log(LOG_ERROR, "other", "other");
+		log.flush();
+
+		vector<string> lines = readLines(f);
+		REQUIRE(lines.size() == 7);
+		REQUIRE(lines[0] == "unpaired 0");
+		REQUIRE(lines[4] == "unpaired 4");
+		REQUIRE(lines[5] == "other");
+		REQUIRE(lines[6] == "20 more `unpaired' messages suppressed");
+	}
+	fclose(f);
+}
+
+TEST_CASE("concurrent writers", "[Logger]")
+{
+	FILE* f = tmpfile();
+	REQUIRE(f != NULL);
+	const unsigned numThreads = 4, perThread = 1000;
+	{
+		Logger log(f);
+		log.setLimit(0);
+		vector<thread> threads;
+		for (unsigned t = 0; t < numThreads; ++t) {
+			threads.push_back(thread([&log, t] {
+				for (unsigned i = 0; i < perThread; ++i)
+					log.log(LOG_WARNING, "message", to_string(t));
+			}));
+		}
+		for (unsigned t = 0; t < numThreads; ++t)
+			threads[t].join();
+	}
+
+	// every message is written, or counted as dropped
+	size_t written = 0, dropped = 0;
+	vector<string> lines = readLines(f);
+	for (size_t i = 0; i < lines.size(); ++i) {
+		if (lines[i].find(" log messages dropped") != string::npos)
+			dropped += strtoul(lines[i].c_str(), NULL, 10);
+		else
+			written++;
+	}
+	REQUIRE(written + dropped == numThreads * perThread);
+	fclose(f);
+}
@@ -0,0 +1,155 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Arks/Misassembly.h"
+#include <vector>
+
+using namespace std;
+
+/* A hit of `barcode` in window `window` of contig `contig` */
+static WindowHit hit(uint32_t contig, uint32_t barcode, uint32_t window)
+{
+	WindowHit h = { contig, barcode, window };
+	return h;
+}
+
+/* Options with 1 kbp windows, a 50 kbp molecule gap and 2 kbp molecules */
+static ARCS::ArcsParams cutParams()
+{
+	ARCS::ArcsParams params;
+	params.cut_window = 1000;
+	params.cut_dist = 50000;
+	params.cut_min_size = 2000;
+	params.cut_span = 3;
+	return params;
+}
+
+TEST_CASE("a gap longer than cut_dist splits a molecule", "[Misassembly]")
+{
+	ARCS::ArcsParams params = cutParams();
+	vector<WindowHit> hits;
+	// barcode 1: windows 0-10 and 70-80, 60 kbp apart
+	for (uint32_t w = 0; w <= 10; ++w)
+		hits.push_back(hit(0, 1, w));
+	for (uint32_t w = 70; w <= 80; ++w)
+		hits.push_back(hit(0, 1, w));
+	// barcode 2: windows 0 and 50, exactly cut_dist apart, on another contig
+	hits.push_back(hit(1, 2, 50));
+	hits.push_back(hit(1, 2, 0));
+
+	vector<unsigned> numWindows(2, 100);
+	vector<vector<unsigned> > spanning;
+	size_t numMolecules;
+	countSpanningMolecules(hits, numWindows, params, spanning, numMolecules);
+
+	REQUIRE(numMolecules == 3);
+	REQUIRE(spanning.size() == 2);
+	REQUIRE(spanning[0].size() == 100);
+	// a molecule spans the windows strictly between its first and last
+	REQUIRE(spanning[0][0] == 0);
+	REQUIRE(spanning[0][1] == 1);
+	REQUIRE(spanning[0][9] == 1);
+	REQUIRE(spanning[0][10] == 0);
+	REQUIRE(spanning[0][40] == 0);
+	REQUIRE(spanning[0][75] == 1);
+	REQUIRE(spanning[0][80] == 0);
+	REQUIRE(spanning[1][0] == 0);
+	REQUIRE(spanning[1][25] == 1);
+	REQUIRE(spanning[1][49] == 1);
+	REQUIRE(spanning[1][50] == 0);
+}
+
+TEST_CASE("molecules shorter than cut_min_size are dropped", "[Misassembly]")
+{
+	ARCS::ArcsParams params = cutParams();
+	params.cut_min_size = 5000;
+	vector<WindowHit> hits;
+	hits.push_back(hit(0, 1, 10));
+	hits.push_back(hit(0, 1, 12)); // 3 kbp: dropped
+	hits.push_back(hit(0, 2, 24));
+	hits.push_back(hit(0, 2, 20)); // 5 kbp: kept
+	hits.push_back(hit(0, 3, 30)); // one window: dropped
+
+	vector<unsigned> numWindows(1, 40);
+	vector<vector<unsigned> > spanning;
+	size_t numMolecules;
+	countSpanningMolecules(hits, numWindows, params, spanning, numMolecules);
+
+	REQUIRE(numMolecules == 1);
+	REQUIRE(spanning[0][11] == 0);
+	REQUIRE(spanning[0][20] == 0);
+	REQUIRE(spanning[0][21] == 1);
+	REQUIRE(spanning[0][23] == 1);
+	REQUIRE(spanning[0][24] == 0);
+}
+
+TEST_CASE("a weakly spanned run inside a contig is cut", "[Misassembly]")
+{
+	ARCS::ArcsParams params = cutParams();
+	vector<vector<unsigned> > spanning(1);
+	unsigned counts[] = { 0, 5, 5, 1, 0, 2, 5, 5, 0 };
+	spanning[0].assign(counts, counts + sizeof counts / sizeof *counts);
+	vector<unsigned> lengths(1, 8500);
+
+	vector<Breakpoint> breakpoints;
+	findBreakpoints(spanning, lengths, params, breakpoints);
+	REQUIRE(breakpoints.size() == 1);
+	REQUIRE(breakpoints[0].contig == 0);
+	REQUIRE(breakpoints[0].start == 3000);
+	REQUIRE(breakpoints[0].end == 6000);
+	REQUIRE(breakpoints[0].cut == 4500);
+	REQUIRE(breakpoints[0].minSpanning == 0);
+}
+
+TEST_CASE("weakly spanned contig ends are not cut", "[Misassembly]")
+{
+	ARCS::ArcsParams params = cutParams();
+	vector<vector<unsigned> > spanning(3);
+	unsigned ends[] = { 1, 1, 5, 5, 2, 2 };
+	spanning[0].assign(ends, ends + sizeof ends / sizeof *ends);
+	spanning[1].assign(4, 1); // no well spanned window at all
+	// a weak run up to a well spanned last window, which is cut
+	unsigned last[] = { 5, 1, 5 };
+	spanning[2].assign(last, last + sizeof last / sizeof *last);
+	vector<unsigned> lengths;
+	lengths.push_back(6000);
+	lengths.push_back(4000);
+	lengths.push_back(2500);
+
+	vector<Breakpoint> breakpoints;
+	findBreakpoints(spanning, lengths, params, breakpoints);
+	REQUIRE(breakpoints.size() == 1);
+	REQUIRE(breakpoints[0].contig == 2);
+	REQUIRE(breakpoints[0].start == 1000);
+	REQUIRE(breakpoints[0].end == 2000);
+}
+
+TEST_CASE("molecules that stop short of each other give a cut", "[Misassembly]")
+{
+	ARCS::ArcsParams params = cutParams();
+	vector<WindowHit> hits;
+	// five molecules on windows 0-14 and five on windows 16-29, as of
+	// two sequences joined at 15 kbp
+	for (uint32_t b = 0; b < 5; ++b) {
+		for (uint32_t w = 0; w <= 14; w += 2)
+			hits.push_back(hit(0, b, w));
+		hits.push_back(hit(0, b, 14));
+		for (uint32_t w = 16; w <= 29; w += 3)
+			hits.push_back(hit(0, 10 + b, w));
+		hits.push_back(hit(0, 10 + b, 29));
+	}
+
+	vector<unsigned> numWindows(1, 30);
+	vector<vector<unsigned> > spanning;
+	size_t numMolecules;
+	countSpanningMolecules(hits, numWindows, params, spanning, numMolecules);
+	REQUIRE(numMolecules == 10);
+
+	vector<Breakpoint> breakpoints;
+	findBreakpoints(spanning, vector<unsigned>(1, 30000), params, breakpoints);
+	REQUIRE(breakpoints.size() == 1);
+	REQUIRE(breakpoints[0].start == 14000);
+	REQUIRE(breakpoints[0].end == 17000);
+	REQUIRE(breakpoints[0].cut == 15500);
+	REQUIRE(breakpoints[0].minSpanning == 0);
+}
@@ -0,0 +1,147 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Arks/Arks.h"
+#include "Arks/Checkpoint.h"
+#include "Arks/PairCheckpoint.h"
+#include "Arks/Significance.h"
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <unistd.h>
+
+using namespace std;
+
+/* 2^32, the first count a 32-bit counter can not hold */
+static const uint64_t TWO_TO_32 = uint64_t(1) << 32;
+
+/* A temporary file that is removed at the end of the test */
+struct TempFile
+{
+	string path;
+
+	TempFile(const char* suffix = "")
+	{
+		char name[] = "/tmp/PairCountTest.XXXXXX";
+		int fd = mkstemp(name);
+		REQUIRE(fd != -1);
+		close(fd);
+		unlink(name);
+		path = string(name) + suffix;
+	}
+
+	~TempFile() { unlink(path.c_str()); }
+};
+
+static void writeFile(const string& path, const string& text)
+{
+	FILE* f = fopen(path.c_str(), "w");
+	REQUIRE(f != NULL);
+	REQUIRE(fwrite(text.data(), 1, text.size(), f) == text.size());
+	fclose(f);
+}
+
+TEST_CASE("barcode multiplicities above INT_MAX saturate", "[PairCount]")
+{
+	TempFile csv(".csv"), tsv(".tsv");
+	writeFile(csv.path, "AAAA,5000000000\nCCCC,7\nNNNN,3\nGGGG,18446744073709551615\n");
+	writeFile(tsv.path, "TTTT\t4294967297\n");
+
+	unordered_map<string, int> mult;
+	ARCS::ArcsParams params;
+	REQUIRE(createIndexMultMap(csv.path, "lib1_", mult, params) == 3);
+	REQUIRE(createIndexMultMap(tsv.path, "", mult, params) == 1);
+	logger().flush();
+	REQUIRE(mult.size() == 4);
+	REQUIRE(mult["lib1_AAAA"] == INT_MAX);
+	REQUIRE(mult["lib1_CCCC"] == 7);
+	REQUIRE(mult["lib1_GGGG"] == INT_MAX);
+	REQUIRE(mult["TTTT"] == INT_MAX);
+	REQUIRE(mult.count("lib1_NNNN") == 0);
+}
+
+TEST_CASE("contig end test on read pair counts above 2^32", "[PairCount]")
+{
+	ARCS::ArcsParams params;
+
+	// 2^32 + 10 against 2^32 is even; truncated to 32 bits it is 10 to 0
+	REQUIRE(!headOrTail(TWO_TO_32 + 10, TWO_TO_32, params).first);
+	REQUIRE(headOrTail(10, 0, params) == make_pair(true, true));
+
+	// truncated to 32 bits both are 0, below -c
+	REQUIRE(headOrTail(TWO_TO_32, 3 * TWO_TO_32, params) == make_pair(true, false));
+	REQUIRE(headOrTail(3 * TWO_TO_32, TWO_TO_32, params) == make_pair(true, true));
+}
+
+TEST_CASE("link orientation test on counts above 2^32", "[PairCount]")
+{
+	ARCS::ArcsParams params;
+	params.min_links = 5;
+
+	// truncated to 32 bits the max is 3 links, below -l
+	REQUIRE(checkSignificance(TWO_TO_32 + 3, TWO_TO_32, params));
+	REQUIRE(!checkSignificance(3, 0, params));
+	REQUIRE(checkSignificance(7 * TWO_TO_32, 0, params));
+}
+
+TEST_CASE("IndexMap checkpoint keeps counts above 2^32", "[PairCount]")
+{
+	TempFile base;
+	ARCS::ArcsParams params;
+	params.base_name = base.path;
+	params.deterministic = true;
+
+	ARCS::IndexMap imap;
+	imap["AAAACCCC"][ARCS::CI("contig1", true)] = TWO_TO_32 + 8;
+	imap["AAAACCCC"][ARCS::CI("contig2", false)] = 1;
+	imap["GGGGTTTT"][ARCS::CI("contig1", false)] = 20 * TWO_TO_32;
+	writeIndexMap(imap, params);
+
+	string path = base.path + "_imap.tsv";
+	ARCS::IndexMap loaded;
+	createIndexMap(path, loaded);
+	unlink(path.c_str());
+	REQUIRE(loaded == imap);
+}
+
+TEST_CASE("edge weight above 2^32 is written to the graph", "[PairCount]")
+{
+	ARCS::Graph g;
+	ARCS::Graph::vertex_descriptor u = boost::add_vertex(g);
+	ARCS::Graph::vertex_descriptor v = boost::add_vertex(g);
+	ARCS::Graph::edge_descriptor e = boost::add_edge(u, v, g).first;
+	g[e].weight = TWO_TO_32 + 3;
+
+	ostringstream out;
+	ARCS::EdgePropertyWriter<ARCS::Graph> writer(g);
+	writer(out, e);
+	REQUIRE(out.str() == "[label=0, weight=4294967299]");
+}
+
+TEST_CASE("pair checkpoint keeps link counts above 2^32", "[PairCount]")
+{
+	char path[] = "/tmp/PairCountTest.XXXXXX";
+	int fd = mkstemp(path);
+	REQUIRE(fd >= 0);
+	close(fd);
+
+	ARCS::PairMap pmap;
+	std::vector<uint64_t> counts(4, 0);
+	counts[0] = TWO_TO_32 + 1;
+	counts[3] = 7 * TWO_TO_32;
+	pmap[ARCS::ContigPair("contig1", "contig2")] = counts;
+
+	PairToBarcodeStats pairToStats;
+	DistSampleMap distSamples;
+	writePairCheckpoint(path, pmap, false, pairToStats, distSamples,
+		ARCS::ArcsParams());
+
+	ARCS::PairMap loaded;
+	readPairCheckpoint(path, loaded, pairToStats, distSamples);
+	remove(path);
+	REQUIRE(loaded == pmap);
+}
@@ -0,0 +1,228 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Arks/PartialHits.h"
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+/* A temporary file that is removed at the end of the test */
+struct TempFile
+{
+	string path;
+
+	TempFile()
+	{
+		char name[] = "/tmp/PartialHitsTest.XXXXXX";
+		int fd = mkstemp(name);
+		REQUIRE(fd != -1);
+		close(fd);
+		path = name;
+	}
+
+	~TempFile() { unlink(path.c_str()); }
+};
+
+static const char BASES[] = "ACGT";
+
+static string randomSequence(size_t n)
+{
+	string s;
+	for (size_t i = 0; i < n; ++i)
+		s += BASES[rand() % 4];
+	return s;
+}
+
+/* Hits of each pair of a batch, some pairs and batches without any */
+static PartialHitFile::Batch makeBatch(size_t first, size_t count)
+{
+	PartialHitFile::Batch batch(count);
+	if (first % 3 == 0)
+		return batch;
+	for (size_t i = 0; i < count; ++i) {
+		for (size_t j = 0; j < (first + i) % 4; ++j)
+			batch[i].read1.push_back(make_pair(int(first + i + j), int(j + 1)));
+		for (size_t j = 0; j < (first + i) % 3; ++j)
+			batch[i].read2.push_back(make_pair(int(first + j), 2));
+	}
+	return batch;
+}
+
+static bool sameHits(const PartialHitFile::Batch& a, const PartialHitFile::Batch& b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i)
+		if (a[i].read1 != b[i].read1 || a[i].read2 != b[i].read2)
+			return false;
+	return true;
+}
+
+TEST_CASE("batches put out of order are read back in order", "[PartialHits]")
+{
+	const size_t numBatches = 40, batchSize = 7;
+	TempFile tmp;
+	{
+		// write in the order 1, 0, 3, 2, ...
+		PartialHitFile out("", tmp.path, 2);
+		for (size_t b = 0; b < numBatches; b += 2) {
+			out.put((b + 1) * batchSize, makeBatch((b + 1) * batchSize, batchSize));
+			out.put(b * batchSize, makeBatch(b * batchSize, batchSize));
+		}
+		out.close();
+		REQUIRE(out.bytes() > 0);
+	}
+
+	// take them back in another order
+	PartialHitFile in(tmp.path, "", 1);
+	for (size_t b = 0; b < numBatches; b += 4) {
+		size_t order[] = { b + 2, b, b + 3, b + 1 };
+		for (size_t i = 0; i < 4; ++i) {
+			size_t first = order[i] * batchSize;
+			PartialHitFile::Batch batch;
+			in.take(first, batchSize, batch);
+			REQUIRE(sameHits(batch, makeBatch(first, batchSize)));
+		}
+	}
+
+	// a batch past the end has no saved hits
+	PartialHitFile::Batch batch;
+	in.take(numBatches * batchSize, batchSize, batch);
+	REQUIRE(sameHits(batch, PartialHitFile::Batch(batchSize)));
+}
+
+TEST_CASE("a thread ahead waits for the batch to write", "[PartialHits]")
+{
+	const size_t numBatches = 200, batchSize = 5;
+	TempFile tmp;
+	{
+		PartialHitFile out("", tmp.path, 1);
+		atomic<size_t> next(0);
+		vector<thread> threads;
+		for (unsigned t = 0; t < 4; ++t) {
+			threads.push_back(thread([&]() {
+				for (size_t b; (b = next++) < numBatches;) {
+					if (b % 7 == 0)
+						this_thread::yield();
+					out.put(b * batchSize, makeBatch(b * batchSize, batchSize));
+				}
+			}));
+		}
+		for (unsigned t = 0; t < threads.size(); ++t)
+			threads[t].join();
+		out.close();
+	}
+
+	PartialHitFile in(tmp.path, "", 1);
+	for (size_t b = 0; b < numBatches; ++b) {
+		PartialHitFile::Batch batch;
+		in.take(b * batchSize, batchSize, batch);
+		REQUIRE(sameHits(batch, makeBatch(b * batchSize, batchSize)));
+	}
+}
+
+/*
+ * Classify read pairs against an index of contig-end k-mers in one pass
+ * and in `numPartitions` passes over k-mer space, as chromiumRead does,
+ * with the hits carried from pass to pass in batches through hit files
+ */
+static void classify(const map<string, ARCS::ContigEndId>& index,
+	const vector<string>& reads, unsigned k, unsigned numPartitions,
+	size_t batchSize, vector<ARCS::ContigEndId>& classes)
+{
+	const double j_index = 0.5;
+	size_t numPairs = reads.size() / 2;
+	classes.assign(reads.size(), -1);
+	vector<TempFile> files(numPartitions);
+	for (unsigned p = 0; p < numPartitions; ++p) {
+		ARCS::IndexPartition partition(p, numPartitions, NULL);
+		PartialHitFile hits(p > 0 ? files[p - 1].path : "",
+			partition.last() ? "" : files[p].path, 1);
+		for (size_t first = 0; first < numPairs; first += batchSize) {
+			size_t count = min(batchSize, numPairs - first);
+			PartialHitFile::Batch saved;
+			hits.take(first, count, saved);
+			for (size_t i = 0; i < count; ++i) {
+				map<int, int> ktrack[2];
+				int total[2] = { 0, 0 };
+				for (unsigned r = 0; r < 2; ++r) {
+					const string& read = reads[2 * (first + i) + r];
+					for (size_t pos = 0; pos + k <= read.size(); ++pos) {
+						string kmer = read.substr(pos, k);
+						total[r]++;
+						if (!partition.contains(kmer))
+							continue;
+						map<string, ARCS::ContigEndId>::const_iterator it = index.find(kmer);
+						if (it != index.end() && it->second != 0)
+							ktrack[r][it->second]++;
+					}
+				}
+				if (!partition.last()) {
+					saveHits(ktrack[0], saved[i].read1);
+					saveHits(ktrack[1], saved[i].read2);
+					continue;
+				}
+				restoreHits(saved[i].read1, ktrack[0]);
+				restoreHits(saved[i].read2, ktrack[1]);
+				classes[2 * (first + i)] = bestJaccardContig(ktrack[0], total[0], j_index);
+				classes[2 * (first + i) + 1] = bestJaccardContig(ktrack[1], total[1], j_index);
+			}
+			hits.put(first, saved);
+		}
+		hits.close();
+	}
+}
+
+TEST_CASE("partitioned classification equals the single-index one", "[PartialHits]")
+{
+	srand(7);
+	const unsigned k = 15;
+	const unsigned numEnds = 30;
+	vector<string> ends(numEnds + 1);
+	map<string, ARCS::ContigEndId> index;
+	for (unsigned e = 1; e <= numEnds; ++e) {
+		ends[e] = randomSequence(400);
+		// contig ends 2e and 2e-1 share a segment, as repeats
+		if (e % 2 == 0)
+			ends[e].replace(100, 80, ends[e - 1], 100, 80);
+		for (size_t pos = 0; pos + k <= ends[e].size(); ++pos) {
+			string kmer = ends[e].substr(pos, k);
+			map<string, ARCS::ContigEndId>::iterator it = index.find(kmer);
+			if (it == index.end())
+				index[kmer] = e;
+			else if (it->second != (int)e)
+				it->second = 0;
+		}
+	}
+
+	// reads from the contig ends, some with errors, some of neither
+	vector<string> reads;
+	for (unsigned i = 0; i < 2000; ++i) {
+		unsigned e = 1 + rand() % numEnds;
+		string read = ends[e].substr(rand() % 300, 100);
+		for (unsigned errors = rand() % 4; errors > 0; --errors)
+			read[rand() % read.size()] = BASES[rand() % 4];
+		if (i % 11 == 0)
+			read = randomSequence(100);
+		reads.push_back(read);
+	}
+
+	vector<ARCS::ContigEndId> single, partitioned;
+	classify(index, reads, k, 1, 64, single);
+	unsigned decided = 0;
+	for (size_t i = 0; i < single.size(); ++i)
+		decided += single[i] > 0;
+	REQUIRE(decided > reads.size() / 2);
+	REQUIRE(decided < reads.size());
+
+	for (unsigned numPartitions = 2; numPartitions <= 5; ++numPartitions) {
+		classify(index, reads, k, numPartitions, 64, partitioned);
+		REQUIRE(partitioned == single);
+	}
+}
@@ -0,0 +1,242 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Arks/PrefixKmerIndex.h"
+#include "Common/ReadsProcessor.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* A random sequence of `n` bases, with an N about every 200 */
+static string randomSeq(size_t n)
+{
+	static const char bases[] = "ACGT";
+	string s(n, 'A');
+	for (size_t i = 0; i < n; ++i)
+		s[i] = rand() % 200 == 0 ? 'N' : bases[rand() % 4];
+	return s;
+}
+
+/* The packed k-mer of `seq` at `i`, or "" if it has an N */
+static string packedKmer(const string& seq, size_t i, unsigned k, ReadsProcessor& proc)
+{
+	const unsigned char* kmer = proc.prepSeq(seq, i);
+	return kmer == NULL ? string()
+		: string(reinterpret_cast<const char*>(kmer), ARCS::packedKmerBytes(k));
+}
+
+/* Contig ends with k-mers repeated on one end and shared between ends */
+static vector<string> contigEnds(unsigned n)
+{
+	vector<string> ends;
+	for (unsigned i = 0; i < n; ++i)
+		ends.push_back(randomSeq(300));
+	for (unsigned i = 0; i + 1 < n; i += 2) {
+		// a repeat within an end and a segment shared with the next end,
+		// at offsets that are multiples of the k-shifts tested
+		ends[i].replace(200, 60, ends[i].substr(20, 60));
+		ends[i + 1].replace(120, 80, ends[i].substr(60, 80));
+	}
+	ends.push_back(string(100, 'A') + string(100, 'T') + "ACGT");
+	return ends;
+}
+
+/* Check find() against the ContigKMap for `kmer` */
+static void requireSameLookup(const ARCS::ContigKMap& kmap,
+	const PrefixKmerIndex& sorted, const string& kmer)
+{
+	int conreci = -1;
+	bool found = sorted.find(reinterpret_cast<const unsigned char*>(kmer.data()), conreci);
+	ARCS::ContigKMap::const_iterator it = kmap.find(kmer);
+	REQUIRE(found == (it != kmap.end()));
+	if (found)
+		REQUIRE(conreci == it->second);
+}
+
+TEST_CASE("PrefixKmerIndex matches the ContigKMap and mapKmers tallies", "[PrefixKmerIndex]")
+{
+	srand(1);
+	const unsigned ks[] = { 13, 30, 32 };
+	for (unsigned ki = 0; ki < sizeof ks / sizeof *ks; ++ki) {
+		unsigned k = ks[ki];
+		for (unsigned kShift = 1; kShift <= 3; kShift += 2) {
+			ReadsProcessor proc(k);
+			vector<string> ends = contigEnds(40);
+			ARCS::ContigKMap kmap;
+			PrefixKmerIndex sorted(k);
+			uint64_t mapped = 0, collisions = 0, removedDuplicates = 0, unique = 0;
+			vector<string> present;
+			for (size_t e = 0; e < ends.size(); ++e) {
+				// as mapKmers: step k-shift, or past a k-mer with an N
+				for (size_t i = 0; i + k <= ends[e].size();) {
+					string kmer = packedKmer(ends[e], i, k, proc);
+					if (kmer.empty()) {
+						i += k;
+						continue;
+					}
+					addContigKmer(kmap, kmer, e + 1, mapped, collisions,
+						removedDuplicates, unique);
+					sorted.add(kmer, e + 1);
+					present.push_back(kmer);
+					i += kShift;
+				}
+			}
+			PrefixKmerIndex::BuildStats stats = sorted.build();
+			REQUIRE(stats.mapped == mapped);
+			REQUIRE(stats.collisions == collisions);
+			REQUIRE(stats.removedDuplicates == removedDuplicates);
+			REQUIRE(stats.unique == unique);
+			REQUIRE(removedDuplicates > 0);
+			REQUIRE(sorted.size() == kmap.size());
+
+			for (size_t i = 0; i < sorted.size(); ++i)
+				REQUIRE(kmap.find(sorted.kmer(i))->second == sorted.conreci(i));
+
+			for (size_t i = 0; i < present.size(); ++i) {
+				const string& kmer = present[i];
+				requireSameLookup(kmap, sorted, kmer);
+				// the same bucket, and the neighbouring buckets of the prefix
+				for (unsigned b = 0; b < kmer.size(); ++b) {
+					string other = kmer;
+					other[b] ^= 1;
+					requireSameLookup(kmap, sorted, other);
+					other[b] = kmer[b] + 1;
+					requireSameLookup(kmap, sorted, other);
+				}
+			}
+
+			// mostly absent k-mers, spread over all of the buckets
+			for (unsigned r = 0; r < 2000; ++r) {
+				string kmer = packedKmer(randomSeq(k), 0, k, proc);
+				if (!kmer.empty())
+					requireSameLookup(kmap, sorted, kmer);
+			}
+			requireSameLookup(kmap, sorted, string(ARCS::packedKmerBytes(k), '\0'));
+			requireSameLookup(kmap, sorted, string(ARCS::packedKmerBytes(k), '\xff'));
+		}
+	}
+}
+
+TEST_CASE("PrefixKmerIndex with no k-mers", "[PrefixKmerIndex]")
+{
+	PrefixKmerIndex sorted(30);
+	PrefixKmerIndex::BuildStats stats = sorted.build();
+	REQUIRE(stats.mapped == 0);
+	REQUIRE(sorted.size() == 0);
+	int conreci;
+	string kmer(sorted.kmerBytes(), 'A');
+	REQUIRE(!sorted.find(reinterpret_cast<const unsigned char*>(kmer.data()), conreci));
+}
+
+/* A random key whose first byte is one of a few, so that most prefix
+ * buckets are empty and the rest are crowded */
+static string clusteredKmer(unsigned bytes)
+{
+	static const unsigned char firsts[] = { 0x00, 0x1b, 0x80, 0xe4, 0xff };
+	string kmer(bytes, '\0');
+	kmer[0] = firsts[rand() % sizeof firsts];
+	kmer[1] = rand() % 4;
+	for (unsigned b = 2; b < bytes; ++b)
+		kmer[b] = rand() % 256;
+	return kmer;
+}
+
+static bool keyLess(const TaggedKmer& x, const TaggedKmer& y)
+{
+	return x.key < y.key;
+}
+
+/* Check that radixSortKmers sorts `kmers` as std::stable_sort does */
+static void requireStableSorted(vector<TaggedKmer> kmers)
+{
+	vector<TaggedKmer> expected = kmers, tmp;
+	stable_sort(expected.begin(), expected.end(), keyLess);
+	radixSortKmers(kmers, tmp);
+	REQUIRE(kmers.size() == expected.size());
+	for (size_t i = 0; i < kmers.size(); ++i) {
+		REQUIRE(kmers[i].key == expected[i].key);
+		REQUIRE(kmers[i].tag == expected[i].tag);
+	}
+}
+
+TEST_CASE("radixSortKmers sorts as std::stable_sort", "[PrefixKmerIndex]")
+{
+	srand(2);
+	vector<TaggedKmer> kmers;
+	requireStableSorted(kmers);
+
+	// random keys, with many repeats to check stability
+	for (uint32_t i = 0; i < 5000; ++i) {
+		uint64_t key = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 11) ^ rand();
+		TaggedKmer kmer = { i % 3 == 0 && i > 0 ? kmers[rand() % i].key : key, i };
+		kmers.push_back(kmer);
+	}
+	requireStableSorted(kmers);
+
+	// k-mers of 30 bases leave the low byte 0, and the first byte is
+	// shared by all of the keys: those passes are skipped
+	for (size_t i = 0; i < kmers.size(); ++i)
+		kmers[i].key = (kmers[i].key & 0x00ffffffffffff00ULL) | 0x5a00000000000000ULL;
+	requireStableSorted(kmers);
+
+	// all keys equal: every pass is skipped
+	for (size_t i = 0; i < kmers.size(); ++i)
+		kmers[i].key = 42;
+	requireStableSorted(kmers);
+}
+
+TEST_CASE("joinSorted returns what find() does", "[PrefixKmerIndex]")
+{
+	srand(3);
+	PrefixKmerIndex sorted(30);
+	unsigned bytes = sorted.kmerBytes();
+	vector<string> present;
+	for (int i = 0; i < 3000; ++i) {
+		present.push_back(clusteredKmer(bytes));
+		sorted.add(present.back(), i % 50);
+	}
+	sorted.build();
+
+	vector<TaggedKmer> queries;
+	for (uint32_t i = 0; i < 20000; ++i) {
+		string kmer;
+		switch (i % 4) {
+		case 0: // present, and repeated
+		case 1:
+			kmer = present[rand() % (i % 4 == 0 ? present.size() : 20)];
+			break;
+		case 2: // absent, in between the present k-mers
+			kmer = clusteredKmer(bytes);
+			break;
+		default: // anywhere, mostly in empty buckets
+			kmer.resize(bytes);
+			for (unsigned b = 0; b < bytes; ++b)
+				kmer[b] = rand() % 256;
+		}
+		TaggedKmer q = { sorted.key(reinterpret_cast<const unsigned char*>(kmer.data())), i };
+		queries.push_back(q);
+	}
+	TaggedKmer lowest = { 0, 0 }, highest = { ~(uint64_t)0 << 8 * (8 - bytes), 0 };
+	queries.push_back(lowest);
+	queries.push_back(highest);
+	stable_sort(queries.begin(), queries.end(), keyLess);
+
+	vector<int32_t> conrecis;
+	sorted.joinSorted(queries, conrecis);
+	REQUIRE(conrecis.size() == queries.size());
+	size_t found = 0;
+	for (size_t i = 0; i < queries.size(); ++i) {
+		string kmer(bytes, '\0');
+		for (unsigned b = 0; b < bytes; ++b)
+			kmer[b] = (char)(queries[i].key >> (56 - 8 * b));
+		int conreci = -1;
+		bool inIndex = sorted.find(reinterpret_cast<const unsigned char*>(kmer.data()), conreci);
+		REQUIRE(conrecis[i] == (inIndex ? conreci : -1));
+		found += inIndex;
+	}
+	REQUIRE(found >= queries.size() / 3);
+	REQUIRE(found < queries.size());
+}
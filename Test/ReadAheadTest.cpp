@@ -0,0 +1,177 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/ReadAhead.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace std;
+
+/* A temporary file that is removed at the end of the test */
+struct TempFile
+{
+	string path;
+
+	TempFile()
+	{
+		char name[] = "/tmp/ReadAheadTest.XXXXXX";
+		int fd = mkstemp(name);
+		REQUIRE(fd != -1);
+		close(fd);
+		path = name;
+	}
+
+	~TempFile() { unlink(path.c_str()); }
+};
+
+/* Lines "line 0" to "line n-1" */
+static string makeLines(unsigned n)
+{
+	string text;
+	for (unsigned i = 0; i < n; ++i)
+		text += "line " + to_string(i) + "\n";
+	return text;
+}
+
+static void writeFile(const string& path, const string& text)
+{
+	FILE* f = fopen(path.c_str(), "wb");
+	REQUIRE(f != NULL);
+	REQUIRE(fwrite(text.data(), 1, text.size(), f) == text.size());
+	fclose(f);
+}
+
+/* Write `text` as `members` concatenated gzip members */
+static void writeGzip(const string& path, const string& text, unsigned members)
+{
+	FILE* f = fopen(path.c_str(), "wb");
+	REQUIRE(f != NULL);
+	fclose(f);
+	size_t part = text.size() / members + 1;
+	for (size_t i = 0; i < text.size(); i += part) {
+		gzFile gz = gzopen(path.c_str(), "ab");
+		REQUIRE(gz != NULL);
+		string chunk = text.substr(i, part);
+		REQUIRE(gzwrite(gz, chunk.data(), chunk.size()) == (int)chunk.size());
+		gzclose(gz);
+	}
+}
+
+static string readAll(const string& path, unsigned chunk)
+{
+	ReadAheadStream in(path);
+	REQUIRE(in.good());
+	string text;
+	vector<char> buf(chunk);
+	for (int n; (n = in.read(buf.data(), buf.size())) > 0;)
+		text.append(buf.data(), n);
+	return text;
+}
+
+TEST_CASE("plain file across many small blocks", "[ReadAhead]")
+{
+	ReadAheadFile::setBlockSize(1000);
+	TempFile tmp;
+	string text = makeLines(10000);
+	writeFile(tmp.path, text);
+
+	REQUIRE(readAll(tmp.path, 333) == text);
+	REQUIRE(readAll(tmp.path, 1 << 16) == text);
+
+	ReadAheadStream in(tmp.path);
+	string line;
+	unsigned n = 0;
+	while (in.getline(line))
+		REQUIRE(line == "line " + to_string(n++));
+	REQUIRE(n == 10000);
+	ReadAheadFile::setBlockSize(ReadAheadFile::DEFAULT_BLOCK_SIZE);
+}
+
+TEST_CASE("gzip file with several members", "[ReadAhead]")
+{
+	ReadAheadFile::setBlockSize(4096);
+	TempFile tmp;
+	string text = makeLines(20000);
+	writeGzip(tmp.path, text, 3);
+
+	REQUIRE(readAll(tmp.path, 1000) == text);
+	ReadAheadFile::setBlockSize(ReadAheadFile::DEFAULT_BLOCK_SIZE);
+}
+
+TEST_CASE("block size given per file", "[ReadAhead]")
+{
+	TempFile tmp;
+	string text = makeLines(10000);
+	writeFile(tmp.path, text);
+
+	ReadAheadFile in(tmp.path, 1000);
+	REQUIRE(in.good());
+	const char* data;
+	size_t size;
+	REQUIRE(in.next(data, size));
+	REQUIRE(size == 1000);
+	REQUIRE(string(data, size) == text.substr(0, 1000));
+	REQUIRE(ReadAheadFile::blockSize() == size_t(ReadAheadFile::DEFAULT_BLOCK_SIZE));
+
+	ReadAheadStream stream(tmp.path, 777);
+	string line;
+	unsigned n = 0;
+	while (stream.getline(line))
+		REQUIRE(line == "line " + to_string(n++));
+	REQUIRE(n == 10000);
+}
+
+TEST_CASE("missing, empty and abandoned files", "[ReadAhead]")
+{
+	ReadAheadStream missing("/nonexistent/ReadAheadTest");
+	REQUIRE(!missing.good());
+
+	TempFile empty;
+	REQUIRE(readAll(empty.path, 100).empty());
+
+	// closing before the end must not hang the read-ahead thread
+
+	ReadAheadFile::setBlockSize(100);
+	TempFile tmp;
+	writeFile(tmp.path, makeLines(10000));
+	{
+		ReadAheadStream in(tmp.path);
+		string line;
+		REQUIRE(in.getline(line));
+		REQUIRE(line == "line 0");
+	}
+	ReadAheadFile::setBlockSize(ReadAheadFile::DEFAULT_BLOCK_SIZE);
+}
+
+TEST_CASE("offset of the input consumed", "[ReadAhead]")
+{
+	ReadAheadFile::setBlockSize(1000);
+	TempFile plain, gz;
+	string text = makeLines(10000);
+	writeFile(plain.path, text);
+	writeGzip(gz.path, text, 1);
+
+	ReadAheadStream in(plain.path);
+	REQUIRE(in.offset() == 0);
+	vector<char> buf(2500);
+	REQUIRE(in.read(buf.data(), buf.size()) == 2500);
+	REQUIRE(in.offset() == 2500);
+
+	// compressed input is consumed a block at a time, and in full at the end
+
+	ReadAheadStream zin(gz.path);
+	REQUIRE(zin.read(buf.data(), buf.size()) == 2500);
+	REQUIRE(zin.offset() > 0);
+	REQUIRE(zin.offset() <= 1000);
+	while (zin.read(buf.data(), buf.size()) > 0)
+		;
+	FILE* f = fopen(gz.path.c_str(), "rb");
+	REQUIRE(f != NULL);
+	fseek(f, 0, SEEK_END);
+	REQUIRE(zin.offset() == (uint64_t)ftell(f));
+	fclose(f);
+	ReadAheadFile::setBlockSize(ReadAheadFile::DEFAULT_BLOCK_SIZE);
+}
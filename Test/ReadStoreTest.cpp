@@ -0,0 +1,197 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Arks/ReadStore.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+/* A temporary file that is removed at the end of the test */
+struct TempFile
+{
+	string path;
+
+	TempFile()
+	{
+		char name[] = "/tmp/ReadStoreTest.XXXXXX";
+		int fd = mkstemp(name);
+		REQUIRE(fd != -1);
+		close(fd);
+		path = name;
+	}
+
+	~TempFile() { unlink(path.c_str()); }
+};
+
+/* A random read of `n` bases, in either case, with N about every `nEvery` */
+static string randomRead(size_t n, unsigned nEvery)
+{
+	static const char bases[] = "ACGTacgt";
+	string s(n, 'A');
+	for (size_t i = 0; i < n; ++i)
+		s[i] = rand() % nEvery == 0 ? "Nn"[rand() % 2] : bases[rand() % 8];
+	return s;
+}
+
+static string upper(string s)
+{
+	for (size_t i = 0; i < s.size(); ++i)
+		s[i] = toupper(s[i]);
+	return s;
+}
+
+/* Read all of the pairs of the store at `path`, in file order, as BARCODE SEQ1 SEQ2 */
+static vector<string> readStore(const string& path, size_t& numBlocks)
+{
+	ReadStoreReader reader(path);
+	vector<string> pairs;
+	string payload, seq1, seq2;
+	uint32_t numPairs, barcodeId;
+	numBlocks = 0;
+	while (reader.readBlock(payload, numPairs)) {
+		const char* p = payload.data();
+		for (uint32_t i = 0; i < numPairs; ++i) {
+			p = ReadStoreReader::decode(p, barcodeId, seq1, seq2);
+			pairs.push_back(reader.barcode(barcodeId) + " " + seq1 + " " + seq2);
+		}
+		REQUIRE(p == payload.data() + payload.size());
+		numBlocks++;
+	}
+	REQUIRE(reader.numPairs() == pairs.size());
+	return pairs;
+}
+
+/* Overwrite the bytes of `path` at `offset` */
+static void patchFile(const string& path, long offset, const string& bytes)
+{
+	FILE* f = fopen(path.c_str(), "r+b");
+	REQUIRE(f != NULL);
+	fseek(f, offset, SEEK_SET);
+	REQUIRE(fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size());
+	fclose(f);
+}
+
+/* Read the store at `path`; return the message of the error it throws, if any */
+static string errorReading(const string& path)
+{
+	try {
+		size_t numBlocks;
+		readStore(path, numBlocks);
+	} catch (const runtime_error& e) {
+		return e.what();
+	}
+	return string();
+}
+
+TEST_CASE("packBases and unpackBases round trip", "[ReadStore]")
+{
+	srand(1);
+	for (size_t n = 0; n <= 41; ++n) {
+		for (unsigned nEvery = 3; nEvery <= 1000; nEvery *= 10) {
+			string seq = randomRead(n, nEvery);
+			string bases, mask;
+			bool hasN = packBases(seq, bases, mask);
+			REQUIRE(hasN == (upper(seq).find('N') != string::npos));
+			REQUIRE(bases.size() == (n + 3) / 4);
+			REQUIRE(mask.size() == (n + 7) / 8);
+
+			string packed = bases + (hasN ? mask : string()) + "~";
+			string unpacked;
+			const char* end = unpackBases(packed.data(), n, hasN, unpacked);
+			REQUIRE(*end == '~');
+			REQUIRE(unpacked == upper(seq));
+		}
+	}
+}
+
+TEST_CASE("read store round trip across buckets and blocks", "[ReadStore]")
+{
+	srand(2);
+	TempFile store;
+	vector<string> pairs;
+	{
+		ReadStoreWriter writer(store.path);
+		for (unsigned i = 0; i < 12000; ++i) {
+			string barcode = "BC" + to_string(rand() % 500);
+			string seq1 = randomRead(100 + rand() % 60, 50);
+			string seq2 = randomRead(rand() % 151, 50);
+			writer.add(barcode, seq1, seq2);
+			pairs.push_back(barcode + " " + upper(seq1) + " " + upper(seq2));
+		}
+		REQUIRE(writer.numBarcodes() == 500);
+		REQUIRE(writer.finish() == pairs.size());
+	}
+
+	size_t numBlocks;
+	vector<string> read = readStore(store.path, numBlocks);
+	REQUIRE(numBlocks > 1);
+
+	// grouped by barcode, in the order added within a barcode
+	map<string, vector<string> > byBarcode;
+	for (size_t i = 0; i < pairs.size(); ++i)
+		byBarcode[pairs[i].substr(0, pairs[i].find(' '))].push_back(pairs[i]);
+	vector<string> seen;
+	for (size_t i = 0; i < read.size();) {
+		string barcode = read[i].substr(0, read[i].find(' '));
+		REQUIRE(find(seen.begin(), seen.end(), barcode) == seen.end());
+		seen.push_back(barcode);
+		const vector<string>& expected = byBarcode[barcode];
+		REQUIRE(read.size() - i >= expected.size());
+		REQUIRE(vector<string>(read.begin() + i, read.begin() + i + expected.size())
+			== expected);
+		i += expected.size();
+	}
+	REQUIRE(seen.size() == byBarcode.size());
+}
+
+TEST_CASE("read store corruption is detected", "[ReadStore]")
+{
+	srand(3);
+	TempFile store;
+	ReadStoreWriter writer(store.path);
+	for (unsigned i = 0; i < 100; ++i)
+		writer.add("BC" + to_string(i % 7), randomRead(150, 50), randomRead(150, 50));
+	writer.finish();
+
+	SECTION("a corrupted block fails its CRC") {
+		patchFile(store.path, READ_STORE_HEADER_BYTES + READ_STORE_BLOCK_HEADER_BYTES + 20, "\xa5\x5a");
+		REQUIRE(errorReading(store.path).find("block checksum mismatch") != string::npos);
+	}
+
+	SECTION("a block with more pairs than it holds") {
+		uint32_t numPairs = 1000;
+		patchFile(store.path, READ_STORE_HEADER_BYTES,
+			string(reinterpret_cast<const char*>(&numPairs), sizeof numPairs));
+		REQUIRE(errorReading(store.path).find("corrupt block") != string::npos);
+	}
+
+	SECTION("a barcode table offset past the end") {
+		uint64_t offset = 1 << 30;
+		patchFile(store.path, 24,
+			string(reinterpret_cast<const char*>(&offset), sizeof offset));
+		REQUIRE(errorReading(store.path).find("corrupt barcode table offset") != string::npos);
+	}
+
+	SECTION("a barcode table with more barcodes than it holds") {
+		// the table CRC does not cover the count
+		FILE* f = fopen(store.path.c_str(), "rb");
+		REQUIRE(f != NULL);
+		fseek(f, 24, SEEK_SET);
+		uint64_t tableOffset;
+		REQUIRE(fread(&tableOffset, sizeof tableOffset, 1, f) == 1);
+		fclose(f);
+		uint32_t numBarcodes = 8;
+		patchFile(store.path, tableOffset,
+			string(reinterpret_cast<const char*>(&numBarcodes), sizeof numBarcodes));
+		REQUIRE(errorReading(store.path).find("corrupt barcode table") != string::npos);
+	}
+
+	REQUIRE(errorReading("/nonexistent/ReadStoreTest").find("cannot open") != string::npos);
+}
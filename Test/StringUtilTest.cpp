@@ -0,0 +1,40 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/StringUtil.h"
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+TEST_CASE("counts beyond 32 bits", "[StringUtil]")
+{
+	uint64_t n;
+
+	REQUIRE(parseCount("0", n));
+	REQUIRE(n == 0);
+	REQUIRE(parseCount("4294967295", n));
+	REQUIRE(n == UINT32_MAX);
+
+	// the k-mer and read pair tallies of a multi-lane library
+
+	REQUIRE(parseCount("4294967296", n));
+	REQUIRE(n == (uint64_t)1 << 32);
+	REQUIRE(parseCount("12000000000", n));
+	REQUIRE(n == 12000000000ULL);
+
+	REQUIRE(parseCount("18446744073709551615", n));
+	REQUIRE(n == UINT64_MAX);
+}
+
+TEST_CASE("malformed and overflowing counts", "[StringUtil]")
+{
+	uint64_t n;
+
+	REQUIRE(!parseCount("", n));
+	REQUIRE(!parseCount("-1", n));
+	REQUIRE(!parseCount("12a", n));
+	REQUIRE(!parseCount(" 12", n));
+	REQUIRE(!parseCount("18446744073709551616", n));
+	REQUIRE(!parseCount("99999999999999999999", n));
+}